@@ -0,0 +1,56 @@
+#!/bin/bash
+# Run shms_optics as N shards on this machine and merge them.
+#
+# Usage: run_shards.sh N CONFIG_F ROOTout [OPTION]...
+#
+# OPTIONs are passed to every shard, the ones that apply to the fit also to
+# shms_optics_merge. The executables are taken from BIN_DIR (default `.`,
+# the build directory). Each shard logs to ROOTout with `_shard<I>of<N>.log`.
+
+set -u
+
+if [ $# -lt 3 ]; then
+  echo "Usage: $0 N CONFIG_F ROOTout [OPTION]..."
+  exit 1
+fi
+
+nShards=$1
+config=$2
+rootOut=$3
+shift 3
+
+binDir=${BIN_DIR:-.}
+
+# Options of the merge step.
+mergeOpts=()
+args=("$@")
+for ((i=0; i<${#args[@]}; ++i)); do
+  case "${args[$i]}" in
+    --irls|--irls-iter|-j|--bootstrap|--bootstrap-by|--cuts-db|--event-tree)
+      mergeOpts+=("${args[$i]}" "${args[$((i+1))]}")
+      ;;
+  esac
+done
+
+pids=()
+for ((iShard=0; iShard<nShards; ++iShard)); do
+  log="${rootOut%.root}_shard${iShard}of${nShards}.log"
+  "$binDir/shms_optics" --batch --shard "$iShard/$nShards" -o "$rootOut" \
+    "$@" "$config" > "$log" 2>&1 &
+  pids+=($!)
+  echo "Started shard $iShard of $nShards, logging to \`$log\`."
+done
+
+failed=0
+for ((iShard=0; iShard<nShards; ++iShard)); do
+  if ! wait "${pids[$iShard]}"; then
+    echo "Shard $iShard failed."
+    failed=1
+  fi
+done
+if [ $failed -ne 0 ]; then
+  exit 1
+fi
+
+"$binDir/shms_optics_merge" --shards "$nShards" -o "$rootOut" \
+  ${mergeOpts[@]+"${mergeOpts[@]}"} "$config"
@@ -2,6 +2,8 @@
 #define cmdOptions_h 1
 
 #include <string>
+#include <utility>
+#include <vector>
 
 
 //! Interface for dealing with command line arguments.
@@ -23,6 +25,11 @@ namespace cmdOptions {
 
       std::string configFileName;
       std::string matrixFileName;
+
+      // Directory of the friend trees, histograms mode if empty.
+      std::string friendDirName;
+      int threadNum;
+      int compression;
   };
 
   class OptionParser_shmsOptics {
@@ -40,6 +47,71 @@ namespace cmdOptions {
       unsigned long delay;
 
       std::string configFileName;
+
+      std::string robustLoss;
+      int robustIterNum;
+
+      int iterationNum;
+      bool refreshCuts;
+
+      int threadNum;
+      int bootstrapNum;
+      std::string bootstrapUnit;
+
+      std::string sweepFileName;
+      bool fitOffsets;
+
+      bool batch;
+
+      std::string holeFitMethod;
+      bool holeFitCompare;
+      bool holeFit2D;
+      bool holeGrid;
+      bool foilMixture;
+      int quickLookNum;
+      int runJobNum;
+      // Shard index and number of shards, no sharding for 0 shards.
+      int shardIndex;
+      int shardNum;
+      // Memory cap of the run read ahead, no reading ahead for 0.
+      int prefetchMB;
+      bool pipeline;
+      bool fileCache;
+      bool holeHists;
+      // Diagnostic tree of the selected events, none if empty.
+      std::string eventTreeFileName;
+      int treeCompression;
+      int treeBasketSize;
+
+      std::string cutsDbFileName;
+      std::vector<int> refreshRuns;
+      // Run number and foil index.
+      std::vector<std::pair<int, int> > refreshFoils;
+  };
+
+  class OptionParser_shmsOpticsMerge {
+    public:
+      OptionParser_shmsOpticsMerge();
+      ~OptionParser_shmsOpticsMerge();
+
+      void init(const int& argc, const char* const* argv);
+      void printHelp();
+
+      bool displayHelp;
+
+      std::string rootFileName;
+      std::string configFileName;
+      int shardNum;
+
+      std::string robustLoss;
+      int robustIterNum;
+
+      int threadNum;
+      int bootstrapNum;
+      std::string bootstrapUnit;
+
+      std::string cutsDbFileName;
+      std::string eventTreeFileName;
   };
 
 }
@@ -0,0 +1,40 @@
+#ifndef myBootstrap_h
+#define myBootstrap_h 1
+
+#include <vector>
+
+#include "myFit.hpp"
+
+
+//! Spread of fitted coefficients over bootstrap replicas.
+class BootstrapResult {
+  public:
+    BootstrapResult();
+    ~BootstrapResult();
+
+    // Standard deviation of each coefficient.
+    std::vector<double> xpTarSigmas;
+    std::vector<double> yTarSigmas;
+    std::vector<double> ypTarSigmas;
+
+    // Coefficient uncertainty propagated to the reconstructed quantities,
+    // averaged over the (weighted) fitted events. yTar is in cm.
+    double xpTarResolution;
+    double yTarResolution;
+    double ypTarResolution;
+
+    int nReplicas;
+    int nFailed;
+};
+
+
+// Resample the blocks (usually one per sieve hole) with replacement and solve
+// the normal equations of each replica. Replicas are spread over nThreads
+// threads, results do not depend on the number of threads.
+BootstrapResult bootstrapFit(
+  const std::vector<FitAccumulator>& blocks,
+  int nReplicas, int nThreads, unsigned int seed
+);
+
+
+#endif  // myBootstrap_h
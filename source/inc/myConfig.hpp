@@ -73,6 +73,10 @@ namespace config {
     std::vector<double> getSieveHolesY() const;
     int use2017Corr;
 
+    double weight;  // relative weight of the run in the fit
+    std::vector<double> foilWeights;  // relative weights of the foils
+    double getFoilWeight(size_t iFoil) const;
+
   };
 
 
@@ -87,7 +91,7 @@ namespace config {
       std::string recMatrixFileNameOld;
       std::string recMatrixFileNameNew;
       int fitOrder;
-      int maxEventsPerHole;
+      int maxEventsPerHole;  // target total weight per hole, 0 for unweighted
       double zFoilOffset;  // cm
 
       int xTarCorrIterNum;
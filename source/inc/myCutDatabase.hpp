@@ -0,0 +1,63 @@
+#ifndef myCutDatabase_h
+#define myCutDatabase_h 1
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "myConfig.hpp"
+#include "myRecMatrix.hpp"
+#include "mySelection.hpp"
+
+
+//! Cuts of a run, valid for the run configuration and reconstruction
+//! matrices they were found with.
+class CutRecord {
+  public:
+    CutRecord();
+    ~CutRecord();
+
+    int runNumber;
+    std::uint64_t configHash;
+    std::uint64_t matrixHash;
+    RunCuts cuts;
+};
+
+
+//! Cuts saved between invocations, keyed by run number, configuration hash
+//! and matrix hash.
+class CutDatabase {
+  public:
+    CutDatabase();
+    ~CutDatabase();
+
+    // Return cuts with all keys matching, NULL if there are none.
+    const RunCuts* find(
+      int runNumber, std::uint64_t configHash, std::uint64_t matrixHash
+    ) const;
+    // Add cuts, replacing the ones with the same keys.
+    void store(
+      int runNumber, std::uint64_t configHash, std::uint64_t matrixHash,
+      const RunCuts& cuts
+    );
+
+    std::vector<CutRecord> records;
+};
+
+
+// Hash of everything in the run configuration the cuts depend on.
+std::uint64_t getRunConfigHash(const config::RunConfig& runConf);
+
+// Hash of the matrices events are reconstructed with, including the number
+// of xTar correction iterations.
+std::uint64_t getMatrixHash(
+  const RecMatrix& recMatrixIndep, const RecMatrix& recMatrixDep,
+  int xTarCorrIterNum
+);
+
+// Empty database if the file does not exist.
+CutDatabase loadCutDatabase(const std::string& fileName);
+void writeCutDatabase(const std::string& fileName, const CutDatabase& database);
+
+
+#endif  // myCutDatabase_h
@@ -1,6 +1,9 @@
 #ifndef myEvent_h
 #define myEvent_h 1
 
+#include <cstddef>
+#include <functional>
+#include <string>
 #include <vector>
 
 #include "myConfig.hpp"
@@ -47,7 +50,62 @@ class Event {
 };
 
 
-std::vector<Event> readEvents(const config::RunConfig& runConf);
+//! Focal plane and vertex variables of all events of one input file, as
+//! read from the tree. The central angle is set per run.
+class EventColumns {
+  public:
+    EventColumns();
+    ~EventColumns();
+
+    std::size_t size() const;
+    std::size_t getBytes() const;
+    void reserve(std::size_t nEvents);
+
+    std::vector<double> xFp;  // cm
+    std::vector<double> yFp;  // cm
+    std::vector<double> xpFp;
+    std::vector<double> ypFp;
+    std::vector<double> xVer;  // cm
+    std::vector<double> yVer;  // cm
+    std::vector<double> delta;  // %
+};
+
+
+class EventFileCache;
+class TTree;
+
+
+// Read the focal plane and vertex variables and delta of tree to the given
+// variables.
+void setEventBranches(
+  TTree* tree, double& xFp, double& yFp, double& xpFp, double& ypFp,
+  double& xVer, double& yVer, double& delta
+);
+// Number of events in the files of a run, only the file headers are read.
+long long countEvents(const config::RunConfig& runConf);
+// Files shared with other runs are taken from cache, if given.
+std::vector<Event> readEvents(
+  const config::RunConfig& runConf, EventFileCache* cache=NULL
+);
+// Same with nEvents from countEvents, so the files are not counted again.
+std::vector<Event> readEvents(
+  const config::RunConfig& runConf, long long nEvents,
+  EventFileCache* cache=NULL
+);
+// Read all events and pass them to push in batches of batchSize events, the
+// last one possibly smaller. push may take the contents of the batch.
+void readEventBatches(
+  const config::RunConfig& runConf, std::size_t batchSize,
+  const std::function<void(std::vector<Event>&)>& push,
+  EventFileCache* cache=NULL
+);
+// Read all entries of the tree in fileName.
+EventColumns readEventColumns(const std::string& fileName);
+// Read a random subsample of nSample events, all events if there are fewer.
+// Events keep the order of the files, and only the sampled entries are read.
+std::vector<Event> readEventSample(
+  const config::RunConfig& runConf, std::size_t nSample, unsigned int seed
+);
 
 
 #endif  // myEvent_h
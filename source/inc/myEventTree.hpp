@@ -0,0 +1,81 @@
+#ifndef myEventTree_h
+#define myEventTree_h 1
+
+#include <cstddef>
+#include <exception>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "myQueue.hpp"
+
+
+//! One selected event of the diagnostic tree.
+class EventTreeRow {
+  public:
+    EventTreeRow();
+    ~EventTreeRow();
+
+    int run;
+    int foil;
+    // Hole of the foil, and its sieve row and column.
+    int hole;
+    int xSieveIndex;
+    int ySieveIndex;
+
+    // Focal plane variables.
+    float xFp;  // cm
+    float yFp;  // cm
+    float xpFp;
+    float ypFp;
+
+    // "True" target variables from the sieve hole and foil positions.
+    float xTarPhy;  // cm
+    float yTarPhy;  // cm
+    float xpTarPhy;
+    float ypTarPhy;
+    float zFoil;  // cm
+
+    // Target variables reconstructed with the old matrix.
+    float xTar;  // cm
+    float yTar;  // cm
+    float xpTar;
+    float ypTar;
+    float zVer;  // cm
+    float delta;  // %
+
+    float weight;
+};
+
+
+//! Writes the diagnostic tree `T` to its own ROOT file from a background
+//! thread, which takes the rows of a run while the next run is processed.
+class EventTreeWriter {
+  public:
+    EventTreeWriter(
+      const std::string& fileName, int compression, int basketSize,
+      std::size_t queueDepth=4
+    );
+    ~EventTreeWriter();
+
+    // Move the rows to the writer. Rows are written in the order pushed.
+    void push(std::vector<EventTreeRow>& rows);
+    // Write the rest of the rows and close the file. Rethrows an error of
+    // the writer.
+    void finish();
+
+    // Only consistent after finish.
+    long long nRows;
+    double writeTime;  // s
+
+  private:
+    std::string fileName;
+    int compression;
+    int basketSize;
+    BoundedQueue<std::vector<EventTreeRow> > queue;
+    std::thread thread;
+    std::exception_ptr error;
+};
+
+
+#endif  // myEventTree_h
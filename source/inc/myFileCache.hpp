@@ -0,0 +1,61 @@
+#ifndef myFileCache_h
+#define myFileCache_h 1
+
+#include <cstddef>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include "myConfig.hpp"
+#include "myEvent.hpp"
+
+
+//! Events of input files used by several runs, read once and shared. Each
+//! file is kept until all runs using it have read it.
+class EventFileCache {
+  public:
+    EventFileCache();
+    ~EventFileCache();
+
+    // Count the files of runConf as used once more.
+    void addRun(const config::RunConfig& runConf);
+    // Whether fileName is used by more than one run with cuts.
+    bool isShared(const std::string& fileName, const std::string& cuts) const;
+    // Events of fileName, read by the first caller while the others wait.
+    std::shared_ptr<const EventColumns> get(
+      const std::string& fileName, const std::string& cuts
+    );
+    // One use of fileName is done, the events are dropped after the last.
+    void release(const std::string& fileName, const std::string& cuts);
+
+    // Files read and reads saved.
+    int nReads;
+    int nHits;
+    // Size of the cached events.
+    std::size_t bytes;
+    std::size_t peakBytes;
+
+  private:
+    class CachedFile {
+      public:
+        CachedFile();
+        ~CachedFile();
+
+        int nUses;
+        int nUsesLeft;
+        std::size_t bytes;
+        std::shared_future<std::shared_ptr<const EventColumns> > columns;
+    };
+
+    // File name and cuts.
+    typedef std::pair<std::string, std::string> Key;
+
+    mutable std::mutex mutex;
+    std::map<Key, CachedFile> files;
+};
+
+
+#endif  // myFileCache_h
@@ -0,0 +1,108 @@
+#ifndef myFit_h
+#define myFit_h 1
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "TMatrixD.h"
+#include "TVectorD.h"
+
+#include "myConfig.hpp"
+
+
+//! Weighted normal equations for fitting the xTar independent terms.
+/*!
+  The lambda products are the same for the xpTar, yTar and ypTar problems, so
+  a single (symmetric) matrix is shared and only the vectors differ.
+*/
+class FitAccumulator {
+  public:
+    FitAccumulator(int nTerms);
+    ~FitAccumulator();
+
+    void addEvent(
+      const std::vector<double>& lambdas,
+      double xpTarTarget, double yTarTarget, double ypTarTarget,
+      double weight=1.0
+    );
+    void add(const FitAccumulator& other, double factor=1.0);
+
+    // Binary form for passing partial sums between processes.
+    void write(std::ostream& os) const;
+    void read(std::istream& is);
+
+    TMatrixD getFitMatrix() const;
+    TVectorD getXpTarFitVector() const;
+    TVectorD getYTarFitVector() const;
+    TVectorD getYpTarFitVector() const;
+
+    int nTerms;
+    long long nEvents;
+    double sumWeights;
+
+  private:
+    std::vector<double> fitMat;  // packed upper triangle, row by row
+    std::vector<double> xpTarFitVec;
+    std::vector<double> yTarFitVec;
+    std::vector<double> ypTarFitVec;
+};
+
+
+//! Selected events' lambdas and fit targets kept in memory for refitting.
+/*!
+  Lambdas are stored as floats to halve the memory, the sums are always
+  done in double precision.
+*/
+class DesignCache {
+  public:
+    DesignCache(int nTerms);
+    ~DesignCache();
+
+    void addEvent(
+      const std::vector<double>& lambdas,
+      double xpTarTarget, double yTarTarget, double ypTarTarget,
+      double weight=1.0
+    );
+    // Append the events of other.
+    void add(const DesignCache& other);
+    std::size_t size() const;
+
+    void write(std::ostream& os) const;
+    void read(std::istream& is);
+
+    int nTerms;
+    std::vector<float> rows;  // nTerms lambdas per event
+    std::vector<double> xpTarTargets;
+    std::vector<double> yTarTargets;
+    std::vector<double> ypTarTargets;
+    std::vector<double> weights;
+};
+
+
+enum RobustLoss {
+  kLeastSquares,
+  kHuber,
+  kTukey
+};
+
+
+double getEventWeight(
+  const config::Config& conf, const config::RunConfig& runConf,
+  std::size_t iFoil, std::size_t nHoleEvents
+);
+
+
+RobustLoss parseRobustLoss(const std::string& name);
+double getRobustWeight(double u, RobustLoss loss);
+
+// Iteratively reweighted least squares starting from given coefficients,
+// which are replaced by the robust solution. Returns false if any solve fails.
+bool robustRefit(
+  const DesignCache& cache, RobustLoss loss, int nIter,
+  TVectorD& xpTarCoeffs, TVectorD& yTarCoeffs, TVectorD& ypTarCoeffs
+);
+
+
+#endif  // myFit_h
@@ -0,0 +1,46 @@
+#ifndef myFoilMixture_h
+#define myFoilMixture_h 1
+
+#include <vector>
+
+
+//! 2D gaussian of one foil in (zVer, yTar).
+class FoilComponent {
+  public:
+    FoilComponent();
+    ~FoilComponent();
+
+    double weight;
+    double zVerMean, zVerSigma;  // cm
+    double yTarMean, yTarSigma;  // cm
+    double correlation;
+};
+
+
+//! Mixture of foil gaussians on a flat background.
+class FoilMixture {
+  public:
+    FoilMixture();
+    ~FoilMixture();
+
+    std::vector<FoilComponent> foils;
+    double backgroundWeight;
+    double backgroundDensity;  // 1/cm^2
+    double logLikelihood;
+    int nIterations;
+    bool converged;
+};
+
+
+// Fit the mixture to (zVers, yTars) by expectation-maximisation, one foil
+// per seed. The background is flat over the bounding box of the values.
+// Each step runs over the values component by component, so the inner
+// loops have no branches and vectorise.
+FoilMixture fitFoilMixture(
+  const std::vector<double>& zVers, const std::vector<double>& yTars,
+  const std::vector<double>& zVerSeeds, const std::vector<double>& yTarSeeds,
+  int maxIterations=200, double tolerance=1e-3
+);
+
+
+#endif  // myFoilMixture_h
@@ -0,0 +1,49 @@
+#ifndef myFriendTree_h
+#define myFriendTree_h 1
+
+#include <cstddef>
+#include <string>
+
+#include "myConfig.hpp"
+#include "myRecMatrix.hpp"
+#include "myResiduals.hpp"
+
+
+//! Throughput of writing a friend tree and differences of the reconstructed
+//! target variables to the ones of hcana (`P.gtr.*`).
+class FriendTreeStats {
+  public:
+    FriendTreeStats();
+    ~FriendTreeStats();
+
+    void add(const FriendTreeStats& other);
+
+    long long nEvents;
+    double time;  // s
+    // Only events with a track in hcana.
+    RunningStats xpTarDiff;
+    RunningStats ypTarDiff;
+    RunningStats yTarDiff;  // cm
+    RunningStats deltaDiff;  // %
+};
+
+
+// Reconstruct all entries of the tree `T` in fileName, taken at central
+// angle theta, and write their target variables to the tree `Trec` in
+// friendFileName, entry by entry. The input is read in batches of
+// batchSize events in the background and each batch is reconstructed on
+// nThreads threads.
+FriendTreeStats writeFriendTree(
+  const std::string& fileName, double theta, const config::RunConfig& runConf,
+  const RecMatrix& recMatrixIndep, const RecMatrix& recMatrixDep,
+  int xTarCorrIterNum, const std::string& friendFileName, int compression,
+  int nThreads, std::size_t batchSize=10000
+);
+
+// fileName in directory dirName, with `_rec` inserted before the extension.
+std::string getFriendFileName(
+  const std::string& fileName, const std::string& dirName
+);
+
+
+#endif  // myFriendTree_h
@@ -0,0 +1,105 @@
+#ifndef myIndex_h
+#define myIndex_h 1
+
+#include <cstddef>
+#include <vector>
+
+
+//! Uniform grid over 2D points for gathering the points inside a box.
+//! Points are stored sorted by cell, each cell keeping the original order.
+class GridIndex2D {
+  public:
+    GridIndex2D();
+    GridIndex2D(
+      const std::vector<double>& xs, const std::vector<double>& ys,
+      double cellSize
+    );
+    ~GridIndex2D();
+
+    // Append indexes of points inside [xLow, xHigh] x [yLow, yHigh] to
+    // indexes, cell by cell.
+    void query(
+      double xLow, double xHigh, double yLow, double yHigh,
+      std::vector<std::size_t>& indexes
+    ) const;
+
+    std::size_t size() const;
+
+  private:
+    std::size_t getCellX(double x) const;
+    std::size_t getCellY(double y) const;
+
+    double xMin;
+    double yMin;
+    double cellSize;
+    std::size_t nCellsX;
+    std::size_t nCellsY;
+
+    // Points of cell i are cellStarts[i] to cellStarts[i+1].
+    std::vector<std::size_t> cellStarts;
+    std::vector<std::size_t> pointIndexes;
+    std::vector<double> pointXs;
+    std::vector<double> pointYs;
+};
+
+//! Index over closed intervals for finding the intervals containing a value.
+//! Values are looked up in the elementary segments between interval ends,
+//! each keeping the intervals that overlap it, so the intervals found may
+//! still have to be checked at the segment ends.
+class IntervalIndex1D {
+  public:
+    IntervalIndex1D();
+    IntervalIndex1D(
+      const std::vector<double>& lows, const std::vector<double>& highs
+    );
+    ~IntervalIndex1D();
+
+    // Set [first, last) to the indexes of the intervals that may contain x,
+    // in increasing order.
+    void find(double x, const std::size_t*& first, const std::size_t*& last) const;
+
+  private:
+    // Sorted distinct interval ends.
+    std::vector<double> bounds;
+    // Intervals of segment i are segmentStarts[i] to segmentStarts[i+1].
+    std::vector<std::size_t> segmentStarts;
+    std::vector<std::size_t> intervalIndexes;
+};
+
+
+//! Uniform grid over 2D boxes for finding the boxes containing a point.
+//! Each cell keeps the boxes overlapping it, so the boxes found have to be
+//! checked.
+class BoxGridIndex2D {
+  public:
+    BoxGridIndex2D();
+    BoxGridIndex2D(
+      const std::vector<double>& xLows, const std::vector<double>& xHighs,
+      const std::vector<double>& yLows, const std::vector<double>& yHighs,
+      double cellSize
+    );
+    ~BoxGridIndex2D();
+
+    // Set [first, last) to the indexes of the boxes that may contain
+    // (x, y), in increasing order.
+    void find(
+      double x, double y, const std::size_t*& first, const std::size_t*& last
+    ) const;
+
+  private:
+    std::size_t getCellX(double x) const;
+    std::size_t getCellY(double y) const;
+
+    double xMin, xMax;
+    double yMin, yMax;
+    double cellSize;
+    std::size_t nCellsX;
+    std::size_t nCellsY;
+
+    // Boxes of cell i are cellStarts[i] to cellStarts[i+1].
+    std::vector<std::size_t> cellStarts;
+    std::vector<std::size_t> boxIndexes;
+};
+
+
+#endif  // myIndex_h
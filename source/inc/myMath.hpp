@@ -1,9 +1,12 @@
 #ifndef myMath_h
 #define myMath_h 1
 
+#include <iostream>
+#include <string>
 #include <vector>
 
 
+class TF1;
 class TH1D;
 
 
@@ -13,6 +16,8 @@ class MultiPeakFunc {
     ~MultiPeakFunc();
 
     double Evaluate(double* x, double* pars);
+    // Functor interface, so that TF1 keeps its own copy.
+    double operator()(double* x, double* pars);
 
     double getNPeaks();
 
@@ -33,15 +38,92 @@ class Peak {
 };
 
 
-Peak fitPeak(TH1D* histo, double normInit, double meanInit, double sigmaInit);
+// Estimators of a single peak.
+enum PeakMethod {
+  kPeakMinuit,  // binned chi2 fit of a gaussian
+  kPeakMoments,  // truncated moments, corrected for the truncation
+  kPeakCaruana  // weighted parabola fit of the logarithm of the counts
+};
+
+
+//! Speed and agreement of a closed-form peak estimator with the Minuit fit.
+class PeakFitComparison {
+  public:
+    PeakFitComparison();
+    ~PeakFitComparison();
+
+    void add(const PeakFitComparison& other);
+
+    long long n;
+    double estimatorTime;  // s
+    double minuitTime;  // s
+    double sumMeanDiff, sumMeanDiff2, maxMeanDiff;
+    double sumSigmaDiff, sumSigmaDiff2, maxSigmaDiff;
+};
+
+
+//! Gaussian fit of single peaks reusing one private function, so that
+//! separate fitters can be used from separate threads. The closed-form
+//! methods allocate nothing per peak.
+class PeakFitter {
+  public:
+    PeakFitter(PeakMethod method=kPeakMinuit, bool compare=false);
+    ~PeakFitter();
+
+    // The function is owned, so fitters are not copied.
+    PeakFitter(const PeakFitter&) = delete;
+    PeakFitter& operator=(const PeakFitter&) = delete;
+
+    // Fitted function is neither drawn nor stored if draw is false.
+    Peak fit(
+      TH1D* histo, double normInit, double meanInit, double sigmaInit,
+      bool draw=true
+    );
+
+    PeakMethod method;
+    // Closed-form estimates are compared with the Minuit fit if set.
+    bool compare;
+    PeakFitComparison comparison;
+
+  private:
+    Peak fitMinuit(
+      TH1D* histo, double normInit, double meanInit, double sigmaInit,
+      bool draw, double& chi2
+    );
+
+    TF1* fitFunc;
+};
+
+
+// Fitted functions are not drawn if draw is false, so no default canvas is
+// created in batch mode.
+Peak fitPeak(
+  TH1D* histo, double normInit, double meanInit, double sigmaInit,
+  bool draw=true
+);
+
+// Closed-form estimates of a gaussian peak from the bins with centres in
+// meanInit +- 2*sigmaInit and inside the axis range of histo. Sigma is 0 if
+// the estimate fails. chi2 is that of the gaussian with the estimates.
+Peak estimatePeakMoments(
+  const TH1D* histo, double meanInit, double sigmaInit, double& chi2
+);
+Peak estimatePeakCaruana(
+  const TH1D* histo, double meanInit, double sigmaInit, double& chi2
+);
+
+PeakMethod parsePeakMethod(const std::string& name);
+void writePeakFitComparison(
+  std::ostream& os, const PeakFitComparison& comparison
+);
 
 std::vector<Peak> findPeaks(TH1D* histo, int nfoil=3);
-std::vector<Peak> fitMultiPeak(TH1D* histo, double sigma=0.5);
+std::vector<Peak> fitMultiPeak(TH1D* histo, double sigma=0.5, bool draw=true);
 std::vector<Peak> selectMultiPeakY(TH1D* histo, int nfoil=3, double sinTheta=1);
 std::vector<Peak> selectMultiPeakZ(TH1D* histo, int nfoil=3, double sinTheta=1);
 std::vector<Peak> sortByHeight(std::vector<Peak> peaksFound, int nFoil=3);
 
-std::size_t getClosestIndex(double value, std::vector<double>& reference);
+std::size_t getClosestIndex(double value, const std::vector<double>& reference);
 
 
 #endif  // myMath_h
@@ -0,0 +1,55 @@
+#ifndef myOffsetFit_h
+#define myOffsetFit_h 1
+
+#include <cstddef>
+#include <vector>
+
+#include "myConfig.hpp"
+#include "myEvent.hpp"
+#include "myReconstruct.hpp"
+#include "mySweep.hpp"
+
+
+//! Events of a run cached for fitting the offsets.
+class OffsetFitRun {
+  public:
+    OffsetFitRun(
+      const config::RunConfig& runConf, std::vector<Event>& events,
+      const RecMatrix& recMatrixIndep, const RecMatrix& recMatrixDep
+    );
+    ~OffsetFitRun();
+
+    config::RunConfig runConf;
+    std::vector<Event> events;
+    std::vector<MatrixSums> sumss;
+
+    // Foil and hole assignment of each event, nFoils if not used.
+    std::vector<std::size_t> foils;
+    std::vector<std::size_t> xSieveIndexes;
+    std::vector<std::size_t> ySieveIndexes;
+    std::size_t nAssigned;
+};
+
+
+// Assign events to closest foils and holes for given shifts.
+void assignEvents(
+  OffsetFitRun& run, const OffsetShifts& shifts, int xTarCorrIterNum
+);
+
+// Mean squared sieve and foil residual of assigned events in units of the
+// expected resolution, reconstructed in memory for given shifts.
+double getOffsetObjective(
+  const std::vector<OffsetFitRun>& runs, const OffsetShifts& shifts,
+  int xTarCorrIterNum, int nThreads
+);
+
+// Minimise the objective over theta and phi offsets and x and y mispointing
+// with BFGS, starting from shifts. Events are reassigned to foils and holes
+// nAssignIter times. Returns the fitted shifts.
+OffsetShifts fitOffsets(
+  std::vector<OffsetFitRun>& runs, const OffsetShifts& shifts,
+  int xTarCorrIterNum, int nThreads, int nAssignIter
+);
+
+
+#endif  // myOffsetFit_h
@@ -2,7 +2,10 @@
 #define myOther_h 1
 
 #include <cstddef>
-
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 
 // reportProgress
@@ -16,4 +19,52 @@ void reportProgress(long long int done, long long int length);
 void reportProgressFinish();
 
 
+// Number of worker threads to use, all hardware threads if requested <= 0.
+int getThreadNum(int requested);
+
+
+// Raw values for intermediate files, read back on the same kind of machine.
+
+template<typename T>
+void writeBinary(std::ostream& os, const T& value) {
+  os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+
+template<typename T>
+void readBinary(std::istream& is, T& value) {
+  if (!is.read(reinterpret_cast<char*>(&value), sizeof(T))) {
+    throw std::runtime_error("Unexpected end of binary file!");
+  }
+}
+
+
+template<typename T>
+void writeBinary(std::ostream& os, const std::vector<T>& values) {
+  writeBinary(os, static_cast<unsigned long long>(values.size()));
+  os.write(
+    reinterpret_cast<const char*>(values.data()),
+    static_cast<std::streamsize>(values.size()*sizeof(T))
+  );
+}
+
+
+template<typename T>
+void readBinary(std::istream& is, std::vector<T>& values) {
+  unsigned long long size = 0;
+  readBinary(is, size);
+  values.resize(static_cast<std::size_t>(size));
+  if (!is.read(
+    reinterpret_cast<char*>(values.data()),
+    static_cast<std::streamsize>(values.size()*sizeof(T))
+  )) {
+    throw std::runtime_error("Unexpected end of binary file!");
+  }
+}
+
+
+void writeBinary(std::ostream& os, const std::string& str);
+void readBinary(std::istream& is, std::string& str);
+
+
 #endif  // myOther_h
@@ -0,0 +1,44 @@
+#ifndef myPipeline_h
+#define myPipeline_h 1
+
+#include <cstddef>
+#include <exception>
+#include <thread>
+#include <vector>
+
+#include "myConfig.hpp"
+#include "myEvent.hpp"
+#include "myFileCache.hpp"
+#include "myQueue.hpp"
+
+
+//! Reads the events of a run in a background thread and hands them over in
+//! batches of batchSize events through a queue of queueDepth batches, so
+//! that they can be reconstructed while the rest is read. Shared files are
+//! taken from cache, if given.
+class EventPipeline {
+  public:
+    EventPipeline(
+      const config::RunConfig& runConf, EventFileCache* cache=NULL,
+      std::size_t batchSize=10000, std::size_t queueDepth=16
+    );
+    ~EventPipeline();
+
+    // Take the next batch of events, in file order. Returns false after
+    // the last batch, and rethrows an error of the reader.
+    bool next(std::vector<Event>& batch);
+
+    // Only consistent after next returned false.
+    const QueueMetrics& getMetrics() const;
+
+    // Time the reader thread took.
+    double readTime;  // s
+
+  private:
+    BoundedQueue<std::vector<Event> > queue;
+    std::thread thread;
+    std::exception_ptr error;
+};
+
+
+#endif  // myPipeline_h
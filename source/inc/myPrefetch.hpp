@@ -0,0 +1,60 @@
+#ifndef myPrefetch_h
+#define myPrefetch_h 1
+
+#include <cstddef>
+#include <exception>
+#include <thread>
+#include <vector>
+
+#include "myConfig.hpp"
+#include "myEvent.hpp"
+#include "myFileCache.hpp"
+
+
+//! Reads the events of the next run in the background while the current
+//! run is processed. Only one run is read ahead, and only if its events
+//! fit in maxBytes. Shared files are taken from cache, if given.
+class EventPrefetcher {
+  public:
+    EventPrefetcher(std::size_t maxBytes, EventFileCache* cache=NULL);
+    ~EventPrefetcher();
+
+    // Holds a reading thread.
+    EventPrefetcher(const EventPrefetcher&) = delete;
+    EventPrefetcher& operator=(const EventPrefetcher&) = delete;
+
+    // Start reading the events of runConf. Waits for an earlier read that
+    // was not taken.
+    void start(const config::RunConfig& runConf);
+    // Whether the events of run runNumber are being read.
+    bool isReading(int runNumber) const;
+    // Wait for the events being read and move them to events. Returns
+    // false if the run did not fit in the memory cap and was not read.
+    bool take(std::vector<Event>& events);
+
+    // Runs read ahead and skipped for the memory cap.
+    int nPrefetched;
+    int nSkipped;
+    // Time spent reading in the background, and waiting for it in take,
+    // summed over all prefetched runs.
+    double readTime;  // s
+    double waitTime;  // s
+    // Of the last prefetched run.
+    double lastReadTime;  // s
+    double lastWaitTime;  // s
+
+  private:
+    void wait();
+
+    std::size_t maxBytes;
+    EventFileCache* cache;
+    int readRunNumber;
+    std::thread thread;
+    std::vector<Event> buffer;
+    bool skipped;
+    double bufferReadTime;  // s
+    std::exception_ptr error;
+};
+
+
+#endif  // myPrefetch_h
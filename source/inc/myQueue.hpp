@@ -0,0 +1,143 @@
+#ifndef myQueue_h
+#define myQueue_h 1
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+//! Depth and stall times of a BoundedQueue.
+class QueueMetrics {
+  public:
+    QueueMetrics();
+    ~QueueMetrics();
+
+    // Mean depth seen by the consumer when taking an item.
+    double getMeanDepth() const;
+
+    std::size_t capacity;
+    std::size_t nItems;
+    std::size_t maxDepth;
+    std::size_t depthSum;
+    // Time the producer waited for a free slot and the consumer waited
+    // for an item.
+    double producerStallTime;  // s
+    double consumerStallTime;  // s
+};
+
+
+//! Lock-free bounded queue between one producer and one consumer thread.
+//! The producer closes the queue after its last item.
+template<typename T>
+class BoundedQueue {
+  public:
+    BoundedQueue(std::size_t capacity);
+    ~BoundedQueue();
+
+    // Move item in, waiting while the queue is full.
+    void push(T& item);
+    // No more items will be pushed.
+    void close();
+    // Move the oldest item out, waiting while the queue is empty. Returns
+    // false if the queue is closed and empty.
+    bool pop(T& item);
+
+    // Only consistent after the producer closed the queue.
+    const QueueMetrics& getMetrics() const;
+
+  private:
+    // One slot stays free to tell a full from an empty queue.
+    std::vector<T> slots;
+    // Next slot to pop, written by the consumer only.
+    std::atomic<std::size_t> head;
+    // Next slot to push, written by the producer only.
+    std::atomic<std::size_t> tail;
+    std::atomic<bool> closed;
+    QueueMetrics metrics;
+};
+
+
+// BoundedQueue implementation.
+
+template<typename T>
+BoundedQueue<T>::BoundedQueue(std::size_t capacity) :
+  slots(capacity+1), head(0), tail(0), closed(false), metrics()
+{
+  metrics.capacity = capacity;
+}
+
+
+template<typename T>
+BoundedQueue<T>::~BoundedQueue() {}
+
+
+template<typename T>
+void BoundedQueue<T>::push(T& item) {
+  const std::size_t iTail = tail.load(std::memory_order_relaxed);
+  const std::size_t iNext = (iTail+1) % slots.size();
+
+  if (iNext == head.load(std::memory_order_acquire)) {
+    auto start = std::chrono::steady_clock::now();
+    while (iNext == head.load(std::memory_order_acquire)) {
+      std::this_thread::yield();
+    }
+    std::chrono::duration<double> stall = std::chrono::steady_clock::now() - start;
+    metrics.producerStallTime += stall.count();
+  }
+
+  slots[iTail] = std::move(item);
+  tail.store(iNext, std::memory_order_release);
+}
+
+
+template<typename T>
+void BoundedQueue<T>::close() {
+  closed.store(true, std::memory_order_release);
+}
+
+
+template<typename T>
+bool BoundedQueue<T>::pop(T& item) {
+  const std::size_t iHead = head.load(std::memory_order_relaxed);
+
+  if (iHead == tail.load(std::memory_order_acquire)) {
+    auto start = std::chrono::steady_clock::now();
+    while (iHead == tail.load(std::memory_order_acquire)) {
+      // Items pushed before closing are visible once closed is.
+      if (
+        closed.load(std::memory_order_acquire) &&
+        iHead == tail.load(std::memory_order_acquire)
+      ) {
+        std::chrono::duration<double> stall = std::chrono::steady_clock::now() - start;
+        metrics.consumerStallTime += stall.count();
+        return false;
+      }
+      std::this_thread::yield();
+    }
+    std::chrono::duration<double> stall = std::chrono::steady_clock::now() - start;
+    metrics.consumerStallTime += stall.count();
+  }
+
+  const std::size_t iTail = tail.load(std::memory_order_acquire);
+  const std::size_t depth = (iTail + slots.size() - iHead) % slots.size();
+  ++metrics.nItems;
+  metrics.depthSum += depth;
+  if (depth > metrics.maxDepth) metrics.maxDepth = depth;
+
+  item = std::move(slots[iHead]);
+  head.store((iHead+1) % slots.size(), std::memory_order_release);
+
+  return true;
+}
+
+
+template<typename T>
+const QueueMetrics& BoundedQueue<T>::getMetrics() const {
+  return metrics;
+}
+
+
+#endif  // myQueue_h
@@ -59,5 +59,9 @@ std::ostream& operator<<(std::ostream& os, const RecMatrixLine& line);
 
 RecMatrix readMatrixFile(const std::string& fileName);
 void writeMatrixFile(const std::string& fileName, const RecMatrix& recMatrix);
+// Split a full matrix into its xTar independent and dependent lines.
+void splitRecMatrix(
+  const RecMatrix& recMatrix, RecMatrix& recMatrixIndep, RecMatrix& recMatrixDep
+);
 
 #endif  // myRecMatrixIO_h
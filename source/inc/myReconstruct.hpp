@@ -0,0 +1,94 @@
+#ifndef myReconstruct_h
+#define myReconstruct_h 1
+
+#include <vector>
+
+#include "myConfig.hpp"
+#include "myEvent.hpp"
+#include "myRecMatrix.hpp"
+
+
+//! Target variables in spectrometer target system.
+class TargetVariables {
+  public:
+    TargetVariables();
+    ~TargetVariables();
+
+    double xTar;  // cm
+    double yTar;  // cm
+    double xpTar;
+    double ypTar;
+};
+
+
+//! Matrix sums of an event as a polynomial in xTar.
+/*!
+  The focal plane part of each line is summed once, so the xTar dependent
+  contribution for any xTar is a short polynomial evaluation. This is what
+  makes reconstructing the same event many times cheap.
+*/
+class MatrixSums {
+  public:
+    MatrixSums();
+    MatrixSums(
+      const Event& event,
+      const RecMatrix& recMatrixIndep, const RecMatrix& recMatrixDep
+    );
+    ~MatrixSums();
+
+    void getSums(double xTar, double& xpSum, double& ySum, double& ypSum) const;
+
+    // Exponents are single digits in the matrix files.
+    static const int kMaxXTarPower = 9;
+
+    // Coefficients of (xTar/100)^k, independent matrix is added to k=0.
+    double xpSums[kMaxXTarPower+1];
+    double ySums[kMaxXTarPower+1];
+    double ypSums[kMaxXTarPower+1];
+    int nPowers;
+};
+
+
+// Reconstruct target, vertex and sieve variables of an event from its focal
+// plane variables, using xTar independent and dependent matrices.
+void reconstructEvent(
+  Event& event, const config::RunConfig& runConf,
+  const RecMatrix& recMatrixIndep, const RecMatrix& recMatrixDep,
+  int xTarCorrIterNum
+);
+void reconstructEvent(
+  Event& event, const config::RunConfig& runConf,
+  const MatrixSums& sums, int xTarCorrIterNum
+);
+
+// Calculate the real or "physical" target variables of an event coming from
+// given foil and going through given sieve hole.
+TargetVariables getPhysicalTarget(
+  const Event& event, const config::RunConfig& runConf,
+  double zFoil, double xSieveHole, double ySieveHole
+);
+
+// Sum matrix elements times lambdas for given xTar.
+void sumMatrix(
+  const Event& event, double xTar, const RecMatrix& recMatrix,
+  double& xpSum, double& ySum, double& ypSum
+);
+
+// Sum delta matrix elements times lambdas for given xTar.
+double sumDelta(const Event& event, double xTar, const RecMatrix& recMatrix);
+
+// Delta (in %) of a reconstructed event from the delta elements of both
+// matrices, at the xTar of its last iteration.
+double reconstructDelta(
+  const Event& event, const config::RunConfig& runConf,
+  const RecMatrix& recMatrixIndep, const RecMatrix& recMatrixDep
+);
+
+// Calculate lambdas of all lines of matrix for given xTar.
+void getLambdas(
+  const Event& event, double xTar, const RecMatrix& recMatrix,
+  std::vector<double>& lambdas
+);
+
+
+#endif  // myReconstruct_h
@@ -0,0 +1,93 @@
+#ifndef myResiduals_h
+#define myResiduals_h 1
+
+#include <iostream>
+
+#include "myEvent.hpp"
+#include "myReconstruct.hpp"
+
+
+//! Streaming mean and variance (Welford's algorithm).
+class RunningStats {
+  public:
+    RunningStats();
+    ~RunningStats();
+
+    void fill(double value);
+    // Combine with the statistics of other values.
+    void add(const RunningStats& other);
+
+    double getMean() const;
+    double getRMS() const;
+
+    void write(std::ostream& os) const;
+    void read(std::istream& is);
+
+    long long n;
+
+  private:
+    double mean;
+    double m2;
+};
+
+
+//! Streaming median estimate in constant memory (P-square algorithm of
+//! Jain and Chlamtac), exact for fewer than 5 values.
+class RunningMedian {
+  public:
+    RunningMedian();
+    ~RunningMedian();
+
+    void fill(double value);
+
+    double getMedian() const;
+
+    long long n;
+
+  private:
+    // Marker heights, actual and desired marker positions.
+    double heights[5];
+    double positions[5];
+    double desired[5];
+};
+
+
+//! Streaming mean, RMS and median of one residual.
+class ResidualStats {
+  public:
+    ResidualStats();
+    ~ResidualStats();
+
+    void fill(double value);
+
+    RunningStats moments;
+    RunningMedian median;
+};
+
+
+//! Residuals of reconstructed with respect to physical target variables.
+class ResidualSummary {
+  public:
+    ResidualSummary();
+    ~ResidualSummary();
+
+    void fill(const Event& event, const TargetVariables& target, double zFoil);
+
+    void write(std::ostream& os) const;
+    void read(std::istream& is);
+
+    RunningStats xpTar;
+    RunningStats yTar;
+    RunningStats ypTar;
+    RunningStats zVer;
+};
+
+
+void writeResidualSummaryHeader(std::ostream& os);
+void writeResidualSummary(
+  std::ostream& os, int iteration, int runNumber, int iFoil,
+  const ResidualSummary& summary
+);
+
+
+#endif  // myResiduals_h
@@ -0,0 +1,134 @@
+#ifndef mySelection_h
+#define mySelection_h 1
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "myConfig.hpp"
+#include "myEvent.hpp"
+#include "myIndex.hpp"
+#include "myMath.hpp"
+
+
+//! Foil and sieve hole cuts of a single run.
+class RunCuts {
+  public:
+    RunCuts();
+    ~RunCuts();
+
+    std::vector<Peak> zVerPeaks;
+    std::vector<Peak> yTarPeaks;
+
+    // For each foil, one entry per sieve hole.
+    std::vector<std::vector<Peak> > xSievePeakss;
+    std::vector<std::vector<Peak> > ySievePeakss;
+    std::vector<std::vector<std::size_t> > xSieveIndexess;
+    std::vector<std::vector<std::size_t> > ySieveIndexess;
+    // Correlation of x and y of each hole, empty for a foil fitted by
+    // projections.
+    std::vector<std::vector<double> > sieveCorrelationss;
+};
+
+
+//! Lookup of the foil and sieve hole of events, with the same results as
+//! findFoil and findHole for the cuts it was built from. Foils are looked
+//! up by zVer intervals and holes on a grid of their boxes, each checking
+//! only the few foils or holes found.
+class CutIndex {
+  public:
+    // Holes are indexed only if cuts have sieve peaks for all foils. Cuts
+    // must outlive the index.
+    CutIndex(const RunCuts& cuts, const config::RunConfig& runConf);
+    ~CutIndex();
+
+    // Indexes are built once per run and passed by reference.
+    CutIndex(const CutIndex&) = delete;
+    CutIndex& operator=(const CutIndex&) = delete;
+
+    std::size_t findFoil(const Event& event) const;
+    std::size_t findHole(const Event& event, std::size_t iFoil) const;
+
+  private:
+    const RunCuts* cuts;
+    IntervalIndex1D zVerIndex;
+    std::vector<BoxGridIndex2D> holeIndexes;
+};
+
+
+//! Foil and sieve hole of each event of a run.
+class EventAssignment {
+  public:
+    EventAssignment();
+    ~EventAssignment();
+
+    // Unassign all of nEvents events.
+    void reset(std::size_t nEvents, std::size_t nFoils);
+    // Add unassigned events up to nEvents events, for events that are read
+    // in batches.
+    void grow(std::size_t nEvents);
+
+    std::size_t nFoils;
+    // Foil of each event, nFoils if the event is not used.
+    std::vector<std::uint16_t> foils;
+    // Hole of each event within its foil.
+    std::vector<std::uint16_t> holes;
+    // Indexes of the used events in increasing order, for passes that only
+    // need those.
+    std::vector<std::uint32_t> selected;
+};
+
+
+// Return index of the foil the event belongs to, or zVerPeaks.size() if none.
+std::size_t findFoil(
+  const Event& event,
+  const std::vector<Peak>& zVerPeaks, const std::vector<Peak>& yTarPeaks
+);
+
+// Return index of the sieve hole the event went through, or
+// xSievePeaks.size() if none.
+// Holes are boxes of 2.2 sigma in x and 2 sigma in y, or the ellipses
+// inscribed in them and tilted by the correlations if those are given.
+std::size_t findHole(
+  const Event& event,
+  const std::vector<Peak>& xSievePeaks, const std::vector<Peak>& ySievePeaks,
+  const std::vector<double>& correlations=std::vector<double>()
+);
+
+// Assign event iEvent to its foil and hole, if any. Events have to be
+// assigned in increasing order after resetting the assignment.
+void assignEvent(
+  const Event& event, std::size_t iEvent,
+  const CutIndex& index, const RunCuts& cuts, EventAssignment& assignment
+);
+
+// Assign events to foils, holes are not assigned.
+void assignFoils(
+  const std::vector<Event>& events, const CutIndex& index,
+  const RunCuts& cuts, EventAssignment& assignment
+);
+
+// Assign events of assigned foils to holes, events in no hole are taken
+// out of their foil.
+void assignHoles(
+  const std::vector<Event>& events, const CutIndex& index,
+  const RunCuts& cuts, EventAssignment& assignment
+);
+
+// Selection by geometry alone, without fitted peaks.
+// Return index of the closest foil, or zFoils.size() if the event is further
+// than half of the foil spacing from any foil.
+std::size_t findClosestFoil(
+  const Event& event, const std::vector<double>& zFoils
+);
+
+// Find the closest sieve hole, false if the event is further than half of
+// the hole spacing from any hole.
+bool findClosestHole(
+  const Event& event, const config::RunConfig& runConf,
+  const std::vector<double>& xSievePhys, const std::vector<double>& ySievePhys,
+  std::size_t& xSieveIndex, std::size_t& ySieveIndex
+);
+
+
+#endif  // mySelection_h
@@ -0,0 +1,81 @@
+#ifndef myShard_h
+#define myShard_h 1
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "myEventTree.hpp"
+#include "myFit.hpp"
+#include "myResiduals.hpp"
+
+
+//! Fit input and summaries of a single run, merged in run order.
+class RunResult {
+  public:
+    RunResult(int nTerms);
+    ~RunResult();
+
+    FitAccumulator fitAcc;
+    DesignCache designCache;
+    // Blocks of the bootstrap, one per sieve hole or one for the run.
+    std::vector<FitAccumulator> holeBlocks;
+    std::vector<ResidualSummary> summaries;
+    // Rows of the diagnostic tree, not saved in shard files.
+    std::vector<EventTreeRow> treeRows;
+
+    // Whether cuts were found, to be saved under configHash.
+    bool newCuts;
+    // Run and hash of its config, checked when merging shards.
+    int runNumber;
+    std::uint64_t configHash;
+};
+
+
+//! Start of the partial fit file of one shard, checked when merging.
+class ShardHeader {
+  public:
+    ShardHeader();
+    ~ShardHeader();
+
+    int shardIndex;
+    int shardNum;
+    std::size_t nRuns;
+    int nTerms;
+    std::uint64_t matrixHash;
+    // The design cache is only filled for a robust loss, and hole blocks
+    // only with a bootstrap unit (empty without bootstrap).
+    std::string robustLoss;
+    std::string blockUnit;
+};
+
+
+// Whether run iRun belongs to shard shardIndex of shardNum. Runs are dealt
+// out in config order, so all shards agree on the split.
+bool isShardRun(std::size_t iRun, int shardIndex, int shardNum);
+
+// fileName with `_shard<i>of<N>` inserted before the extension, which is
+// replaced by extension if given.
+std::string getShardFileName(
+  const std::string& fileName, int shardIndex, int shardNum,
+  const std::string& extension=""
+);
+
+// Add the fit input of run iRun to the totals. Hole blocks are appended
+// and blockRuns extended with iRun.
+void mergeRunResult(
+  const RunResult& result, std::size_t iRun,
+  FitAccumulator& fitAcc, DesignCache& designCache,
+  std::vector<FitAccumulator>& holeBlocks, std::vector<std::size_t>& blockRuns
+);
+
+void writeShardHeader(std::ostream& os, const ShardHeader& header);
+ShardHeader readShardHeader(std::istream& is);
+void writeShardRun(std::ostream& os, std::size_t iRun, const RunResult& result);
+// Returns false at the end of the file.
+bool readShardRun(std::istream& is, std::size_t& iRun, RunResult& result);
+
+
+#endif  // myShard_h
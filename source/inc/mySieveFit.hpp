@@ -0,0 +1,38 @@
+#ifndef mySieveFit_h
+#define mySieveFit_h 1
+
+#include <vector>
+
+#include "myConfig.hpp"
+#include "myEvent.hpp"
+#include "mySelection.hpp"
+#include "mySieveGrid.hpp"
+
+
+class TH2D;
+
+
+// Fit the sieve holes of xySieveHists, one histogram per foil, and fill the
+// sieve peaks and indexes of cuts. Foils and holes are fitted on nThreads
+// threads, each with its own projections and fitter. Holes are fitted ahead
+// and selected afterwards in the order of the sequential fit, so the result
+// does not depend on the number of threads.
+// Needs ROOT thread safety and a thread safe minimiser (Minuit2).
+// Hole positions are estimated with method; if comparison is given, the
+// estimates are compared with the Minuit fit and the results added to it.
+// If unbinned, each hole is instead fitted by a 2D gaussian on a flat
+// background to the (xSieve, ySieve) of the events assigned to its foil,
+// and the correlations are stored in cuts.
+// If gridMatches is given, the hole positions are predicted by matching the
+// whole sieve grid to each histogram instead of by the projections, only
+// the populated holes are fitted, and the matches are stored in it.
+void fitSieveHoles(
+  const std::vector<Event>& events, const EventAssignment& assignment,
+  const std::vector<TH2D>& xySieveHists, const config::RunConfig& runConf,
+  int nThreads, PeakMethod method, bool unbinned,
+  PeakFitComparison* comparison, std::vector<SieveGridMatch>* gridMatches,
+  RunCuts& cuts
+);
+
+
+#endif  // mySieveFit_h
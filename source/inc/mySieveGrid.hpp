@@ -0,0 +1,39 @@
+#ifndef mySieveGrid_h
+#define mySieveGrid_h 1
+
+#include <vector>
+
+
+class TH2D;
+
+
+//! Transformation of the physical sieve grid onto a measured xySieve image:
+//! scaled and rotated about the grid centre, then shifted.
+class SieveGridMatch {
+  public:
+    SieveGridMatch();
+    ~SieveGridMatch();
+
+    // Expected position of the physical hole (xPhys, yPhys) in the image.
+    void transform(double xPhys, double yPhys, double& x, double& y) const;
+
+    double xCenter, yCenter;  // cm
+    double xShift, yShift;  // cm
+    double scale;
+    double rotation;  // rad
+    // Cross-correlation of the image and the grid, normalised to 1 for an
+    // image equal to the grid.
+    double score;
+};
+
+
+// Match the grid of physical hole positions to xySieveHist. The image is
+// cross-correlated with the grid through FFT, which gives the best shift
+// for all shifts at once, for a few scales and rotations about 1 and 0.
+SieveGridMatch matchSieveGrid(
+  const TH2D& xySieveHist,
+  const std::vector<double>& xSievePhys, const std::vector<double>& ySievePhys
+);
+
+
+#endif  // mySieveGrid_h
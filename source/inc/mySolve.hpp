@@ -0,0 +1,48 @@
+#ifndef mySolve_h
+#define mySolve_h 1
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "myFit.hpp"
+#include "myRecMatrix.hpp"
+
+
+// Read the `__indep` and `__dep` parts of the matrix fileName.
+void readMatrices(
+  const std::string& fileName, RecMatrix& recMatrixIndep, RecMatrix& recMatrixDep
+);
+
+// Matrix of all xTar independent terms up to fitOrder, with the delta
+// elements of recMatrixIndep and the other elements 0.
+RecMatrix getNewRecMatrix(RecMatrix recMatrixIndep, int fitOrder);
+
+// Solve the normal equations of fitAcc, refit the cached events with the
+// robust loss unless it is `ls`, and put the coefficients in recMatrixNew.
+// Returns false if any solve fails.
+bool solveFit(
+  const FitAccumulator& fitAcc, const DesignCache& designCache,
+  const std::string& robustLossName, int robustIterNum,
+  RecMatrix& recMatrixNew
+);
+
+// Save the matrices to fileName with suffix and `__indep` or `__dep`
+// inserted before the extension.
+void writeMatrices(
+  const std::string& fileName, const std::string& suffix,
+  const RecMatrix& recMatrixIndep, const RecMatrix& recMatrixDep
+);
+
+// Bootstrap the coefficients of recMatrixNew from the blocks of each sieve
+// hole, or of each run with bootstrapUnit `run`, and save their standard
+// deviations next to fileName. A failed bootstrap is only reported.
+void bootstrap(
+  const std::vector<FitAccumulator>& holeBlocks,
+  const std::vector<std::size_t>& blockRuns, std::size_t nRuns,
+  int bootstrapNum, const std::string& bootstrapUnit, int nThreads,
+  const std::string& fileName, const RecMatrix& recMatrixNew
+);
+
+
+#endif  // mySolve_h
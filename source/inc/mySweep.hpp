@@ -0,0 +1,72 @@
+#ifndef mySweep_h
+#define mySweep_h 1
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "myConfig.hpp"
+#include "myEvent.hpp"
+#include "myReconstruct.hpp"
+#include "myResiduals.hpp"
+
+
+//! Shifts of the optics offsets with respect to the config file values.
+class OffsetShifts {
+  public:
+    OffsetShifts();
+    ~OffsetShifts();
+
+    double thetaOffset;
+    double phiOffset;
+    double zFoilOffset;  // cm
+    double xMispointing;  // cm
+    double yMispointing;  // cm
+};
+
+
+//! Residuals of events selected by geometry, for one sweep point.
+class SweepMetrics {
+  public:
+    SweepMetrics();
+    ~SweepMetrics();
+
+    long long nEvents;  // events tried
+    RunningStats zVer;
+    RunningStats xSieve;
+    RunningStats ySieve;
+    RunningStats xpTar;
+    RunningStats yTar;
+    RunningStats ypTar;
+};
+
+
+// Return copy of run config with the shifts applied.
+config::RunConfig applyShifts(
+  const config::RunConfig& runConf, const OffsetShifts& shifts
+);
+
+// Read sweep points from file. Each of the keywords `htheta_offset`,
+// `hphi_offset`, `zoffset_foil`, `xmispointing` and `ymispointing` is
+// followed by a list of values or by `range MIN MAX N`, and all their
+// combinations are swept. Lines `point dTheta dPhi dZ dX dY` add single
+// points.
+std::vector<OffsetShifts> loadSweepFile(const std::string& fname);
+
+// Reconstruct and select events of a run for all sweep points, adding the
+// residuals to metricss. Points are spread over nThreads threads.
+void sweepRun(
+  const std::vector<Event>& events, const std::vector<MatrixSums>& sumss,
+  const config::RunConfig& runConf, int xTarCorrIterNum,
+  const std::vector<OffsetShifts>& points, int nThreads,
+  std::vector<SweepMetrics>& metricss
+);
+
+void writeSweepTable(
+  std::ostream& os,
+  const std::vector<OffsetShifts>& points,
+  const std::vector<SweepMetrics>& metricss
+);
+
+
+#endif  // mySweep_h
@@ -0,0 +1,96 @@
+#ifndef shmsoptics_h
+#define shmsoptics_h 1
+
+// C interface of libshmsoptics: loading of reconstruction matrices and
+// reconstruction of target variables from arrays of focal plane variables.
+// It uses no ROOT types and can be called from C and C++, for example from
+// a replay or online monitoring.
+//
+// Functions return 0 on success. On failure they return a non-zero value
+// and shmsoptics_last_error gives the reason. A loaded matrix is not
+// modified by reconstruction, so one matrix may be used from several
+// threads at the same time.
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// Changes when the interface changes incompatibly.
+#define SHMSOPTICS_API_VERSION 1
+
+// Reconstruction matrix, split into its xTar independent and dependent
+// lines.
+typedef struct shmsoptics_matrix shmsoptics_matrix;
+
+// Spectrometer setup of the events of one reconstruction call. Units as in
+// the config file.
+typedef struct {
+  double theta;  // central angle, deg
+  double thetaOffset;
+  double phiOffset;
+  double xMispointing;  // cm
+  double yMispointing;  // cm
+  double zSieve;  // distance of the sieve from the target, cm
+  int use2017Corr;
+  int xTarCorrIterNum;
+} shmsoptics_setup;
+
+// Input arrays of a reconstruction call, each with one value per event.
+// Delta is only used for the sieve variables and may be NULL.
+typedef struct {
+  const double* xFp;  // cm
+  const double* yFp;  // cm
+  const double* xpFp;
+  const double* ypFp;
+  const double* xVer;  // beam position, cm
+  const double* yVer;  // beam position, cm
+  const double* delta;  // %
+} shmsoptics_focal_plane;
+
+// Output arrays of a reconstruction call, each with room for one value per
+// event. Arrays that are NULL are not filled.
+typedef struct {
+  double* xTar;  // cm
+  double* yTar;  // cm
+  double* xpTar;
+  double* ypTar;
+  double* zVer;  // cm
+  double* delta;  // %, from the delta elements of the matrix
+  double* xSieve;  // cm
+  double* ySieve;  // cm
+} shmsoptics_target;
+
+
+// SHMSOPTICS_API_VERSION of the library.
+int shmsoptics_api_version(void);
+
+// Reason of the last failure in the calling thread.
+const char* shmsoptics_last_error(void);
+
+// Setup with the defaults of a run in the config file.
+void shmsoptics_setup_init(shmsoptics_setup* setup);
+
+// Load a matrix file with xTar independent and dependent lines.
+int shmsoptics_matrix_load(const char* fileName, shmsoptics_matrix** matrix);
+// Load the `__indep` and `__dep` files of fileName, as written by
+// shms_optics.
+int shmsoptics_matrix_load_split(const char* fileName, shmsoptics_matrix** matrix);
+void shmsoptics_matrix_free(shmsoptics_matrix* matrix);
+size_t shmsoptics_matrix_size(const shmsoptics_matrix* matrix);
+
+// Reconstruct nEvents events.
+int shmsoptics_reconstruct(
+  const shmsoptics_matrix* matrix, const shmsoptics_setup* setup,
+  size_t nEvents, const shmsoptics_focal_plane* focalPlane,
+  shmsoptics_target* target
+);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // shmsoptics_h
@@ -19,6 +19,7 @@
 #include "TLine.h"
 #include "TMarker.h"
 #include "TRint.h"
+#include "TROOT.h"
 #include "TString.h"
 #include "TStyle.h"
 #include "TSystem.h"
@@ -27,12 +28,15 @@
 #include "cmdOptions.hpp"
 #include "myConfig.hpp"
 #include "myEvent.hpp"
+#include "myFriendTree.hpp"
 #include "myMath.hpp"
 #include "myOther.hpp"
 #include "myRecMatrix.hpp"
 
 
 int reconstruct(const cmdOptions::OptionParser_reconstruct& cmdOpts);
+int reconstructFriends(const cmdOptions::OptionParser_reconstruct& cmdOpts);
+void printFriendTreeStats(const FriendTreeStats& stats);
 
 
 int main(int argc, char* argv[]) {
@@ -51,6 +55,19 @@ int main(int argc, char* argv[]) {
     return 0;
   }
 
+  if (!cmdOpts.friendDirName.empty()) {
+    // Files are read and written from several threads, nothing is drawn.
+    ROOT::EnableThreadSafety();
+    gROOT->SetBatch(kTRUE);
+    try {
+      return reconstructFriends(cmdOpts);
+    }
+    catch (const std::runtime_error& err) {
+      cout << "reconstruct: " << err.what() << endl;
+      return 1;
+    }
+  }
+
   // Create command line options for ROOT.
   int argcRoot = 3;
   static char argvRoot[][100] = {"-q", "-l"};
@@ -532,3 +549,64 @@ int reconstruct(const cmdOptions::OptionParser_reconstruct& cmdOpts) {
 
   return 0;
 }
+
+
+int reconstructFriends(const cmdOptions::OptionParser_reconstruct& cmdOpts) {
+  cout
+    << "Reading config file:" << endl
+    << "  `" << cmdOpts.configFileName << "`" << endl;
+  config::Config conf = config::loadConfigFile(cmdOpts.configFileName);
+
+  cout
+    << "Reading matrix file:" << endl
+    << "  `" << cmdOpts.matrixFileName << "`" << endl;
+  RecMatrix recMatrixIndep, recMatrixDep;
+  splitRecMatrix(
+    readMatrixFile(cmdOpts.matrixFileName), recMatrixIndep, recMatrixDep
+  );
+
+  const int nThreads = getThreadNum(cmdOpts.threadNum);
+  cout
+    << "Writing friend trees to `" << cmdOpts.friendDirName << "` on "
+    << nThreads << " threads:" << endl;
+
+  FriendTreeStats total;
+  for (const auto& runConf : conf.runConfigs) {  // run loop
+    cout << "  " << runConf.runNumber << ":" << endl;
+
+    for (size_t iFile=0; iFile<runConf.fileList.size(); ++iFile) {  // file loop
+      const std::string& fileName = runConf.fileList.at(iFile);
+      const std::string friendFileName =
+        getFriendFileName(fileName, cmdOpts.friendDirName);
+
+      FriendTreeStats stats = writeFriendTree(
+        fileName, runConf.Theta.at(iFile), runConf,
+        recMatrixIndep, recMatrixDep, conf.xTarCorrIterNum,
+        friendFileName, cmdOpts.compression, nThreads
+      );
+      cout
+        << "    `" << friendFileName << "`: " << stats.nEvents << " events, "
+        << static_cast<double>(stats.nEvents)/stats.time << " events/s" << endl;
+      total.add(stats);
+    }  // file loop
+  }  // run loop
+
+  printFriendTreeStats(total);
+
+  return 0;
+}
+
+
+void printFriendTreeStats(const FriendTreeStats& stats) {
+  cout
+    << "Reconstructed " << stats.nEvents << " events in " << stats.time
+    << " s, " << static_cast<double>(stats.nEvents)/stats.time << " events/s."
+    << endl;
+  cout
+    << "Difference to hcana (P.gtr.*) of " << stats.xpTarDiff.n
+    << " events with a track, mean and RMS:" << endl
+    << "  xpTar " << stats.xpTarDiff.getMean() << " " << stats.xpTarDiff.getRMS() << endl
+    << "  ypTar " << stats.ypTarDiff.getMean() << " " << stats.ypTarDiff.getRMS() << endl
+    << "  yTar  " << stats.yTarDiff.getMean() << " " << stats.yTarDiff.getRMS() << " cm" << endl
+    << "  delta " << stats.deltaDiff.getMean() << " " << stats.deltaDiff.getRMS() << " %" << endl;
+}
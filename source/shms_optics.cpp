@@ -1,19 +1,25 @@
 // Standard includes.
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cmath>
+#include <cstdint>
+#include <exception>
 #include <fstream>
-#include <iomanip>
 #include <iostream>
+#include <memory>
+#include <mutex>
   using std::cin;
   using std::cout;
   using std::endl;
+#include <stdexcept>
 #include <thread>
 #include <utility>
 #include <vector>
 
 // ROOT includes.
+#include "Math/MinimizerOptions.h"
 #include "TCanvas.h"
-#include "TDecompSVD.h"
 #include "TDirectory.h"
 #include "TEllipse.h"
 #include "TFile.h"
@@ -23,6 +29,7 @@
 #include "TMarker.h"
 #include "TMatrixD.h"
 #include "TRint.h"
+#include "TROOT.h"
 #include "TString.h"
 #include "TStyle.h"
 #include "TSystem.h"
@@ -33,16 +40,184 @@
 // Project includes.
 #include "cmdOptions.hpp"
 #include "myConfig.hpp"
+#include "myCutDatabase.hpp"
 #include "myEvent.hpp"
+#include "myEventTree.hpp"
+#include "myFileCache.hpp"
+#include "myFit.hpp"
+#include "myFoilMixture.hpp"
 #include "myMath.hpp"
+#include "myOffsetFit.hpp"
 #include "myOther.hpp"
+#include "myPipeline.hpp"
+#include "myPrefetch.hpp"
 #include "myRecMatrix.hpp"
+#include "myReconstruct.hpp"
+#include "myResiduals.hpp"
+#include "mySelection.hpp"
+#include "myShard.hpp"
+#include "mySieveFit.hpp"
+#include "mySolve.hpp"
+#include "mySweep.hpp"
+
+
+//! Canvases for showing key plots, not created in batch mode.
+class Canvases {
+  public:
+    Canvases(bool batch);
+    ~Canvases();
+
+    bool isActive() const;
+
+    TCanvas* c1;
+    TCanvas* c2;
+    TCanvas* c3;
+
+    // Time spent drawing, in seconds.
+    double drawTime;
+    // Held while writing to the output file, which runs done in parallel
+    // share.
+    std::mutex outputMutex;
+};
+
+
+//! Adds time spent in its scope to the drawing time of canvases.
+class DrawTimer {
+  public:
+    DrawTimer(Canvases& canvases);
+    ~DrawTimer();
+
+  private:
+    Canvases& canvases;
+    std::chrono::steady_clock::time_point start;
+};
+
+
+//! Holds the output lock of canvases in its scope.
+class OutputLock {
+  public:
+    OutputLock(Canvases& canvases);
+    ~OutputLock();
+
+  private:
+    std::lock_guard<std::mutex> lock;
+};
+
+
+//! Diagnostic histograms of a single run.
+class RunHistograms {
+  public:
+    RunHistograms(const config::RunConfig& runConf, bool holeHists);
+    ~RunHistograms();
+
+    void write(Canvases& canvases);
+
+    TH2D* h2_xpTar;
+    TH2D* h2_ypTar;
+    TH2D* h2_yTar;
+    TH2D* h2_zVer;
+    TH2D* h2_yTarVypTar;
+    TH2F* h2_yTarVdelta;
+    TH2F* h2_yTarVdelta_cut;
+    TH2F* h2_fp;
+
+    // Filled while reconstructing, written when fitting the foils.
+    TH1D* h_zVer;
+    TH1D* h_yTar;
+
+    std::vector<TH2D*> h2_xSieveAng;
+    std::vector<TH2D*> h2_ySieveAng;
+
+    // Residuals for each foil and x or y hole.
+    std::vector<std::vector<ResidualStats> > xpTarXSieve;
+    std::vector<std::vector<ResidualStats> > ypTarYSieve;
+    std::vector<std::vector<ResidualStats> > yTarYSieve;
+
+    // 1D residual histograms for each foil and x or y hole, only booked on
+    // demand.
+    std::vector<std::vector<TH1F*> > h_xptar_xsieve;
+    std::vector<std::vector<TH1F*> > h_yptar_ysieve;
+    std::vector<std::vector<TH1F*> > h_ytar_ysieve;
+};
 
 
 int shms_optics(const cmdOptions::OptionParser_shmsOptics& cmdOpts);
+int sweep(
+  const config::Config& conf,
+  const RecMatrix& recMatrixIndep, const RecMatrix& recMatrixDep,
+  const cmdOptions::OptionParser_shmsOptics& cmdOpts
+);
+int optimizeOffsets(
+  const config::Config& conf,
+  const RecMatrix& recMatrixIndep, const RecMatrix& recMatrixDep,
+  const cmdOptions::OptionParser_shmsOptics& cmdOpts
+);
+
+void waitForUser(bool automatic);
+
+void processRun(
+  const config::Config& conf, std::size_t iRun, int iteration,
+  const cmdOptions::OptionParser_shmsOptics& cmdOpts,
+  bool findCuts, bool automatic, int nThreads,
+  const RecMatrix& recMatrixIndep, const RecMatrix& recMatrixDep,
+  const RecMatrix& recMatrixNew, RobustLoss robustLoss,
+  const CutDatabase& cutDatabase, std::uint64_t matrixHash,
+  Canvases& canvases, TDirectory* dir,
+  EventFileCache* fileCache,
+  EventPrefetcher* prefetcher, const config::RunConfig* nextRunConf,
+  std::vector<Event>& runEvents, RunCuts& cuts, RunResult& result
+);
+
+void reconstructEvents(
+  std::vector<Event>& events, EventPipeline* pipeline,
+  const config::RunConfig& runConf,
+  const RecMatrix& recMatrixIndep, const RecMatrix& recMatrixDep,
+  int xTarCorrIterNum, RunHistograms& hists,
+  const RunCuts* cuts, EventAssignment& assignment, bool showProgress
+);
+double getFoilYTar(const config::RunConfig& runConf, size_t iFoil);
+void findFoils(
+  const std::vector<Event>& events, const config::RunConfig& runConf,
+  bool mixture, bool automatic,
+  Canvases& canvases, RunHistograms& hists, RunCuts& cuts
+);
+void findRunCuts(
+  const std::vector<Event>& events, const config::RunConfig& runConf,
+  const cmdOptions::OptionParser_shmsOptics& cmdOpts,
+  bool automatic, int nThreads,
+  const RunCuts* savedCuts, const std::vector<bool>& findFoilHoles,
+  Canvases& canvases, RunHistograms& hists, RunCuts& cuts,
+  EventAssignment& assignment
+);
+void findSieveHoles(
+  const std::vector<Event>& events, const EventAssignment& assignment,
+  const config::RunConfig& runConf,
+  const cmdOptions::OptionParser_shmsOptics& cmdOpts,
+  bool automatic, int nThreads, const std::vector<bool>& fitFoils,
+  Canvases& canvases, RunHistograms& hists, RunCuts& cuts
+);
+TEllipse getHoleEllipse(
+  const Peak& xSievePeak, const Peak& ySievePeak, double correlation=0.0
+);
+void fillFit(
+  const std::vector<Event>& events, const EventAssignment& assignment,
+  const config::Config& conf,
+  const config::RunConfig& runConf, const RunCuts& cuts,
+  const RecMatrix& recMatrixNew, const RecMatrix& recMatrixDep,
+  RunHistograms& hists, std::vector<ResidualSummary>& summaries,
+  FitAccumulator& fitAcc, DesignCache* designCache,
+  std::vector<FitAccumulator>* holeBlocks, bool blockPerHole,
+  std::vector<EventTreeRow>* treeRows, bool showProgress
+);
+void writeResidualGraphs(
+  const config::RunConfig& runConf, Canvases& canvases, RunHistograms& hists
+);
+void printFileCacheStats(const EventFileCache& fileCache);
 
 
 int main(int argc, char* argv[]) {
+  auto programStart = std::chrono::steady_clock::now();
+
   // Parse command line options for shms_optics.
   cmdOptions::OptionParser_shmsOptics cmdOpts;
   try {
@@ -58,19 +233,44 @@ int main(int argc, char* argv[]) {
     return 0;
   }
 
-  // Create command line options for ROOT.
-  int argcRoot = 3;
-  static char argvRoot[][100] = {"-q", "-l"};
-  static char* argvRootList[] = {argv[0], argvRoot[0], argvRoot[1], NULL};
+  if (
+    cmdOpts.batch || cmdOpts.holeFit2D || cmdOpts.holeGrid ||
+    cmdOpts.prefetchMB > 0 || cmdOpts.pipeline ||
+    !cmdOpts.eventTreeFileName.empty()
+  ) {
+    // Sieve holes are fitted and files are read ahead from several
+    // threads, which needs thread safe ROOT and minimiser.
+    ROOT::EnableThreadSafety();
+    ROOT::Math::MinimizerOptions::SetDefaultMinimizer("Minuit2");
+  }
+  TRint *theApp = NULL;
+  if (cmdOpts.batch) {
+    // No interactive ROOT and no graphics at all.
+    gROOT->SetBatch(kTRUE);
+  }
+  else {
+    // Create command line options for ROOT.
+    int argcRoot = 3;
+    static char argvRoot[][100] = {"-q", "-l"};
+    static char* argvRootList[] = {argv[0], argvRoot[0], argvRoot[1], NULL};
+
+    theApp = new TRint("app", &argcRoot, argvRootList);
+  }
+  std::chrono::duration<double> startupTime =
+    std::chrono::steady_clock::now() - programStart;
+  cout << "Startup took " << startupTime.count() << " s." << endl;
 
   // Run shms_optics as an application.
-  TRint *theApp = new TRint("app", &argcRoot, argvRootList);
   int retCode = shms_optics(cmdOpts);
-  theApp->Run(kTRUE);
+  if (theApp) theApp->Run(kTRUE);
 
   // Cleanup and exit.
   delete theApp;
 
+  std::chrono::duration<double> totalTime =
+    std::chrono::steady_clock::now() - programStart;
+  cout << "Total time " << totalTime.count() << " s." << endl;
+
   return retCode;
 }
 
@@ -84,979 +284,1744 @@ int shms_optics(const cmdOptions::OptionParser_shmsOptics& cmdOpts) {
     << "Reading config file:" << endl
     << "  `" << cmdOpts.configFileName << "`" << endl;
   config::Config conf = config::loadConfigFile(cmdOpts.configFileName);
+  RobustLoss robustLoss = parseRobustLoss(cmdOpts.robustLoss);
 
-  std::string recMatrixDepFileName = conf.recMatrixFileNameOld;
-  recMatrixDepFileName.insert(
-    conf.recMatrixFileNameOld.size()-4, "__dep"
-  );
-  std::string recMatrixIndepFileName = conf.recMatrixFileNameOld;
-  recMatrixIndepFileName.insert(
-    conf.recMatrixFileNameOld.size()-4, "__indep"
-  );
-  cout
-    << "Reading xTar dependent matrix file:" << endl
-    << "  `" << recMatrixDepFileName << "`" << endl;
-  RecMatrix recMatrixDep = readMatrixFile(recMatrixDepFileName);
-  cout
-    << "Reading xTar independent matrix file:" << endl
-    << "  `" << recMatrixIndepFileName << "`" << endl;
-  RecMatrix recMatrixIndep = readMatrixFile(recMatrixIndepFileName);
-
-
-  cout << "Initializing new xTar independent matrix." << endl;
-  // Copy header and delta elements from old matrix.
-  // Initialize other elements to 0.
-  RecMatrix recMatrixNew;
-  recMatrixNew.header = recMatrixIndep.header;
-  double C_D;
-  std::vector<RecMatrixLine>::iterator lineIt;
-  // Construct order by order.
-  // Only include xTar independent terms.
-  for (int order=0; order<=conf.fitOrder; ++order) {
-    for (int l=0; l<=order; ++l) {
-      for (int k=0; k<=order-l; ++k) {
-        for (int j=0; j<=order-l-k; ++j) {
-          for (int i=0; i<=order-l-k-j; ++i) {
-            if (i+j+k+l != order) continue;
-
-            lineIt = recMatrixIndep.findLine(i, j, k, l, 0);
-            if (lineIt != recMatrixIndep.end()) C_D = lineIt->C_D;
-            else C_D = 0.0;
-
-            recMatrixNew.addLine(
-              0.0, 0.0, 0.0, C_D,
-              i, j, k, l, 0
-            );
+  RecMatrix recMatrixIndep, recMatrixDep;
+  readMatrices(conf.recMatrixFileNameOld, recMatrixIndep, recMatrixDep);
+
+  if (!cmdOpts.sweepFileName.empty()) {
+    return sweep(conf, recMatrixIndep, recMatrixDep, cmdOpts);
+  }
+  if (cmdOpts.fitOffsets) {
+    return optimizeOffsets(conf, recMatrixIndep, recMatrixDep, cmdOpts);
+  }
+
+  RecMatrix recMatrixNew = getNewRecMatrix(recMatrixIndep, conf.fitOrder);
+  int recMatrixNewLen = static_cast<int>(recMatrixNew.size());
+
+  const bool useCutDatabase = !cmdOpts.cutsDbFileName.empty();
+  CutDatabase cutDatabase;
+  if (useCutDatabase) {
+    cout
+      << "Reading cut database:" << endl
+      << "  `" << cmdOpts.cutsDbFileName << "`" << endl;
+    cutDatabase = loadCutDatabase(cmdOpts.cutsDbFileName);
+    cout << "  " << cutDatabase.records.size() << " saved cuts" << endl;
+  }
+
+
+  // A shard writes its own output files and leaves the solve to
+  // shms_optics_merge.
+  const bool sharded = (cmdOpts.shardNum > 0);
+  std::string rootFileName = cmdOpts.rootFileName;
+  std::string cutsDbFileName = cmdOpts.cutsDbFileName;
+  std::string shardFileName;
+  std::ofstream shardFile;
+  if (sharded) {
+    rootFileName = getShardFileName(
+      cmdOpts.rootFileName, cmdOpts.shardIndex, cmdOpts.shardNum
+    );
+    shardFileName = getShardFileName(
+      cmdOpts.rootFileName, cmdOpts.shardIndex, cmdOpts.shardNum, ".fit"
+    );
+    if (useCutDatabase) {
+      cutsDbFileName = getShardFileName(
+        cmdOpts.cutsDbFileName, cmdOpts.shardIndex, cmdOpts.shardNum
+      );
+    }
+  }
+
+  // Prepare for analysis.
+  TFile fo(rootFileName.c_str(), "RECREATE");
+  TDirectory* dir;
+
+  Canvases canvases(cmdOpts.batch);
+
+  const std::size_t nRuns = conf.runConfigs.size();
+  const int iterationNum = cmdOpts.iterationNum;
+
+  std::vector<std::size_t> shardRuns;
+  for (std::size_t iRun=0; iRun<nRuns; ++iRun) {
+    if (isShardRun(iRun, cmdOpts.shardIndex, cmdOpts.shardNum)) {
+      shardRuns.push_back(iRun);
+    }
+  }
+  if (sharded) {
+    cout
+      << "Shard " << cmdOpts.shardIndex << " of " << cmdOpts.shardNum << ": "
+      << shardRuns.size() << " of " << nRuns << " runs" << endl;
+
+    shardFile.open(shardFileName, std::ios::binary);
+    if (!shardFile.is_open()) {
+      throw std::runtime_error("Could not open file: `"+shardFileName+"`!");
+    }
+    ShardHeader header;
+    header.shardIndex = cmdOpts.shardIndex;
+    header.shardNum = cmdOpts.shardNum;
+    header.nRuns = nRuns;
+    header.nTerms = recMatrixNewLen;
+    header.matrixHash = getMatrixHash(recMatrixIndep, recMatrixDep, conf.xTarCorrIterNum);
+    header.robustLoss = cmdOpts.robustLoss;
+    if (cmdOpts.bootstrapNum > 0) header.blockUnit = cmdOpts.bootstrapUnit;
+    writeShardHeader(shardFile, header);
+  }
+
+  // Events and cuts of each run, kept in memory between iterations.
+  std::vector<std::vector<Event> > runEventss(nRuns);
+  std::vector<RunCuts> runCutss(nRuns);
+
+  // Runs done in parallel share the inner fit threads.
+  const int runJobNum = cmdOpts.runJobNum;
+  const int runThreadNum = std::max(1, getThreadNum(cmdOpts.threadNum)/runJobNum);
+  // Histograms of parallel runs must not be added to the shared directories.
+  if (runJobNum > 1) TH1::AddDirectory(kFALSE);
+
+  // Input files used by several runs are read once.
+  std::unique_ptr<EventFileCache> fileCache;
+  if (cmdOpts.fileCache) {
+    fileCache.reset(new EventFileCache());
+    for (const std::size_t iRun : shardRuns) {
+      fileCache->addRun(conf.runConfigs.at(iRun));
+    }
+  }
+
+  // Runs done one by one read the next run in the background.
+  std::unique_ptr<EventPrefetcher> prefetcher;
+  if (cmdOpts.prefetchMB > 0 && runJobNum == 1) {
+    prefetcher.reset(new EventPrefetcher(
+      static_cast<std::size_t>(cmdOpts.prefetchMB) * 1024 * 1024,
+      fileCache.get()
+    ));
+  }
+
+  // Selected events are written to the diagnostic tree while the next
+  // runs are processed.
+  std::unique_ptr<EventTreeWriter> treeWriter;
+  std::string eventTreeFileName = cmdOpts.eventTreeFileName;
+  if (!eventTreeFileName.empty()) {
+    if (sharded) {
+      eventTreeFileName = getShardFileName(
+        eventTreeFileName, cmdOpts.shardIndex, cmdOpts.shardNum
+      );
+    }
+    treeWriter.reset(new EventTreeWriter(
+      eventTreeFileName, cmdOpts.treeCompression, cmdOpts.treeBasketSize
+    ));
+  }
+
+  std::ofstream residualsFile;
+  if (!sharded) {
+    residualsFile.open("residuals.txt");
+    writeResidualSummaryHeader(residualsFile);
+  }
+
+  for (int iteration=1; iteration<=iterationNum; ++iteration) {  // iteration loop
+    if (iterationNum > 1) {
+      cout << "Iteration " << iteration << " of " << iterationNum << ":" << endl;
+    }
+
+    // Cuts are found (and checked by the user) in the first iteration only,
+    // unless asked to find them again.
+    const bool findCuts = (iteration == 1 || cmdOpts.refreshCuts);
+    const bool automatic = (cmdOpts.automatic || iteration > 1);
+    const std::uint64_t matrixHash =
+      getMatrixHash(recMatrixIndep, recMatrixDep, conf.xTarCorrIterNum);
+
+    FitAccumulator fitAcc(recMatrixNewLen);
+    // Only needed for robust refit.
+    DesignCache designCache(recMatrixNewLen);
+    // Normal equations of each sieve hole, only needed for bootstrap.
+    std::vector<FitAccumulator> holeBlocks;
+    std::vector<std::size_t> blockRuns;
+
+    cout << "Reading and analyzing root files:" << endl;
+    // Directories of all runs are created first, in run order.
+    fo.cd();
+    if (iterationNum > 1) {
+      fo.mkdir(
+        TString::Format("iter_%d", iteration),
+        TString::Format("histograms for iteration %d", iteration)
+      );
+      fo.cd(TString::Format("iter_%d", iteration));
+    }
+    std::vector<TDirectory*> runDirs(nRuns, NULL);
+    dir = gDirectory;
+    for (const std::size_t iRun : shardRuns) {
+      runDirs.at(iRun) = dir->mkdir(
+        TString::Format("run_%d", conf.runConfigs.at(iRun).runNumber),
+        TString::Format("histograms for run %d", conf.runConfigs.at(iRun).runNumber)
+      );
+    }
+
+    // Results are merged in run order, so that they do not depend on the
+    // order in which runs are done.
+    std::vector<std::unique_ptr<RunResult> > results(nRuns);
+    auto doRun = [&](std::size_t iRun, const config::RunConfig* nextRunConf) {
+      results.at(iRun).reset(new RunResult(recMatrixNewLen));
+      processRun(
+        conf, iRun, iteration, cmdOpts, findCuts, automatic, runThreadNum,
+        recMatrixIndep, recMatrixDep, recMatrixNew, robustLoss,
+        cutDatabase, matrixHash, canvases, runDirs.at(iRun),
+        fileCache.get(), (iteration == 1) ? prefetcher.get() : NULL, nextRunConf,
+        runEventss.at(iRun), runCutss.at(iRun), *results.at(iRun)
+      );
+    };
+    auto mergeRun = [&](std::size_t iRun) {
+      const config::RunConfig& runConf = conf.runConfigs.at(iRun);
+      RunResult& result = *results.at(iRun);
+
+      if (sharded) {
+        writeShardRun(shardFile, iRun, result);
+        shardFile.flush();
+      }
+      else {
+        mergeRunResult(result, iRun, fitAcc, designCache, holeBlocks, blockRuns);
+
+        for (std::size_t iFoil=0; iFoil<result.summaries.size(); ++iFoil) {
+          writeResidualSummary(
+            residualsFile, iteration, runConf.runNumber,
+            static_cast<int>(iFoil), result.summaries.at(iFoil)
+          );
+        }
+        residualsFile.flush();
+      }
+
+      if (treeWriter && !result.treeRows.empty()) {
+        treeWriter->push(result.treeRows);
+      }
+
+      if (result.newCuts && useCutDatabase) {
+        cutDatabase.store(
+          runConf.runNumber, result.configHash, matrixHash, runCutss.at(iRun)
+        );
+        writeCutDatabase(cutsDbFileName, cutDatabase);
+      }
+
+      results.at(iRun).reset();
+    };
+
+    if (runJobNum > 1) {
+      // Runs are taken by the next free thread, the largest first.
+      std::vector<std::size_t> runOrder = shardRuns;
+      std::stable_sort(
+        runOrder.begin(), runOrder.end(),
+        [&](std::size_t iRun1, std::size_t iRun2) {
+          return
+            conf.runConfigs.at(iRun1).fileList.size() >
+            conf.runConfigs.at(iRun2).fileList.size();
+        }
+      );
+
+      std::atomic<std::size_t> nextRun(0);
+      std::vector<std::exception_ptr> errors(nRuns);
+      auto work = [&]() {
+        std::size_t iNext;
+        while ((iNext = nextRun++) < runOrder.size()) {
+          const std::size_t iRun = runOrder.at(iNext);
+          try {
+            doRun(iRun, NULL);
+          }
+          catch (...) {
+            errors.at(iRun) = std::current_exception();
           }
         }
+      };
+      std::vector<std::thread> threads;
+      for (int iThread=0; iThread<runJobNum; ++iThread) {
+        threads.push_back(std::thread(work));
+      }
+      for (auto& thread : threads) thread.join();
+
+      for (const std::size_t iRun : shardRuns) {
+        if (errors.at(iRun)) std::rethrow_exception(errors.at(iRun));
+        mergeRun(iRun);
+      }
+    }
+    else {
+      for (std::size_t iShardRun=0; iShardRun<shardRuns.size(); ++iShardRun) {  // run loop
+        const std::size_t iRun = shardRuns.at(iShardRun);
+        doRun(
+          iRun, (iShardRun+1 < shardRuns.size()) ?
+            &conf.runConfigs.at(shardRuns.at(iShardRun+1)) : NULL
+        );
+        mergeRun(iRun);
+      }  // run loop
+    }
+
+    // The fit of a shard is solved when merging all shards.
+    if (sharded) continue;
+
+    solveFit(
+      fitAcc, designCache, cmdOpts.robustLoss, cmdOpts.robustIterNum,
+      recMatrixNew
+    );
+
+    // The fitted matrix is saved before the bootstrap, which may fail.
+    if (iteration == iterationNum) {
+      residualsFile.close();
+
+      writeMatrices(conf.recMatrixFileNameNew, "", recMatrixNew, recMatrixDep);
+
+      if (cmdOpts.bootstrapNum > 0) {
+        bootstrap(
+          holeBlocks, blockRuns, nRuns,
+          cmdOpts.bootstrapNum, cmdOpts.bootstrapUnit,
+          getThreadNum(cmdOpts.threadNum),
+          conf.recMatrixFileNameNew, recMatrixNew
+        );
+      }
+    }
+
+    if (iteration < iterationNum) {
+      writeMatrices(
+        conf.recMatrixFileNameNew,
+        std::string(TString::Format("_iter%d", iteration).Data()),
+        recMatrixNew, recMatrixDep
+      );
+
+      // Reconstruct with the new matrix in the next iteration. Its 0000 terms
+      // already include the angular offsets.
+      recMatrixIndep = recMatrixNew;
+      for (auto& runConf : conf.runConfigs) {
+        runConf.SHMS.thetaOffset = 0.0;
+        runConf.SHMS.phiOffset = 0.0;
       }
     }
+  }  // iteration loop
+
+  if (treeWriter) {
+    treeWriter->finish();
+    cout
+      << "Saved " << treeWriter->nRows << " selected events to tree `T` in:" << endl
+      << "  `" << eventTreeFileName << "`, written in "
+      << treeWriter->writeTime << " s" << endl;
+  }
+
+  if (fileCache) printFileCacheStats(*fileCache);
+  if (prefetcher) {
+    const double overlap = prefetcher->readTime - prefetcher->waitTime;
+    cout
+      << "Prefetched " << prefetcher->nPrefetched << " runs ("
+      << prefetcher->nSkipped << " over the memory cap): read for "
+      << prefetcher->readTime << " s in the background, waited "
+      << prefetcher->waitTime << " s, " << overlap << " s overlapped";
+    if (prefetcher->readTime > 0.0) {
+      cout << " (" << 100.0*overlap/prefetcher->readTime << "%)";
+    }
+    cout << "." << endl;
   }
-  int recMatrixNewLen = static_cast<int>(recMatrixNew.size());
-  cout << "  " << recMatrixNewLen << " xTar independent terms" << endl;
 
+  if (sharded) {
+    shardFile.close();
+    cout
+      << "Saved partial fit of shard " << cmdOpts.shardIndex << " to:" << endl
+      << "  `" << shardFileName << "`" << endl;
+  }
 
-  // Prepare for analysis.
-  char tmp;
+  if (canvases.isActive()) {
+    cout
+      << "Time spent drawing: " << canvases.drawTime << " s," << endl
+      << "  saved together with the interactive ROOT startup by `--batch`."
+      << endl;
+  }
 
-  TFile fo(cmdOpts.rootFileName.c_str(), "RECREATE");
-  TDirectory* dir;
+  return 0;
+}
 
-  TMatrixD xpTarFitMat(recMatrixNewLen, recMatrixNewLen);
-  TMatrixD yTarFitMat(recMatrixNewLen, recMatrixNewLen);
-  TMatrixD ypTarFitMat(recMatrixNewLen, recMatrixNewLen);
-  TVectorD xpTarFitVec(recMatrixNewLen);
-  TVectorD yTarFitVec(recMatrixNewLen);
-  TVectorD ypTarFitVec(recMatrixNewLen);
 
-  TCanvas* c1 = new TCanvas("c1", "c1", 100, 100, 600, 400);
-  TCanvas* c2 = new TCanvas("c2", "c2", 100, 540, 600, 400);
-  TCanvas* c3 = new TCanvas("c3", "c3", 702, 100, 600, 400);
-  gPad->Update();
+int sweep(
+  const config::Config& conf,
+  const RecMatrix& recMatrixIndep, const RecMatrix& recMatrixDep,
+  const cmdOptions::OptionParser_shmsOptics& cmdOpts
+) {
+  cout
+    << "Reading sweep file:" << endl
+    << "  `" << cmdOpts.sweepFileName << "`" << endl;
+  std::vector<OffsetShifts> points = loadSweepFile(cmdOpts.sweepFileName);
+  const int nThreads = getThreadNum(cmdOpts.threadNum);
+  cout
+    << "  " << points.size() << " points on " << nThreads << " threads"
+    << endl;
 
- 
+  std::vector<SweepMetrics> metricss(points.size());
 
-  //make 1D histos for each x and y holes:
-  TH1F *h_ytar_ysieve[3][12];
-  TH1F *h_yptar_ysieve[3][12];
-  TH1F *h_xptar_xsieve[3][12];
+  std::unique_ptr<EventFileCache> fileCache;
+  if (cmdOpts.fileCache) {
+    fileCache.reset(new EventFileCache());
+    for (const auto& runConf : conf.runConfigs) fileCache->addRun(runConf);
+  }
 
-  cout << "Reading and analyzing root files:" << endl;
+  cout << "Reading and sweeping root files:" << endl;
   for (const auto& runConf : conf.runConfigs) {  // run loop
     cout << "  " << runConf.runNumber << ":" << endl;
 
-    //make 2D plots for xpTar and ypTar
-    TH2D *h2_xpTar = new TH2D("h2_xpTar",";xpTar_{real};xpTar_{measured} - xpTar_{real}",200,0.0,0.06,200,-0.01,0.01);
-    TH2D *h2_ypTar = new TH2D("h2_ypTar",";ypTar_{real};ypTar_{measured} - ypTar_{real}",200,0.0,0.06,200,-0.01,0.01);
-    TH2D *h2_yTar = new TH2D("h2_yTar",";yTar_{real};yTar_{measured} - yTar_{real}",200,-6.0,6.0,200,-3.0,3.0);
-    TH2D *h2_zVer = new TH2D("h2_zVer",";zVer_{real};zVer_{measured} - zVer_{real}",200,-12.0,12.0,200,-5.0,5.0);
-    TH2D *h2_yTarVypTar = new TH2D("h2_yTarVypTar",";yTar [cm]; ypTar",200,-4,4,200,-0.05,0.05);
-    TH2F *h2_yTarVdelta = new TH2F("h2_yTarVdelta",";yTar measured [cm];delta",200,-6.0,6.0,200,-15,20);
-    TH2F *h2_yTarVdelta_cut = new TH2F("h2_yTarVdelta_cut","With cuts;yTar measured [cm];delta",200,-6.0,6.0,200,-15,20);
-    TH2F *h2_fp = new TH2F("h2_fp",";xfp [cm]; yfp [cm]",200,0,8,200,-15,15);
+    std::vector<Event> events = readEvents(runConf, fileCache.get());
+    cout << "    " << events.size() << " events survived cuts." << endl;
 
-    const size_t nFoils = runConf.zFoils.size();
+    // Matrix sums do not depend on the offsets, calculate them only once.
+    auto start = std::chrono::steady_clock::now();
+    std::vector<MatrixSums> sumss;
+    sumss.reserve(events.size());
+    for (const auto& event : events) {
+      sumss.push_back(MatrixSums(event, recMatrixIndep, recMatrixDep));
+    }
 
-    std::vector<double> xSievePhys = runConf.getSieveHolesX();
-    std::vector<double> ySievePhys = runConf.getSieveHolesY();
+    sweepRun(
+      events, sumss, runConf, conf.xTarCorrIterNum, points, nThreads, metricss
+    );
+    std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+    cout << "    swept in " << elapsed.count() << " s" << endl;
+  }  // run loop
+  if (fileCache) printFileCacheStats(*fileCache);
 
-    //make plots for sieve holes:
-    const size_t ixSieve = runConf.sieve.nRow;
-    const size_t iySieve = runConf.sieve.nCol;
+  cout << "Saving sweep table to:" << endl << "  `sweep.txt`" << endl;
+  std::ofstream ofs("sweep.txt");
+  writeSweepTable(ofs, points, metricss);
+  ofs.close();
 
-    for (uint iif=0; iif<nFoils; iif++){
-      for (uint ii=0; ii<ixSieve; ii++){
-	h_xptar_xsieve[iif][ii] = new TH1F(Form("h_xptar_xsieve_%d_%d",iif,ii),Form("xptar residual foil %d, hole %d",iif, ii),200,-0.009,0.009);
-      }
-      for (uint ii=0; ii<iySieve; ii++){
-	h_yptar_ysieve[iif][ii] = new TH1F(Form("h_yptar_ysieve_%d_%d",iif,ii),Form("yptar residual foil %d, hole %d",iif, ii),200,-0.009,0.009);
-	h_ytar_ysieve[iif][ii] = new TH1F(Form("h_ytar_ysieve_%d_%d",iif,ii),Form("ytar residual foil %d, hole %d",iif, ii),200,-0.01,0.01);
-      }      
+  return 0;
+}
+
+
+int optimizeOffsets(
+  const config::Config& conf,
+  const RecMatrix& recMatrixIndep, const RecMatrix& recMatrixDep,
+  const cmdOptions::OptionParser_shmsOptics& cmdOpts
+) {
+  const int nThreads = getThreadNum(cmdOpts.threadNum);
+
+  std::unique_ptr<EventFileCache> fileCache;
+  if (cmdOpts.fileCache) {
+    fileCache.reset(new EventFileCache());
+    for (const auto& runConf : conf.runConfigs) fileCache->addRun(runConf);
+  }
+
+  cout << "Reading and caching root files:" << endl;
+  std::vector<OffsetFitRun> runs;
+  runs.reserve(conf.runConfigs.size());
+  for (const auto& runConf : conf.runConfigs) {  // run loop
+    cout << "  " << runConf.runNumber << ":" << endl;
+
+    std::vector<Event> events = readEvents(runConf, fileCache.get());
+    cout << "    " << events.size() << " events survived cuts." << endl;
+    runs.emplace_back(runConf, events, recMatrixIndep, recMatrixDep);
+  }  // run loop
+  if (fileCache) printFileCacheStats(*fileCache);
+
+  cout << "Fitting offsets on " << nThreads << " threads:" << endl;
+  auto start = std::chrono::steady_clock::now();
+  OffsetShifts shifts = fitOffsets(
+    runs, OffsetShifts(), conf.xTarCorrIterNum, nThreads, 3
+  );
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+  cout << "  done in " << elapsed.count() << " s" << endl;
+
+  const config::RunConfig& firstConf = conf.runConfigs.front();
+  cout
+    << "Fitted offsets:" << endl
+    << "  htheta_offset " << firstConf.SHMS.thetaOffset + shifts.thetaOffset
+    << "  (shift " << shifts.thetaOffset << ")" << endl
+    << "  hphi_offset " << firstConf.SHMS.phiOffset + shifts.phiOffset
+    << "  (shift " << shifts.phiOffset << ")" << endl
+    << "  mispointing shift " << shifts.xMispointing << " "
+    << shifts.yMispointing << " cm, per run:" << endl;
+  for (const auto& runConf : conf.runConfigs) {
+    cout
+      << "    " << runConf.runNumber << ": mispointing "
+      << runConf.SHMS.xMispointing + shifts.xMispointing << " "
+      << runConf.SHMS.yMispointing + shifts.yMispointing << endl;
+  }
+
+  return 0;
+}
+
+
+// Canvases implementation.
+
+Canvases::Canvases(bool batch) :
+  c1(batch ? NULL : new TCanvas("c1", "c1", 100, 100, 600, 400)),
+  c2(batch ? NULL : new TCanvas("c2", "c2", 100, 540, 600, 400)),
+  c3(batch ? NULL : new TCanvas("c3", "c3", 702, 100, 600, 400)),
+  drawTime(0.0), outputMutex()
+{
+  if (isActive()) gPad->Update();
+}
+
+
+Canvases::~Canvases() {
+  delete c3;
+  delete c2;
+  delete c1;
+}
+
+
+bool Canvases::isActive() const {
+  return c1 != NULL;
+}
+
+
+// DrawTimer implementation.
+
+DrawTimer::DrawTimer(Canvases& canvases) :
+  canvases(canvases), start(std::chrono::steady_clock::now())
+{}
+
+
+DrawTimer::~DrawTimer() {
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+  canvases.drawTime += elapsed.count();
+}
+
+
+// OutputLock implementation.
+
+OutputLock::OutputLock(Canvases& canvases) :
+  lock(canvases.outputMutex)
+{}
+
+
+OutputLock::~OutputLock() {}
+
+
+// RunHistograms implementation.
+
+RunHistograms::RunHistograms(const config::RunConfig& runConf, bool holeHists) :
+  //make 2D plots for xpTar and ypTar
+  h2_xpTar(new TH2D("h2_xpTar",";xpTar_{real};xpTar_{measured} - xpTar_{real}",200,0.0,0.06,200,-0.01,0.01)),
+  h2_ypTar(new TH2D("h2_ypTar",";ypTar_{real};ypTar_{measured} - ypTar_{real}",200,0.0,0.06,200,-0.01,0.01)),
+  h2_yTar(new TH2D("h2_yTar",";yTar_{real};yTar_{measured} - yTar_{real}",200,-6.0,6.0,200,-3.0,3.0)),
+  h2_zVer(new TH2D("h2_zVer",";zVer_{real};zVer_{measured} - zVer_{real}",200,-12.0,12.0,200,-5.0,5.0)),
+  h2_yTarVypTar(new TH2D("h2_yTarVypTar",";yTar [cm]; ypTar",200,-4,4,200,-0.05,0.05)),
+  h2_yTarVdelta(new TH2F("h2_yTarVdelta",";yTar measured [cm];delta",200,-6.0,6.0,200,-15,20)),
+  h2_yTarVdelta_cut(new TH2F("h2_yTarVdelta_cut","With cuts;yTar measured [cm];delta",200,-6.0,6.0,200,-15,20)),
+  h2_fp(new TH2F("h2_fp",";xfp [cm]; yfp [cm]",200,0,8,200,-15,15)),
+  h_zVer(NULL), h_yTar(NULL),
+  h2_xSieveAng(), h2_ySieveAng(),
+  xpTarXSieve(), ypTarYSieve(), yTarYSieve(),
+  h_xptar_xsieve(), h_yptar_ysieve(), h_ytar_ysieve()
+{
+  const size_t nFoils = runConf.zFoils.size();
+
+  // Histograms for finding the foils.
+  double minx = runConf.zFoils.front() - 5.0;
+  double maxx = runConf.zFoils.back() + 5.0;
+  int binsx = 10 * static_cast<int>(maxx-minx);
+  h_zVer = new TH1D(
+    TString::Format("zVer"),
+    TString::Format("zVer for run %d", runConf.runNumber),
+    binsx, minx, maxx
+  );
+  h_zVer->GetXaxis()->SetTitle("z_{vertex}  [cm]");
+
+  minx *= runConf.SHMS.sinTheta;
+  maxx *= runConf.SHMS.sinTheta;
+  h_yTar = new TH1D(
+    TString::Format("yTar"),
+    TString::Format("yTar for run %d", runConf.runNumber),
+    binsx, minx, maxx
+  );
+  h_yTar->GetXaxis()->SetTitle("y_{target}  [cm]");
+
+  //make plots for sieve holes:
+  const size_t ixSieve = runConf.sieve.nRow;
+  const size_t iySieve = runConf.sieve.nCol;
+
+  xpTarXSieve.assign(nFoils, std::vector<ResidualStats>(ixSieve));
+  ypTarYSieve.assign(nFoils, std::vector<ResidualStats>(iySieve));
+  yTarYSieve.assign(nFoils, std::vector<ResidualStats>(iySieve));
+
+  if (holeHists) {
+    h_xptar_xsieve.resize(nFoils);
+    h_yptar_ysieve.resize(nFoils);
+    h_ytar_ysieve.resize(nFoils);
+  }
+  for (uint iif=0; iif<h_xptar_xsieve.size(); iif++){
+    for (uint ii=0; ii<ixSieve; ii++){
+      h_xptar_xsieve[iif].push_back(new TH1F(Form("h_xptar_xsieve_%d_%d",iif,ii),Form("xptar residual foil %d, hole %d",iif, ii),200,-0.009,0.009));
     }
-    
+    for (uint ii=0; ii<iySieve; ii++){
+      h_yptar_ysieve[iif].push_back(new TH1F(Form("h_yptar_ysieve_%d_%d",iif,ii),Form("yptar residual foil %d, hole %d",iif, ii),200,-0.009,0.009));
+      h_ytar_ysieve[iif].push_back(new TH1F(Form("h_ytar_ysieve_%d_%d",iif,ii),Form("ytar residual foil %d, hole %d",iif, ii),200,-0.01,0.01));
+    }
+  }
 
-    // Reading events from input ROOT files.
-    //cout<<"Made it this far!"<<endl;
-    std::vector<Event> events = readEvents(runConf);
-    //cout<<"Got lost reading events"<<endl;
-    size_t nEvents = events.size();
-    cout << "    " << nEvents << " events survived cuts." << endl;
+  for (size_t iFoil=0; iFoil<nFoils; ++iFoil) {
+    h2_xSieveAng.push_back(new TH2D(Form("h2_xSieveAng_%d",static_cast<int>(iFoil)),Form("Run %d Foil %d;xSieve_{real};ypTar_{measured} - ypTar_{real}",runConf.runNumber, static_cast<int>(iFoil)),200,-12.0,12.0,200,-0.02,0.02));
+    h2_ySieveAng.push_back(new TH2D(Form("h2_ySieveAng_%d",static_cast<int>(iFoil)),Form("Run %d Foil %d;ySieve_{real};xptar_{measured} - xpTar_{real}",runConf.runNumber,static_cast<int>(iFoil)),200,-7.0,7.0,200,-0.02,0.02));
+  }
+}
 
-    fo.cd();
-    // Create directory in output ROOT file for histograms.
-    dir = fo.mkdir(
-      TString::Format("run_%d", runConf.runNumber),
-      TString::Format("histograms for run %d", runConf.runNumber)
+
+RunHistograms::~RunHistograms() {
+  for (auto& hists : h_ytar_ysieve) for (auto& hist : hists) delete hist;
+  for (auto& hists : h_yptar_ysieve) for (auto& hist : hists) delete hist;
+  for (auto& hists : h_xptar_xsieve) for (auto& hist : hists) delete hist;
+  for (auto& hist : h2_ySieveAng) delete hist;
+  for (auto& hist : h2_xSieveAng) delete hist;
+
+  delete h_yTar;
+  delete h_zVer;
+  delete h2_fp;
+  delete h2_yTarVdelta_cut;
+  delete h2_yTarVdelta;
+  delete h2_yTarVypTar;
+  delete h2_zVer;
+  delete h2_yTar;
+  delete h2_ypTar;
+  delete h2_xpTar;
+}
+
+
+void RunHistograms::write(Canvases& canvases) {
+  if (canvases.isActive()) {
+    DrawTimer timer(canvases);
+    h2_xpTar->Draw();
+    h2_ypTar->Draw();
+    h2_yTar->Draw();
+    h2_zVer->Draw();
+    h2_yTarVypTar->Draw();
+    h2_yTarVdelta->Draw();
+    h2_yTarVdelta_cut->Draw();
+    h2_fp->Draw();
+  }
+
+  OutputLock lock(canvases);
+  h2_xpTar->Write();
+  h2_ypTar->Write();
+  h2_yTar->Write();
+  h2_zVer->Write();
+  h2_yTarVypTar->Write();
+  h2_yTarVdelta->Write();
+  h2_yTarVdelta_cut->Write();
+  h2_fp->Write();
+}
+
+
+// Implementation of analysis steps.
+
+void waitForUser(bool automatic) {
+  char tmp;
+
+  if (automatic) {
+    //      std::this_thread::sleep_for(std::chrono::milliseconds(cmdOpts.delay));
+  }
+  else {
+    cout << "    Continue? ";
+    cin >> tmp;
+  }
+}
+
+
+// Read (or take from runEvents), select and accumulate the events of run
+// iRun into result. Writes to the output file only in dir. With a
+// prefetcher, the events may have been read already, and the events of
+// nextRunConf are read while this run is processed.
+void processRun(
+  const config::Config& conf, std::size_t iRun, int iteration,
+  const cmdOptions::OptionParser_shmsOptics& cmdOpts,
+  bool findCuts, bool automatic, int nThreads,
+  const RecMatrix& recMatrixIndep, const RecMatrix& recMatrixDep,
+  const RecMatrix& recMatrixNew, RobustLoss robustLoss,
+  const CutDatabase& cutDatabase, std::uint64_t matrixHash,
+  Canvases& canvases, TDirectory* dir,
+  EventFileCache* fileCache,
+  EventPrefetcher* prefetcher, const config::RunConfig* nextRunConf,
+  std::vector<Event>& runEvents, RunCuts& cuts, RunResult& result
+) {
+  const config::RunConfig& runConf = conf.runConfigs.at(iRun);
+  cout << "  " << runConf.runNumber << ":" << endl;
+  const bool useCutDatabase = !cmdOpts.cutsDbFileName.empty();
+  // Only one run shows progress.
+  const bool showProgress = (cmdOpts.runJobNum <= 1);
+  // The diagnostic tree has the selection of the last iteration.
+  const bool writeTree =
+    !cmdOpts.eventTreeFileName.empty() && iteration == cmdOpts.iterationNum;
+
+  dir->cd();
+
+  RunHistograms hists(runConf, cmdOpts.holeHists);
+
+  // Foil and hole of each event, found once for all passes. With cuts
+  // from an earlier iteration they are found while reconstructing.
+  EventAssignment assignment;
+  const size_t nFoils = runConf.zFoils.size();
+
+  // Cuts saved by an earlier invocation, unless refreshed. Sieve holes
+  // of refreshed foils are found again.
+  result.runNumber = runConf.runNumber;
+  result.configHash = getRunConfigHash(runConf);
+  const RunCuts* savedCuts = NULL;
+  std::vector<bool> findFoilHoles(nFoils, true);
+  if (findCuts && useCutDatabase) {
+    const std::vector<int>& refreshRuns = cmdOpts.refreshRuns;
+    if (
+      std::find(refreshRuns.begin(), refreshRuns.end(), runConf.runNumber) ==
+      refreshRuns.end()
+    ) {
+      savedCuts = cutDatabase.find(runConf.runNumber, result.configHash, matrixHash);
+    }
+    if (savedCuts && savedCuts->zVerPeaks.size() != nFoils) savedCuts = NULL;
+    if (savedCuts) {
+      findFoilHoles.assign(nFoils, false);
+      for (const auto& refreshFoil : cmdOpts.refreshFoils) {
+        if (
+          refreshFoil.first == runConf.runNumber &&
+          static_cast<size_t>(refreshFoil.second) < nFoils
+        ) {
+          findFoilHoles.at(refreshFoil.second) = true;
+        }
+      }
+    }
+  }
+  const bool newCuts = result.newCuts = findCuts && (
+    !savedCuts ||
+    std::find(findFoilHoles.begin(), findFoilHoles.end(), true) != findFoilHoles.end()
+  );
+  if (savedCuts) cuts = *savedCuts;
+
+  // Quick look: cuts are found on a subsample before reading the run,
+  // which is then only reconstructed and selected with them.
+  const bool quickLook = newCuts && cmdOpts.quickLookNum > 0;
+  if (quickLook) {
+    std::vector<Event> sample = readEventSample(
+      runConf, static_cast<size_t>(cmdOpts.quickLookNum),
+      static_cast<unsigned int>(runConf.runNumber)
+    );
+    cout << "    Quick look at " << sample.size() << " events: ";
+
+    // Histograms of the subsample are kept apart.
+    {
+      OutputLock lock(canvases);
+      dir->mkdir("quick_look", "histograms of the quick look subsample")->cd();
+    }
+    RunHistograms sampleHists(runConf, false);
+    EventAssignment sampleAssignment;
+    reconstructEvents(
+      sample, NULL, runConf, recMatrixIndep, recMatrixDep,
+      conf.xTarCorrIterNum, sampleHists, NULL, sampleAssignment, showProgress
+    );
+    findRunCuts(
+      sample, runConf, cmdOpts, automatic, nThreads, savedCuts, findFoilHoles,
+      canvases, sampleHists, cuts, sampleAssignment
     );
+    cout
+      << "    " << sampleAssignment.selected.size()
+      << " subsample events in sieve holes." << endl;
     dir->cd();
+  }
+
+  // Reading events from input ROOT files.
+  std::vector<Event> events;
+  std::unique_ptr<EventPipeline> pipeline;
+  if (iteration > 1) {
+    events.swap(runEvents);
+  }
+  else if (
+    prefetcher && prefetcher->isReading(runConf.runNumber) &&
+    prefetcher->take(events)
+  ) {
+    cout
+      << "    Prefetched in " << prefetcher->lastReadTime << " s, waited "
+      << prefetcher->lastWaitTime << " s." << endl;
+  }
+  else if (cmdOpts.pipeline) {
+    // Events are reconstructed while the rest is read.
+    pipeline.reset(new EventPipeline(runConf, fileCache));
+  }
+  else {
+    events = readEvents(runConf, fileCache);
+  }
+  if (prefetcher && nextRunConf) prefetcher->start(*nextRunConf);
+  if (!pipeline) {
+    cout << "    " << events.size() << " events survived cuts." << endl;
+  }
+  // Opening the input files changed the current directory.
+  dir->cd();
+
+  cout << "    Reconstructing events: ";
+  reconstructEvents(
+    events, pipeline.get(), runConf, recMatrixIndep, recMatrixDep,
+    conf.xTarCorrIterNum, hists,
+    (newCuts && !quickLook) ? NULL : &cuts, assignment, showProgress
+  );
+  if (pipeline) {
+    const QueueMetrics& metrics = pipeline->getMetrics();
+    cout
+      << "    " << events.size() << " events survived cuts, read in "
+      << pipeline->readTime << " s." << endl
+      << "    Pipeline: " << metrics.nItems << " batches, mean queue depth "
+      << metrics.getMeanDepth() << " (max " << metrics.maxDepth << " of "
+      << metrics.capacity << "), reading stalled " << metrics.producerStallTime
+      << " s, reconstruction stalled " << metrics.consumerStallTime << " s." << endl;
+  }
 
-    cout << "    Reconstructing events: ";
-    size_t iEvent = 0;
-    double xpSumIndep, xpSumDep;
-    double ySumIndep, ySumDep;
-    double ypSumIndep, ypSumDep;
-    double lambda;
-    const double D1 = 138.0;
-    const double D2 = 75.0;
-    const double D3 = 40.0;
+  if (newCuts) {
+    if (!quickLook) {
+      findRunCuts(
+        events, runConf, cmdOpts, automatic, nThreads, savedCuts, findFoilHoles,
+        canvases, hists, cuts, assignment
+      );
+    }
+  }
+  else if (savedCuts) {
+    cout << "    Using saved foil and sieve hole cuts." << endl;
+  }
+  else {
+    cout << "    Reusing foil and sieve hole cuts." << endl;
+  }
+  cout
+    << "    " << assignment.selected.size()
+    << " events in sieve holes." << endl;
+
+  result.summaries.assign(runConf.zFoils.size(), ResidualSummary());
+  fillFit(
+    events, assignment, conf, runConf, cuts, recMatrixNew, recMatrixDep,
+    hists, result.summaries, result.fitAcc,
+    (robustLoss != kLeastSquares) ? &result.designCache : NULL,
+    // Blocks are only bootstrapped after the last iteration.
+    (cmdOpts.bootstrapNum > 0 && iteration == cmdOpts.iterationNum) ?
+      &result.holeBlocks : NULL,
+    cmdOpts.bootstrapUnit == "hole",
+    writeTree ? &result.treeRows : NULL, showProgress
+  );
 
-    reportProgressInit();
-    for (auto& event : events) {  // reconstruction event loop
-      if (iEvent%2000 == 0) reportProgress(iEvent, nEvents);
+  writeResidualGraphs(runConf, canvases, hists);
+  hists.write(canvases);
 
-      double cosTheta = cos(event.theta*TMath::DegToRad());
-      double sinTheta = sin(event.theta*TMath::DegToRad());
+  // Keep events for next iteration.
+  if (iteration < cmdOpts.iterationNum) events.swap(runEvents);
+}
 
 
-      xpSumIndep = 0.0;
-      ySumIndep = 0.0;
-      ypSumIndep = 0.0;
-      xpSumDep = 0.0;
-      ySumDep = 0.0;
-      ypSumDep = 0.0;
-      lambda = 0.0;
+// Reconstruct events and fill everything that needs only the reconstructed
+// event in the same pass. With known cuts the events are also assigned to
+// foils and holes.
+void reconstructEvents(
+  std::vector<Event>& events, EventPipeline* pipeline,
+  const config::RunConfig& runConf,
+  const RecMatrix& recMatrixIndep, const RecMatrix& recMatrixDep,
+  int xTarCorrIterNum, RunHistograms& hists,
+  const RunCuts* cuts, EventAssignment& assignment, bool showProgress
+) {
+  const size_t nEvents = events.size();
+  size_t iEvent = 0;
+
+  std::unique_ptr<CutIndex> cutIndex;
+  if (cuts) {
+    cutIndex.reset(new CutIndex(*cuts, runConf));
+    assignment.reset(nEvents, cuts->zVerPeaks.size());
+  }
 
-      h2_fp->Fill(event.xFp,event.yFp);
+  reportProgressInit();
+  // With a pipeline, the events are reconstructed batch by batch as they
+  // are read. Their number is only known at the end, so there is no
+  // progress.
+  std::vector<Event> batch;
+  while (!pipeline || pipeline->next(batch)) {  // batch loop
+    if (pipeline) {
+      events.insert(events.end(), batch.begin(), batch.end());
+      if (cutIndex) assignment.grow(events.size());
+    }
 
-      if (iEvent==1){
-	//cout<<"------------Matrix Elements Indep-------------"<<endl;
+    for (; iEvent<events.size(); ++iEvent) {  // reconstruction event loop
+      Event& event = events[iEvent];
+      if (showProgress && !pipeline && iEvent%2000 == 0) {
+        reportProgress(iEvent, nEvents);
       }
 
-      // Calculate contribution of xTar independent terms.
-      for (const auto& line : recMatrixIndep.matrix) {  // line loop
-        lambda =
-          pow(event.xFp/100.0, line.E_x) *
-          pow(event.xpFp, line.E_xp) *
-          pow(event.yFp/100.0, line.E_y) *
-          pow(event.ypFp, line.E_yp);
-
-        xpSumIndep += line.C_Xp * lambda;
-        ySumIndep += line.C_Y * lambda;
-        ypSumIndep += line.C_Yp * lambda;
-
-	if (iEvent==1){
-	  //cout<<line.C_Xp<<"\t"<<line.C_Y<<"\t"<<line.C_Yp<<"\t"<<line.E_x<<line.E_xp<<line.E_y<<line.E_yp<<endl;
-	}
-      }   // line loop
-
-      // Now do several iterations of xTar dependent constributions, each time
-      // with a better approximation for xTar.
-      event.xTar = -event.yVer - runConf.SHMS.xMispointing;
-      double corrFactor = 25.0;
-      double uncorrYTar = 0.0;
-      double uncorrZVer = 0.0;
-      for (int iIter=0; iIter<conf.xTarCorrIterNum+1; ++iIter) {  // iteration loop
-        xpSumDep = 0.0;
-        ySumDep = 0.0;
-        ypSumDep = 0.0;
-
-	if (iEvent==1){
-	  //cout<<"------------Matrix Elements Dep-------------"<<endl;
-	}
-
-        for (const auto& line : recMatrixDep.matrix) {  // line loop
-          lambda =
-            pow(event.xFp/100.0, line.E_x) *
-            pow(event.xpFp, line.E_xp) *
-            pow(event.yFp/100.0, line.E_y) *
-            pow(event.ypFp, line.E_yp) *
-            pow(event.xTar/100.0, line.E_xTar);
-
-          xpSumDep += line.C_Xp * lambda;
-          ySumDep += line.C_Y * lambda;
-          ypSumDep += line.C_Yp * lambda;
-
-	  if (iEvent==1){
-	    //cout<<line.C_Xp<<"\t"<<line.C_Y<<"\t"<<line.C_Yp<<"\t"<<line.E_x<<line.E_xp<<line.E_y<<line.E_yp<<line.E_xTar<<endl;
-	  }
-        }  // line loop
-
-        event.xpTar = (xpSumIndep+xpSumDep) + runConf.SHMS.phiOffset;
-        event.yTar = (ySumIndep+ySumDep)*100.0 + runConf.SHMS.yMispointing;
-        event.ypTar = (ypSumIndep+ypSumDep) + runConf.SHMS.thetaOffset;
-
-	//correct the ytar vs yptar dependency
-	//this is for 2017 data prior to optimization only
-	uncorrYTar = event.yTar;
-	if (sinTheta>0.4){corrFactor = 6.0;}
-	
-	if (runConf.use2017Corr != 0){
-	  event.yTar = event.yTar - runConf.SHMS.yMispointing - corrFactor*event.ypTar;
-	  event.yTar += runConf.SHMS.yMispointing;
-	}
-	
-	event.zVer =
-          (event.yTar - event.xVer*(cosTheta - event.ypTar*sinTheta)) /
-          (-sinTheta - event.ypTar*cosTheta);
-	
-	uncorrZVer = (uncorrYTar - event.xVer*(cosTheta - event.ypTar*sinTheta)) /
-	  (-sinTheta - event.ypTar*cosTheta);
-	
-
-        event.xTarVer = -event.yVer;	
-	event.yTarVer = -event.zVer*sinTheta + event.xVer*cosTheta;
-        event.zTarVer = event.zVer*cosTheta + event.xVer*sinTheta;
-
-	event.yTarVer = -uncorrZVer*sinTheta + event.xVer*cosTheta;
-        event.zTarVer = uncorrZVer*cosTheta + event.xVer*sinTheta;
-
-
-        event.xTar = event.xTarVer - event.zTarVer*event.xpTar - runConf.SHMS.xMispointing;
-      }   // iteration loop
-
-      event.xTar += runConf.SHMS.xMispointing;
-      event.yTar -= runConf.SHMS.yMispointing;
-      h2_yTarVypTar->Fill(event.yTar,event.ypTar);
-
-      event.xSieve = event.xTar + event.xpTar*runConf.sieve.z0;
-      event.ySieve = (-0.019*event.delta+0.00019*pow(event.delta,2)+(D1+D2)*event.ypTar+uncorrYTar) + D3*(-0.00052*event.delta+0.0000052*pow(event.delta,2)+event.ypTar);
-      h2_yTarVdelta->Fill(event.yTar, event.delta);
-
-      ++iEvent;
+      hists.h2_fp->Fill(event.xFp,event.yFp);
+
+      reconstructEvent(
+        event, runConf, recMatrixIndep, recMatrixDep, xTarCorrIterNum
+      );
+
+      hists.h2_yTarVypTar->Fill(event.yTar,event.ypTar);
+      hists.h2_yTarVdelta->Fill(event.yTar, event.delta);
+      hists.h_zVer->Fill(event.zVer);
+      hists.h_yTar->Fill(event.yTar);
+
+      if (cutIndex) assignEvent(event, iEvent, *cutIndex, *cuts, assignment);
     }  // reconstruction event loop
-    reportProgressFinish();
 
+    if (!pipeline) break;
+  }  // batch loop
+  reportProgressFinish();
+}
 
-    cout << "    Fitting target foils." << endl;
 
-    // Setting historgams.
-    double minx = runConf.zFoils.front() - 5.0;
-    double maxx = runConf.zFoils.back() + 5.0;
-    int binsx = 10 * static_cast<int>(maxx-minx);
-    TH1D zVerHist(
-      TString::Format("zVer"),
-      TString::Format("zVer for run %d", runConf.runNumber),
-      binsx, minx, maxx
-    );
-    zVerHist.GetXaxis()->SetTitle("z_{vertex}  [cm]");
-    
-    minx *= runConf.SHMS.sinTheta;
-    maxx *= runConf.SHMS.sinTheta;
-    TH1D yTarHist(
-      TString::Format("yTar"),
-      TString::Format("yTar for run %d", runConf.runNumber),
-      binsx, minx, maxx
-    );
-    yTarHist.GetXaxis()->SetTitle("y_{target}  [cm]");
+// Expected yTar of the events from a foil.
+double getFoilYTar(const config::RunConfig& runConf, size_t iFoil) {
+  double xVer = -runConf.beam.x0;//?
+  double yTarVer = -runConf.zFoils.at(iFoil)*runConf.SHMS.sinTheta + xVer*runConf.SHMS.cosTheta - runConf.SHMS.yMispointing;
+  double zTarVer = runConf.zFoils.at(iFoil)*runConf.SHMS.cosTheta + xVer*runConf.SHMS.sinTheta;
+  double ypTar = (0 - yTarVer)/(253.0 - zTarVer);
 
-    // Filling the histograms.
-    for (const auto& event : events) {
-      zVerHist.Fill(event.zVer);
-      yTarHist.Fill(event.yTar);
+  return yTarVer - ypTar*zTarVer;
+}
+
+
+void findFoils(
+  const std::vector<Event>& events, const config::RunConfig& runConf,
+  bool mixture, bool automatic,
+  Canvases& canvases, RunHistograms& hists, RunCuts& cuts
+) {
+  const size_t nFoils = runConf.zFoils.size();
+  const bool draw = canvases.isActive();
+  TCanvas* c1 = canvases.c1;
+  TCanvas* c3 = canvases.c3;
+
+  // Histograms were filled while reconstructing.
+  TH1D& zVerHist = *hists.h_zVer;
+  TH1D& yTarHist = *hists.h_yTar;
+  const int binsx = zVerHist.GetNbinsX();
+
+  if (mixture) {
+    // Every n-th event inside the histograms, at most maxSample of them.
+    const size_t maxSample = 20000;
+    const size_t stride = events.size()/maxSample + 1;
+    std::vector<double> zVers, yTars;
+    for (size_t iEvent=0; iEvent<events.size(); iEvent+=stride) {
+      const Event& event = events[iEvent];
+      if (
+        event.zVer < zVerHist.GetXaxis()->GetXmin() ||
+        event.zVer > zVerHist.GetXaxis()->GetXmax() ||
+        event.yTar < yTarHist.GetXaxis()->GetXmin() ||
+        event.yTar > yTarHist.GetXaxis()->GetXmax()
+      ) {
+        continue;
+      }
+      zVers.push_back(event.zVer);
+      yTars.push_back(event.yTar);
+    }
+    if (zVers.empty()) {
+      throw std::runtime_error("findFoils: no events for the foil mixture!");
     }
 
+    std::vector<double> yTarSeeds(nFoils);
+    for (size_t iFoil=0; iFoil<nFoils; ++iFoil) {
+      yTarSeeds.at(iFoil) = getFoilYTar(runConf, iFoil);
+    }
+    auto start = std::chrono::steady_clock::now();
+    FoilMixture foilMixture = fitFoilMixture(zVers, yTars, runConf.zFoils, yTarSeeds);
+    std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+    cout
+      << "    Foil mixture of " << zVers.size() << " events: "
+      << foilMixture.nIterations << " iterations"
+      << (foilMixture.converged ? "" : " (not converged)")
+      << " in " << 1000*elapsed.count() << " ms, background "
+      << foilMixture.backgroundWeight << "." << endl;
+
+    // Peaks of yTar are in the reverse order of the foils.
+    cuts.zVerPeaks.assign(nFoils, Peak());
+    cuts.yTarPeaks.assign(nFoils, Peak());
+    for (size_t iFoil=0; iFoil<nFoils; ++iFoil) {
+      const FoilComponent& foil = foilMixture.foils.at(iFoil);
+      cuts.zVerPeaks.at(iFoil) = Peak(
+        zVerHist.GetBinContent(zVerHist.GetXaxis()->FindBin(foil.zVerMean)),
+        foil.zVerMean, foil.zVerSigma
+      );
+      cuts.yTarPeaks.at(nFoils-1-iFoil) = Peak(
+        yTarHist.GetBinContent(yTarHist.GetXaxis()->FindBin(foil.yTarMean)),
+        foil.yTarMean, foil.yTarSigma
+      );
+    }
+  }
+  else {
     // Fitting the histograms.
     int nnFoils = (int)nFoils;
 
-    std::vector<Peak> zVerPeaks = findPeaks(&zVerHist, nnFoils);
-    std::vector<Peak> yTarPeaks = findPeaks(&yTarHist, nnFoils);
+    cuts.zVerPeaks = findPeaks(&zVerHist, nnFoils);
+    cuts.yTarPeaks = findPeaks(&yTarHist, nnFoils);
     zVerHist.GetXaxis()->SetRange(1,binsx);
     yTarHist.GetXaxis()->SetRange(1,binsx);
+  }
 
-    //std::vector<Peak> yTarPeaks = findPeaks(&yTarHist, nnFoils);
+  const std::vector<Peak>& zVerPeaks = cuts.zVerPeaks;
+  const std::vector<Peak>& yTarPeaks = cuts.yTarPeaks;
 
-    //std::vector<Peak> zVerPeaks = fitMultiPeak(&zVerHist, 0.5);
-    /*
-    int nnFoils = (int)nFoils;
-    std::vector<Peak> zVerPeaks = selectMultiPeakZ(&zVerHist, nnFoils, sinTheta);
-    std::vector<Peak> yTarPeaks = selectMultiPeakY(&yTarHist, nnFoils, sinTheta);
-    */
-    //std::vector<Peak> yTarPeaks = fitMultiPeak(&yTarHist, 0.7);
-    
-    cout<<"Number of foils found: "<<zVerPeaks.size()<<endl;
-    for (uint kk=0; kk<zVerPeaks.size(); kk++){
-      cout<<"   peak: "<<zVerPeaks.at(kk).mean<<" , width: "<<zVerPeaks.at(kk).sigma<<" height: "<<zVerPeaks.at(kk).norm<<endl;
-    }
-    cout<<"Number of yTar found: "<<yTarPeaks.size()<<endl;
-    
-    for (uint kk=0; kk<yTarPeaks.size(); kk++){
-      cout<<"   peak: "<<yTarPeaks.at(kk).mean<<" , width: "<<yTarPeaks.at(kk).sigma<<" height: "<<yTarPeaks.at(kk).norm<<endl;
-    }
-    
-    // Plotting the histograms.
+  cout<<"Number of foils found: "<<zVerPeaks.size()<<endl;
+  for (uint kk=0; kk<zVerPeaks.size(); kk++){
+    cout<<"   peak: "<<zVerPeaks.at(kk).mean<<" , width: "<<zVerPeaks.at(kk).sigma<<" height: "<<zVerPeaks.at(kk).norm<<endl;
+  }
+  cout<<"Number of yTar found: "<<yTarPeaks.size()<<endl;
+
+  for (uint kk=0; kk<yTarPeaks.size(); kk++){
+    cout<<"   peak: "<<yTarPeaks.at(kk).mean<<" , width: "<<yTarPeaks.at(kk).sigma<<" height: "<<yTarPeaks.at(kk).norm<<endl;
+  }
+
+  // Plotting the histograms. Without canvases the lines span the range that
+  // would be drawn.
+  double miny = 0.0;
+  double maxy = 1.05*zVerHist.GetMaximum();
+  if (draw) {
+    DrawTimer timer(canvases);
     c1->cd();
     zVerHist.Draw();
     c1->Update();
-    double miny = gPad->GetUymin();
-    double maxy = gPad->GetUymax();
-    // Add lines for physical positions of foils.
-    std::vector<TLine> zFoilLines(nFoils);
-    for (size_t iFoil=0; iFoil<nFoils; ++iFoil) {
-      zFoilLines.at(iFoil) = TLine(
-        runConf.zFoils.at(iFoil), miny,
-        runConf.zFoils.at(iFoil), maxy
-      );
-      zFoilLines.at(iFoil).SetLineColor(6);
-      zFoilLines.at(iFoil).SetLineWidth(2);
-      zVerHist.GetListOfFunctions()->Add(&(zFoilLines.at(iFoil)));
-    }
+    miny = gPad->GetUymin();
+    maxy = gPad->GetUymax();
+  }
+  // Add lines for physical positions of foils.
+  std::vector<TLine> zFoilLines(nFoils);
+  for (size_t iFoil=0; iFoil<nFoils; ++iFoil) {
+    zFoilLines.at(iFoil) = TLine(
+      runConf.zFoils.at(iFoil), miny,
+      runConf.zFoils.at(iFoil), maxy
+    );
+    zFoilLines.at(iFoil).SetLineColor(6);
+    zFoilLines.at(iFoil).SetLineWidth(2);
+    zVerHist.GetListOfFunctions()->Add(&(zFoilLines.at(iFoil)));
+  }
+  if (draw) {
+    DrawTimer timer(canvases);
     c1->Update();
     gPad->Update();
+  }
+  {
+    OutputLock lock(canvases);
     zVerHist.Write();
+  }
 
+  miny = 0.0;
+  maxy = 1.05*yTarHist.GetMaximum();
+  if (draw) {
+    DrawTimer timer(canvases);
     c3->cd();
     yTarHist.Draw();
     c3->Update();
     miny = gPad->GetUymin();
     maxy = gPad->GetUymax();
-    std::vector<TLine> yTarLines(nFoils);
-    for (size_t iFoil=0; iFoil<nFoils; ++iFoil) {
-      double xVer = -runConf.beam.x0;//?
-      double yTarVer = -runConf.zFoils.at(iFoil)*runConf.SHMS.sinTheta + xVer*runConf.SHMS.cosTheta - runConf.SHMS.yMispointing;
-      double zTarVer = runConf.zFoils.at(iFoil)*runConf.SHMS.cosTheta + xVer*runConf.SHMS.sinTheta;
-      double ypTar = (0 - yTarVer)/(253.0 - zTarVer);
-      Double_t yTarZ = yTarVer - ypTar*zTarVer; 
-
-      yTarLines.at(iFoil) = TLine(
-        yTarZ, miny,
-        yTarZ, maxy
-      );
-      yTarLines.at(iFoil).SetLineColor(6);
-      yTarLines.at(iFoil).SetLineWidth(2);
-      yTarHist.GetListOfFunctions()->Add(&(yTarLines.at(iFoil)));
-    }
+  }
+  std::vector<TLine> yTarLines(nFoils);
+  for (size_t iFoil=0; iFoil<nFoils; ++iFoil) {
+    Double_t yTarZ = getFoilYTar(runConf, iFoil);
+
+    yTarLines.at(iFoil) = TLine(
+      yTarZ, miny,
+      yTarZ, maxy
+    );
+    yTarLines.at(iFoil).SetLineColor(6);
+    yTarLines.at(iFoil).SetLineWidth(2);
+    yTarHist.GetListOfFunctions()->Add(&(yTarLines.at(iFoil)));
+  }
+  if (draw) {
+    DrawTimer timer(canvases);
     c3->Update();
     gPad->Update();
+  }
+  {
+    OutputLock lock(canvases);
     yTarHist.Write();
+  }
 
-    if (cmdOpts.automatic) {
-      //      std::this_thread::sleep_for(std::chrono::milliseconds(cmdOpts.delay));
-    }
-    else {
-      cout << "    Continue? ";
-      cin >> tmp;
-    }
+  waitForUser(automatic);
 
+  if (draw) {
+    DrawTimer timer(canvases);
     c1->Clear();
     gPad->Update();
     c3->Clear();
     gPad->Update();
-    
-    cout << "    Fitting sieve holes." << endl;
-    
-    std::vector<TH2D> xySieveHists(nFoils);
-    std::vector<TLine> xSieveLines(runConf.sieve.nRow);
-    std::vector<TLine> ySieveLines(runConf.sieve.nCol);
-    
-    minx = xSievePhys.front() - 0.1*(xSievePhys.back()-xSievePhys.front());
-    maxx = xSievePhys.back() + 0.1*(xSievePhys.back()-xSievePhys.front());
-    binsx = 10 * static_cast<int>(maxx-minx);
-    miny = ySievePhys.front() - 0.1*(ySievePhys.back()-ySievePhys.front());
-    maxy = ySievePhys.back() + 0.1*(ySievePhys.back()-ySievePhys.front());
-    int binsy = 10 * static_cast<int>(maxy-miny);
-    
-    // Construct lines for physical positions of sieve holes.
-    for (size_t iRow=0; iRow<runConf.sieve.nRow; ++iRow) {
-      xSieveLines.at(iRow) = TLine(
-				   xSievePhys.at(iRow), miny,
-				   xSievePhys.at(iRow), maxy
-				   );
-      xSieveLines.at(iRow).SetLineColor(6);
-      xSieveLines.at(iRow).SetLineWidth(2);
-    }
-    for (size_t iCol=0; iCol<runConf.sieve.nCol; ++iCol) {
-      ySieveLines.at(iCol) = TLine(
-				   minx, ySievePhys.at(iCol),
-				   maxx, ySievePhys.at(iCol)
-				   );
-      ySieveLines.at(iCol).SetLineColor(6);
-      ySieveLines.at(iCol).SetLineWidth(2);
+  }
+
+  // Lines go out of scope before the histograms.
+  for (auto& line : zFoilLines) zVerHist.GetListOfFunctions()->Remove(&line);
+  for (auto& line : yTarLines) yTarHist.GetListOfFunctions()->Remove(&line);
+}
+
+
+// Find foils (unless saved) and the sieve holes of findFoilHoles for
+// reconstructed events, and assign the events to them.
+void findRunCuts(
+  const std::vector<Event>& events, const config::RunConfig& runConf,
+  const cmdOptions::OptionParser_shmsOptics& cmdOpts,
+  bool automatic, int nThreads,
+  const RunCuts* savedCuts, const std::vector<bool>& findFoilHoles,
+  Canvases& canvases, RunHistograms& hists, RunCuts& cuts,
+  EventAssignment& assignment
+) {
+  const size_t nFoils = runConf.zFoils.size();
+
+  if (savedCuts) {
+    cout << "    Using saved foil cuts." << endl;
+  }
+  else {
+    cuts = RunCuts();
+
+    cout << "    Fitting target foils." << endl;
+    findFoils(
+      events, runConf, cmdOpts.foilMixture, automatic, canvases, hists, cuts
+    );
+  }
+  assignFoils(events, CutIndex(cuts, runConf), cuts, assignment);
+
+  cout << "    Fitting sieve holes." << endl;
+  findSieveHoles(
+    events, assignment, runConf, cmdOpts, automatic, nThreads, findFoilHoles,
+    canvases, hists, cuts
+  );
+  // All foils may have been fitted, keep the saved ones.
+  for (size_t iFoil=0; savedCuts && iFoil<nFoils; ++iFoil) {
+    if (findFoilHoles.at(iFoil)) continue;
+    cuts.xSievePeakss.at(iFoil) = savedCuts->xSievePeakss.at(iFoil);
+    cuts.ySievePeakss.at(iFoil) = savedCuts->ySievePeakss.at(iFoil);
+    cuts.xSieveIndexess.at(iFoil) = savedCuts->xSieveIndexess.at(iFoil);
+    cuts.ySieveIndexess.at(iFoil) = savedCuts->ySieveIndexess.at(iFoil);
+    cuts.sieveCorrelationss.at(iFoil) = savedCuts->sieveCorrelationss.at(iFoil);
+  }
+
+  cout << "    Assigning events to sieve holes." << endl;
+  assignHoles(events, CutIndex(cuts, runConf), cuts, assignment);
+}
+
+
+void findSieveHoles(
+  const std::vector<Event>& events, const EventAssignment& assignment,
+  const config::RunConfig& runConf,
+  const cmdOptions::OptionParser_shmsOptics& cmdOpts,
+  bool automatic, int nThreads, const std::vector<bool>& fitFoils,
+  Canvases& canvases, RunHistograms& hists, RunCuts& cuts
+) {
+  const size_t nFoils = runConf.zFoils.size();
+  const PeakMethod peakMethod = parsePeakMethod(cmdOpts.holeFitMethod);
+  const bool compare =
+    cmdOpts.holeFitCompare && peakMethod != kPeakMinuit && !cmdOpts.holeFit2D;
+  PeakFitComparison comparison;
+  const bool draw = canvases.isActive();
+  TCanvas* c1 = canvases.c1;
+  TCanvas* c2 = canvases.c2;
+  TCanvas* c3 = canvases.c3;
+
+  std::vector<double> xSievePhys = runConf.getSieveHolesX();
+  std::vector<double> ySievePhys = runConf.getSieveHolesY();
+
+  std::vector<TH2D> xySieveHists(nFoils);
+  std::vector<TLine> xSieveLines(runConf.sieve.nRow);
+  std::vector<TLine> ySieveLines(runConf.sieve.nCol);
+
+  double minx = xSievePhys.front() - 0.1*(xSievePhys.back()-xSievePhys.front());
+  double maxx = xSievePhys.back() + 0.1*(xSievePhys.back()-xSievePhys.front());
+  int binsx = 10 * static_cast<int>(maxx-minx);
+  double miny = ySievePhys.front() - 0.1*(ySievePhys.back()-ySievePhys.front());
+  double maxy = ySievePhys.back() + 0.1*(ySievePhys.back()-ySievePhys.front());
+  int binsy = 10 * static_cast<int>(maxy-miny);
+
+  // Construct lines for physical positions of sieve holes.
+  for (size_t iRow=0; iRow<runConf.sieve.nRow; ++iRow) {
+    xSieveLines.at(iRow) = TLine(
+      xSievePhys.at(iRow), miny,
+      xSievePhys.at(iRow), maxy
+    );
+    xSieveLines.at(iRow).SetLineColor(6);
+    xSieveLines.at(iRow).SetLineWidth(2);
+  }
+  for (size_t iCol=0; iCol<runConf.sieve.nCol; ++iCol) {
+    ySieveLines.at(iCol) = TLine(
+      minx, ySievePhys.at(iCol),
+      maxx, ySievePhys.at(iCol)
+    );
+    ySieveLines.at(iCol).SetLineColor(6);
+    ySieveLines.at(iCol).SetLineWidth(2);
+  }
+
+  // Setting histograms.
+  for (size_t iFoil=0; iFoil<nFoils; ++iFoil) {
+    xySieveHists.at(iFoil) = TH2D(
+      TString::Format("xySieve_%d", static_cast<int>(iFoil)),
+      TString::Format("xySieve for foil %d run %d", static_cast<int>(iFoil), runConf.runNumber),
+      binsx, minx, maxx,
+      binsy, miny, maxy
+    );
+    xySieveHists.at(iFoil).GetXaxis()->SetTitle("x_{sieve}  [cm]");
+    xySieveHists.at(iFoil).GetYaxis()->SetTitle("y_{sieve}  [cm]");
+    for (auto& line : xSieveLines) {
+      xySieveHists.at(iFoil).GetListOfFunctions()->Add(&line);
     }
-    
-   
-
-    // Setting histograms.
-    for (size_t iCol=0; iCol<runConf.sieve.nCol; ++iCol) {
-      ySieveLines.at(iCol) = TLine(
-				   minx, ySievePhys.at(iCol),
-				   maxx, ySievePhys.at(iCol)
-				   );
-      ySieveLines.at(iCol).SetLineColor(6);
-      ySieveLines.at(iCol).SetLineWidth(2);
+    for (auto& line : ySieveLines) {
+      xySieveHists.at(iFoil).GetListOfFunctions()->Add(&line);
     }
-    
-    
-    TH2D *h2_xSieveAng[nFoils];
-    TH2D *h2_ySieveAng[nFoils];
+  }
+
+  // Filling the histograms.
+  for (const std::uint32_t iEvent : assignment.selected) {
+    const Event& event = events[iEvent];
+    hists.h2_yTarVdelta_cut->Fill(event.yTar, event.delta);
+    xySieveHists.at(assignment.foils[iEvent]).Fill(event.xSieve, event.ySieve);
+  }
+
+  // Setting things before starting.
+  cuts.xSievePeakss.assign(nFoils, std::vector<Peak>());
+  cuts.ySievePeakss.assign(nFoils, std::vector<Peak>());
+  cuts.xSieveIndexess.assign(nFoils, std::vector<std::size_t>());
+  cuts.ySieveIndexess.assign(nFoils, std::vector<std::size_t>());
+  cuts.sieveCorrelationss.assign(nFoils, std::vector<double>());
+  std::vector<std::vector<TEllipse> > ellipsess(nFoils);
+
+  // Nothing to show between the fits, fit all foils and holes concurrently.
+  // Foils not in fitFoils are fitted too, but not shown.
+  if (!draw || cmdOpts.holeFit2D || cmdOpts.holeGrid) {
+    std::vector<SieveGridMatch> gridMatches;
+    fitSieveHoles(
+      events, assignment, xySieveHists, runConf, nThreads,
+      peakMethod, cmdOpts.holeFit2D, compare ? &comparison : NULL,
+      cmdOpts.holeGrid ? &gridMatches : NULL, cuts
+    );
+    writePeakFitComparison(cout, comparison);
 
     for (size_t iFoil=0; iFoil<nFoils; ++iFoil) {
-      h2_xSieveAng[iFoil] = new TH2D(Form("h2_xSieveAng_%d",static_cast<int>(iFoil)),Form("Run %d Foil %d;xSieve_{real};ypTar_{measured} - ypTar_{real}",runConf.runNumber, static_cast<int>(iFoil)),200,-12.0,12.0,200,-0.02,0.02);
-      h2_ySieveAng[iFoil] = new TH2D(Form("h2_ySieveAng_%d",static_cast<int>(iFoil)),Form("Run %d Foil %d;ySieve_{real};xptar_{measured} - xpTar_{real}",runConf.runNumber,static_cast<int>(iFoil)),200,-7.0,7.0,200,-0.02,0.02);
-
-      xySieveHists.at(iFoil) = TH2D(
-				    TString::Format("xySieve_%d", static_cast<int>(iFoil)),
-				    TString::Format("xySieve for foil %d run %d", static_cast<int>(iFoil), runConf.runNumber),
-				    binsx, minx, maxx,
-				    binsy, miny, maxy
-				    );
-      xySieveHists.at(iFoil).GetXaxis()->SetTitle("x_{sieve}  [cm]");
-      xySieveHists.at(iFoil).GetYaxis()->SetTitle("y_{sieve}  [cm]");
-      for (auto& line : xSieveLines) {
-	xySieveHists.at(iFoil).GetListOfFunctions()->Add(&line);
+      cout
+        << "      Foil " << iFoil << ": "
+        << cuts.xSievePeakss.at(iFoil).size() << " holes." << endl;
+      if (cmdOpts.holeGrid) {
+        const SieveGridMatch& match = gridMatches.at(iFoil);
+        cout
+          << "        grid shift (" << match.xShift << ", " << match.yShift
+          << ") cm, scale " << match.scale
+          << ", rotation " << match.rotation*TMath::RadToDeg() << " deg"
+          << ", score " << match.score << endl;
       }
-      for (auto& line : ySieveLines) {
-	xySieveHists.at(iFoil).GetListOfFunctions()->Add(&line);
+      const std::vector<double>& correlations = cuts.sieveCorrelationss.at(iFoil);
+      std::vector<TEllipse>& ellipses = ellipsess.at(iFoil);
+      for (size_t iHole=0; iHole<cuts.xSievePeakss.at(iFoil).size(); ++iHole) {
+        ellipses.push_back(getHoleEllipse(
+          cuts.xSievePeakss.at(iFoil).at(iHole),
+          cuts.ySievePeakss.at(iFoil).at(iHole),
+          correlations.empty() ? 0.0 : correlations.at(iHole)
+        ));
       }
-    }
-  
-    // Filling the histograms.
-    for (const auto& event : events) {
-      for (size_t iFoil=0; iFoil<nFoils; ++iFoil) {
-	double zVerSigma = zVerPeaks.at(iFoil).sigma;
-	if (
-	    zVerPeaks.at(iFoil).mean - 1.3*zVerSigma <= event.zVer &&
-	    event.zVer <= zVerPeaks.at(iFoil).mean + 1.3*zVerSigma &&
-	    ((event.delta<1&&(yTarPeaks.at(nFoils-1-iFoil).mean - 1.0*yTarPeaks.at(nFoils-1-iFoil).sigma <= event.yTar &&
-			      event.yTar <= yTarPeaks.at(nFoils-1-iFoil).mean + 1.0*yTarPeaks.at(nFoils-1-iFoil).sigma))||
-	     (event.delta>=1&&(yTarPeaks.at(nFoils-1-iFoil).mean - 1.8*yTarPeaks.at(nFoils-1-iFoil).sigma <= event.yTar &&
-			       event.yTar <= yTarPeaks.at(nFoils-1-iFoil).mean + 1.8*yTarPeaks.at(nFoils-1-iFoil).sigma)))
-	    &&event.delta>-12
-	    ) {
-	  h2_yTarVdelta_cut->Fill(event.yTar, event.delta);
-	  xySieveHists.at(iFoil).Fill(event.xSieve, event.ySieve);
-	  break;
-	}
+      for (auto& ellipse : ellipses) {
+        xySieveHists.at(iFoil).GetListOfFunctions()->Add(&ellipse);
+      }
+      {
+        OutputLock lock(canvases);
+        xySieveHists.at(iFoil).Write();
+      }
+
+      if (draw && fitFoils.at(iFoil)) {
+        {
+          DrawTimer timer(canvases);
+          c1->cd();
+          xySieveHists.at(iFoil).Draw("colz");
+          gPad->Update();
+        }
+        waitForUser(automatic);
+        DrawTimer timer(canvases);
+        c1->Clear();
+        gPad->Update();
       }
     }
 
-    // Setting things before starting.
-    std::vector<std::vector<Peak> > xSievePeakss(nFoils);
-    std::vector<std::vector<Peak> > ySievePeakss(nFoils);
-    std::vector<std::vector<std::size_t> > xSieveIndexess(nFoils);
-    std::vector<std::vector<std::size_t> > ySieveIndexess(nFoils);
-    std::vector<std::vector<std::size_t> > nEventss(nFoils);
-    std::vector<std::vector<TEllipse> > ellipsess(nFoils);
-    
-    TH1D* tmpHist;
-    TMarker* tmpMark = new TMarker(0.0, 0.0, 22);
-    tmpMark->SetMarkerColor(2);
-    
-    // Fit sieve holes for each foil.
-    for (size_t iFoil=0; iFoil<nFoils; ++iFoil) {  // foil loop
-      cout << "      Foil " << iFoil << "." << endl;
-      //if (iFoil<2) continue;
-      TH2D& xySieveHist = xySieveHists.at(iFoil);
-      
+    return;
+  }
+
+  TH1D* tmpHist = NULL;
+  PeakFitter fitter(peakMethod, compare);
+  TMarker* tmpMark = new TMarker(0.0, 0.0, 22);
+  tmpMark->SetMarkerColor(2);
+
+  // Fit sieve holes for each foil.
+  for (size_t iFoil=0; iFoil<nFoils; ++iFoil) {  // foil loop
+    // Other foils keep empty cuts for the caller to fill.
+    if (!fitFoils.at(iFoil)) continue;
+    cout << "      Foil " << iFoil << "." << endl;
+    TH2D& xySieveHist = xySieveHists.at(iFoil);
+
+    if (draw) {
+      DrawTimer timer(canvases);
       c1->cd();
       xySieveHist.Draw("colz");
       c1->Update();
       gPad->Update();
-      
-      // Fit the projections to get position estimates.
+    }
+
+    // Fit the projections to get position estimates.
+    if (iFoil>=1){
+      tmpHist = xySieveHist.ProjectionX("",binsy/4,binsy/1,"");
+    }
+    else{
+      tmpHist = xySieveHist.ProjectionX();
+    }
+    tmpHist->SetTitle("x_{fp} projection");
+    if (draw) {
+      DrawTimer timer(canvases);
       c2->cd();
-      if (iFoil>=1){
-	tmpHist = xySieveHist.ProjectionX("",binsy/4,binsy/1,"");
-      }
-      else{
-	tmpHist = xySieveHist.ProjectionX();
-      }
-      tmpHist->SetTitle("x_{fp} projection");
       tmpHist->Draw();
-      std::vector<Peak> xSievePeaksFit = fitMultiPeak(tmpHist, 0.1);
+    }
+    std::vector<Peak> xSievePeaksFit = fitMultiPeak(tmpHist, 0.1, draw);
+    if (draw) {
+      DrawTimer timer(canvases);
       gPad->Update();
-      
+    }
+
+    if (iFoil>=1){
+      tmpHist = xySieveHist.ProjectionY("", binsx/4,binsx/1,"");
+    }
+    else{
+      tmpHist = xySieveHist.ProjectionY();
+    }
+    tmpHist->SetTitle("y_{fp} projection");
+    if (draw) {
+      DrawTimer timer(canvases);
       c3->cd();
-      if (iFoil>=1){
-	tmpHist = xySieveHist.ProjectionY("", binsx/4,binsx/1,"");				       
-      }
-      else{
-	tmpHist = xySieveHist.ProjectionY();				       
-      }
-      tmpHist->SetTitle("y_{fp} projection");
       tmpHist->Draw();
-      std::vector<Peak> ySievePeaksFit = fitMultiPeak(tmpHist, 0.1);
+    }
+    std::vector<Peak> ySievePeaksFit = fitMultiPeak(tmpHist, 0.1, draw);
+    if (draw) {
+      DrawTimer timer(canvases);
       gPad->Update();
+    }
 
-      // Setup before fitting.
-      
-      std::vector<Peak>& xSievePeaks = xSievePeakss.at(iFoil);
-      std::vector<Peak>& ySievePeaks = ySievePeakss.at(iFoil);
-      std::vector<std::size_t>& xSieveIndexes = xSieveIndexess.at(iFoil);
-      std::vector<std::size_t>& ySieveIndexes = ySieveIndexess.at(iFoil);
-      std::vector<std::size_t>& nEvents = nEventss.at(iFoil);
-      std::vector<TEllipse>& ellipses = ellipsess.at(iFoil);
+    // Setup before fitting.
+    std::vector<Peak>& xSievePeaks = cuts.xSievePeakss.at(iFoil);
+    std::vector<Peak>& ySievePeaks = cuts.ySievePeakss.at(iFoil);
+    std::vector<std::size_t>& xSieveIndexes = cuts.xSieveIndexess.at(iFoil);
+    std::vector<std::size_t>& ySieveIndexes = cuts.ySieveIndexess.at(iFoil);
+    std::vector<TEllipse>& ellipses = ellipsess.at(iFoil);
+
+    // Fit each individual hole.
+    double xComparison = -30.0;
+    for (const auto& xSievePeak : xSievePeaksFit) {
+      tmpMark->SetX(xSievePeak.mean);
+      double xPeakSigmaInit = 0.36;//xSievePeak.sigma;
+      if (xPeakSigmaInit>0.36){xPeakSigmaInit=0.36;}
+      int binXmin = xySieveHist.GetXaxis()->FindBin(xSievePeak.mean - 3*xPeakSigmaInit);
+      int binXmax = xySieveHist.GetXaxis()->FindBin(xSievePeak.mean + 3*xPeakSigmaInit);
+      if(TMath::Abs(xSievePeak.mean - xComparison)<1.5){continue;}
+      if(TMath::Abs(xSievePeak.mean - xComparison)>=1.5 && TMath::Abs(xSievePeak.mean - xComparison)<2.0){xPeakSigmaInit=0.35;}
+      xComparison = xSievePeak.mean;
+
+      waitForUser(automatic);
+
+      double yComparison = -10.0;
+      for (const auto& ySievePeak : ySievePeaksFit) {
+        tmpMark->SetY(ySievePeak.mean);
+        if (draw) {
+          DrawTimer timer(canvases);
+          c1->cd();
+          tmpMark->Draw();
+          gPad->Update();
+        }
+
+        if(TMath::Abs(ySievePeak.mean - yComparison)<0.95){continue;}
 
-      // Fit each individual hole.      
-      double xComparison = -30.0;
-      for (const auto& xSievePeak : xSievePeaksFit) {
-	tmpMark->SetX(xSievePeak.mean);
-	double xPeakSigmaInit = 0.36;//xSievePeak.sigma;
-	if (xPeakSigmaInit>0.36){xPeakSigmaInit=0.36;}
-	int binXmin = xySieveHist.GetXaxis()->FindBin(xSievePeak.mean - 3*xPeakSigmaInit);
-	int binXmax = xySieveHist.GetXaxis()->FindBin(xSievePeak.mean + 3*xPeakSigmaInit);
-	if(TMath::Abs(xSievePeak.mean - xComparison)<1.5){continue;}
-	if(TMath::Abs(xSievePeak.mean - xComparison)>=1.5 && TMath::Abs(xSievePeak.mean - xComparison)<2.0){xPeakSigmaInit=0.35;}
-	xComparison = xSievePeak.mean;
-	
-	//////////////////////////
-	if (cmdOpts.automatic) {
-	  //	  std::this_thread::sleep_for(std::chrono::milliseconds(cmdOpts.delay));
-	}
-	else {
-	  cout << "    Continue? ";
-	  cin >> tmp;
-	}
-
-	//////////////////////////
-	double yComparison = -10.0;
-	for (const auto& ySievePeak : ySievePeaksFit) {
-	  tmpMark->SetY(ySievePeak.mean);
-	  c1->cd();
-	  tmpMark->Draw();
-	  gPad->Update();
-	  
-	  if(TMath::Abs(ySievePeak.mean - yComparison)<0.95){continue;}
-	  
-	  double yPeakSigmaInit = ySievePeak.sigma;
-	  if (yPeakSigmaInit>0.35){yPeakSigmaInit=0.35;}
-
-	  // Find bounding box for current hole.
-	  int binYmin = xySieveHist.GetYaxis()->FindBin(ySievePeak.mean - 3*yPeakSigmaInit);
-	  int binYmax = xySieveHist.GetYaxis()->FindBin(ySievePeak.mean + 3*yPeakSigmaInit);
-	  
-	  // Want to have at least 50 events for fitting.
-	  double integral = xySieveHist.Integral(
-						 binXmin, binXmax,
-						 binYmin, binYmax
-						 );
-	  
-	  if (integral < 50) continue;
-	  
-	  // Fit x and y projection separately.
-	  c2->cd();
-	  tmpHist = xySieveHist.ProjectionX("_px", binYmin, binYmax);
-	  tmpHist->GetXaxis()->SetRange(binXmin, binXmax);
-	  tmpHist->Draw();
-	  Peak xSievePeakSingle = fitPeak(
-					  tmpHist,
-					  xSievePeak.norm,
-					  xSievePeak.mean,
-					  xPeakSigmaInit
-					  );
-	  gPad->Update();
-	  
-	  c3->cd();
-	  tmpHist = xySieveHist.ProjectionY("_py", binXmin, binXmax);
-	  tmpHist->GetXaxis()->SetRange(binYmin, binYmax);
-	  tmpHist->Draw();
-	  Peak ySievePeakSingle = fitPeak(
-					  tmpHist,
-					  ySievePeak.norm,
-					  ySievePeak.mean,
-					  yPeakSigmaInit
-					  );
-	  gPad->Update();
-
-	  int binYFitmin = xySieveHist.GetYaxis()->FindBin(ySievePeakSingle.mean - 2.2*ySievePeakSingle.sigma);
-	  int binYFitmax = xySieveHist.GetYaxis()->FindBin(ySievePeakSingle.mean + 2.2*ySievePeakSingle.sigma);
-	  int binXFitmin = xySieveHist.GetXaxis()->FindBin(xSievePeakSingle.mean - 2.2*xSievePeakSingle.sigma);
-	  int binXFitmax = xySieveHist.GetXaxis()->FindBin(xSievePeakSingle.mean + 2.2*xSievePeakSingle.sigma);
-	  integral = xySieveHist.Integral(
-					  binXFitmin, binXFitmax,
-					  binYFitmin, binYFitmax
-					  );
-	  if (integral<50){continue;}
-	  ////////////////////////
-	  if (cmdOpts.automatic) {
-	    //	    std::this_thread::sleep_for(std::chrono::milliseconds(cmdOpts.delay));
-	  }
-	  else {
-	    cout << "    Continue? ";
-	    cin >> tmp;
-	  }
-	  /////////////////////////
-
-	  // Construct bounding ellipse.
-	  if (xSievePeakSingle.sigma!=0.0 && ySievePeakSingle.sigma!=0.0 && abs(xSievePeakSingle.mean)<15.0 && abs(ySievePeakSingle.mean)<10.0 && TMath::Abs(ySievePeakSingle.mean-yComparison)>0.95){
-	    
-	    TEllipse ellipse(
-			     xSievePeakSingle.mean, ySievePeakSingle.mean,
-			     2.2*xSievePeakSingle.sigma, 2*ySievePeakSingle.sigma
-			     );
-	    ellipse.SetLineColor(2);
-	    ellipse.SetLineWidth(2);
-	    ellipse.SetFillStyle(0);
-	    
-	    // Push everything to collection.
-	    xSievePeaks.push_back(xSievePeakSingle);
-	    ySievePeaks.push_back(ySievePeakSingle);
-	    xSieveIndexes.push_back(getClosestIndex(xSievePeakSingle.mean, xSievePhys));
-	    ySieveIndexes.push_back(getClosestIndex(ySievePeakSingle.mean, ySievePhys));
-	    nEvents.push_back(0);
-	    ellipses.push_back(ellipse);
-	    yComparison = ySievePeakSingle.mean;
-	    
-	  }
-	}
+        double yPeakSigmaInit = ySievePeak.sigma;
+        if (yPeakSigmaInit>0.35){yPeakSigmaInit=0.35;}
+
+        // Find bounding box for current hole.
+        int binYmin = xySieveHist.GetYaxis()->FindBin(ySievePeak.mean - 3*yPeakSigmaInit);
+        int binYmax = xySieveHist.GetYaxis()->FindBin(ySievePeak.mean + 3*yPeakSigmaInit);
+
+        // Want to have at least 50 events for fitting.
+        double integral = xySieveHist.Integral(
+          binXmin, binXmax,
+          binYmin, binYmax
+        );
+
+        if (integral < 50) continue;
+
+        // Fit x and y projection separately.
+        tmpHist = xySieveHist.ProjectionX("_px", binYmin, binYmax);
+        tmpHist->GetXaxis()->SetRange(binXmin, binXmax);
+        if (draw) {
+          DrawTimer timer(canvases);
+          c2->cd();
+          tmpHist->Draw();
+        }
+        Peak xSievePeakSingle = fitter.fit(
+          tmpHist,
+          xSievePeak.norm,
+          xSievePeak.mean,
+          xPeakSigmaInit,
+          draw
+        );
+        if (draw) {
+          DrawTimer timer(canvases);
+          gPad->Update();
+        }
+
+        tmpHist = xySieveHist.ProjectionY("_py", binXmin, binXmax);
+        tmpHist->GetXaxis()->SetRange(binYmin, binYmax);
+        if (draw) {
+          DrawTimer timer(canvases);
+          c3->cd();
+          tmpHist->Draw();
+        }
+        Peak ySievePeakSingle = fitter.fit(
+          tmpHist,
+          ySievePeak.norm,
+          ySievePeak.mean,
+          yPeakSigmaInit,
+          draw
+        );
+        if (draw) {
+          DrawTimer timer(canvases);
+          gPad->Update();
+        }
+
+        int binYFitmin = xySieveHist.GetYaxis()->FindBin(ySievePeakSingle.mean - 2.2*ySievePeakSingle.sigma);
+        int binYFitmax = xySieveHist.GetYaxis()->FindBin(ySievePeakSingle.mean + 2.2*ySievePeakSingle.sigma);
+        int binXFitmin = xySieveHist.GetXaxis()->FindBin(xSievePeakSingle.mean - 2.2*xSievePeakSingle.sigma);
+        int binXFitmax = xySieveHist.GetXaxis()->FindBin(xSievePeakSingle.mean + 2.2*xSievePeakSingle.sigma);
+        integral = xySieveHist.Integral(
+          binXFitmin, binXFitmax,
+          binYFitmin, binYFitmax
+        );
+        if (integral<50){continue;}
+
+        waitForUser(automatic);
+
+        // Construct bounding ellipse.
+        if (xSievePeakSingle.sigma!=0.0 && ySievePeakSingle.sigma!=0.0 && abs(xSievePeakSingle.mean)<15.0 && abs(ySievePeakSingle.mean)<10.0 && TMath::Abs(ySievePeakSingle.mean-yComparison)>0.95){
+
+          TEllipse ellipse = getHoleEllipse(xSievePeakSingle, ySievePeakSingle);
+
+          // Push everything to collection.
+          xSievePeaks.push_back(xSievePeakSingle);
+          ySievePeaks.push_back(ySievePeakSingle);
+          xSieveIndexes.push_back(getClosestIndex(xSievePeakSingle.mean, xSievePhys));
+          ySieveIndexes.push_back(getClosestIndex(ySievePeakSingle.mean, ySievePhys));
+          ellipses.push_back(ellipse);
+          yComparison = ySievePeakSingle.mean;
+        }
       }
+    }
 
+    for (auto& ellipse : ellipses) {
+      xySieveHist.GetListOfFunctions()->Add(&ellipse);
+    }
+    if (draw) {
+      DrawTimer timer(canvases);
       c1->cd();
       tmpMark->SetX(1000.0);
       tmpMark->Draw();
-      for (auto& ellipse : ellipses) {
-	xySieveHist.GetListOfFunctions()->Add(&ellipse);
-      }
       gPad->Update();
+    }
+    {
+      OutputLock lock(canvases);
       xySieveHist.Write();
-      
+    }
+
+    if (draw) {
+      DrawTimer timer(canvases);
       c2->Clear();
       gPad->Update();
       c3->Clear();
       gPad->Update();
-      
-      if (cmdOpts.automatic) {
-	//	std::this_thread::sleep_for(std::chrono::milliseconds(cmdOpts.delay));
-      }
-      else {
-	cout << "    Continue? ";
-	cin >> tmp;
-      }
-      
-      c1->Clear();
-      gPad->Update();
-    }  // foil loop
-    
-    // Cleanup of sieve fit.
-    delete tmpHist;
-    delete tmpMark;
-
-    cout << "    Filling SVD matrices and vectors: ";
-    iEvent = 0;
-
-    reportProgressInit();
-    for (const auto& event : events) {  // SVD filling loop
-      if (iEvent%1000 == 0) reportProgress(iEvent, nEvents);
-      ++iEvent;
-
-      double cosTheta = cos(event.theta*TMath::DegToRad());
-      double sinTheta = sin(event.theta*TMath::DegToRad());
-
-      // Find which foil if any.
-      uint iFoil = 0;
-      for (iFoil=0; iFoil<nFoils; ++iFoil) {
-	double zVerSigma = zVerPeaks.at(iFoil).sigma;
-        if (
-          zVerPeaks.at(iFoil).mean - 1.3*zVerSigma <= event.zVer &&
-          event.zVer <= zVerPeaks.at(iFoil).mean + 1.3*zVerSigma &&
-	  ((event.delta<1&&(yTarPeaks.at(nFoils-1-iFoil).mean - 1.0*yTarPeaks.at(nFoils-1-iFoil).sigma <= event.yTar &&
-			    event.yTar <= yTarPeaks.at(nFoils-1-iFoil).mean + 1.0*yTarPeaks.at(nFoils-1-iFoil).sigma))||
-	   (event.delta>=1&&(yTarPeaks.at(nFoils-1-iFoil).mean - 1.8*yTarPeaks.at(nFoils-1-iFoil).sigma <= event.yTar &&
-			     event.yTar <= yTarPeaks.at(nFoils-1-iFoil).mean + 1.8*yTarPeaks.at(nFoils-1-iFoil).sigma)))
-	  &&event.delta>-12
-        ) {
-          break;
-        }
-      }
-      //if (iFoil!=0) continue;/////this is only to test!!!!!!!!!!!!!!!!!!!!!!
-      // Skip event if it is too far from any foil.
-      if (iFoil == nFoils) continue;
-
-      // Find which sieve hole if any for corresponding delta. 
-      uint iHole = 0;
-      
-      for (iHole=0; iHole<xSievePeakss.at(iFoil).size(); ++iHole) {
-	Peak& xSieveP = xSievePeakss.at(iFoil).at(iHole);
-	Peak& ySieveP = ySievePeakss.at(iFoil).at(iHole);
-	if (
-	    xSieveP.mean - 2.2*xSieveP.sigma <= event.xSieve &&
-	    event.xSieve <= xSieveP.mean + 2.2*xSieveP.sigma &&
-	    ySieveP.mean - 2*ySieveP.sigma <= event.ySieve &&
-	    event.ySieve <= ySieveP.mean + 2*ySieveP.sigma
-	    ) {
-	  break;
-	}
-      }
-
-      // Skip event if it is too far from any hole or if there is enough events
-      // from this hole already.
-      if (
-	  iHole == xSievePeakss.at(iFoil).size() ||
-	  nEventss.at(iFoil).at(iHole) > 50
-	  ) {
-	continue;
-      }
-      ++nEventss.at(iFoil).at(iHole);
-
-      // Calculate the real or "physical" event quantities.
-      double zFoil = runConf.zFoils.at(iFoil);
-
-      double xTarVerPhy = -event.yVer- runConf.SHMS.xMispointing;
-      double yTarVerPhy = -zFoil*sinTheta + event.xVer*cosTheta - runConf.SHMS.yMispointing;
-      double zTarVerPhy = zFoil*cosTheta + event.xVer*sinTheta;
-
-      double xpTarPhy =
-        (xSievePhys.at(xSieveIndexess.at(iFoil).at(iHole)) - xTarVerPhy) /
-        (runConf.sieve.z0 - zTarVerPhy);
-      
-      double Cdelta = -0.019*event.delta+0.00019*pow(event.delta,2) + 40.0*(-0.00052*event.delta+0.0000052*pow(event.delta,2));
-      double ypTarPhy =
-	(ySievePhys.at(ySieveIndexess.at(iFoil).at(iHole)) - Cdelta - yTarVerPhy) /
-        (runConf.sieve.z0 - zTarVerPhy);
-      
-      double xTarPhy = xTarVerPhy - xpTarPhy*zTarVerPhy; 
-      double yTarPhy = yTarVerPhy - ypTarPhy*zTarVerPhy; 
-
-
-      //h2_yTarVdeltaReal->Fill(yTarPhy, event.delta);
-
-      h2_xpTar->Fill(xpTarPhy,event.xpTar-xpTarPhy);
-      h2_ypTar->Fill(ypTarPhy,event.ypTar-ypTarPhy);
-      h2_yTar->Fill(yTarPhy, event.yTar-yTarPhy);
-      h2_zVer->Fill(zFoil,event.zVer - zFoil);
-      h2_xSieveAng[iFoil]->Fill(xSievePhys.at(xSieveIndexess.at(iFoil).at(iHole)),event.xpTar-xpTarPhy);
-      h2_ySieveAng[iFoil]->Fill(ySievePhys.at(ySieveIndexess.at(iFoil).at(iHole)),event.ypTar-ypTarPhy);
-
-      h_xptar_xsieve[iFoil][xSieveIndexess.at(iFoil).at(iHole)]->Fill(event.xpTar-xpTarPhy);  
-      h_yptar_ysieve[iFoil][ySieveIndexess.at(iFoil).at(iHole)]->Fill(event.ypTar-ypTarPhy);
-      h_ytar_ysieve[iFoil][ySieveIndexess.at(iFoil).at(iHole)]->Fill(event.yTar-yTarPhy);
-    
-
-      // Calculate contributions of xTar dependent terms.
-      // Use old reconstruction matrix and xTarPhy.
-      xpSumDep = 0.0;
-      ySumDep = 0.0;
-      ypSumDep = 0.0;
-
-      for (const auto& line : recMatrixDep.matrix) {
-        lambda =
-          pow(event.xFp/100.0, line.E_x) *
-          pow(event.xpFp, line.E_xp) *
-          pow(event.yFp/100.0, line.E_y) *
-          pow(event.ypFp, line.E_yp) *
-          pow(xTarPhy/100.0, line.E_xTar);
-
-        xpSumDep += line.C_Xp * lambda;
-        ySumDep += line.C_Y * lambda;
-        ypSumDep += line.C_Yp * lambda;
-      }
-
-      // Calculate lambdas for xTar independent terms.
-      // Use new matrix and xTarPhy.
-      std::vector<double> lambdas;
-      for (const auto& line : recMatrixNew.matrix) {
-        lambdas.push_back(
-          pow(event.xFp/100.0, line.E_x) *
-          pow(event.xpFp, line.E_xp) *
-          pow(event.yFp/100.0, line.E_y) *
-          pow(event.ypFp, line.E_yp) *
-          pow(xTarPhy/100.0, line.E_xTar)
-        );
-      }
+    }
 
-      // Add lambda_i * lambda_j to (i,j)-th element of SVD matrices.
-      // Add (_TarPhy - _SumDep) to SVD vectors.
-      // We only have xTar independent terms.
-      Int_t i = 0;
-      Int_t j = 0;
-      for (const auto& lambda_i : lambdas) {
-        j = 0;
-        for (const auto& lambda_j : lambdas) {
-          xpTarFitMat(i, j) += lambda_i * lambda_j;
-          yTarFitMat(i, j) += lambda_i * lambda_j;
-          ypTarFitMat(i, j) += lambda_i * lambda_j;
-
-          ++j;
-        }
+    waitForUser(automatic);
 
-        xpTarFitVec(i) += lambda_i * (xpTarPhy - xpSumDep);
-        yTarFitVec(i) += lambda_i * (yTarPhy/100.0 - ySumDep);
-        ypTarFitVec(i) += lambda_i * (ypTarPhy - ypSumDep);
+    if (draw) {
+      DrawTimer timer(canvases);
+      c1->Clear();
+      gPad->Update();
+    }
+  }  // foil loop
 
-        ++i;
-      }
-    }  // SVD filling loop
+  writePeakFitComparison(cout, fitter.comparison);
 
+  // Cleanup of sieve fit.
+  delete tmpHist;
+  delete tmpMark;
+}
 
-    double xptarDiff[nFoils][ixSieve];
-    double yptarDiff[nFoils][iySieve];
-    double ytarDiff[nFoils][iySieve];
-    TGraph *g1[nFoils];
-    TGraph *g2[nFoils];
-    TGraph *g3[nFoils];
 
-    double xSievePhysFormat[nFoils][ixSieve];
-    double ySievePhysFormat[nFoils][iySieve];
+TEllipse getHoleEllipse(
+  const Peak& xSievePeak, const Peak& ySievePeak, double correlation
+) {
+  double xRadius = 2.2*xSievePeak.sigma;
+  double yRadius = 2*ySievePeak.sigma;
+  double theta = 0.0;
+  if (correlation != 0.0) {
+    // Principal axes of the ellipse inscribed in the bounding box.
+    const double sxx = xRadius*xRadius;
+    const double syy = yRadius*yRadius;
+    const double sxy = correlation*xRadius*yRadius;
+    theta = 0.5*std::atan2(2*sxy, sxx-syy);
+    const double c = std::cos(theta);
+    const double s = std::sin(theta);
+    xRadius = std::sqrt(sxx*c*c + 2*sxy*s*c + syy*s*s);
+    yRadius = std::sqrt(sxx*s*s - 2*sxy*s*c + syy*c*c);
+  }
+  TEllipse ellipse(
+    xSievePeak.mean, ySievePeak.mean,
+    xRadius, yRadius, 0.0, 360.0, theta*180.0/TMath::Pi()
+  );
+  ellipse.SetLineColor(2);
+  ellipse.SetLineWidth(2);
+  ellipse.SetFillStyle(0);
 
+  return ellipse;
+}
 
-    for (uint iFoil=0; iFoil<nFoils; iFoil++){
 
-      for (uint ii=0; ii<ixSieve; ii++){
-        xSievePhysFormat[iFoil][ii] = runConf.sieve.xHoleMin + ii*runConf.sieve.xHoleSpace;
-	h_xptar_xsieve[iFoil][ii]->Fit("gaus","Q");
-        h_xptar_xsieve[iFoil][ii]->Draw();
-        h_xptar_xsieve[iFoil][ii]->Write();
-        if (h_xptar_xsieve[iFoil][ii]->Integral()>0.0){
-          xptarDiff[iFoil][ii] = h_xptar_xsieve[iFoil][ii]->GetFunction("gaus")->GetParameter(1);
-        }
-        else{xptarDiff[iFoil][ii] = 0.0;}
-      }
+void fillFit(
+  const std::vector<Event>& events, const EventAssignment& assignment,
+  const config::Config& conf,
+  const config::RunConfig& runConf, const RunCuts& cuts,
+  const RecMatrix& recMatrixNew, const RecMatrix& recMatrixDep,
+  RunHistograms& hists, std::vector<ResidualSummary>& summaries,
+  FitAccumulator& fitAcc, DesignCache* designCache,
+  std::vector<FitAccumulator>* holeBlocks, bool blockPerHole,
+  std::vector<EventTreeRow>* treeRows, bool showProgress
+) {
+  const size_t nFoils = runConf.zFoils.size();
+
+  std::vector<double> xSievePhys = runConf.getSieveHolesX();
+  std::vector<double> ySievePhys = runConf.getSieveHolesY();
+
+  // Number of events in each hole.
+  std::vector<std::vector<std::size_t> > nEventss(nFoils);
+  for (size_t iFoil=0; iFoil<nFoils; ++iFoil) {
+    nEventss.at(iFoil).assign(cuts.xSievePeakss.at(iFoil).size(), 0);
+  }
+  for (const std::uint32_t iEvent : assignment.selected) {
+    ++nEventss.at(assignment.foils[iEvent]).at(assignment.holes[iEvent]);
+  }
 
-      for (uint ii=0; ii<iySieve; ii++){
-	if (runConf.sievetype>1){
-	  ySievePhysFormat[iFoil][ii] = runConf.sieve.yHoleMin+runConf.sieve.yHoleSpace/2.0+ii*runConf.sieve.yHoleSpace;
-	}
-	else{
-	  ySievePhysFormat[iFoil][ii] = runConf.sieve.yHoleMin + ii*runConf.sieve.yHoleSpace;
-	}
-	h_ytar_ysieve[iFoil][ii]->Fit("gaus","Q");
-        h_ytar_ysieve[iFoil][ii]->Draw();
-        if (h_ytar_ysieve[iFoil][ii]->Integral()>0.0){
-	  ytarDiff[iFoil][ii] = h_ytar_ysieve[iFoil][ii]->GetFunction("gaus")->GetParameter(1);
-	}
-	else{ytarDiff[iFoil][ii] = 0.0;}
-	h_yptar_ysieve[iFoil][ii]->Fit("gaus","Q");
-        h_yptar_ysieve[iFoil][ii]->Draw();
-        if (h_yptar_ysieve[iFoil][ii]->Integral()>0.0){
-	  yptarDiff[iFoil][ii]= h_yptar_ysieve[iFoil][ii]->GetFunction("gaus")->GetParameter(1);
-	}
-	else{yptarDiff[iFoil][ii] = 0.0;}	
-      }
-           
-      g1[iFoil] = new TGraph(ixSieve, xSievePhysFormat[iFoil],xptarDiff[iFoil]);
-      g2[iFoil] = new TGraph(iySieve, ySievePhysFormat[iFoil], yptarDiff[iFoil]);
-      g3[iFoil] = new TGraph(iySieve, ySievePhysFormat[iFoil], ytarDiff[iFoil]);
-      
-      g1[iFoil]->SetMarkerColor(kBlue);
-      g1[iFoil]->SetMarkerStyle(21);
-      g1[iFoil]->SetTitle(Form("Foil %d", iFoil));
-      g1[iFoil]->GetXaxis()->SetTitle("xSieve");
-      g1[iFoil]->GetYaxis()->SetTitle("xpTar_{m}-xpTar_{real}");      
-      g2[iFoil]->SetMarkerColor(kBlue);
-      g2[iFoil]->SetMarkerStyle(21);
-      g3[iFoil]->SetMarkerColor(kBlue);
-      g3[iFoil]->SetMarkerStyle(21);
-      g2[iFoil]->SetTitle(Form("Foil %d", iFoil));
-      g2[iFoil]->GetXaxis()->SetTitle("ySieve");
-      g2[iFoil]->GetYaxis()->SetTitle("ypTar_{m}-ypTar_{real}");
-      g3[iFoil]->SetTitle(Form("Foil %d", iFoil));
-      g3[iFoil]->GetXaxis()->SetTitle("ySieve");
-      g3[iFoil]->GetYaxis()->SetTitle("yTar_{m}-yTar_{real}");
-      
-      g1[iFoil]->Draw("AP");
-      g2[iFoil]->Draw("AP");
-      g3[iFoil]->Draw("AP");
-      
-      g1[iFoil]->Write();
-      g2[iFoil]->Write();
-      g3[iFoil]->Write();
+  // Weight events so that each hole has the same total weight instead of
+  // dropping events beyond some maximum number per hole.
+  std::vector<std::vector<double> > holeWeightss(nFoils);
+  for (size_t iFoil=0; iFoil<nFoils; ++iFoil) {
+    for (const auto& nHoleEvents : nEventss.at(iFoil)) {
+      holeWeightss.at(iFoil).push_back(
+        getEventWeight(conf, runConf, iFoil, nHoleEvents)
+      );
     }
+  }
 
-    h2_xpTar->Draw();
-    h2_ypTar->Draw();
-    h2_yTar->Draw();
-    h2_zVer->Draw();
-    h2_yTarVypTar->Draw();
-    h2_yTarVdelta->Draw();
-    h2_yTarVdelta_cut->Draw();
-    h2_fp->Draw();
-    
-    h2_xpTar->Write();
-    h2_ypTar->Write();
-    h2_yTar->Write();
-    h2_zVer->Write();
-    h2_yTarVypTar->Write();
-    h2_yTarVdelta->Write();
-    h2_yTarVdelta_cut->Write();
-    h2_fp->Write();
-
-    reportProgressFinish(); 
+  // Each hole, or without blockPerHole the whole run, gets its own block
+  // of normal equations, which are summed to fitAcc at the end.
+  std::vector<std::size_t> blockOffsets(nFoils, 0);
+  const std::size_t firstBlock = holeBlocks ? holeBlocks->size() : 0;
+  if (holeBlocks && blockPerHole) {
+    for (size_t iFoil=0; iFoil<nFoils; ++iFoil) {
+      blockOffsets.at(iFoil) = holeBlocks->size();
+      holeBlocks->resize(
+        holeBlocks->size() + nEventss.at(iFoil).size(),
+        FitAccumulator(fitAcc.nTerms)
+      );
+    }
+  }
+  else if (holeBlocks) {
+    blockOffsets.assign(nFoils, firstBlock);
+    holeBlocks->push_back(FitAccumulator(fitAcc.nTerms));
+  }
 
-  }  // run loop
+  cout << "    Filling SVD matrices and vectors: ";
+  double xpSumDep, ySumDep, ypSumDep;
+  std::vector<double> lambdas;
+  const size_t nSelected = assignment.selected.size();
+  size_t iSelected = 0;
+
+  // Only events in some foil and hole.
+  reportProgressInit();
+  for (const std::uint32_t iEvent : assignment.selected) {  // SVD filling loop
+    if (showProgress && iSelected%1000 == 0) reportProgress(iSelected, nSelected);
+    ++iSelected;
+
+    const Event& event = events[iEvent];
+    const size_t iFoil = assignment.foils[iEvent];
+    const size_t iHole = assignment.holes[iEvent];
+    const double weight = holeWeightss.at(iFoil).at(iHole);
+
+    // Calculate the real or "physical" event quantities.
+    double zFoil = runConf.zFoils.at(iFoil);
+    const size_t xSieveIndex = cuts.xSieveIndexess.at(iFoil).at(iHole);
+    const size_t ySieveIndex = cuts.ySieveIndexess.at(iFoil).at(iHole);
+
+    TargetVariables targetPhy = getPhysicalTarget(
+      event, runConf, zFoil,
+      xSievePhys.at(xSieveIndex), ySievePhys.at(ySieveIndex)
+    );
+    double xpTarPhy = targetPhy.xpTar;
+    double ypTarPhy = targetPhy.ypTar;
+    double xTarPhy = targetPhy.xTar;
+    double yTarPhy = targetPhy.yTar;
+
+    hists.h2_xpTar->Fill(xpTarPhy,event.xpTar-xpTarPhy);
+    hists.h2_ypTar->Fill(ypTarPhy,event.ypTar-ypTarPhy);
+    hists.h2_yTar->Fill(yTarPhy, event.yTar-yTarPhy);
+    hists.h2_zVer->Fill(zFoil,event.zVer - zFoil);
+    hists.h2_xSieveAng.at(iFoil)->Fill(xSievePhys.at(xSieveIndex),event.xpTar-xpTarPhy);
+    hists.h2_ySieveAng.at(iFoil)->Fill(ySievePhys.at(ySieveIndex),event.ypTar-ypTarPhy);
+
+    hists.xpTarXSieve[iFoil][xSieveIndex].fill(event.xpTar-xpTarPhy);
+    hists.ypTarYSieve[iFoil][ySieveIndex].fill(event.ypTar-ypTarPhy);
+    hists.yTarYSieve[iFoil][ySieveIndex].fill(event.yTar-yTarPhy);
+    if (!hists.h_xptar_xsieve.empty()) {
+      hists.h_xptar_xsieve[iFoil][xSieveIndex]->Fill(event.xpTar-xpTarPhy);
+      hists.h_yptar_ysieve[iFoil][ySieveIndex]->Fill(event.ypTar-ypTarPhy);
+      hists.h_ytar_ysieve[iFoil][ySieveIndex]->Fill(event.yTar-yTarPhy);
+    }
 
+    summaries.at(iFoil).fill(event, targetPhy, zFoil);
+
+    if (treeRows) {
+      treeRows->emplace_back();
+      EventTreeRow& row = treeRows->back();
+      row.run = runConf.runNumber;
+      row.foil = static_cast<int>(iFoil);
+      row.hole = static_cast<int>(iHole);
+      row.xSieveIndex = static_cast<int>(xSieveIndex);
+      row.ySieveIndex = static_cast<int>(ySieveIndex);
+      row.xFp = static_cast<float>(event.xFp);
+      row.yFp = static_cast<float>(event.yFp);
+      row.xpFp = static_cast<float>(event.xpFp);
+      row.ypFp = static_cast<float>(event.ypFp);
+      row.xTarPhy = static_cast<float>(xTarPhy);
+      row.yTarPhy = static_cast<float>(yTarPhy);
+      row.xpTarPhy = static_cast<float>(xpTarPhy);
+      row.ypTarPhy = static_cast<float>(ypTarPhy);
+      row.zFoil = static_cast<float>(zFoil);
+      row.xTar = static_cast<float>(event.xTar);
+      row.yTar = static_cast<float>(event.yTar);
+      row.xpTar = static_cast<float>(event.xpTar);
+      row.ypTar = static_cast<float>(event.ypTar);
+      row.zVer = static_cast<float>(event.zVer);
+      row.delta = static_cast<float>(event.delta);
+      row.weight = static_cast<float>(weight);
+    }
 
-  std::ofstream ofs("xpVec.txt");
-  std::ios::fmtflags f1(ofs.flags());
-  std::streamsize prevPrec1 = ofs.precision(9);
-  for (Int_t iTerm=0; iTerm<recMatrixNewLen; ++iTerm) {
-    ofs << std::scientific << std::setw(17) << xpTarFitVec(iTerm) << endl;
-  }
-  ofs.precision(prevPrec1);
-  ofs.flags(f1);
-  ofs.close();
+    // Calculate contributions of xTar dependent terms.
+    // Use old reconstruction matrix and xTarPhy.
+    sumMatrix(event, xTarPhy, recMatrixDep, xpSumDep, ySumDep, ypSumDep);
+
+    // Calculate lambdas for xTar independent terms.
+    // Use new matrix and xTarPhy.
+    getLambdas(event, xTarPhy, recMatrixNew, lambdas);
+
+    // Add w * lambda_i * lambda_j to (i,j)-th element of SVD matrix.
+    // Add w * lambda_i * (_TarPhy - _SumDep) to SVD vectors.
+    // We only have xTar independent terms.
+    FitAccumulator& eventAcc = !holeBlocks ? fitAcc :
+      holeBlocks->at(blockOffsets.at(iFoil) + (blockPerHole ? iHole : 0));
+    eventAcc.addEvent(
+      lambdas,
+      xpTarPhy - xpSumDep, yTarPhy/100.0 - ySumDep, ypTarPhy - ypSumDep,
+      weight
+    );
+    if (designCache) {
+      designCache->addEvent(
+        lambdas,
+        xpTarPhy - xpSumDep, yTarPhy/100.0 - ySumDep, ypTarPhy - ypSumDep,
+        weight
+      );
+    }
+  }  // SVD filling loop
+  reportProgressFinish();
 
-  ofs.open("xpMat.txt");
-  std::ios::fmtflags f2(ofs.flags());
-  std::streamsize prevPrec2 = ofs.precision(9);
-  for (Int_t iTerm=0; iTerm<recMatrixNewLen; ++iTerm) {
-    for (Int_t jTerm=0; jTerm<recMatrixNewLen; ++jTerm) {
-      ofs
-        << std::scientific << std::setw(17)
-        << xpTarFitMat(iTerm, jTerm);
+  if (holeBlocks) {
+    for (std::size_t iBlock=firstBlock; iBlock<holeBlocks->size(); ++iBlock) {
+      fitAcc.add(holeBlocks->at(iBlock));
     }
-    ofs << endl;
   }
-  ofs.precision(prevPrec2);
-  ofs.flags(f2);
-  ofs.close();
+}
 
 
-  cout << "Solving SVD problems:" << endl;
-  TDecompSVD xpTarSVD(xpTarFitMat);
-  TDecompSVD yTarSVD(yTarFitMat);
-  TDecompSVD ypTarSVD(ypTarFitMat);
+void writeResidualGraphs(
+  const config::RunConfig& runConf, Canvases& canvases, RunHistograms& hists
+) {
+  const size_t nFoils = runConf.zFoils.size();
+  const bool draw = canvases.isActive();
+  const size_t ixSieve = runConf.sieve.nRow;
+  const size_t iySieve = runConf.sieve.nCol;
+
+  std::vector<double> xptarDiff(ixSieve);
+  std::vector<double> yptarDiff(iySieve);
+  std::vector<double> ytarDiff(iySieve);
+  std::vector<double> xSievePhysFormat(ixSieve);
+  std::vector<double> ySievePhysFormat(iySieve);
+
+  for (uint iFoil=0; iFoil<nFoils; iFoil++){
+    // Medians are not pulled by the tails from neighbouring holes, holes
+    // without events get 0.
+    for (uint ii=0; ii<ixSieve; ii++){
+      xSievePhysFormat[ii] = runConf.sieve.xHoleMin + ii*runConf.sieve.xHoleSpace;
+      xptarDiff[ii] = hists.xpTarXSieve[iFoil][ii].median.getMedian();
+    }
 
-  bool xpTarSuccess = xpTarSVD.Solve(xpTarFitVec);
-  cout << "  xpTar: " << (xpTarSuccess ? "success" : "failure") << endl;
-  bool yTarSuccess = yTarSVD.Solve(yTarFitVec);
-  cout << "  yTar: " << (yTarSuccess ? "success" : "failure") << endl;
-  bool ypTarSuccess = ypTarSVD.Solve(ypTarFitVec);
-  cout << "  ypTar: " << (ypTarSuccess ? "success" : "failure") << endl;
+    for (uint ii=0; ii<iySieve; ii++){
+      if (runConf.sievetype>1){
+        ySievePhysFormat[ii] = runConf.sieve.yHoleMin+runConf.sieve.yHoleSpace/2.0+ii*runConf.sieve.yHoleSpace;
+      }
+      else{
+        ySievePhysFormat[ii] = runConf.sieve.yHoleMin + ii*runConf.sieve.yHoleSpace;
+      }
+      ytarDiff[ii] = hists.yTarYSieve[iFoil][ii].median.getMedian();
+      yptarDiff[ii] = hists.ypTarYSieve[iFoil][ii].median.getMedian();
+    }
 
+    if (!hists.h_xptar_xsieve.empty()) {
+      std::vector<TH1F*>& h_xptar_xsieve = hists.h_xptar_xsieve[iFoil];
+      std::vector<TH1F*>& h_yptar_ysieve = hists.h_yptar_ysieve[iFoil];
+      std::vector<TH1F*>& h_ytar_ysieve = hists.h_ytar_ysieve[iFoil];
+      for (uint ii=0; ii<ixSieve; ii++){
+        if (draw) {
+          DrawTimer timer(canvases);
+          h_xptar_xsieve[ii]->Draw();
+        }
+        OutputLock lock(canvases);
+        h_xptar_xsieve[ii]->Write();
+      }
+      for (uint ii=0; ii<iySieve; ii++){
+        if (draw) {
+          DrawTimer timer(canvases);
+          h_ytar_ysieve[ii]->Draw();
+        }
+        if (draw) {
+          DrawTimer timer(canvases);
+          h_yptar_ysieve[ii]->Draw();
+        }
+        OutputLock lock(canvases);
+        h_ytar_ysieve[ii]->Write();
+        h_yptar_ysieve[ii]->Write();
+      }
+    }
 
-  cout << "Constructing new xTar independent optics matrix." << endl;
-  Int_t iTerm = 0;
-  for(auto& line : recMatrixNew.matrix) {
-    line.C_Xp = xpTarFitVec(iTerm);
-    line.C_Y = yTarFitVec(iTerm);
-    line.C_Yp = ypTarFitVec(iTerm);
+    TGraph g1(static_cast<Int_t>(ixSieve), xSievePhysFormat.data(), xptarDiff.data());
+    TGraph g2(static_cast<Int_t>(iySieve), ySievePhysFormat.data(), yptarDiff.data());
+    TGraph g3(static_cast<Int_t>(iySieve), ySievePhysFormat.data(), ytarDiff.data());
+
+    g1.SetMarkerColor(kBlue);
+    g1.SetMarkerStyle(21);
+    g1.SetTitle(Form("Foil %d", iFoil));
+    g1.GetXaxis()->SetTitle("xSieve");
+    g1.GetYaxis()->SetTitle("xpTar_{m}-xpTar_{real}");
+    g2.SetMarkerColor(kBlue);
+    g2.SetMarkerStyle(21);
+    g3.SetMarkerColor(kBlue);
+    g3.SetMarkerStyle(21);
+    g2.SetTitle(Form("Foil %d", iFoil));
+    g2.GetXaxis()->SetTitle("ySieve");
+    g2.GetYaxis()->SetTitle("ypTar_{m}-ypTar_{real}");
+    g3.SetTitle(Form("Foil %d", iFoil));
+    g3.GetXaxis()->SetTitle("ySieve");
+    g3.GetYaxis()->SetTitle("yTar_{m}-yTar_{real}");
+
+    if (draw) {
+      DrawTimer timer(canvases);
+      g1.Draw("AP");
+      g2.Draw("AP");
+      g3.Draw("AP");
+    }
 
-    ++iTerm;
+    OutputLock lock(canvases);
+    g1.Write();
+    g2.Write();
+    g3.Write();
   }
+}
 
-  recMatrixDepFileName = conf.recMatrixFileNameNew;
-  recMatrixDepFileName.insert(
-    conf.recMatrixFileNameNew.size()-4, "__dep"
-  );
-  recMatrixIndepFileName = conf.recMatrixFileNameNew;
-  recMatrixIndepFileName.insert(
-    conf.recMatrixFileNameNew.size()-4, "__indep"
-  );
 
+void printFileCacheStats(const EventFileCache& fileCache) {
   cout
-    << "Saving xTar independent matrix to:" << endl
-    << "  `" << recMatrixIndepFileName << "`" << endl;
-  writeMatrixFile(recMatrixIndepFileName, recMatrixNew);
-  cout
-    << "Saving xTar dependent matrix to:" << endl
-    << "  `" << recMatrixDepFileName << "`" << endl;
-  writeMatrixFile(recMatrixDepFileName, recMatrixDep);
-
-  // Cleanup and exit.
-  delete c3;
-  delete c2;
-  delete c1;
-
- 
-
-  return 0;
+    << "Shared input files: " << fileCache.nReads << " read, "
+    << fileCache.nHits << " reads saved, at most "
+    << static_cast<double>(fileCache.peakBytes)/(1024*1024) << " MB cached."
+    << endl;
 }
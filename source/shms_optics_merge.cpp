@@ -0,0 +1,266 @@
+// Standard includes.
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+  using std::cout;
+  using std::endl;
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// ROOT includes.
+#include "TFileMerger.h"
+#include "TROOT.h"
+
+// Project includes.
+#include "cmdOptions.hpp"
+#include "myConfig.hpp"
+#include "myCutDatabase.hpp"
+#include "myFit.hpp"
+#include "myOther.hpp"
+#include "myRecMatrix.hpp"
+#include "myResiduals.hpp"
+#include "myShard.hpp"
+#include "mySolve.hpp"
+
+
+int shms_optics_merge(const cmdOptions::OptionParser_shmsOpticsMerge& cmdOpts);
+
+
+int main(int argc, char* argv[]) {
+  auto programStart = std::chrono::steady_clock::now();
+
+  // Parse command line options for shms_optics_merge.
+  cmdOptions::OptionParser_shmsOpticsMerge cmdOpts;
+  try {
+    cmdOpts.init(argc, argv);
+  }
+  catch (const std::runtime_error& err) {
+    cout << "shms_optics_merge: " << err.what() << endl;
+    cout << "shms_optics_merge: Try `shms_optics_merge -h` for more information." << endl;
+    return 1;
+  }
+  if (cmdOpts.displayHelp) {
+    cmdOpts.printHelp();
+    return 0;
+  }
+
+  // Nothing is drawn.
+  gROOT->SetBatch(kTRUE);
+
+  int retCode = 0;
+  try {
+    retCode = shms_optics_merge(cmdOpts);
+  }
+  catch (const std::runtime_error& err) {
+    cout << "shms_optics_merge: " << err.what() << endl;
+    retCode = 1;
+  }
+
+  std::chrono::duration<double> totalTime =
+    std::chrono::steady_clock::now() - programStart;
+  cout << "Total time " << totalTime.count() << " s." << endl;
+
+  return retCode;
+}
+
+
+int shms_optics_merge(const cmdOptions::OptionParser_shmsOpticsMerge& cmdOpts) {
+  cout
+    << "Reading config file:" << endl
+    << "  `" << cmdOpts.configFileName << "`" << endl;
+  config::Config conf = config::loadConfigFile(cmdOpts.configFileName);
+
+  RecMatrix recMatrixIndep, recMatrixDep;
+  readMatrices(conf.recMatrixFileNameOld, recMatrixIndep, recMatrixDep);
+  RecMatrix recMatrixNew = getNewRecMatrix(recMatrixIndep, conf.fitOrder);
+  const int recMatrixNewLen = static_cast<int>(recMatrixNew.size());
+  const std::uint64_t matrixHash =
+    getMatrixHash(recMatrixIndep, recMatrixDep, conf.xTarCorrIterNum);
+
+  const std::size_t nRuns = conf.runConfigs.size();
+  const int shardNum = cmdOpts.shardNum;
+
+  // Partial fits of all shards, which must come from the same config and
+  // matrices.
+  cout << "Reading partial fits of " << shardNum << " shards:" << endl;
+  std::vector<std::unique_ptr<std::ifstream> > shardFiles;
+  for (int iShard=0; iShard<shardNum; ++iShard) {
+    const std::string fileName = getShardFileName(
+      cmdOpts.rootFileName, iShard, shardNum, ".fit"
+    );
+    cout << "  `" << fileName << "`" << endl;
+    shardFiles.emplace_back(new std::ifstream(fileName, std::ios::binary));
+    if (!shardFiles.back()->is_open()) {
+      throw std::runtime_error("Could not open file: `"+fileName+"`!");
+    }
+
+    const ShardHeader header = readShardHeader(*shardFiles.back());
+    if (header.shardIndex != iShard || header.shardNum != shardNum) {
+      throw std::runtime_error(
+        "Shard file `"+fileName+"` is shard " + std::to_string(header.shardIndex) +
+        " of " + std::to_string(header.shardNum) + "!"
+      );
+    }
+    if (header.nRuns != nRuns || header.nTerms != recMatrixNewLen) {
+      throw std::runtime_error(
+        "Shard file `"+fileName+"` is for a different config file!"
+      );
+    }
+    if (header.matrixHash != matrixHash) {
+      throw std::runtime_error(
+        "Shard file `"+fileName+"` is for different matrices!"
+      );
+    }
+    // The shards must have kept what the merge needs.
+    if (header.robustLoss != cmdOpts.robustLoss) {
+      throw std::runtime_error(
+        "Shard file `"+fileName+"` is for `--irls "+header.robustLoss+
+        "`, not `"+cmdOpts.robustLoss+"`!"
+      );
+    }
+    if (
+      cmdOpts.bootstrapNum > 0 &&
+      header.blockUnit != cmdOpts.bootstrapUnit && header.blockUnit != "hole"
+    ) {
+      throw std::runtime_error(
+        "Shard file `"+fileName+"` has no blocks to bootstrap by "+
+        cmdOpts.bootstrapUnit+", run the shards with the same `--bootstrap` options!"
+      );
+    }
+  }
+
+  // Runs are merged in run order, as in a single process.
+  FitAccumulator fitAcc(recMatrixNewLen);
+  DesignCache designCache(recMatrixNewLen);
+  std::vector<FitAccumulator> holeBlocks;
+  std::vector<std::size_t> blockRuns;
+
+  std::ofstream residualsFile("residuals.txt");
+  writeResidualSummaryHeader(residualsFile);
+
+  for (std::size_t iRun=0; iRun<nRuns; ++iRun) {
+    const config::RunConfig& runConf = conf.runConfigs.at(iRun);
+    int iShard = 0;
+    while (!isShardRun(iRun, iShard, shardNum)) ++iShard;
+
+    RunResult result(recMatrixNewLen);
+    std::size_t iRunRead = 0;
+    if (
+      !readShardRun(*shardFiles.at(static_cast<std::size_t>(iShard)), iRunRead, result) ||
+      iRunRead != iRun
+    ) {
+      throw std::runtime_error(
+        "Shard " + std::to_string(iShard) + " has no result for run " +
+        std::to_string(runConf.runNumber) + "!"
+      );
+    }
+    if (
+      result.runNumber != runConf.runNumber ||
+      result.configHash != getRunConfigHash(runConf)
+    ) {
+      throw std::runtime_error(
+        "Shard " + std::to_string(iShard) + " has run " +
+        std::to_string(result.runNumber) + " with a different config than run " +
+        std::to_string(runConf.runNumber) + "!"
+      );
+    }
+
+    mergeRunResult(result, iRun, fitAcc, designCache, holeBlocks, blockRuns);
+    for (std::size_t iFoil=0; iFoil<result.summaries.size(); ++iFoil) {
+      writeResidualSummary(
+        residualsFile, 1, runConf.runNumber,
+        static_cast<int>(iFoil), result.summaries.at(iFoil)
+      );
+    }
+  }
+  residualsFile.close();
+
+  for (int iShard=0; iShard<shardNum; ++iShard) {
+    std::ifstream& shardFile = *shardFiles.at(static_cast<std::size_t>(iShard));
+    if (shardFile.peek() != std::char_traits<char>::eof()) {
+      throw std::runtime_error(
+        "Shard " + std::to_string(iShard) + " has more results than runs!"
+      );
+    }
+  }
+
+  solveFit(
+    fitAcc, designCache, cmdOpts.robustLoss, cmdOpts.robustIterNum,
+    recMatrixNew
+  );
+
+  // The fitted matrix is saved before the bootstrap, which may fail.
+  writeMatrices(conf.recMatrixFileNameNew, "", recMatrixNew, recMatrixDep);
+
+  if (cmdOpts.bootstrapNum > 0) {
+    bootstrap(
+      holeBlocks, blockRuns, nRuns,
+      cmdOpts.bootstrapNum, cmdOpts.bootstrapUnit,
+      getThreadNum(cmdOpts.threadNum),
+      conf.recMatrixFileNameNew, recMatrixNew
+    );
+  }
+
+  // Shards have different runs, so merging only collects their directories.
+  cout
+    << "Merging histograms to:" << endl
+    << "  `" << cmdOpts.rootFileName << "`" << endl;
+  TFileMerger merger(kFALSE);
+  if (!merger.OutputFile(cmdOpts.rootFileName.c_str(), "RECREATE")) {
+    throw std::runtime_error("Could not open file: `"+cmdOpts.rootFileName+"`!");
+  }
+  for (int iShard=0; iShard<shardNum; ++iShard) {
+    const std::string fileName =
+      getShardFileName(cmdOpts.rootFileName, iShard, shardNum);
+    if (!merger.AddFile(fileName.c_str(), kFALSE)) {
+      throw std::runtime_error("Could not open file: `"+fileName+"`!");
+    }
+  }
+  if (!merger.Merge()) {
+    throw std::runtime_error("Could not merge histograms of the shards!");
+  }
+
+  if (!cmdOpts.eventTreeFileName.empty()) {
+    cout
+      << "Merging diagnostic trees to:" << endl
+      << "  `" << cmdOpts.eventTreeFileName << "`" << endl;
+    TFileMerger treeMerger(kFALSE);
+    if (!treeMerger.OutputFile(cmdOpts.eventTreeFileName.c_str(), "RECREATE")) {
+      throw std::runtime_error("Could not open file: `"+cmdOpts.eventTreeFileName+"`!");
+    }
+    for (int iShard=0; iShard<shardNum; ++iShard) {
+      const std::string fileName =
+        getShardFileName(cmdOpts.eventTreeFileName, iShard, shardNum);
+      if (!treeMerger.AddFile(fileName.c_str(), kFALSE)) {
+        throw std::runtime_error("Could not open file: `"+fileName+"`!");
+      }
+    }
+    if (!treeMerger.Merge()) {
+      throw std::runtime_error("Could not merge diagnostic trees of the shards!");
+    }
+  }
+
+  if (!cmdOpts.cutsDbFileName.empty()) {
+    cout
+      << "Adding cuts of the shards to cut database:" << endl
+      << "  `" << cmdOpts.cutsDbFileName << "`" << endl;
+    CutDatabase cutDatabase = loadCutDatabase(cmdOpts.cutsDbFileName);
+    for (int iShard=0; iShard<shardNum; ++iShard) {
+      const CutDatabase shardDatabase = loadCutDatabase(
+        getShardFileName(cmdOpts.cutsDbFileName, iShard, shardNum)
+      );
+      for (const auto& record : shardDatabase.records) {
+        cutDatabase.store(
+          record.runNumber, record.configHash, record.matrixHash, record.cuts
+        );
+      }
+    }
+    writeCutDatabase(cmdOpts.cutsDbFileName, cutDatabase);
+    cout << "  " << cutDatabase.records.size() << " saved cuts" << endl;
+  }
+
+  return 0;
+}
@@ -5,12 +5,41 @@
 #include <stdexcept>
 
 
+// Helpers for flags with arguments.
+
+namespace {
+
+  std::string getOperand(const int& argc, const char* const* argv, int i) {
+    if (i == argc-1 || argv[i+1][0] == '-') {
+      std::string errorMsg = "Missing operand after `" + std::string(argv[i]) + "`.";
+      throw std::runtime_error(errorMsg.c_str());
+    }
+
+    return std::string(argv[i+1]);
+  }
+
+
+  int getIntOperand(const int& argc, const char* const* argv, int i) {
+    std::string operand = getOperand(argc, argv, i);
+    try {
+      return std::stoi(operand);
+    }
+    catch (const std::logic_error& err) {
+      std::string errorMsg = "Wrong type of operand after `" + std::string(argv[i]) + "` : `" + operand + "`.";
+      throw std::runtime_error(errorMsg.c_str());
+    }
+  }
+
+}
+
+
 // Implementation of OptionParser_reconstruct.
 
 cmdOptions::OptionParser_reconstruct::OptionParser_reconstruct() :
   displayHelp(false), automatic(false),
   rootFileName("out.root"), delay(2000),
-  configFileName(), matrixFileName()
+  configFileName(), matrixFileName(),
+  friendDirName(), threadNum(0), compression(101)
 {}
 
 
@@ -56,6 +85,26 @@ void cmdOptions::OptionParser_reconstruct::init(
         throw std::runtime_error(errorMsg.c_str());
       }
     }
+    else if (strcmp(argv[i], "--friend") == 0) {
+      friendDirName = getOperand(argc, argv, i);
+      ++i;
+    }
+    else if (strcmp(argv[i], "-j") == 0) {
+      threadNum = getIntOperand(argc, argv, i);
+      if (threadNum < 1) {
+        std::string errorMsg = "Number of threads must be positive.";
+        throw std::runtime_error(errorMsg.c_str());
+      }
+      ++i;
+    }
+    else if (strcmp(argv[i], "--compression") == 0) {
+      compression = getIntOperand(argc, argv, i);
+      if (compression < 0) {
+        std::string errorMsg = "Compression setting must not be negative.";
+        throw std::runtime_error(errorMsg.c_str());
+      }
+      ++i;
+    }
     // Check for invalid flags.
     else if (argv[i][0] == '-') {
       std::string errorMsg = "Invaid option `" + std::string(argv[i]) + "`.";
@@ -100,6 +149,12 @@ void cmdOptions::OptionParser_reconstruct::printHelp() {
   std::cout << "  -o ROOTout : save output ROOT file to `ROOTout`" << std::endl;
   std::cout << "  -d DELAY : delay when showing key plots (in miliseconds)" << std::endl;
   std::cout << "             default is `2000`" << std::endl;
+  std::cout << "  --friend DIR : instead of histograms, write the reconstructed target" << std::endl;
+  std::cout << "                 variables of each input file as friend tree `Trec` to" << std::endl;
+  std::cout << "                 `DIR`, in a file named after the input file with `_rec`" << std::endl;
+  std::cout << "  -j N : reconstruct friend trees on `N` threads, default is all cores" << std::endl;
+  std::cout << "  --compression N : ROOT compression setting of the friend trees," << std::endl;
+  std::cout << "                    100*algorithm + level, default is `101`" << std::endl;
 }
 
 
@@ -108,7 +163,18 @@ void cmdOptions::OptionParser_reconstruct::printHelp() {
 cmdOptions::OptionParser_shmsOptics::OptionParser_shmsOptics() :
   displayHelp(false), automatic(false),
   rootFileName("out.root"), delay(2000),
-  configFileName()
+  configFileName(),
+  robustLoss("ls"), robustIterNum(5),
+  iterationNum(1), refreshCuts(false),
+  threadNum(0), bootstrapNum(0), bootstrapUnit("hole"),
+  sweepFileName(), fitOffsets(false),
+  batch(false),
+  holeFitMethod("minuit"), holeFitCompare(false), holeFit2D(false), holeGrid(false),
+  foilMixture(false), quickLookNum(0), runJobNum(1), shardIndex(0), shardNum(0),
+  prefetchMB(0), pipeline(false), fileCache(false),
+  holeHists(false),
+  eventTreeFileName(), treeCompression(101), treeBasketSize(32000),
+  cutsDbFileName(), refreshRuns(), refreshFoils()
 {}
 
 
@@ -133,6 +199,10 @@ void cmdOptions::OptionParser_shmsOptics::init(
     if (strcmp(argv[i], "-a") == 0) {
       automatic = true;
     }
+    else if (strcmp(argv[i], "--batch") == 0) {
+      batch = true;
+      automatic = true;
+    }
     // Check for flags with arguments.
     else if (strcmp(argv[i], "-o") == 0) {
       if (i == argc-1 || argv[i+1][0] == '-') {
@@ -154,6 +224,178 @@ void cmdOptions::OptionParser_shmsOptics::init(
         throw std::runtime_error(errorMsg.c_str());
       }
     }
+    else if (strcmp(argv[i], "--irls") == 0) {
+      robustLoss = getOperand(argc, argv, i);
+      if (robustLoss != "ls" && robustLoss != "huber" && robustLoss != "tukey") {
+        std::string errorMsg = "Unknown robust loss `" + robustLoss + "`.";
+        throw std::runtime_error(errorMsg.c_str());
+      }
+      ++i;
+    }
+    else if (strcmp(argv[i], "--irls-iter") == 0) {
+      robustIterNum = getIntOperand(argc, argv, i);
+      if (robustIterNum < 1) {
+        std::string errorMsg = "Number of robust refit iterations must be positive.";
+        throw std::runtime_error(errorMsg.c_str());
+      }
+      ++i;
+    }
+    else if (strcmp(argv[i], "--iterations") == 0) {
+      iterationNum = getIntOperand(argc, argv, i);
+      if (iterationNum < 1) {
+        std::string errorMsg = "Number of iterations must be positive.";
+        throw std::runtime_error(errorMsg.c_str());
+      }
+      ++i;
+    }
+    else if (strcmp(argv[i], "--refresh-cuts") == 0) {
+      refreshCuts = true;
+    }
+    else if (strcmp(argv[i], "-j") == 0) {
+      threadNum = getIntOperand(argc, argv, i);
+      ++i;
+    }
+    else if (strcmp(argv[i], "--bootstrap") == 0) {
+      bootstrapNum = getIntOperand(argc, argv, i);
+      if (bootstrapNum < 2) {
+        std::string errorMsg = "Number of bootstrap replicas must be at least 2.";
+        throw std::runtime_error(errorMsg.c_str());
+      }
+      ++i;
+    }
+    else if (strcmp(argv[i], "--bootstrap-by") == 0) {
+      bootstrapUnit = getOperand(argc, argv, i);
+      if (bootstrapUnit != "hole" && bootstrapUnit != "run") {
+        std::string errorMsg = "Unknown bootstrap unit `" + bootstrapUnit + "`.";
+        throw std::runtime_error(errorMsg.c_str());
+      }
+      ++i;
+    }
+    else if (strcmp(argv[i], "--fit-offsets") == 0) {
+      fitOffsets = true;
+    }
+    else if (strcmp(argv[i], "--sweep") == 0) {
+      sweepFileName = getOperand(argc, argv, i);
+      ++i;
+    }
+    else if (strcmp(argv[i], "--hole-fit") == 0) {
+      holeFitMethod = getOperand(argc, argv, i);
+      if (
+        holeFitMethod != "minuit" && holeFitMethod != "moments" &&
+        holeFitMethod != "caruana"
+      ) {
+        std::string errorMsg = "Unknown hole fit method `" + holeFitMethod + "`.";
+        throw std::runtime_error(errorMsg.c_str());
+      }
+      ++i;
+    }
+    else if (strcmp(argv[i], "--hole-fit-compare") == 0) {
+      holeFitCompare = true;
+    }
+    else if (strcmp(argv[i], "--hole-fit-2d") == 0) {
+      holeFit2D = true;
+    }
+    else if (strcmp(argv[i], "--hole-grid") == 0) {
+      holeGrid = true;
+    }
+    else if (strcmp(argv[i], "--foil-em") == 0) {
+      foilMixture = true;
+    }
+    else if (strcmp(argv[i], "--quick-look") == 0) {
+      quickLookNum = getIntOperand(argc, argv, i);
+      if (quickLookNum < 1) {
+        std::string errorMsg = "Quick look subsample must be positive.";
+        throw std::runtime_error(errorMsg.c_str());
+      }
+      ++i;
+    }
+    else if (strcmp(argv[i], "--run-jobs") == 0) {
+      runJobNum = getIntOperand(argc, argv, i);
+      if (runJobNum < 1) {
+        std::string errorMsg = "Number of run jobs must be positive.";
+        throw std::runtime_error(errorMsg.c_str());
+      }
+      ++i;
+    }
+    else if (strcmp(argv[i], "--shard") == 0) {
+      std::string operand = getOperand(argc, argv, i);
+      std::size_t slash = operand.find('/');
+      try {
+        std::size_t nParsed = 0;
+        shardIndex = std::stoi(operand.substr(0, slash), &nParsed);
+        if (slash == std::string::npos || nParsed != slash) throw std::invalid_argument(operand);
+        shardNum = std::stoi(operand.substr(slash+1), &nParsed);
+        if (nParsed != operand.size()-slash-1) throw std::invalid_argument(operand);
+        if (shardIndex < 0 || shardNum < 1 || shardIndex >= shardNum) throw std::invalid_argument(operand);
+      }
+      catch (const std::logic_error& err) {
+        std::string errorMsg = "Operand of `--shard` must be I/N with 0 <= I < N, not `" + operand + "`.";
+        throw std::runtime_error(errorMsg.c_str());
+      }
+      ++i;
+    }
+    else if (strcmp(argv[i], "--prefetch") == 0) {
+      prefetchMB = getIntOperand(argc, argv, i);
+      if (prefetchMB < 1) {
+        std::string errorMsg = "Prefetch memory cap must be positive.";
+        throw std::runtime_error(errorMsg.c_str());
+      }
+      ++i;
+    }
+    else if (strcmp(argv[i], "--pipeline") == 0) {
+      pipeline = true;
+    }
+    else if (strcmp(argv[i], "--file-cache") == 0) {
+      fileCache = true;
+    }
+    else if (strcmp(argv[i], "--hole-hists") == 0) {
+      holeHists = true;
+    }
+    else if (strcmp(argv[i], "--event-tree") == 0) {
+      eventTreeFileName = getOperand(argc, argv, i);
+      ++i;
+    }
+    else if (strcmp(argv[i], "--tree-compression") == 0) {
+      treeCompression = getIntOperand(argc, argv, i);
+      if (treeCompression < 0) {
+        std::string errorMsg = "Tree compression setting must not be negative.";
+        throw std::runtime_error(errorMsg.c_str());
+      }
+      ++i;
+    }
+    else if (strcmp(argv[i], "--tree-basket") == 0) {
+      treeBasketSize = getIntOperand(argc, argv, i);
+      if (treeBasketSize < 1) {
+        std::string errorMsg = "Tree basket size must be positive.";
+        throw std::runtime_error(errorMsg.c_str());
+      }
+      ++i;
+    }
+    else if (strcmp(argv[i], "--cuts-db") == 0) {
+      cutsDbFileName = getOperand(argc, argv, i);
+      ++i;
+    }
+    else if (strcmp(argv[i], "--refresh-run") == 0) {
+      refreshRuns.push_back(getIntOperand(argc, argv, i));
+      ++i;
+    }
+    else if (strcmp(argv[i], "--refresh-foil") == 0) {
+      std::string operand = getOperand(argc, argv, i);
+      std::size_t colon = operand.find(':');
+      try {
+        std::size_t nParsed = 0;
+        int runNumber = std::stoi(operand.substr(0, colon), &nParsed);
+        if (colon == std::string::npos || nParsed != colon) throw std::invalid_argument(operand);
+        int iFoil = std::stoi(operand.substr(colon+1), &nParsed);
+        if (nParsed != operand.size()-colon-1 || iFoil < 0) throw std::invalid_argument(operand);
+        refreshFoils.push_back(std::make_pair(runNumber, iFoil));
+      }
+      catch (const std::logic_error& err) {
+        std::string errorMsg = "Operand of `--refresh-foil` must be RUN:FOIL, not `" + operand + "`.";
+        throw std::runtime_error(errorMsg.c_str());
+      }
+      ++i;
+    }
     // Check for invalid flags.
     else if (argv[i][0] == '-') {
       std::string errorMsg = "Invaid option `" + std::string(argv[i]) + "`.";
@@ -181,6 +423,17 @@ void cmdOptions::OptionParser_shmsOptics::init(
     std::string errorMsg = "Missing operand after `" + std::string(argv[argc-1]) + "`.";
     throw std::runtime_error(errorMsg.c_str());
   }
+
+  // Runs done in parallel cannot wait for the user.
+  if (runJobNum > 1 && !batch) {
+    std::string errorMsg = "Option `--run-jobs` needs `--batch`.";
+    throw std::runtime_error(errorMsg.c_str());
+  }
+  // Shards cannot share the matrix between iterations.
+  if (shardNum > 0 && iterationNum > 1) {
+    std::string errorMsg = "Option `--shard` cannot be used with `--iterations`.";
+    throw std::runtime_error(errorMsg.c_str());
+  }
 }
 
 
@@ -190,7 +443,195 @@ void cmdOptions::OptionParser_shmsOptics::printHelp() {
   std::cout << "[OPTION] :" << std::endl;
   std::cout << "  -h : display this help" << std::endl;
   std::cout << "  -a : proceed automatically, do not wait for input" << std::endl;
+  std::cout << "  --batch : run without interactive ROOT and canvases, implies `-a`" << std::endl;
   std::cout << "  -o ROOTout : save output ROOT file to `ROOTout`" << std::endl;
   std::cout << "  -d DELAY : delay when showing key plots (in miliseconds)" << std::endl;
   std::cout << "             default is `2000`" << std::endl;
+  std::cout << "  --irls LOSS : refit with iteratively reweighted least squares" << std::endl;
+  std::cout << "                LOSS is `ls` (no refit), `huber` or `tukey`" << std::endl;
+  std::cout << "                default is `ls`" << std::endl;
+  std::cout << "  --irls-iter N : number of reweighting iterations" << std::endl;
+  std::cout << "                  default is `5`" << std::endl;
+  std::cout << "  --iterations N : fit, reconstruct with the new matrix and refit N times" << std::endl;
+  std::cout << "                   default is `1`" << std::endl;
+  std::cout << "  --refresh-cuts : find foil and sieve hole cuts again in each iteration" << std::endl;
+  std::cout << "  -j N : number of threads, default is all hardware threads" << std::endl;
+  std::cout << "  --bootstrap N : estimate coefficient uncertainties from N bootstrap replicas" << std::endl;
+  std::cout << "  --bootstrap-by UNIT : resample `hole` (default) or `run`" << std::endl;
+  std::cout << "  --sweep SWEEP_F : only evaluate residuals for offsets listed in `SWEEP_F`" << std::endl;
+  std::cout << "                    and save them to `sweep.txt`, no fit is done" << std::endl;
+  std::cout << "  --fit-offsets : only fit theta and phi offsets and mispointing to the" << std::endl;
+  std::cout << "                  sieve and foil positions with the old matrix" << std::endl;
+  std::cout << "  --hole-fit METHOD : estimate sieve hole positions with `minuit` (default)," << std::endl;
+  std::cout << "                      `moments` or `caruana`" << std::endl;
+  std::cout << "  --hole-fit-compare : also fit every hole with Minuit and print the" << std::endl;
+  std::cout << "                       speed and agreement of the estimates" << std::endl;
+  std::cout << "  --hole-fit-2d : fit each sieve hole as a tilted 2D gaussian directly to" << std::endl;
+  std::cout << "                  the events instead of fitting its projections" << std::endl;
+  std::cout << "  --hole-grid : find sieve holes by matching the whole sieve grid to each" << std::endl;
+  std::cout << "                foil instead of by peaks in the projections" << std::endl;
+  std::cout << "  --foil-em : find the foils by a gaussian mixture fit in zVer and yTar," << std::endl;
+  std::cout << "              seeded from the foil positions" << std::endl;
+  std::cout << "  --quick-look N : find foils and sieve holes on a random subsample of `N`" << std::endl;
+  std::cout << "                   events of each run, then only select the full run" << std::endl;
+  std::cout << "  --run-jobs N : process `N` runs at the same time, needs `--batch`" << std::endl;
+  std::cout << "                 default is `1`" << std::endl;
+  std::cout << "  --shard I/N : process only runs `I`, `I+N`, ... of the config file and save" << std::endl;
+  std::cout << "                the partial fit for `shms_optics_merge`, output file names" << std::endl;
+  std::cout << "                get a `_shard<I>of<N>` suffix" << std::endl;
+  std::cout << "  --prefetch MB : read the next run in the background while a run is" << std::endl;
+  std::cout << "                  processed, if its events fit in `MB` megabytes" << std::endl;
+  std::cout << "  --pipeline : reconstruct the events of a run in batches while the rest is" << std::endl;
+  std::cout << "               read" << std::endl;
+  std::cout << "  --file-cache : read input files used by several runs only once and keep" << std::endl;
+  std::cout << "                 them until the last of these runs has read them" << std::endl;
+  std::cout << "  --hole-hists : book, draw and save 1D residual histograms of each foil and" << std::endl;
+  std::cout << "                 sieve row or column" << std::endl;
+  std::cout << "  --event-tree TREE_F : save the selected events of the last iteration with" << std::endl;
+  std::cout << "                        their true and reconstructed target variables to" << std::endl;
+  std::cout << "                        tree `T` in `TREE_F`" << std::endl;
+  std::cout << "  --tree-compression N : ROOT compression setting of `TREE_F`, 100*algorithm" << std::endl;
+  std::cout << "                         + level, default is `101`" << std::endl;
+  std::cout << "  --tree-basket BYTES : basket size of the branches of `T`, default is" << std::endl;
+  std::cout << "                        `32000`" << std::endl;
+  std::cout << "  --cuts-db CUTS_F : reuse foil and sieve hole cuts saved in `CUTS_F` for the" << std::endl;
+  std::cout << "                     same run, configuration and matrices, save new ones to it" << std::endl;
+  std::cout << "  --refresh-run RUN : find all cuts of run `RUN` again, can be repeated" << std::endl;
+  std::cout << "  --refresh-foil RUN:FOIL : find the sieve holes of foil `FOIL` of run `RUN`" << std::endl;
+  std::cout << "                            again, can be repeated" << std::endl;
+}
+
+
+// Implementation of OptionParser_shmsOpticsMerge.
+
+cmdOptions::OptionParser_shmsOpticsMerge::OptionParser_shmsOpticsMerge() :
+  displayHelp(false),
+  rootFileName("out.root"), configFileName(), shardNum(0),
+  robustLoss("ls"), robustIterNum(5),
+  threadNum(0), bootstrapNum(0), bootstrapUnit("hole"),
+  cutsDbFileName(), eventTreeFileName()
+{}
+
+
+cmdOptions::OptionParser_shmsOpticsMerge::~OptionParser_shmsOpticsMerge() {}
+
+
+void cmdOptions::OptionParser_shmsOpticsMerge::init(
+  const int& argc, const char* const* argv
+) {
+  int operands = 0;
+
+  // First check for -h flag and ignore others.
+  for (int i=1; i<argc; ++i) {
+    if (strcmp(argv[i], "-h") == 0) {
+      displayHelp = true;
+      return;
+    }
+  }
+
+  for (int i=1; i<argc; ++i) {
+    // Check for flags with arguments.
+    if (strcmp(argv[i], "-o") == 0) {
+      rootFileName = getOperand(argc, argv, i);
+      ++i;
+    }
+    else if (strcmp(argv[i], "--shards") == 0) {
+      shardNum = getIntOperand(argc, argv, i);
+      if (shardNum < 1) {
+        std::string errorMsg = "Number of shards must be positive.";
+        throw std::runtime_error(errorMsg.c_str());
+      }
+      ++i;
+    }
+    else if (strcmp(argv[i], "--irls") == 0) {
+      robustLoss = getOperand(argc, argv, i);
+      if (robustLoss != "ls" && robustLoss != "huber" && robustLoss != "tukey") {
+        std::string errorMsg = "Unknown robust loss `" + robustLoss + "`.";
+        throw std::runtime_error(errorMsg.c_str());
+      }
+      ++i;
+    }
+    else if (strcmp(argv[i], "--irls-iter") == 0) {
+      robustIterNum = getIntOperand(argc, argv, i);
+      if (robustIterNum < 1) {
+        std::string errorMsg = "Number of robust refit iterations must be positive.";
+        throw std::runtime_error(errorMsg.c_str());
+      }
+      ++i;
+    }
+    else if (strcmp(argv[i], "-j") == 0) {
+      threadNum = getIntOperand(argc, argv, i);
+      ++i;
+    }
+    else if (strcmp(argv[i], "--bootstrap") == 0) {
+      bootstrapNum = getIntOperand(argc, argv, i);
+      if (bootstrapNum < 2) {
+        std::string errorMsg = "Number of bootstrap replicas must be at least 2.";
+        throw std::runtime_error(errorMsg.c_str());
+      }
+      ++i;
+    }
+    else if (strcmp(argv[i], "--bootstrap-by") == 0) {
+      bootstrapUnit = getOperand(argc, argv, i);
+      if (bootstrapUnit != "hole" && bootstrapUnit != "run") {
+        std::string errorMsg = "Unknown bootstrap unit `" + bootstrapUnit + "`.";
+        throw std::runtime_error(errorMsg.c_str());
+      }
+      ++i;
+    }
+    else if (strcmp(argv[i], "--cuts-db") == 0) {
+      cutsDbFileName = getOperand(argc, argv, i);
+      ++i;
+    }
+    else if (strcmp(argv[i], "--event-tree") == 0) {
+      eventTreeFileName = getOperand(argc, argv, i);
+      ++i;
+    }
+    // Check for invalid flags.
+    else if (argv[i][0] == '-') {
+      std::string errorMsg = "Invaid option `" + std::string(argv[i]) + "`.";
+      throw std::runtime_error(errorMsg.c_str());
+    }
+    // Here is our one filename.
+    else if (operands == 0) {
+      configFileName = std::string(argv[i]);
+      ++operands;
+    }
+    // Only one filename :)
+    else {
+      std::string errorMsg = "Extra operand `" + std::string(argv[i]) + "`.";
+      throw std::runtime_error(errorMsg.c_str());
+    }
+  }
+
+  // Check if we got one filename.
+  if (operands != 1) {
+    std::string errorMsg = "Missing operand after `" + std::string(argv[argc-1]) + "`.";
+    throw std::runtime_error(errorMsg.c_str());
+  }
+  if (shardNum == 0) {
+    std::string errorMsg = "Missing option `--shards`.";
+    throw std::runtime_error(errorMsg.c_str());
+  }
+}
+
+
+void cmdOptions::OptionParser_shmsOpticsMerge::printHelp() {
+  std::cout << "Usage: shms_optics_merge [OPTION]... --shards N CONFIG_F" << std::endl << std::endl;
+  std::cout << "CONFIG_F : configuration file name the shards were run with" << std::endl;
+  std::cout << "[OPTION] :" << std::endl;
+  std::cout << "  -h : display this help" << std::endl;
+  std::cout << "  --shards N : merge the `N` shards of `shms_optics --shard I/N`" << std::endl;
+  std::cout << "  -o ROOTout : output ROOT file name the shards were run with, the merged" << std::endl;
+  std::cout << "               histograms are saved to it" << std::endl;
+  std::cout << "               default is `out.root`" << std::endl;
+  std::cout << "  --irls LOSS : refit with iteratively reweighted least squares" << std::endl;
+  std::cout << "                LOSS is `ls` (no refit), `huber` or `tukey`" << std::endl;
+  std::cout << "                default is `ls`" << std::endl;
+  std::cout << "  --irls-iter N : number of reweighting iterations, default is `5`" << std::endl;
+  std::cout << "  -j N : number of threads for the bootstrap, default is all hardware threads" << std::endl;
+  std::cout << "  --bootstrap N : estimate coefficient uncertainties from `N` replicas" << std::endl;
+  std::cout << "  --bootstrap-by UNIT : resample `hole`s (default) or `run`s" << std::endl;
+  std::cout << "  --cuts-db CUTS_F : add the cuts saved by the shards to `CUTS_F`" << std::endl;
+  std::cout << "  --event-tree TREE_F : merge the diagnostic trees of the shards into `TREE_F`" << std::endl;
 }
@@ -0,0 +1,153 @@
+#include "myBootstrap.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+#include "TDecompSVD.h"
+#include "TMatrixD.h"
+#include "TVectorD.h"
+
+
+// BootstrapResult implementation.
+
+BootstrapResult::BootstrapResult() :
+  xpTarSigmas(), yTarSigmas(), ypTarSigmas(),
+  xpTarResolution(0.0), yTarResolution(0.0), ypTarResolution(0.0),
+  nReplicas(0), nFailed(0)
+{}
+
+
+BootstrapResult::~BootstrapResult() {}
+
+
+// Implementation of functions.
+
+BootstrapResult bootstrapFit(
+  const std::vector<FitAccumulator>& blocks,
+  int nReplicas, int nThreads, unsigned int seed
+) {
+  if (blocks.empty()) {
+    throw std::runtime_error("No blocks to bootstrap!");
+  }
+  if (nReplicas < 2) {
+    throw std::runtime_error("Need at least 2 bootstrap replicas!");
+  }
+  if (nThreads < 1) nThreads = 1;
+
+  const int nTerms = blocks.front().nTerms;
+  const std::size_t n = static_cast<std::size_t>(nTerms);
+  const std::size_t nBlocks = blocks.size();
+  const std::size_t nReps = static_cast<std::size_t>(nReplicas);
+
+  // Coefficients of all replicas, nTerms per replica.
+  std::vector<std::vector<double> > coeffss(3, std::vector<double>(nReps*n));
+  std::vector<char> successes(nReps, 0);
+
+  auto solveReplicas = [&](std::size_t iThread) {
+    std::vector<int> counts(nBlocks);
+    for (std::size_t iRep=iThread; iRep<nReps; iRep+=static_cast<std::size_t>(nThreads)) {
+      // Each replica has its own random stream, so that the result does not
+      // depend on how replicas are spread over threads.
+      std::seed_seq seq{seed, static_cast<unsigned int>(iRep)};
+      std::mt19937 gen(seq);
+      std::uniform_int_distribution<std::size_t> pick(0, nBlocks-1);
+
+      std::fill(counts.begin(), counts.end(), 0);
+      for (std::size_t i=0; i<nBlocks; ++i) ++counts[pick(gen)];
+
+      FitAccumulator replica(nTerms);
+      for (std::size_t iBlock=0; iBlock<nBlocks; ++iBlock) {
+        if (counts[iBlock] == 0) continue;
+        replica.add(blocks[iBlock], static_cast<double>(counts[iBlock]));
+      }
+
+      TVectorD xpTarVec = replica.getXpTarFitVector();
+      TVectorD yTarVec = replica.getYTarFitVector();
+      TVectorD ypTarVec = replica.getYpTarFitVector();
+      TDecompSVD fitSVD(replica.getFitMatrix());
+      bool success =
+        fitSVD.Solve(xpTarVec) && fitSVD.Solve(yTarVec) && fitSVD.Solve(ypTarVec);
+      if (!success) continue;
+
+      for (std::size_t i=0; i<n; ++i) {
+        const Int_t iTerm = static_cast<Int_t>(i);
+        coeffss[0][iRep*n+i] = xpTarVec(iTerm);
+        coeffss[1][iRep*n+i] = yTarVec(iTerm);
+        coeffss[2][iRep*n+i] = ypTarVec(iTerm);
+      }
+      successes[iRep] = 1;
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (int iThread=1; iThread<nThreads; ++iThread) {
+    threads.push_back(std::thread(solveReplicas, static_cast<std::size_t>(iThread)));
+  }
+  solveReplicas(0);
+  for (auto& thread : threads) thread.join();
+
+  BootstrapResult result;
+  result.nReplicas = nReplicas;
+  for (const auto& success : successes) if (!success) ++result.nFailed;
+  const double nGood = static_cast<double>(nReplicas - result.nFailed);
+  if (nGood < 2) {
+    throw std::runtime_error("Too few successful bootstrap replicas!");
+  }
+
+  // Gram matrix and total weight of the full sample, for propagating the
+  // coefficient covariance to the reconstructed quantities.
+  FitAccumulator full(nTerms);
+  for (const auto& block : blocks) full.add(block);
+  TMatrixD gram = full.getFitMatrix();
+
+  std::vector<std::vector<double>*> sigmass = {
+    &result.xpTarSigmas, &result.yTarSigmas, &result.ypTarSigmas
+  };
+  std::vector<double*> resolutions = {
+    &result.xpTarResolution, &result.yTarResolution, &result.ypTarResolution
+  };
+  std::vector<double> means(n);
+  std::vector<double> diffs(n);
+
+  for (std::size_t iVar=0; iVar<3; ++iVar) {
+    const std::vector<double>& coeffs = coeffss[iVar];
+
+    std::fill(means.begin(), means.end(), 0.0);
+    for (std::size_t iRep=0; iRep<nReps; ++iRep) {
+      if (!successes[iRep]) continue;
+      for (std::size_t i=0; i<n; ++i) means[i] += coeffs[iRep*n+i];
+    }
+    for (auto& mean : means) mean /= nGood;
+
+    std::vector<double>& sigmas = *sigmass[iVar];
+    sigmas.assign(n, 0.0);
+    // Sum over replicas of d^T G d, with d the deviation from mean.
+    double propagated = 0.0;
+    for (std::size_t iRep=0; iRep<nReps; ++iRep) {
+      if (!successes[iRep]) continue;
+      for (std::size_t i=0; i<n; ++i) {
+        diffs[i] = coeffs[iRep*n+i] - means[i];
+        sigmas[i] += diffs[i]*diffs[i];
+      }
+      for (std::size_t i=0; i<n; ++i) {
+        for (std::size_t j=0; j<n; ++j) {
+          propagated +=
+            diffs[i] * gram(static_cast<Int_t>(i), static_cast<Int_t>(j)) * diffs[j];
+        }
+      }
+    }
+    for (auto& sigma : sigmas) sigma = std::sqrt(sigma/(nGood-1.0));
+
+    if (full.sumWeights > 0.0) {
+      *resolutions[iVar] = std::sqrt(propagated/(nGood-1.0)/full.sumWeights);
+    }
+  }
+  // yTar matrix elements give yTar in m.
+  result.yTarResolution *= 100.0;
+
+  return result;
+}
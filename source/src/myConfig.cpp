@@ -39,7 +39,8 @@ config::SieveConfig::~SieveConfig() {}
 
 config::RunConfig::RunConfig() :
   runNumber(0), fileList(), cuts(""), zFoils(),
-  beam(), SHMS(), sievetype(0), sieve(), use2017Corr(0), Theta()
+  beam(), SHMS(), sievetype(0), sieve(), use2017Corr(0), Theta(),
+  weight(1.0), foilWeights()
 {}
 
 config::RunConfig::~RunConfig() {}
@@ -77,6 +78,12 @@ std::vector<double> config::RunConfig::getSieveHolesY() const {
   return ySieveHoles;
 }
 
+double config::RunConfig::getFoilWeight(size_t iFoil) const {
+  if (iFoil < foilWeights.size()) return foilWeights.at(iFoil);
+
+  return 1.0;
+}
+
 // Config implementation.
 
 config::Config::Config() :
@@ -174,6 +181,14 @@ config::Config config::loadConfigFile(const std::string& fname) {
       //correction applied to 2017 data prior to optimization, corrects yTar ypTar dependence
       conf.runConfigs.back().use2017Corr = stod(tokens[1]);
     }
+    else if (tokens[0] == "runweight") {
+      conf.runConfigs.back().weight = stod(tokens[1]);
+    }
+    else if (tokens[0] == "foilweight") {
+      for (size_t i=1; i<tokens.size(); ++i) {
+        conf.runConfigs.back().foilWeights.push_back(stod(tokens.at(i)));
+      }
+    }
   }
 
   double thetaOffset;
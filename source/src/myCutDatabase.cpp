@@ -0,0 +1,323 @@
+#include "myCutDatabase.hpp"
+
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+
+namespace {
+
+  // Version 2 changed the matrix hash, version 3 the run config hash.
+  const int cutDatabaseVersion = 3;
+
+
+  // 64-bit FNV-1a, stable between compilers and runs unlike std::hash.
+  std::uint64_t hashString(const std::string& str) {
+    std::uint64_t hash = 14695981039346656037ULL;
+    for (const char c : str) {
+      hash ^= static_cast<unsigned char>(c);
+      hash *= 1099511628211ULL;
+    }
+
+    return hash;
+  }
+
+
+  std::string formatHash(std::uint64_t hash) {
+    std::ostringstream oss;
+    oss << std::hex << std::setw(16) << std::setfill('0') << hash;
+
+    return oss.str();
+  }
+
+
+  std::uint64_t parseHash(const std::string& str) {
+    std::size_t nParsed = 0;
+    std::uint64_t hash = std::stoull(str, &nParsed, 16);
+    if (nParsed != str.size()) {
+      throw std::runtime_error("Invalid hash `"+str+"` in cut database!");
+    }
+
+    return hash;
+  }
+
+
+  void writePeak(std::ostream& os, const Peak& peak) {
+    os << " " << peak.norm << " " << peak.mean << " " << peak.sigma;
+  }
+
+
+  Peak readPeak(const std::vector<std::string>& tokens, std::size_t first) {
+    return Peak(
+      stod(tokens.at(first)), stod(tokens.at(first+1)), stod(tokens.at(first+2))
+    );
+  }
+
+}
+
+
+// CutRecord implementation.
+
+CutRecord::CutRecord() :
+  runNumber(0), configHash(0), matrixHash(0), cuts()
+{}
+
+
+CutRecord::~CutRecord() {}
+
+
+// CutDatabase implementation.
+
+CutDatabase::CutDatabase() : records() {}
+
+
+CutDatabase::~CutDatabase() {}
+
+
+const RunCuts* CutDatabase::find(
+  int runNumber, std::uint64_t configHash, std::uint64_t matrixHash
+) const {
+  for (const auto& record : records) {
+    if (
+      record.runNumber == runNumber &&
+      record.configHash == configHash && record.matrixHash == matrixHash
+    ) {
+      return &record.cuts;
+    }
+  }
+
+  return NULL;
+}
+
+
+void CutDatabase::store(
+  int runNumber, std::uint64_t configHash, std::uint64_t matrixHash,
+  const RunCuts& cuts
+) {
+  for (auto& record : records) {
+    if (
+      record.runNumber == runNumber &&
+      record.configHash == configHash && record.matrixHash == matrixHash
+    ) {
+      record.cuts = cuts;
+      return;
+    }
+  }
+
+  records.push_back(CutRecord());
+  records.back().runNumber = runNumber;
+  records.back().configHash = configHash;
+  records.back().matrixHash = matrixHash;
+  records.back().cuts = cuts;
+}
+
+
+// Implementation of functions.
+
+std::uint64_t getRunConfigHash(const config::RunConfig& runConf) {
+  std::ostringstream oss;
+  oss << std::setprecision(std::numeric_limits<double>::max_digits10);
+
+  oss << runConf.runNumber << "\n";
+  for (const auto& fileName : runConf.fileList) oss << fileName << "\n";
+  oss << runConf.cuts << "\n";
+  for (const auto& zFoil : runConf.zFoils) oss << zFoil << " ";
+  oss << "\n";
+  oss
+    << runConf.beam.x0 << " " << runConf.beam.y0 << " "
+    << runConf.beam.xp0 << " " << runConf.beam.yp0 << "\n";
+  // Angles of the input files, used to reconstruct their events.
+  for (const auto& theta : runConf.Theta) oss << theta << " ";
+  oss << "\n";
+  oss
+    << runConf.SHMS.thetaCentral << " "
+    << runConf.SHMS.thetaOffset << " " << runConf.SHMS.phiOffset << " "
+    << runConf.SHMS.xMispointing << " " << runConf.SHMS.yMispointing << "\n";
+  oss
+    << runConf.sievetype << " "
+    << runConf.sieve.nRow << " " << runConf.sieve.nCol << " "
+    << runConf.sieve.xHoleMin << " " << runConf.sieve.yHoleMin << " "
+    << runConf.sieve.xHoleSpace << " " << runConf.sieve.yHoleSpace << " "
+    << runConf.sieve.x0 << " " << runConf.sieve.y0 << " "
+    << runConf.sieve.z0 << "\n";
+  oss << runConf.use2017Corr << "\n";
+
+  return hashString(oss.str());
+}
+
+
+std::uint64_t getMatrixHash(
+  const RecMatrix& recMatrixIndep, const RecMatrix& recMatrixDep,
+  int xTarCorrIterNum
+) {
+  std::ostringstream oss;
+  oss << std::setprecision(std::numeric_limits<double>::max_digits10);
+
+  for (const RecMatrix* recMatrix : {&recMatrixIndep, &recMatrixDep}) {
+    for (const auto& line : recMatrix->matrix) {
+      oss
+        << line.C_Xp << " " << line.C_Y << " "
+        << line.C_Yp << " " << line.C_D << " "
+        << line.E_x << " " << line.E_xp << " " << line.E_y << " "
+        << line.E_yp << " " << line.E_xTar
+        << "\n";
+    }
+    oss << "---\n";
+  }
+  oss << xTarCorrIterNum << "\n";
+
+  return hashString(oss.str());
+}
+
+
+CutDatabase loadCutDatabase(const std::string& fileName) {
+  CutDatabase database;
+
+  std::ifstream ifs(fileName);
+  if (!ifs.is_open()) return database;
+
+  std::string line;
+  std::vector<std::string> tokens;
+  bool versionFound = false;
+  CutRecord* record = NULL;
+
+  while (getline(ifs, line)) {
+    if (line.empty()) continue;
+
+    tokens = config::tokenize(line);
+    if (tokens.empty() || tokens[0][0] == '#') continue;
+
+    if (tokens[0] == "version") {
+      if (tokens.size() != 2 || stoi(tokens[1]) != cutDatabaseVersion) {
+        throw std::runtime_error(
+          "Unsupported version of cut database `"+fileName+"`: `"+line+"`!"
+        );
+      }
+      versionFound = true;
+      continue;
+    }
+    if (!versionFound) {
+      throw std::runtime_error("Cut database `"+fileName+"` has no version!");
+    }
+
+    if (tokens[0] == "run") {
+      if (tokens.size() != 4) {
+        throw std::runtime_error("Cut database run needs 3 values: `"+line+"`!");
+      }
+      database.records.push_back(CutRecord());
+      record = &database.records.back();
+      record->runNumber = stoi(tokens[1]);
+      record->configHash = parseHash(tokens[2]);
+      record->matrixHash = parseHash(tokens[3]);
+      continue;
+    }
+    if (!record) {
+      throw std::runtime_error("Cut database entry before any run: `"+line+"`!");
+    }
+
+    RunCuts& cuts = record->cuts;
+    if (tokens[0] == "zver" && tokens.size() == 4) {
+      cuts.zVerPeaks.push_back(readPeak(tokens, 1));
+      cuts.xSievePeakss.resize(cuts.zVerPeaks.size());
+      cuts.ySievePeakss.resize(cuts.zVerPeaks.size());
+      cuts.xSieveIndexess.resize(cuts.zVerPeaks.size());
+      cuts.ySieveIndexess.resize(cuts.zVerPeaks.size());
+      cuts.sieveCorrelationss.resize(cuts.zVerPeaks.size());
+    }
+    else if (tokens[0] == "ytar" && tokens.size() == 4) {
+      cuts.yTarPeaks.push_back(readPeak(tokens, 1));
+    }
+    else if (tokens[0] == "hole" && (tokens.size() == 10 || tokens.size() == 11)) {
+      const std::size_t iFoil = stoul(tokens[1]);
+      if (iFoil >= cuts.zVerPeaks.size()) {
+        throw std::runtime_error("Cut database hole of unknown foil: `"+line+"`!");
+      }
+      cuts.xSievePeakss.at(iFoil).push_back(readPeak(tokens, 2));
+      cuts.ySievePeakss.at(iFoil).push_back(readPeak(tokens, 5));
+      cuts.xSieveIndexess.at(iFoil).push_back(stoul(tokens[8]));
+      cuts.ySieveIndexess.at(iFoil).push_back(stoul(tokens[9]));
+      if (tokens.size() == 11) {
+        cuts.sieveCorrelationss.at(iFoil).push_back(stod(tokens[10]));
+      }
+    }
+    else {
+      throw std::runtime_error("Invalid cut database entry: `"+line+"`!");
+    }
+  }
+
+  // Correlations are given for all holes of a foil or for none.
+  for (const auto& record : database.records) {
+    const RunCuts& cuts = record.cuts;
+    if (cuts.yTarPeaks.size() != cuts.zVerPeaks.size()) {
+      throw std::runtime_error(
+        "Cut database has different number of zVer and yTar peaks for run " +
+        std::to_string(record.runNumber) + "!"
+      );
+    }
+    for (std::size_t iFoil=0; iFoil<cuts.zVerPeaks.size(); ++iFoil) {
+      const std::size_t nCorrelations = cuts.sieveCorrelationss.at(iFoil).size();
+      if (nCorrelations != 0 && nCorrelations != cuts.xSievePeakss.at(iFoil).size()) {
+        throw std::runtime_error(
+          "Cut database has correlations for some holes only for run " +
+          std::to_string(record.runNumber) + "!"
+        );
+      }
+    }
+  }
+
+  return database;
+}
+
+
+void writeCutDatabase(const std::string& fileName, const CutDatabase& database) {
+  std::ofstream ofs(fileName);
+  if (!ofs.is_open()) {
+    throw std::runtime_error("Could not open file: `"+fileName+"`!");
+  }
+  ofs << std::setprecision(std::numeric_limits<double>::max_digits10);
+
+  ofs
+    << "# Foil and sieve hole cuts of shms_optics." << std::endl
+    << "# run NUMBER CONFIG_HASH MATRIX_HASH" << std::endl
+    << "# zver NORM MEAN SIGMA" << std::endl
+    << "# ytar NORM MEAN SIGMA" << std::endl
+    << "# hole FOIL X_NORM X_MEAN X_SIGMA Y_NORM Y_MEAN Y_SIGMA X_INDEX Y_INDEX [CORRELATION]" << std::endl
+    << "version " << cutDatabaseVersion << std::endl;
+
+  for (const auto& record : database.records) {
+    const RunCuts& cuts = record.cuts;
+    ofs
+      << std::endl
+      << "run " << record.runNumber << " "
+      << formatHash(record.configHash) << " "
+      << formatHash(record.matrixHash) << std::endl;
+
+    for (const auto& peak : cuts.zVerPeaks) {
+      ofs << "zver";
+      writePeak(ofs, peak);
+      ofs << std::endl;
+    }
+    for (const auto& peak : cuts.yTarPeaks) {
+      ofs << "ytar";
+      writePeak(ofs, peak);
+      ofs << std::endl;
+    }
+    for (std::size_t iFoil=0; iFoil<cuts.xSievePeakss.size(); ++iFoil) {
+      const std::vector<double>& correlations = cuts.sieveCorrelationss.at(iFoil);
+      for (std::size_t iHole=0; iHole<cuts.xSievePeakss.at(iFoil).size(); ++iHole) {
+        ofs << "hole " << iFoil;
+        writePeak(ofs, cuts.xSievePeakss.at(iFoil).at(iHole));
+        writePeak(ofs, cuts.ySievePeakss.at(iFoil).at(iHole));
+        ofs
+          << " " << cuts.xSieveIndexess.at(iFoil).at(iHole)
+          << " " << cuts.ySieveIndexess.at(iFoil).at(iHole);
+        if (!correlations.empty()) ofs << " " << correlations.at(iHole);
+        ofs << std::endl;
+      }
+    }
+  }
+
+  ofs.close();
+}
@@ -3,9 +3,13 @@
 // ROOT includes.
 #include "TChain.h"
 #include "TTree.h"
+#include <algorithm>
 #include <iostream>
+#include <random>
 #include "TFile.h"
 
+#include "myFileCache.hpp"
+
 
 
 // Implementation of Event.
@@ -48,62 +52,262 @@ void Event::reset() {
 }
 
 
+// Implementation of EventColumns.
+
+EventColumns::EventColumns() :
+  xFp(), yFp(), xpFp(), ypFp(), xVer(), yVer(), delta()
+{}
+
+
+EventColumns::~EventColumns() {}
+
+
+std::size_t EventColumns::size() const {
+  return xFp.size();
+}
+
+
+std::size_t EventColumns::getBytes() const {
+  return 7*xFp.capacity()*sizeof(double);
+}
+
+
+void EventColumns::reserve(std::size_t nEvents) {
+  xFp.reserve(nEvents);
+  yFp.reserve(nEvents);
+  xpFp.reserve(nEvents);
+  ypFp.reserve(nEvents);
+  xVer.reserve(nEvents);
+  yVer.reserve(nEvents);
+  delta.reserve(nEvents);
+}
+
+
 // Implementation of other functions.
 
-std::vector<Event> readEvents(const config::RunConfig& runConf) {
-  Double_t hsxfp, hsyfp, hsxpfp, hsypfp, frx_cm, fry_cm, dp;
+namespace {
 
-  Long64_t entriesTotal = 0.0;
+  Long64_t countEntries(const config::RunConfig& runConf) {
+    Long64_t entriesTotal = 0.0;
 
-  //std::cout<<"entries: "<<entriesTotal<<std::endl;
+    //std::cout<<"entries: "<<entriesTotal<<std::endl;
 
-  for (const auto& fileName : runConf.fileList) {
-    //std::cout<<"Filename: "<<fileName<<std::endl;
+    for (const auto& fileName : runConf.fileList) {
+      //std::cout<<"Filename: "<<fileName<<std::endl;
 
-    TFile *f = new TFile(fileName.c_str());
-    TTree *tree = (TTree*)f->Get("T");
-    Long64_t nEntries = tree->GetEntries();
-    entriesTotal += nEntries;
+      TFile *f = new TFile(fileName.c_str());
+      TTree *tree = (TTree*)f->Get("T");
+      Long64_t nEntries = tree->GetEntries();
+      entriesTotal += nEntries;
+      f->Close();
+      delete f;
+    }
+
+    return entriesTotal;
   }
 
-  std::vector<Event> events(static_cast<std::size_t>(entriesTotal));
-  std::vector<Event>::iterator it = events.begin();
-  int iList = 0;
-  for (const auto& fileName : runConf.fileList) {
-
-    double iTheta = runConf.Theta.at(iList); 
-    TFile *f = new TFile(fileName.c_str());
-    TTree *tree = (TTree*)f->Get("T");
-
-    tree->SetBranchAddress("P.dc.x_fp", &hsxfp);
-    tree->SetBranchAddress("P.dc.y_fp", &hsyfp);
-    tree->SetBranchAddress("P.dc.xp_fp", &hsxpfp);
-    tree->SetBranchAddress("P.dc.yp_fp", &hsypfp);
-    tree->SetBranchAddress("P.react.x", &frx_cm);
-    tree->SetBranchAddress("P.react.y", &fry_cm);
-    tree->SetBranchAddress("P.gtr.dp", &dp);
-    
-   
-    Long64_t nEntries = tree->GetEntries();
-    //nEntries = 10000;  // TMP    
-    for (Long64_t iEntry=0; iEntry<nEntries; ++iEntry) {
-      tree->GetEntry(iEntry);
+
+  // Read the events at the given entries, counted over all files in
+  // increasing order, or all entries if entries is NULL, and pass them to
+  // push in batches of batchSize events, the last one possibly smaller.
+  // Without entries, files shared with other runs are taken from cache.
+  void readEntries(
+    const config::RunConfig& runConf, const std::vector<Long64_t>* entries,
+    std::size_t batchSize, const std::function<void(std::vector<Event>&)>& push,
+    EventFileCache* cache
+  ) {
+    Double_t hsxfp, hsyfp, hsxpfp, hsypfp, frx_cm, fry_cm, dp;
+
+    std::vector<Event> batch;
+    batch.reserve(batchSize);
+    std::size_t iNext = 0;
+    Long64_t firstEntry = 0;
+    int iList = 0;
+    for (const auto& fileName : runConf.fileList) {
+
+      double iTheta = runConf.Theta.at(iList); 
+
+      if (cache && !entries && cache->isShared(fileName, runConf.cuts)) {
+        const std::shared_ptr<const EventColumns> columns =
+          cache->get(fileName, runConf.cuts);
+        for (std::size_t iEntry=0; iEntry<columns->size(); ++iEntry) {
+          batch.emplace_back();
+          Event& event = batch.back();
+          event.xFp = columns->xFp[iEntry];
+          event.yFp = columns->yFp[iEntry];
+          event.xpFp = columns->xpFp[iEntry];
+          event.ypFp = columns->ypFp[iEntry];
+          event.delta = columns->delta[iEntry];
+          event.xVer = columns->xVer[iEntry];
+          event.yVer = columns->yVer[iEntry];
+          event.theta = iTheta;
+
+          if (batch.size() == batchSize) {
+            push(batch);
+            batch.clear();
+            batch.reserve(batchSize);
+          }
+        }
+        cache->release(fileName, runConf.cuts);
+        firstEntry += static_cast<Long64_t>(columns->size());
+        iList++;
+        continue;
+      }
+
+      TFile *f = new TFile(fileName.c_str());
+      TTree *tree = (TTree*)f->Get("T");
+
+      setEventBranches(tree, hsxfp, hsyfp, hsxpfp, hsypfp, frx_cm, fry_cm, dp);
       
-      it->xFp = hsxfp;
-      it->yFp = hsyfp ;//+ 0.613;
-      it->xpFp = hsxpfp;
-      it->ypFp = hsypfp;
-      it->delta = dp;
-
-      it->xVer = frx_cm;
-      it->yVer = fry_cm;
-      it->theta = iTheta;
-
-      ++it;
-    }//end entries
-    f->Close();
-    iList++;
-  }//end file loop
-
-  return events;
+     
+      Long64_t nEntries = tree->GetEntries();
+      //nEntries = 10000;  // TMP    
+      for (Long64_t iEntry=0; iEntry<nEntries; ++iEntry) {
+        if (entries) {
+          if (iNext == entries->size()) break;
+          if (entries->at(iNext) != firstEntry+iEntry) continue;
+          ++iNext;
+        }
+        tree->GetEntry(iEntry);
+        batch.emplace_back();
+        Event* it = &batch.back();
+        
+        it->xFp = hsxfp;
+        it->yFp = hsyfp ;//+ 0.613;
+        it->xpFp = hsxpfp;
+        it->ypFp = hsypfp;
+        it->delta = dp;
+
+        it->xVer = frx_cm;
+        it->yVer = fry_cm;
+        it->theta = iTheta;
+
+        if (batch.size() == batchSize) {
+          push(batch);
+          batch.clear();
+          batch.reserve(batchSize);
+        }
+      }//end entries
+      f->Close();
+      delete f;
+      firstEntry += nEntries;
+      iList++;
+    }//end file loop
+    if (!batch.empty()) push(batch);
+  }
+
+
+  // Read nEvents events at the given entries, or all entries if entries is
+  // NULL, in one batch.
+  std::vector<Event> readEntries(
+    const config::RunConfig& runConf,
+    const std::vector<Long64_t>* entries, Long64_t nEvents,
+    EventFileCache* cache=NULL
+  ) {
+    std::vector<Event> events;
+    readEntries(
+      runConf, entries, std::max<std::size_t>(static_cast<std::size_t>(nEvents), 1),
+      [&events](std::vector<Event>& batch) {
+        if (events.empty()) events.swap(batch);
+        else events.insert(events.end(), batch.begin(), batch.end());
+      },
+      cache
+    );
+
+    return events;
+  }
+
+}
+
+
+void setEventBranches(
+  TTree* tree, double& xFp, double& yFp, double& xpFp, double& ypFp,
+  double& xVer, double& yVer, double& delta
+) {
+  tree->SetBranchAddress("P.dc.x_fp", &xFp);
+  tree->SetBranchAddress("P.dc.y_fp", &yFp);
+  tree->SetBranchAddress("P.dc.xp_fp", &xpFp);
+  tree->SetBranchAddress("P.dc.yp_fp", &ypFp);
+  tree->SetBranchAddress("P.react.x", &xVer);
+  tree->SetBranchAddress("P.react.y", &yVer);
+  tree->SetBranchAddress("P.gtr.dp", &delta);
+}
+
+
+long long countEvents(const config::RunConfig& runConf) {
+  return countEntries(runConf);
+}
+
+
+std::vector<Event> readEvents(
+  const config::RunConfig& runConf, EventFileCache* cache
+) {
+  return readEntries(runConf, NULL, countEntries(runConf), cache);
+}
+
+
+std::vector<Event> readEvents(
+  const config::RunConfig& runConf, long long nEvents, EventFileCache* cache
+) {
+  return readEntries(runConf, NULL, nEvents, cache);
+}
+
+
+void readEventBatches(
+  const config::RunConfig& runConf, std::size_t batchSize,
+  const std::function<void(std::vector<Event>&)>& push, EventFileCache* cache
+) {
+  readEntries(runConf, NULL, batchSize, push, cache);
+}
+
+
+EventColumns readEventColumns(const std::string& fileName) {
+  Double_t xFp, yFp, xpFp, ypFp, xVer, yVer, delta;
+
+  TFile *f = new TFile(fileName.c_str());
+  TTree *tree = (TTree*)f->Get("T");
+  setEventBranches(tree, xFp, yFp, xpFp, ypFp, xVer, yVer, delta);
+
+  const Long64_t nEntries = tree->GetEntries();
+  EventColumns columns;
+  columns.reserve(static_cast<std::size_t>(nEntries));
+  for (Long64_t iEntry=0; iEntry<nEntries; ++iEntry) {
+    tree->GetEntry(iEntry);
+    columns.xFp.push_back(xFp);
+    columns.yFp.push_back(yFp);
+    columns.xpFp.push_back(xpFp);
+    columns.ypFp.push_back(ypFp);
+    columns.xVer.push_back(xVer);
+    columns.yVer.push_back(yVer);
+    columns.delta.push_back(delta);
+  }
+  f->Close();
+  delete f;
+
+  return columns;
+}
+
+
+std::vector<Event> readEventSample(
+  const config::RunConfig& runConf, std::size_t nSample, unsigned int seed
+) {
+  const Long64_t entriesTotal = countEntries(runConf);
+  if (static_cast<Long64_t>(nSample) >= entriesTotal) {
+    return readEntries(runConf, NULL, entriesTotal);
+  }
+
+  // Selection sampling: each entry is taken with the probability of the
+  // entries still needed among the entries left, which gives exactly
+  // nSample entries in increasing order.
+  std::mt19937 gen(seed);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  std::vector<Long64_t> entries;
+  entries.reserve(nSample);
+  for (Long64_t iEntry=0; iEntry<entriesTotal && entries.size()<nSample; ++iEntry) {
+    const double nNeeded = static_cast<double>(nSample - entries.size());
+    const double nLeft = static_cast<double>(entriesTotal - iEntry);
+    if (nLeft*uniform(gen) < nNeeded) entries.push_back(iEntry);
+  }
+
+  return readEntries(runConf, &entries, static_cast<Long64_t>(entries.size()));
 }
@@ -0,0 +1,119 @@
+#include "myEventTree.hpp"
+
+#include <chrono>
+#include <stdexcept>
+
+#include "TFile.h"
+#include "TTree.h"
+
+
+// EventTreeRow implementation.
+
+EventTreeRow::EventTreeRow() :
+  run(0), foil(0), hole(0), xSieveIndex(0), ySieveIndex(0),
+  xFp(0.0), yFp(0.0), xpFp(0.0), ypFp(0.0),
+  xTarPhy(0.0), yTarPhy(0.0), xpTarPhy(0.0), ypTarPhy(0.0), zFoil(0.0),
+  xTar(0.0), yTar(0.0), xpTar(0.0), ypTar(0.0), zVer(0.0), delta(0.0),
+  weight(0.0)
+{}
+
+
+EventTreeRow::~EventTreeRow() {}
+
+
+// EventTreeWriter implementation.
+
+EventTreeWriter::EventTreeWriter(
+  const std::string& fileName, int compression, int basketSize,
+  std::size_t queueDepth
+) :
+  nRows(0), writeTime(0.0),
+  fileName(fileName), compression(compression), basketSize(basketSize),
+  queue(queueDepth), thread(), error()
+{
+  // The file and tree belong to the writer thread. Its baskets are
+  // compressed serially: ROOT implicit multi-threading would compress them
+  // in parallel, but it is enabled for the whole process, input trees and
+  // the threads of -j included.
+  thread = std::thread([this]() {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<EventTreeRow> rows;
+    try {
+      TFile* file = new TFile(
+        this->fileName.c_str(), "RECREATE", "", this->compression
+      );
+      if (file->IsZombie()) {
+        delete file;
+        throw std::runtime_error("Could not open file: `"+this->fileName+"`!");
+      }
+      // The tree is owned by the file.
+      TTree* tree = new TTree("T", "selected events");
+      EventTreeRow row;
+      const int size = this->basketSize;
+      tree->Branch("run", &row.run, "run/I", size);
+      tree->Branch("foil", &row.foil, "foil/I", size);
+      tree->Branch("hole", &row.hole, "hole/I", size);
+      tree->Branch("xSieveIndex", &row.xSieveIndex, "xSieveIndex/I", size);
+      tree->Branch("ySieveIndex", &row.ySieveIndex, "ySieveIndex/I", size);
+      tree->Branch("xFp", &row.xFp, "xFp/F", size);
+      tree->Branch("yFp", &row.yFp, "yFp/F", size);
+      tree->Branch("xpFp", &row.xpFp, "xpFp/F", size);
+      tree->Branch("ypFp", &row.ypFp, "ypFp/F", size);
+      tree->Branch("xTarPhy", &row.xTarPhy, "xTarPhy/F", size);
+      tree->Branch("yTarPhy", &row.yTarPhy, "yTarPhy/F", size);
+      tree->Branch("xpTarPhy", &row.xpTarPhy, "xpTarPhy/F", size);
+      tree->Branch("ypTarPhy", &row.ypTarPhy, "ypTarPhy/F", size);
+      tree->Branch("zFoil", &row.zFoil, "zFoil/F", size);
+      tree->Branch("xTar", &row.xTar, "xTar/F", size);
+      tree->Branch("yTar", &row.yTar, "yTar/F", size);
+      tree->Branch("xpTar", &row.xpTar, "xpTar/F", size);
+      tree->Branch("ypTar", &row.ypTar, "ypTar/F", size);
+      tree->Branch("zVer", &row.zVer, "zVer/F", size);
+      tree->Branch("delta", &row.delta, "delta/F", size);
+      tree->Branch("weight", &row.weight, "weight/F", size);
+
+      while (queue.pop(rows)) {
+        for (const auto& rowIn : rows) {
+          row = rowIn;
+          tree->Fill();
+        }
+        nRows += static_cast<long long>(rows.size());
+      }
+
+      file->cd();
+      tree->Write();
+      file->Close();
+      delete file;
+    }
+    catch (...) {
+      error = std::current_exception();
+      // Keep taking rows, so that push never waits for a dead writer.
+      while (queue.pop(rows)) {}
+    }
+    std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+    writeTime = elapsed.count();
+  });
+}
+
+
+EventTreeWriter::~EventTreeWriter() {
+  if (thread.joinable()) {
+    queue.close();
+    thread.join();
+  }
+}
+
+
+void EventTreeWriter::push(std::vector<EventTreeRow>& rows) {
+  queue.push(rows);
+}
+
+
+void EventTreeWriter::finish() {
+  if (!thread.joinable()) return;
+
+  queue.close();
+  thread.join();
+  if (error) std::rethrow_exception(error);
+}
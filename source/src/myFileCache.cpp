@@ -0,0 +1,110 @@
+#include "myFileCache.hpp"
+
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+
+
+// EventFileCache::CachedFile implementation.
+
+EventFileCache::CachedFile::CachedFile() :
+  nUses(0), nUsesLeft(0), bytes(0), columns()
+{}
+
+
+EventFileCache::CachedFile::~CachedFile() {}
+
+
+// EventFileCache implementation.
+
+EventFileCache::EventFileCache() :
+  nReads(0), nHits(0), bytes(0), peakBytes(0), mutex(), files()
+{}
+
+
+EventFileCache::~EventFileCache() {}
+
+
+void EventFileCache::addRun(const config::RunConfig& runConf) {
+  std::lock_guard<std::mutex> lock(mutex);
+  for (const auto& fileName : runConf.fileList) {
+    CachedFile& file = files[Key(fileName, runConf.cuts)];
+    ++file.nUses;
+    ++file.nUsesLeft;
+  }
+}
+
+
+bool EventFileCache::isShared(
+  const std::string& fileName, const std::string& cuts
+) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  const auto it = files.find(Key(fileName, cuts));
+
+  return it != files.end() && it->second.nUses > 1;
+}
+
+
+std::shared_ptr<const EventColumns> EventFileCache::get(
+  const std::string& fileName, const std::string& cuts
+) {
+  std::promise<std::shared_ptr<const EventColumns> > promise;
+  std::shared_future<std::shared_ptr<const EventColumns> > columns;
+  bool read = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    const auto it = files.find(Key(fileName, cuts));
+    if (it == files.end() || it->second.nUsesLeft <= 0) {
+      throw std::runtime_error(
+        "EventFileCache: file `"+fileName+"` is not used by any run left!"
+      );
+    }
+    CachedFile& file = it->second;
+    if (!file.columns.valid()) {
+      file.columns = promise.get_future().share();
+      read = true;
+      ++nReads;
+    }
+    else {
+      ++nHits;
+    }
+    columns = file.columns;
+  }
+
+  // Reading is done without the lock, other files can be read meanwhile.
+  if (read) {
+    try {
+      std::shared_ptr<const EventColumns> readColumns =
+        std::make_shared<const EventColumns>(readEventColumns(fileName));
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        files[Key(fileName, cuts)].bytes = readColumns->getBytes();
+        bytes += readColumns->getBytes();
+        peakBytes = std::max(peakBytes, bytes);
+      }
+      promise.set_value(readColumns);
+    }
+    catch (...) {
+      promise.set_exception(std::current_exception());
+    }
+  }
+
+  return columns.get();
+}
+
+
+void EventFileCache::release(
+  const std::string& fileName, const std::string& cuts
+) {
+  std::lock_guard<std::mutex> lock(mutex);
+  const auto it = files.find(Key(fileName, cuts));
+  if (it == files.end()) return;
+
+  CachedFile& file = it->second;
+  if (--file.nUsesLeft > 0) return;
+
+  // Runs still holding the events keep them until they are done.
+  bytes -= file.bytes;
+  file.bytes = 0;
+  file.columns = std::shared_future<std::shared_ptr<const EventColumns> >();
+}
@@ -0,0 +1,349 @@
+#include "myFit.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+
+#include "TDecompSVD.h"
+
+#include "myOther.hpp"
+
+
+// FitAccumulator implementation.
+
+FitAccumulator::FitAccumulator(int nTerms) :
+  nTerms(nTerms), nEvents(0), sumWeights(0.0),
+  fitMat(static_cast<std::size_t>(nTerms*(nTerms+1)/2), 0.0),
+  xpTarFitVec(static_cast<std::size_t>(nTerms), 0.0),
+  yTarFitVec(static_cast<std::size_t>(nTerms), 0.0),
+  ypTarFitVec(static_cast<std::size_t>(nTerms), 0.0)
+{}
+
+
+FitAccumulator::~FitAccumulator() {}
+
+
+void FitAccumulator::addEvent(
+  const std::vector<double>& lambdas,
+  double xpTarTarget, double yTarTarget, double ypTarTarget,
+  double weight
+) {
+  const std::size_t n = static_cast<std::size_t>(nTerms);
+  if (lambdas.size() != n) {
+    throw std::runtime_error("Wrong number of lambdas for FitAccumulator!");
+  }
+
+  // Add w * lambda_i * lambda_j to (i,j)-th element for j >= i only, the
+  // lower triangle is mirrored in getFitMatrix.
+  std::size_t k = 0;
+  for (std::size_t i=0; i<n; ++i) {
+    const double wLambda_i = weight * lambdas[i];
+    for (std::size_t j=i; j<n; ++j) {
+      fitMat[k++] += wLambda_i * lambdas[j];
+    }
+
+    xpTarFitVec[i] += wLambda_i * xpTarTarget;
+    yTarFitVec[i] += wLambda_i * yTarTarget;
+    ypTarFitVec[i] += wLambda_i * ypTarTarget;
+  }
+
+  ++nEvents;
+  sumWeights += weight;
+}
+
+
+void FitAccumulator::add(const FitAccumulator& other, double factor) {
+  if (other.nTerms != nTerms) {
+    throw std::runtime_error("Cannot add FitAccumulators of different size!");
+  }
+
+  for (std::size_t i=0; i<fitMat.size(); ++i) fitMat[i] += factor*other.fitMat[i];
+  for (std::size_t i=0; i<xpTarFitVec.size(); ++i) {
+    xpTarFitVec[i] += factor*other.xpTarFitVec[i];
+    yTarFitVec[i] += factor*other.yTarFitVec[i];
+    ypTarFitVec[i] += factor*other.ypTarFitVec[i];
+  }
+
+  nEvents += other.nEvents;
+  sumWeights += factor*other.sumWeights;
+}
+
+
+void FitAccumulator::write(std::ostream& os) const {
+  writeBinary(os, nTerms);
+  writeBinary(os, nEvents);
+  writeBinary(os, sumWeights);
+  writeBinary(os, fitMat);
+  writeBinary(os, xpTarFitVec);
+  writeBinary(os, yTarFitVec);
+  writeBinary(os, ypTarFitVec);
+}
+
+
+void FitAccumulator::read(std::istream& is) {
+  int nTermsRead = 0;
+  readBinary(is, nTermsRead);
+  if (nTermsRead != nTerms) {
+    throw std::runtime_error("Cannot read FitAccumulator of different size!");
+  }
+  readBinary(is, nEvents);
+  readBinary(is, sumWeights);
+  readBinary(is, fitMat);
+  readBinary(is, xpTarFitVec);
+  readBinary(is, yTarFitVec);
+  readBinary(is, ypTarFitVec);
+}
+
+
+TMatrixD FitAccumulator::getFitMatrix() const {
+  const std::size_t n = static_cast<std::size_t>(nTerms);
+  TMatrixD mat(nTerms, nTerms);
+
+  std::size_t k = 0;
+  for (std::size_t i=0; i<n; ++i) {
+    for (std::size_t j=i; j<n; ++j) {
+      mat(static_cast<Int_t>(i), static_cast<Int_t>(j)) = fitMat[k];
+      mat(static_cast<Int_t>(j), static_cast<Int_t>(i)) = fitMat[k];
+      ++k;
+    }
+  }
+
+  return mat;
+}
+
+
+TVectorD FitAccumulator::getXpTarFitVector() const {
+  TVectorD vec(nTerms);
+  for (Int_t i=0; i<nTerms; ++i) vec(i) = xpTarFitVec[static_cast<std::size_t>(i)];
+
+  return vec;
+}
+
+
+TVectorD FitAccumulator::getYTarFitVector() const {
+  TVectorD vec(nTerms);
+  for (Int_t i=0; i<nTerms; ++i) vec(i) = yTarFitVec[static_cast<std::size_t>(i)];
+
+  return vec;
+}
+
+
+TVectorD FitAccumulator::getYpTarFitVector() const {
+  TVectorD vec(nTerms);
+  for (Int_t i=0; i<nTerms; ++i) vec(i) = ypTarFitVec[static_cast<std::size_t>(i)];
+
+  return vec;
+}
+
+
+// DesignCache implementation.
+
+DesignCache::DesignCache(int nTerms) :
+  nTerms(nTerms), rows(),
+  xpTarTargets(), yTarTargets(), ypTarTargets(), weights()
+{}
+
+
+DesignCache::~DesignCache() {}
+
+
+void DesignCache::addEvent(
+  const std::vector<double>& lambdas,
+  double xpTarTarget, double yTarTarget, double ypTarTarget,
+  double weight
+) {
+  if (lambdas.size() != static_cast<std::size_t>(nTerms)) {
+    throw std::runtime_error("Wrong number of lambdas for DesignCache!");
+  }
+
+  for (const auto& lambda : lambdas) rows.push_back(static_cast<float>(lambda));
+  xpTarTargets.push_back(xpTarTarget);
+  yTarTargets.push_back(yTarTarget);
+  ypTarTargets.push_back(ypTarTarget);
+  weights.push_back(weight);
+}
+
+
+void DesignCache::add(const DesignCache& other) {
+  if (other.nTerms != nTerms) {
+    throw std::runtime_error("Cannot add DesignCaches of different size!");
+  }
+
+  rows.insert(rows.end(), other.rows.begin(), other.rows.end());
+  xpTarTargets.insert(xpTarTargets.end(), other.xpTarTargets.begin(), other.xpTarTargets.end());
+  yTarTargets.insert(yTarTargets.end(), other.yTarTargets.begin(), other.yTarTargets.end());
+  ypTarTargets.insert(ypTarTargets.end(), other.ypTarTargets.begin(), other.ypTarTargets.end());
+  weights.insert(weights.end(), other.weights.begin(), other.weights.end());
+}
+
+
+std::size_t DesignCache::size() const {
+  return weights.size();
+}
+
+
+void DesignCache::write(std::ostream& os) const {
+  writeBinary(os, nTerms);
+  writeBinary(os, rows);
+  writeBinary(os, xpTarTargets);
+  writeBinary(os, yTarTargets);
+  writeBinary(os, ypTarTargets);
+  writeBinary(os, weights);
+}
+
+
+void DesignCache::read(std::istream& is) {
+  int nTermsRead = 0;
+  readBinary(is, nTermsRead);
+  if (nTermsRead != nTerms) {
+    throw std::runtime_error("Cannot read DesignCache of different size!");
+  }
+  readBinary(is, rows);
+  readBinary(is, xpTarTargets);
+  readBinary(is, yTarTargets);
+  readBinary(is, ypTarTargets);
+  readBinary(is, weights);
+}
+
+
+// Implementation of other functions.
+
+double getEventWeight(
+  const config::Config& conf, const config::RunConfig& runConf,
+  std::size_t iFoil, std::size_t nHoleEvents
+) {
+  double weight = runConf.weight * runConf.getFoilWeight(iFoil);
+
+  // Normalise total weight of each hole to maxEventsPerHole, so that all
+  // holes contribute equally regardless of their statistics.
+  if (conf.maxEventsPerHole > 0 && nHoleEvents > 0) {
+    weight *=
+      static_cast<double>(conf.maxEventsPerHole) /
+      static_cast<double>(nHoleEvents);
+  }
+
+  return weight;
+}
+
+
+RobustLoss parseRobustLoss(const std::string& name) {
+  if (name == "ls") return kLeastSquares;
+  if (name == "huber") return kHuber;
+  if (name == "tukey") return kTukey;
+
+  throw std::runtime_error("Unknown robust loss `" + name + "`.");
+}
+
+
+double getRobustWeight(double u, RobustLoss loss) {
+  // Tuning constants give 95% efficiency for gaussian residuals.
+  const double kHuberK = 1.345;
+  const double kTukeyC = 4.685;
+  const double absU = std::abs(u);
+
+  switch (loss) {
+    case kHuber:
+      return (absU <= kHuberK) ? 1.0 : kHuberK/absU;
+    case kTukey:
+      if (absU >= kTukeyC) return 0.0;
+      return (1.0 - (u/kTukeyC)*(u/kTukeyC)) * (1.0 - (u/kTukeyC)*(u/kTukeyC));
+    default:
+      return 1.0;
+  }
+}
+
+
+bool robustRefit(
+  const DesignCache& cache, RobustLoss loss, int nIter,
+  TVectorD& xpTarCoeffs, TVectorD& yTarCoeffs, TVectorD& ypTarCoeffs
+) {
+  const std::size_t nTerms = static_cast<std::size_t>(cache.nTerms);
+  const std::size_t nEvents = cache.size();
+  if (nEvents == 0) return false;
+
+  std::vector<TVectorD*> coeffs = {&xpTarCoeffs, &yTarCoeffs, &ypTarCoeffs};
+  std::vector<const std::vector<double>*> targets = {
+    &cache.xpTarTargets, &cache.yTarTargets, &cache.ypTarTargets
+  };
+  const char* names[] = {"xpTar", "yTar", "ypTar"};
+
+  std::vector<double> residuals(nEvents);
+  std::vector<double> absResiduals(nEvents);
+  std::vector<double> lambdas(nTerms);
+  bool success = true;
+
+  for (int iIter=0; iIter<nIter; ++iIter) {  // iteration loop
+    auto start = std::chrono::steady_clock::now();
+    std::cout << "  Iteration " << iIter+1 << ":";
+
+    for (std::size_t iVar=0; iVar<3; ++iVar) {  // variable loop
+      const double* c = coeffs[iVar]->GetMatrixArray();
+      const std::vector<double>& target = *targets[iVar];
+
+      // Residuals with respect to current solution.
+      for (std::size_t iEvent=0; iEvent<nEvents; ++iEvent) {
+        const float* row = &cache.rows[iEvent*nTerms];
+        double prediction = 0.0;
+        for (std::size_t i=0; i<nTerms; ++i) prediction += row[i] * c[i];
+        residuals[iEvent] = target[iEvent] - prediction;
+        absResiduals[iEvent] = std::abs(residuals[iEvent]);
+      }
+
+      // Robust scale from median absolute deviation.
+      std::nth_element(
+        absResiduals.begin(),
+        absResiduals.begin() + static_cast<std::ptrdiff_t>(nEvents/2),
+        absResiduals.end()
+      );
+      double scale = 1.4826 * absResiduals[nEvents/2];
+      if (scale <= 0.0) scale = 1.0e-12;
+
+      // Refill the normal equations with robust weights.
+      FitAccumulator fitAcc(cache.nTerms);
+      std::size_t nDownWeighted = 0;
+      std::size_t nRejected = 0;
+      for (std::size_t iEvent=0; iEvent<nEvents; ++iEvent) {
+        double robustWeight = getRobustWeight(residuals[iEvent]/scale, loss);
+        if (robustWeight < 1.0) ++nDownWeighted;
+        if (robustWeight == 0.0) {
+          ++nRejected;
+          continue;
+        }
+
+        const float* row = &cache.rows[iEvent*nTerms];
+        for (std::size_t i=0; i<nTerms; ++i) lambdas[i] = row[i];
+        fitAcc.addEvent(
+          lambdas,
+          (iVar==0) ? target[iEvent] : 0.0,
+          (iVar==1) ? target[iEvent] : 0.0,
+          (iVar==2) ? target[iEvent] : 0.0,
+          cache.weights[iEvent] * robustWeight
+        );
+      }
+
+      TVectorD vec =
+        (iVar==0) ? fitAcc.getXpTarFitVector() :
+        (iVar==1) ? fitAcc.getYTarFitVector() :
+        fitAcc.getYpTarFitVector();
+      TDecompSVD fitSVD(fitAcc.getFitMatrix());
+      if (fitSVD.Solve(vec)) {
+        *coeffs[iVar] = vec;
+      }
+      else {
+        success = false;
+      }
+
+      std::cout
+        << " " << names[iVar] << " " << nDownWeighted << " down-weighted ("
+        << nRejected << " rejected),";
+    }  // variable loop
+
+    std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+    std::cout << " " << elapsed.count() << " s" << std::endl;
+  }  // iteration loop
+
+  return success;
+}
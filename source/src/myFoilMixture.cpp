@@ -0,0 +1,197 @@
+#include "myFoilMixture.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <stdexcept>
+
+#include "TMath.h"
+
+
+namespace {
+
+  // Lower limit of the variances, keeps a foil from collapsing onto a few
+  // identical values.
+  const double minVariance = 1e-4;  // cm^2
+  const double minWeight = 1e-6;
+  const double backgroundWeightInit = 0.1;
+
+
+  // Half the smallest distance between neighbouring seeds, or 1 cm for a
+  // single seed.
+  double getSeedSpacing(std::vector<double> seeds) {
+    std::sort(seeds.begin(), seeds.end());
+    double spacing = std::numeric_limits<double>::infinity();
+    for (std::size_t i=1; i<seeds.size(); ++i) {
+      spacing = std::min(spacing, seeds[i]-seeds[i-1]);
+    }
+
+    return (std::isfinite(spacing) && spacing > 0.0) ? 0.5*spacing : 1.0;
+  }
+
+}
+
+
+// FoilComponent implementation.
+
+FoilComponent::FoilComponent() :
+  weight(0.0), zVerMean(0.0), zVerSigma(0.0), yTarMean(0.0), yTarSigma(0.0),
+  correlation(0.0)
+{}
+
+
+FoilComponent::~FoilComponent() {}
+
+
+// FoilMixture implementation.
+
+FoilMixture::FoilMixture() :
+  foils(), backgroundWeight(0.0), backgroundDensity(0.0),
+  logLikelihood(0.0), nIterations(0), converged(false)
+{}
+
+
+FoilMixture::~FoilMixture() {}
+
+
+// Implementation of functions.
+
+FoilMixture fitFoilMixture(
+  const std::vector<double>& zVers, const std::vector<double>& yTars,
+  const std::vector<double>& zVerSeeds, const std::vector<double>& yTarSeeds,
+  int maxIterations, double tolerance
+) {
+  const std::size_t nValues = zVers.size();
+  const std::size_t nFoils = zVerSeeds.size();
+  if (yTars.size() != nValues || yTarSeeds.size() != nFoils) {
+    throw std::runtime_error("fitFoilMixture: different number of zVer and yTar values!");
+  }
+  if (nValues == 0 || nFoils == 0) {
+    throw std::runtime_error("fitFoilMixture: no values or no foils!");
+  }
+  const double valueNum = static_cast<double>(nValues);
+  const double foilNum = static_cast<double>(nFoils);
+
+  FoilMixture mixture;
+
+  // Flat background over the bounding box.
+  const double zVerMin = *std::min_element(zVers.begin(), zVers.end());
+  const double zVerMax = *std::max_element(zVers.begin(), zVers.end());
+  const double yTarMin = *std::min_element(yTars.begin(), yTars.end());
+  const double yTarMax = *std::max_element(yTars.begin(), yTars.end());
+  const double area = std::max(zVerMax-zVerMin, 1e-3) * std::max(yTarMax-yTarMin, 1e-3);
+  mixture.backgroundWeight = backgroundWeightInit;
+  mixture.backgroundDensity = 1.0/area;
+
+  // Seeded foils with half of the seed spacing as sigmas.
+  const double zVerSigmaInit = 0.5*getSeedSpacing(zVerSeeds);
+  const double yTarSigmaInit = 0.5*getSeedSpacing(yTarSeeds);
+  mixture.foils.resize(nFoils);
+  for (std::size_t iFoil=0; iFoil<nFoils; ++iFoil) {
+    FoilComponent& foil = mixture.foils[iFoil];
+    foil.weight = (1.0-backgroundWeightInit) / foilNum;
+    foil.zVerMean = zVerSeeds[iFoil];
+    foil.zVerSigma = zVerSigmaInit;
+    foil.yTarMean = yTarSeeds[iFoil];
+    foil.yTarSigma = yTarSigmaInit;
+  }
+
+  // Densities of component k at all values are densities[k*nValues + i],
+  // the background being the last component. They become the posteriors.
+  std::vector<double> densities((nFoils+1)*nValues);
+  std::vector<double> totals(nValues);
+  double previousLogLikelihood = -std::numeric_limits<double>::infinity();
+
+  for (mixture.nIterations=1; mixture.nIterations<=maxIterations; ++mixture.nIterations) {
+    // Expectation.
+    for (std::size_t iFoil=0; iFoil<nFoils; ++iFoil) {
+      const FoilComponent& foil = mixture.foils[iFoil];
+      const double oneMinusRho2 = 1.0 - foil.correlation*foil.correlation;
+      const double norm = foil.weight / (
+        2*TMath::Pi() * foil.zVerSigma * foil.yTarSigma * std::sqrt(oneMinusRho2)
+      );
+      const double zVerScale = 1.0/foil.zVerSigma;
+      const double yTarScale = 1.0/foil.yTarSigma;
+      const double rho = foil.correlation;
+      const double halfInverse = -0.5/oneMinusRho2;
+      double* density = densities.data() + iFoil*nValues;
+      for (std::size_t i=0; i<nValues; ++i) {
+        const double u = (zVers[i] - foil.zVerMean) * zVerScale;
+        const double v = (yTars[i] - foil.yTarMean) * yTarScale;
+        density[i] = norm * std::exp(halfInverse*(u*u - 2*rho*u*v + v*v));
+      }
+    }
+    double* background = densities.data() + nFoils*nValues;
+    std::fill(background, background+nValues, mixture.backgroundWeight*mixture.backgroundDensity);
+
+    std::copy(background, background+nValues, totals.begin());
+    for (std::size_t iFoil=0; iFoil<nFoils; ++iFoil) {
+      const double* density = densities.data() + iFoil*nValues;
+      for (std::size_t i=0; i<nValues; ++i) totals[i] += density[i];
+    }
+    double logLikelihood = 0.0;
+    for (std::size_t i=0; i<nValues; ++i) {
+      totals[i] = std::max(totals[i], std::numeric_limits<double>::min());
+      logLikelihood += std::log(totals[i]);
+      totals[i] = 1.0/totals[i];
+    }
+    for (std::size_t iComponent=0; iComponent<=nFoils; ++iComponent) {
+      double* posterior = densities.data() + iComponent*nValues;
+      for (std::size_t i=0; i<nValues; ++i) posterior[i] *= totals[i];
+    }
+
+    mixture.logLikelihood = logLikelihood;
+    if (std::abs(logLikelihood - previousLogLikelihood) < tolerance) {
+      mixture.converged = true;
+      break;
+    }
+    previousLogLikelihood = logLikelihood;
+
+    // Maximisation.
+    for (std::size_t iFoil=0; iFoil<nFoils; ++iFoil) {
+      FoilComponent& foil = mixture.foils[iFoil];
+      const double* posterior = densities.data() + iFoil*nValues;
+      double sum = 0.0, sumZ = 0.0, sumY = 0.0;
+      for (std::size_t i=0; i<nValues; ++i) {
+        sum += posterior[i];
+        sumZ += posterior[i]*zVers[i];
+        sumY += posterior[i]*yTars[i];
+      }
+      // A foil without events keeps its place.
+      if (sum <= minWeight*valueNum) {
+        foil.weight = minWeight;
+        continue;
+      }
+      const double zVerMean = sumZ/sum;
+      const double yTarMean = sumY/sum;
+
+      double sumZZ = 0.0, sumYY = 0.0, sumZY = 0.0;
+      for (std::size_t i=0; i<nValues; ++i) {
+        const double dz = zVers[i] - zVerMean;
+        const double dy = yTars[i] - yTarMean;
+        sumZZ += posterior[i]*dz*dz;
+        sumYY += posterior[i]*dy*dy;
+        sumZY += posterior[i]*dz*dy;
+      }
+      const double zVerVariance = std::max(sumZZ/sum, minVariance);
+      const double yTarVariance = std::max(sumYY/sum, minVariance);
+
+      foil.weight = sum/valueNum;
+      foil.zVerMean = zVerMean;
+      foil.yTarMean = yTarMean;
+      foil.zVerSigma = std::sqrt(zVerVariance);
+      foil.yTarSigma = std::sqrt(yTarVariance);
+      foil.correlation = std::max(
+        -0.99, std::min(0.99, sumZY/sum / (foil.zVerSigma*foil.yTarSigma))
+      );
+    }
+    const double* posterior = densities.data() + nFoils*nValues;
+    double sum = 0.0;
+    for (std::size_t i=0; i<nValues; ++i) sum += posterior[i];
+    mixture.backgroundWeight = std::max(sum/valueNum, minWeight);
+  }
+  if (mixture.nIterations > maxIterations) mixture.nIterations = maxIterations;
+
+  return mixture;
+}
@@ -0,0 +1,253 @@
+#include "myFriendTree.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "TFile.h"
+#include "TTree.h"
+
+#include "myEvent.hpp"
+#include "myQueue.hpp"
+#include "myReconstruct.hpp"
+
+
+namespace {
+
+  // hcana sets the target variables of events without a track to a huge
+  // value.
+  const double maxHcanaValue = 1e10;
+
+
+  //! Events of a batch and their target variables from hcana.
+  class FriendBatch {
+    public:
+      FriendBatch() : events(), hcanaTargets() {}
+      ~FriendBatch() {}
+
+      std::vector<Event> events;
+      std::vector<TargetVariables> hcanaTargets;
+  };
+
+
+  bool hasTrack(const TargetVariables& target, double delta) {
+    const double values[] = {target.xpTar, target.ypTar, target.yTar, delta};
+    for (const double value : values) {
+      if (!std::isfinite(value) || std::abs(value) > maxHcanaValue) return false;
+    }
+
+    return true;
+  }
+
+}
+
+
+// FriendTreeStats implementation.
+
+FriendTreeStats::FriendTreeStats() :
+  nEvents(0), time(0.0), xpTarDiff(), ypTarDiff(), yTarDiff(), deltaDiff()
+{}
+
+
+FriendTreeStats::~FriendTreeStats() {}
+
+
+void FriendTreeStats::add(const FriendTreeStats& other) {
+  nEvents += other.nEvents;
+  time += other.time;
+  xpTarDiff.add(other.xpTarDiff);
+  ypTarDiff.add(other.ypTarDiff);
+  yTarDiff.add(other.yTarDiff);
+  deltaDiff.add(other.deltaDiff);
+}
+
+
+// Implementation of functions.
+
+FriendTreeStats writeFriendTree(
+  const std::string& fileName, double theta, const config::RunConfig& runConf,
+  const RecMatrix& recMatrixIndep, const RecMatrix& recMatrixDep,
+  int xTarCorrIterNum, const std::string& friendFileName, int compression,
+  int nThreads, std::size_t batchSize
+) {
+  auto start = std::chrono::steady_clock::now();
+  FriendTreeStats stats;
+
+  // Input is read in the background, a few batches ahead.
+  BoundedQueue<FriendBatch> queue(4);
+  std::exception_ptr readError;
+  std::thread reader([&]() {
+    try {
+      TFile* file = new TFile(fileName.c_str());
+      TTree* tree = file->IsZombie() ? NULL : (TTree*)file->Get("T");
+      if (!tree) {
+        delete file;
+        throw std::runtime_error("Could not read tree `T` from file: `"+fileName+"`!");
+      }
+      double xFp, yFp, xpFp, ypFp, xVer, yVer, delta;
+      double xpTar, ypTar, yTar;
+      setEventBranches(tree, xFp, yFp, xpFp, ypFp, xVer, yVer, delta);
+      tree->SetBranchAddress("P.gtr.th", &xpTar);
+      tree->SetBranchAddress("P.gtr.ph", &ypTar);
+      tree->SetBranchAddress("P.gtr.y", &yTar);
+
+      const Long64_t nEntries = tree->GetEntries();
+      FriendBatch batch;
+      for (Long64_t iEntry=0; iEntry<nEntries; ++iEntry) {
+        tree->GetEntry(iEntry);
+        batch.events.emplace_back();
+        Event& event = batch.events.back();
+        event.xFp = xFp;
+        event.yFp = yFp;
+        event.xpFp = xpFp;
+        event.ypFp = ypFp;
+        event.xVer = xVer;
+        event.yVer = yVer;
+        event.delta = delta;
+        event.theta = theta;
+        batch.hcanaTargets.emplace_back();
+        TargetVariables& target = batch.hcanaTargets.back();
+        target.xpTar = xpTar;
+        target.ypTar = ypTar;
+        target.yTar = yTar;
+
+        if (batch.events.size() == batchSize || iEntry == nEntries-1) {
+          queue.push(batch);
+          batch = FriendBatch();
+        }
+      }
+      file->Close();
+      delete file;
+    }
+    catch (...) {
+      readError = std::current_exception();
+    }
+    queue.close();
+  });
+
+  // Entries of the friend tree follow the entries of the input tree.
+  TFile* friendFile = new TFile(friendFileName.c_str(), "RECREATE", "", compression);
+  if (friendFile->IsZombie()) {
+    delete friendFile;
+    // The reader may wait for a free slot.
+    FriendBatch batch;
+    while (queue.pop(batch)) {}
+    reader.join();
+    throw std::runtime_error("Could not open file: `"+friendFileName+"`!");
+  }
+  // The tree is owned by the file.
+  TTree* friendTree = new TTree("Trec", "reconstructed target variables");
+  double xTar, xpTar, ypTar, yTar, zVer, delta;
+  friendTree->Branch("xTar", &xTar, "xTar/D");
+  friendTree->Branch("xpTar", &xpTar, "xpTar/D");
+  friendTree->Branch("ypTar", &ypTar, "ypTar/D");
+  friendTree->Branch("yTar", &yTar, "yTar/D");
+  friendTree->Branch("zVer", &zVer, "zVer/D");
+  friendTree->Branch("delta", &delta, "delta/D");
+
+  FriendBatch batch;
+  std::vector<double> deltas;
+  std::exception_ptr reconstructError;
+  try {
+    while (queue.pop(batch)) {  // batch loop
+      std::vector<Event>& events = batch.events;
+      const std::size_t nEvents = events.size();
+      deltas.resize(nEvents);
+
+      // Each thread reconstructs a contiguous part of the batch. Errors are
+      // kept until all parts are joined.
+      const std::size_t nParts = static_cast<std::size_t>(std::max(nThreads, 1));
+      std::vector<std::exception_ptr> partErrors(nParts);
+      auto reconstructPart = [&](std::size_t iPart) {
+        try {
+          const std::size_t iBegin = nEvents*iPart/nParts;
+          const std::size_t iEnd = nEvents*(iPart+1)/nParts;
+          for (std::size_t iEvent=iBegin; iEvent<iEnd; ++iEvent) {
+            Event& event = events[iEvent];
+            reconstructEvent(
+              event, runConf, recMatrixIndep, recMatrixDep, xTarCorrIterNum
+            );
+            deltas[iEvent] =
+              reconstructDelta(event, runConf, recMatrixIndep, recMatrixDep);
+          }
+        }
+        catch (...) {
+          partErrors[iPart] = std::current_exception();
+        }
+      };
+      std::vector<std::thread> threads;
+      try {
+        for (std::size_t iPart=1; iPart<nParts; ++iPart) {
+          threads.emplace_back(reconstructPart, iPart);
+        }
+        reconstructPart(0);
+      }
+      catch (...) {
+        for (auto& thread : threads) thread.join();
+        throw;
+      }
+      for (auto& thread : threads) thread.join();
+      for (const auto& partError : partErrors) {
+        if (partError) std::rethrow_exception(partError);
+      }
+
+      for (std::size_t iEvent=0; iEvent<nEvents; ++iEvent) {
+        const Event& event = events[iEvent];
+        xTar = event.xTar;
+        xpTar = event.xpTar;
+        ypTar = event.ypTar;
+        yTar = event.yTar;
+        zVer = event.zVer;
+        delta = deltas[iEvent];
+        friendTree->Fill();
+
+        const TargetVariables& hcana = batch.hcanaTargets[iEvent];
+        if (hasTrack(hcana, event.delta)) {
+          stats.xpTarDiff.fill(xpTar - hcana.xpTar);
+          stats.ypTarDiff.fill(ypTar - hcana.ypTar);
+          stats.yTarDiff.fill(yTar - hcana.yTar);
+          stats.deltaDiff.fill(delta - event.delta);
+        }
+      }
+      stats.nEvents += static_cast<long long>(nEvents);
+    }  // batch loop
+  }
+  catch (...) {
+    reconstructError = std::current_exception();
+  }
+  // After an error the reader may wait for a free slot.
+  while (queue.pop(batch)) {}
+  reader.join();
+
+  if (!reconstructError) {
+    friendFile->cd();
+    friendTree->Write();
+  }
+  friendFile->Close();
+  delete friendFile;
+
+  if (reconstructError) std::rethrow_exception(reconstructError);
+  if (readError) std::rethrow_exception(readError);
+
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+  stats.time = elapsed.count();
+
+  return stats;
+}
+
+
+std::string getFriendFileName(
+  const std::string& fileName, const std::string& dirName
+) {
+  std::string baseName = fileName.substr(fileName.find_last_of('/')+1);
+  const std::size_t dot = baseName.rfind('.');
+  if (dot == std::string::npos) baseName += "_rec";
+  else baseName.insert(dot, "_rec");
+
+  return dirName + "/" + baseName;
+}
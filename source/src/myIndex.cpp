@@ -0,0 +1,296 @@
+#include "myIndex.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+
+
+// GridIndex2D implementation.
+
+GridIndex2D::GridIndex2D() :
+  xMin(0.0), yMin(0.0), cellSize(1.0), nCellsX(0), nCellsY(0),
+  cellStarts(1, 0), pointIndexes(), pointXs(), pointYs()
+{}
+
+
+GridIndex2D::GridIndex2D(
+  const std::vector<double>& xs, const std::vector<double>& ys,
+  double cellSize
+) :
+  xMin(0.0), yMin(0.0), cellSize(cellSize), nCellsX(0), nCellsY(0),
+  cellStarts(), pointIndexes(), pointXs(), pointYs()
+{
+  if (xs.size() != ys.size()) {
+    throw std::runtime_error("GridIndex2D: different number of x and y values!");
+  }
+  if (!(cellSize > 0.0)) {
+    throw std::runtime_error("GridIndex2D: cell size must be positive!");
+  }
+
+  // Bounds of the finite points.
+  double xMax = 0.0;
+  double yMax = 0.0;
+  bool first = true;
+  for (std::size_t i=0; i<xs.size(); ++i) {
+    if (!std::isfinite(xs[i]) || !std::isfinite(ys[i])) continue;
+    if (first) {
+      xMin = xMax = xs[i];
+      yMin = yMax = ys[i];
+      first = false;
+    }
+    xMin = std::min(xMin, xs[i]);
+    xMax = std::max(xMax, xs[i]);
+    yMin = std::min(yMin, ys[i]);
+    yMax = std::max(yMax, ys[i]);
+  }
+  nCellsX = first ? 0 : static_cast<std::size_t>((xMax-xMin)/cellSize) + 1;
+  nCellsY = first ? 0 : static_cast<std::size_t>((yMax-yMin)/cellSize) + 1;
+
+  // Counting sort of points by cell.
+  std::vector<std::size_t> cells(xs.size(), nCellsX*nCellsY);
+  cellStarts.assign(nCellsX*nCellsY+1, 0);
+  for (std::size_t i=0; i<xs.size(); ++i) {
+    if (!std::isfinite(xs[i]) || !std::isfinite(ys[i])) continue;
+    cells[i] = getCellY(ys[i])*nCellsX + getCellX(xs[i]);
+    ++cellStarts[cells[i]+1];
+  }
+  for (std::size_t iCell=0; iCell<nCellsX*nCellsY; ++iCell) {
+    cellStarts[iCell+1] += cellStarts[iCell];
+  }
+
+  const std::size_t nPoints = cellStarts.back();
+  pointIndexes.resize(nPoints);
+  pointXs.resize(nPoints);
+  pointYs.resize(nPoints);
+  std::vector<std::size_t> next(cellStarts.begin(), cellStarts.end()-1);
+  for (std::size_t i=0; i<xs.size(); ++i) {
+    if (cells[i] == nCellsX*nCellsY) continue;
+    const std::size_t iPoint = next[cells[i]]++;
+    pointIndexes[iPoint] = i;
+    pointXs[iPoint] = xs[i];
+    pointYs[iPoint] = ys[i];
+  }
+}
+
+
+GridIndex2D::~GridIndex2D() {}
+
+
+void GridIndex2D::query(
+  double xLow, double xHigh, double yLow, double yHigh,
+  std::vector<std::size_t>& indexes
+) const {
+  if (nCellsX == 0 || xHigh < xLow || yHigh < yLow) return;
+
+  const std::size_t iXLow = getCellX(xLow);
+  const std::size_t iXHigh = getCellX(xHigh);
+  const std::size_t iYLow = getCellY(yLow);
+  const std::size_t iYHigh = getCellY(yHigh);
+
+  for (std::size_t iY=iYLow; iY<=iYHigh; ++iY) {
+    for (std::size_t iX=iXLow; iX<=iXHigh; ++iX) {
+      const std::size_t iCell = iY*nCellsX + iX;
+      for (std::size_t iPoint=cellStarts[iCell]; iPoint<cellStarts[iCell+1]; ++iPoint) {
+        const double x = pointXs[iPoint];
+        const double y = pointYs[iPoint];
+        if (xLow <= x && x <= xHigh && yLow <= y && y <= yHigh) {
+          indexes.push_back(pointIndexes[iPoint]);
+        }
+      }
+    }
+  }
+}
+
+
+std::size_t GridIndex2D::size() const {
+  return pointIndexes.size();
+}
+
+
+std::size_t GridIndex2D::getCellX(double x) const {
+  if (x <= xMin) return 0;
+  const std::size_t iX = static_cast<std::size_t>((x-xMin)/cellSize);
+
+  return std::min(iX, nCellsX-1);
+}
+
+
+std::size_t GridIndex2D::getCellY(double y) const {
+  if (y <= yMin) return 0;
+  const std::size_t iY = static_cast<std::size_t>((y-yMin)/cellSize);
+
+  return std::min(iY, nCellsY-1);
+}
+
+
+// IntervalIndex1D implementation.
+
+IntervalIndex1D::IntervalIndex1D() :
+  bounds(), segmentStarts(1, 0), intervalIndexes()
+{}
+
+
+IntervalIndex1D::IntervalIndex1D(
+  const std::vector<double>& lows, const std::vector<double>& highs
+) :
+  bounds(), segmentStarts(), intervalIndexes()
+{
+  if (lows.size() != highs.size()) {
+    throw std::runtime_error("IntervalIndex1D: different number of low and high ends!");
+  }
+
+  // Intervals that contain nothing are left out.
+  std::vector<bool> valid(lows.size(), false);
+  for (std::size_t i=0; i<lows.size(); ++i) {
+    valid[i] = std::isfinite(lows[i]) && std::isfinite(highs[i]) && lows[i] <= highs[i];
+    if (!valid[i]) continue;
+    bounds.push_back(lows[i]);
+    bounds.push_back(highs[i]);
+  }
+  std::sort(bounds.begin(), bounds.end());
+  bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+
+  // A single point is a segment of its own.
+  const std::size_t nSegments = (bounds.size() > 1) ? bounds.size()-1 : bounds.size();
+  segmentStarts.push_back(0);
+  for (std::size_t iSegment=0; iSegment<nSegments; ++iSegment) {
+    const double low = bounds[iSegment];
+    const double high = bounds[std::min(iSegment+1, bounds.size()-1)];
+    for (std::size_t i=0; i<lows.size(); ++i) {
+      if (valid[i] && lows[i] <= high && low <= highs[i]) intervalIndexes.push_back(i);
+    }
+    segmentStarts.push_back(intervalIndexes.size());
+  }
+}
+
+
+IntervalIndex1D::~IntervalIndex1D() {}
+
+
+void IntervalIndex1D::find(
+  double x, const std::size_t*& first, const std::size_t*& last
+) const {
+  first = last = intervalIndexes.data();
+  if (bounds.empty() || !(bounds.front() <= x && x <= bounds.back())) return;
+
+  const std::size_t nSegments = segmentStarts.size()-1;
+  // First bound above x, at least the second one as x is not below the
+  // first one.
+  const std::ptrdiff_t iUpper =
+    std::upper_bound(bounds.begin(), bounds.end(), x) - bounds.begin();
+  std::size_t iSegment = (iUpper > 0) ? static_cast<std::size_t>(iUpper-1) : 0;
+  if (iSegment >= nSegments) iSegment = nSegments-1;
+
+  first = intervalIndexes.data() + segmentStarts[iSegment];
+  last = intervalIndexes.data() + segmentStarts[iSegment+1];
+}
+
+
+// BoxGridIndex2D implementation.
+
+BoxGridIndex2D::BoxGridIndex2D() :
+  xMin(0.0), xMax(0.0), yMin(0.0), yMax(0.0), cellSize(1.0),
+  nCellsX(0), nCellsY(0), cellStarts(1, 0), boxIndexes()
+{}
+
+
+BoxGridIndex2D::BoxGridIndex2D(
+  const std::vector<double>& xLows, const std::vector<double>& xHighs,
+  const std::vector<double>& yLows, const std::vector<double>& yHighs,
+  double cellSize
+) :
+  xMin(0.0), xMax(0.0), yMin(0.0), yMax(0.0), cellSize(cellSize),
+  nCellsX(0), nCellsY(0), cellStarts(), boxIndexes()
+{
+  const std::size_t nBoxes = xLows.size();
+  if (
+    xHighs.size() != nBoxes || yLows.size() != nBoxes || yHighs.size() != nBoxes
+  ) {
+    throw std::runtime_error("BoxGridIndex2D: different number of box edges!");
+  }
+  if (!(cellSize > 0.0)) {
+    throw std::runtime_error("BoxGridIndex2D: cell size must be positive!");
+  }
+
+  // Boxes that contain nothing are left out.
+  std::vector<bool> valid(nBoxes, false);
+  bool first = true;
+  for (std::size_t i=0; i<nBoxes; ++i) {
+    valid[i] =
+      std::isfinite(xLows[i]) && std::isfinite(xHighs[i]) && xLows[i] <= xHighs[i] &&
+      std::isfinite(yLows[i]) && std::isfinite(yHighs[i]) && yLows[i] <= yHighs[i];
+    if (!valid[i]) continue;
+    if (first) {
+      xMin = xLows[i];
+      xMax = xHighs[i];
+      yMin = yLows[i];
+      yMax = yHighs[i];
+      first = false;
+    }
+    xMin = std::min(xMin, xLows[i]);
+    xMax = std::max(xMax, xHighs[i]);
+    yMin = std::min(yMin, yLows[i]);
+    yMax = std::max(yMax, yHighs[i]);
+  }
+  nCellsX = first ? 0 : static_cast<std::size_t>((xMax-xMin)/cellSize) + 1;
+  nCellsY = first ? 0 : static_cast<std::size_t>((yMax-yMin)/cellSize) + 1;
+
+  // Count boxes of each cell, then fill them in box order.
+  cellStarts.assign(nCellsX*nCellsY+1, 0);
+  for (int pass=0; pass<2; ++pass) {
+    std::vector<std::size_t> next(cellStarts.begin(), cellStarts.end()-1);
+    for (std::size_t i=0; i<nBoxes; ++i) {
+      if (!valid[i]) continue;
+      for (std::size_t iY=getCellY(yLows[i]); iY<=getCellY(yHighs[i]); ++iY) {
+        for (std::size_t iX=getCellX(xLows[i]); iX<=getCellX(xHighs[i]); ++iX) {
+          const std::size_t iCell = iY*nCellsX + iX;
+          if (pass == 0) ++cellStarts[iCell+1];
+          else boxIndexes[next[iCell]++] = i;
+        }
+      }
+    }
+    if (pass == 0) {
+      for (std::size_t iCell=0; iCell<nCellsX*nCellsY; ++iCell) {
+        cellStarts[iCell+1] += cellStarts[iCell];
+      }
+      boxIndexes.resize(cellStarts.back());
+    }
+  }
+}
+
+
+BoxGridIndex2D::~BoxGridIndex2D() {}
+
+
+void BoxGridIndex2D::find(
+  double x, double y, const std::size_t*& first, const std::size_t*& last
+) const {
+  first = last = boxIndexes.data();
+  if (
+    nCellsX == 0 ||
+    !(xMin <= x && x <= xMax) || !(yMin <= y && y <= yMax)
+  ) {
+    return;
+  }
+
+  const std::size_t iCell = getCellY(y)*nCellsX + getCellX(x);
+  first = boxIndexes.data() + cellStarts[iCell];
+  last = boxIndexes.data() + cellStarts[iCell+1];
+}
+
+
+std::size_t BoxGridIndex2D::getCellX(double x) const {
+  if (x <= xMin) return 0;
+  const std::size_t iX = static_cast<std::size_t>((x-xMin)/cellSize);
+
+  return std::min(iX, nCellsX-1);
+}
+
+
+std::size_t BoxGridIndex2D::getCellY(double y) const {
+  if (y <= yMin) return 0;
+  const std::size_t iY = static_cast<std::size_t>((y-yMin)/cellSize);
+
+  return std::min(iY, nCellsY-1);
+}
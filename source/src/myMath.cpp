@@ -1,14 +1,81 @@
 #include "myMath.hpp"
 
 #include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <iostream>
+#include <stdexcept>
 
+#include "TAxis.h"
 #include "TMath.h"
 #include "TH1D.h"
 #include "TSpectrum.h"
 #include "TF1.h"
 
+
+namespace {
+
+  // Apply the sanity corrections of the single peak fit.
+  Peak correctPeak(
+    const Peak& fitted, double chi2,
+    double normInit, double meanInit, double sigmaInit
+  ) {
+    double aa = fitted.norm;
+    double mu = fitted.mean;
+    double ssig = fitted.sigma;
+
+    if ((mu>meanInit+0.2 || mu<meanInit-0.2) && (chi2>20 || ssig>1)){
+      mu = meanInit;
+    }
+    if (aa>normInit*20 || chi2<0.1  ){//|| aa<normInit/10.0){
+      ssig = 0;
+    }
+    if (ssig>sigmaInit){
+      ssig = TMath::Abs(sigmaInit);
+    }
+    if (mu-meanInit>0.5){mu = meanInit;}
+    //compare number of events in central peak to norm
+    // std::cout<<"\tcorrected:\t"<<aa<<"\t"<<mu<<"\t"<<ssig<<std::endl;
+
+    return Peak(aa, mu, ssig);
+  }
+
+
+  // Ratio of the variance of a gaussian truncated at +-k sigma to sigma^2.
+  double getTruncatedVarianceFactor(double k) {
+    const double fraction = std::erf(k/std::sqrt(2.0));
+    const double density = std::exp(-0.5*k*k)/std::sqrt(2.0*TMath::Pi());
+
+    return 1.0 - 2.0*k*density/fraction;
+  }
+
+
+  // Same chi2 as the binned fit: bins in [low, high] and axis range,
+  // empty bins skipped.
+  double getChi2(
+    const TH1D* histo, double low, double high,
+    double norm, double mean, double sigma
+  ) {
+    if (sigma <= 0.0) return 0.0;
+
+    double chi2 = 0.0;
+    const TAxis* axis = histo->GetXaxis();
+    for (int bin=axis->GetFirst(); bin<=axis->GetLast(); ++bin) {
+      const double x = axis->GetBinCenter(bin);
+      const double content = histo->GetBinContent(bin);
+      if (x<low || x>high || content<=0.0) continue;
+
+      const double u = (x-mean)/sigma;
+      const double diff = content - norm*std::exp(-0.5*u*u);
+      chi2 += diff*diff/content;
+    }
+
+    return chi2;
+  }
+
+}
+
+
 bool compare(Peak p1,Peak p2){return (p1.mean<p2.mean);}
 
 bool compareHt(Peak p1,Peak p2){
@@ -37,6 +104,11 @@ MultiPeakFunc::MultiPeakFunc(int numPeaks) : nPeaks(numPeaks) {}
 MultiPeakFunc::~MultiPeakFunc() {}
 
 
+double MultiPeakFunc::operator()(double* x, double* pars) {
+  return Evaluate(x, pars);
+}
+
+
 double MultiPeakFunc::Evaluate(double* x, double* pars) {
   double result = 0;
   for (int iPeak=0; iPeak<nPeaks; iPeak++) {
@@ -63,52 +135,270 @@ Peak::Peak(double norm, double mean, double sigma) :
 Peak::~Peak() {}
 
 
-// Fitting.
-Peak fitPeak(TH1D* histo, double normInit, double meanInit, double sigmaInit) {
-  TF1* fitFunc = new TF1(
-    "fitFunc",
-    "gaus(0)",
+// PeakFitComparison.
+PeakFitComparison::PeakFitComparison() :
+  n(0), estimatorTime(0.0), minuitTime(0.0),
+  sumMeanDiff(0.0), sumMeanDiff2(0.0), maxMeanDiff(0.0),
+  sumSigmaDiff(0.0), sumSigmaDiff2(0.0), maxSigmaDiff(0.0)
+{}
+
+
+PeakFitComparison::~PeakFitComparison() {}
+
+
+void PeakFitComparison::add(const PeakFitComparison& other) {
+  n += other.n;
+  estimatorTime += other.estimatorTime;
+  minuitTime += other.minuitTime;
+  sumMeanDiff += other.sumMeanDiff;
+  sumMeanDiff2 += other.sumMeanDiff2;
+  maxMeanDiff = std::max(maxMeanDiff, other.maxMeanDiff);
+  sumSigmaDiff += other.sumSigmaDiff;
+  sumSigmaDiff2 += other.sumSigmaDiff2;
+  maxSigmaDiff = std::max(maxSigmaDiff, other.maxSigmaDiff);
+}
+
+
+// PeakFitter.
+PeakFitter::PeakFitter(PeakMethod method, bool compare) :
+  method(method), compare(compare), comparison(),
+  fitFunc(new TF1("fitFunc", "gaus(0)", 0.0, 1.0, TF1::EAddToList::kNo))
+{
+  fitFunc->SetNpx(1000);
+}
+
+
+PeakFitter::~PeakFitter() {
+  delete fitFunc;
+}
+
+
+Peak PeakFitter::fit(
+  TH1D* histo, double normInit, double meanInit, double sigmaInit,
+  bool draw
+) {
+  double chi2 = 0.0;
+  if (method == kPeakMinuit) {
+    Peak fitted = fitMinuit(histo, normInit, meanInit, sigmaInit, draw, chi2);
+    return correctPeak(fitted, chi2, normInit, meanInit, sigmaInit);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  Peak estimated = (method == kPeakMoments) ?
+    estimatePeakMoments(histo, meanInit, sigmaInit, chi2) :
+    estimatePeakCaruana(histo, meanInit, sigmaInit, chi2);
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+
+  if (compare) {
+    double minuitChi2 = 0.0;
+    start = std::chrono::steady_clock::now();
+    Peak fitted = fitMinuit(histo, normInit, meanInit, sigmaInit, false, minuitChi2);
+    std::chrono::duration<double> minuitElapsed =
+      std::chrono::steady_clock::now() - start;
+
+    const double meanDiff = estimated.mean - fitted.mean;
+    const double sigmaDiff = estimated.sigma - fitted.sigma;
+    ++comparison.n;
+    comparison.estimatorTime += elapsed.count();
+    comparison.minuitTime += minuitElapsed.count();
+    comparison.sumMeanDiff += meanDiff;
+    comparison.sumMeanDiff2 += meanDiff*meanDiff;
+    comparison.maxMeanDiff = std::max(comparison.maxMeanDiff, std::abs(meanDiff));
+    comparison.sumSigmaDiff += sigmaDiff;
+    comparison.sumSigmaDiff2 += sigmaDiff*sigmaDiff;
+    comparison.maxSigmaDiff = std::max(comparison.maxSigmaDiff, std::abs(sigmaDiff));
+  }
+
+  return correctPeak(estimated, chi2, normInit, meanInit, sigmaInit);
+}
+
+
+Peak PeakFitter::fitMinuit(
+  TH1D* histo, double normInit, double meanInit, double sigmaInit,
+  bool draw, double& chi2
+) {
+  // Same starting point as a freshly created function, errors of the last
+  // fit would otherwise be used as initial steps.
+  const double parErrors[3] = {0.0, 0.0, 0.0};
+  fitFunc->SetRange(
     meanInit-2*TMath::Abs(sigmaInit),meanInit+2*TMath::Abs(sigmaInit)
     //histo->GetXaxis()->GetXmin(), histo->GetXaxis()->GetXmax()
   );
-  fitFunc->SetNpx(1000);
+  fitFunc->SetParErrors(parErrors);
 
   fitFunc->SetParameter(0, normInit);
   fitFunc->SetParameter(1, meanInit);
   fitFunc->SetParameter(2, sigmaInit);
-  histo->Fit("fitFunc", "QR");
+  histo->Fit(fitFunc, draw ? "QR" : "QRN");
 
-  double aa = fitFunc->GetParameter(0);
-  double mu = fitFunc->GetParameter(1);
-  double ssig = TMath::Abs(fitFunc->GetParameter(2));
-  double chi2 = fitFunc->GetChisquare();
+  chi2 = fitFunc->GetChisquare();
   //std::cout<<"initial:\t"<<normInit<<"\t"<<meanInit<<"\t"<<sigmaInit<<std::endl;
   //std::cout<<"\tfitted:\t"<<aa<<"\t"<<mu<<"\t"<<ssig<<"\t"<<chi2<<std::endl;
 
-  if ((mu>meanInit+0.2 || mu<meanInit-0.2) && (chi2>20 || ssig>1)){
-    mu = meanInit;
-  }
- 
- 
-   if (aa>normInit*20 || chi2<0.1  ){//|| aa<normInit/10.0){
-    ssig = 0;
+  return Peak(
+    fitFunc->GetParameter(0),
+    fitFunc->GetParameter(1),
+    TMath::Abs(fitFunc->GetParameter(2))
+  );
+}
+
+
+// Fitting.
+Peak fitPeak(
+  TH1D* histo, double normInit, double meanInit, double sigmaInit,
+  bool draw
+) {
+  PeakFitter fitter;
+
+  return fitter.fit(histo, normInit, meanInit, sigmaInit, draw);
+}
+
+
+Peak estimatePeakMoments(
+  const TH1D* histo, double meanInit, double sigmaInit, double& chi2
+) {
+  const TAxis* axis = histo->GetXaxis();
+  const double halfWidth = 2.0*std::abs(sigmaInit);
+  const double binWidth = axis->GetBinWidth(axis->GetFirst());
+  chi2 = 0.0;
+
+  // Second pass is centred on the first estimate, which reduces the bias
+  // from truncating the peak asymmetrically.
+  double mean = meanInit;
+  double sum0 = 0.0;
+  double variance = 0.0;
+  for (int iPass=0; iPass<2; ++iPass) {
+    const double centre = mean;
+    double sum1 = 0.0;
+    double sum2 = 0.0;
+    sum0 = 0.0;
+    for (int bin=axis->GetFirst(); bin<=axis->GetLast(); ++bin) {
+      const double u = axis->GetBinCenter(bin) - centre;
+      if (u<-halfWidth || u>halfWidth) continue;
+
+      const double content = histo->GetBinContent(bin);
+      sum0 += content;
+      sum1 += content*u;
+      sum2 += content*u*u;
+    }
+    if (sum0 <= 0.0) return Peak(0.0, meanInit, 0.0);
+
+    mean = centre + sum1/sum0;
+    variance = sum2/sum0 - (sum1/sum0)*(sum1/sum0);
   }
-   if (ssig>sigmaInit){
-    ssig = TMath::Abs(sigmaInit);
+
+  // Sheppard's correction for the binning.
+  variance -= binWidth*binWidth/12.0;
+  if (variance <= 0.0) return Peak(0.0, meanInit, 0.0);
+
+  // Undo the truncation at +-halfWidth, sigma = sqrt(variance/factor(k))
+  // with k = halfWidth/sigma solved by fixed point iteration.
+  double sigma = std::sqrt(variance);
+  for (int iIter=0; iIter<20; ++iIter) {
+    const double factor = getTruncatedVarianceFactor(halfWidth/sigma);
+    // Window too narrow to correct.
+    if (factor < 0.05) break;
+    sigma = std::sqrt(variance/factor);
   }
 
-   if (mu-meanInit>0.5){mu = meanInit;}
-  //compare number of events in central peak to norm
-   // std::cout<<"\tcorrected:\t"<<aa<<"\t"<<mu<<"\t"<<ssig<<std::endl;
+  const double fraction = std::erf(halfWidth/(sigma*std::sqrt(2.0)));
+  const double norm = sum0*binWidth / (sigma*std::sqrt(2.0*TMath::Pi())*fraction);
+  chi2 = getChi2(
+    histo, meanInit-halfWidth, meanInit+halfWidth, norm, mean, sigma
+  );
+
+  return Peak(norm, mean, sigma);
+}
+
 
-  // if (ssig==0){std::cout<<"flagged event for removal!!!!"<<std::endl;}
-  Peak peak(
-    aa,
-    mu,
-    ssig
+Peak estimatePeakCaruana(
+  const TH1D* histo, double meanInit, double sigmaInit, double& chi2
+) {
+  const TAxis* axis = histo->GetXaxis();
+  const double halfWidth = 2.0*std::abs(sigmaInit);
+  chi2 = 0.0;
+
+  // Fit ln(counts) = a + b*u + c*u^2 with u = x - meanInit, weighting bins
+  // by their counts, which are the inverse variances of the logarithms.
+  double s[5] = {0.0, 0.0, 0.0, 0.0, 0.0};  // sum w*u^i
+  double t[3] = {0.0, 0.0, 0.0};  // sum w*u^i*ln(counts)
+  int nBins = 0;
+  for (int bin=axis->GetFirst(); bin<=axis->GetLast(); ++bin) {
+    const double u = axis->GetBinCenter(bin) - meanInit;
+    const double content = histo->GetBinContent(bin);
+    if (u<-halfWidth || u>halfWidth || content<=0.0) continue;
+
+    const double y = std::log(content);
+    double uPow = content;
+    for (int i=0; i<5; ++i) {
+      s[i] += uPow;
+      if (i < 3) t[i] += uPow*y;
+      uPow *= u;
+    }
+    ++nBins;
+  }
+  if (nBins < 3) return Peak(0.0, meanInit, 0.0);
+
+  // Solve the 3x3 normal equations by Cramer's rule.
+  auto det3 = [](
+    double a00, double a01, double a02,
+    double a10, double a11, double a12,
+    double a20, double a21, double a22
+  ) {
+    return
+      a00*(a11*a22 - a12*a21) -
+      a01*(a10*a22 - a12*a20) +
+      a02*(a10*a21 - a11*a20);
+  };
+  const double det = det3(s[0], s[1], s[2], s[1], s[2], s[3], s[2], s[3], s[4]);
+  if (det == 0.0) return Peak(0.0, meanInit, 0.0);
+
+  const double a = det3(t[0], s[1], s[2], t[1], s[2], s[3], t[2], s[3], s[4]) / det;
+  const double b = det3(s[0], t[0], s[2], s[1], t[1], s[3], s[2], t[2], s[4]) / det;
+  const double c = det3(s[0], s[1], t[0], s[1], s[2], t[1], s[2], s[3], t[2]) / det;
+  // Not a peak.
+  if (c >= 0.0) return Peak(0.0, meanInit, 0.0);
+
+  const double mean = meanInit - b/(2.0*c);
+  const double sigma = std::sqrt(-1.0/(2.0*c));
+  const double norm = std::exp(a - b*b/(4.0*c));
+  chi2 = getChi2(
+    histo, meanInit-halfWidth, meanInit+halfWidth, norm, mean, sigma
   );
 
-  return peak;
+  return Peak(norm, mean, sigma);
+}
+
+
+PeakMethod parsePeakMethod(const std::string& name) {
+  if (name == "minuit") return kPeakMinuit;
+  if (name == "moments") return kPeakMoments;
+  if (name == "caruana") return kPeakCaruana;
+
+  throw std::runtime_error("Unknown peak method `" + name + "`.");
+}
+
+
+void writePeakFitComparison(
+  std::ostream& os, const PeakFitComparison& comparison
+) {
+  if (comparison.n == 0) return;
+
+  const double n = static_cast<double>(comparison.n);
+  const double meanDiff = comparison.sumMeanDiff/n;
+  const double sigmaDiff = comparison.sumSigmaDiff/n;
+  os
+    << "    Peak estimates compared with Minuit fit for "
+    << comparison.n << " projections:" << std::endl
+    << "      time " << comparison.estimatorTime << " s instead of "
+    << comparison.minuitTime << " s" << std::endl
+    << "      mean difference " << meanDiff << " +- "
+    << std::sqrt(std::max(0.0, comparison.sumMeanDiff2/n - meanDiff*meanDiff))
+    << " cm, max " << comparison.maxMeanDiff << " cm" << std::endl
+    << "      sigma difference " << sigmaDiff << " +- "
+    << std::sqrt(std::max(0.0, comparison.sumSigmaDiff2/n - sigmaDiff*sigmaDiff))
+    << " cm, max " << comparison.maxSigmaDiff << " cm" << std::endl;
 }
 /*
 std::vector<Peak> sortByHeight(std::vector<Peak> peaksFound, int nFoil) {
@@ -292,19 +582,21 @@ std::vector<Peak> findPeaks(TH1D* histo, int nfoil) {
   return peaksFound;
 }
 
-std::vector<Peak> fitMultiPeak(TH1D* histo, double sigma) {
+std::vector<Peak> fitMultiPeak(TH1D* histo, double sigma, bool draw) {
   TSpectrum* spec = new TSpectrum();
   int nPeaks = spec->Search(histo, sigma, "goff");
 
   double* peaksX = (double*)spec->GetPositionX();
   double* peaksY = (double*)spec->GetPositionY();
 
-  MultiPeakFunc* peaksFunc = new MultiPeakFunc(nPeaks);
+  // Kept out of the global list of functions, which is shared by threads.
+  // The function keeps a copy of peaksFunc, as does the one stored in histo.
+  MultiPeakFunc peaksFunc(nPeaks);
   TF1* fitFunc = new TF1(
     "fitFunc",
-    peaksFunc, &MultiPeakFunc::Evaluate,
+    peaksFunc,
     histo->GetXaxis()->GetXmin(), histo->GetXaxis()->GetXmax(),
-    3*nPeaks
+    3*nPeaks, 1, TF1::EAddToList::kNo
   );
   fitFunc->SetNpx(1000);
 
@@ -315,7 +607,7 @@ std::vector<Peak> fitMultiPeak(TH1D* histo, double sigma) {
     pars[3*iPeak+2] = sigma;
   }
   fitFunc->SetParameters(pars);
-  histo->Fit("fitFunc", "Q");
+  histo->Fit(fitFunc, draw ? "Q" : "QN");
 
   std::vector<Peak> peaks;
   for (int iPeak=0; iPeak<nPeaks; ++iPeak) { 
@@ -336,6 +628,7 @@ std::vector<Peak> fitMultiPeak(TH1D* histo, double sigma) {
 
   std::sort(peaks.begin(), peaks.end(),compare);
   
+  delete fitFunc;
   delete spec;
 
   return peaks;
@@ -369,7 +662,7 @@ std::vector<Peak> selectMultiPeakY(TH1D* histo, int nfoil, double sinTheta) {
   return peaks;
 }
 
-std::size_t getClosestIndex(double value, std::vector<double>& reference) {
+std::size_t getClosestIndex(double value, const std::vector<double>& reference) {
   size_t index;
   double min_dist = INFINITY;
   double distance;
@@ -0,0 +1,297 @@
+#include "myOffsetFit.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <thread>
+
+#include "mySelection.hpp"
+
+
+namespace {
+
+  // Expected resolution used to combine sieve and foil residuals.
+  const double kSieveSigma = 0.3;  // cm
+  const double kZVerSigma = 0.5;  // cm
+
+  // Fitted parameters are theta and phi offsets in mrad and x and y
+  // mispointing in mm, so that they are of similar size.
+  const std::size_t kNPars = 4;
+  const double kParScales[kNPars] = {1.0e-3, 1.0e-3, 0.1, 0.1};
+
+  OffsetShifts getShifts(const OffsetShifts& start, const std::vector<double>& pars) {
+    OffsetShifts shifts = start;
+    shifts.thetaOffset += kParScales[0]*pars[0];
+    shifts.phiOffset += kParScales[1]*pars[1];
+    shifts.xMispointing += kParScales[2]*pars[2];
+    shifts.yMispointing += kParScales[3]*pars[3];
+
+    return shifts;
+  }
+
+
+  double getObjective(
+    const std::vector<OffsetFitRun>& runs, const OffsetShifts& start,
+    const std::vector<double>& pars, int xTarCorrIterNum, int nThreads
+  ) {
+    return getOffsetObjective(
+      runs, getShifts(start, pars), xTarCorrIterNum, nThreads
+    );
+  }
+
+
+  // Central difference gradient.
+  std::vector<double> getGradient(
+    const std::vector<OffsetFitRun>& runs, const OffsetShifts& start,
+    const std::vector<double>& pars, int xTarCorrIterNum, int nThreads
+  ) {
+    const double step = 1.0e-3;
+    std::vector<double> gradient(kNPars);
+    std::vector<double> parsUp = pars;
+    std::vector<double> parsDown = pars;
+
+    for (std::size_t i=0; i<kNPars; ++i) {
+      parsUp[i] = pars[i] + step;
+      parsDown[i] = pars[i] - step;
+      gradient[i] = (
+        getObjective(runs, start, parsUp, xTarCorrIterNum, nThreads) -
+        getObjective(runs, start, parsDown, xTarCorrIterNum, nThreads)
+      ) / (2.0*step);
+      parsUp[i] = pars[i];
+      parsDown[i] = pars[i];
+    }
+
+    return gradient;
+  }
+
+
+  double dot(const std::vector<double>& a, const std::vector<double>& b) {
+    double sum = 0.0;
+    for (std::size_t i=0; i<a.size(); ++i) sum += a[i]*b[i];
+
+    return sum;
+  }
+
+}
+
+
+// OffsetFitRun implementation.
+
+OffsetFitRun::OffsetFitRun(
+  const config::RunConfig& runConf, std::vector<Event>& events,
+  const RecMatrix& recMatrixIndep, const RecMatrix& recMatrixDep
+) :
+  runConf(runConf), events(), sumss(),
+  foils(), xSieveIndexes(), ySieveIndexes(), nAssigned(0)
+{
+  this->events.swap(events);
+
+  sumss.reserve(this->events.size());
+  for (const auto& event : this->events) {
+    sumss.push_back(MatrixSums(event, recMatrixIndep, recMatrixDep));
+  }
+}
+
+
+OffsetFitRun::~OffsetFitRun() {}
+
+
+// Implementation of functions.
+
+void assignEvents(
+  OffsetFitRun& run, const OffsetShifts& shifts, int xTarCorrIterNum
+) {
+  const config::RunConfig conf = applyShifts(run.runConf, shifts);
+  const std::size_t nFoils = conf.zFoils.size();
+  const std::size_t nEvents = run.events.size();
+  const std::vector<double> xSievePhys = conf.getSieveHolesX();
+  const std::vector<double> ySievePhys = conf.getSieveHolesY();
+
+  run.foils.assign(nEvents, nFoils);
+  run.xSieveIndexes.assign(nEvents, 0);
+  run.ySieveIndexes.assign(nEvents, 0);
+  run.nAssigned = 0;
+
+  Event event;
+  for (std::size_t iEvent=0; iEvent<nEvents; ++iEvent) {
+    event = run.events[iEvent];
+    reconstructEvent(event, conf, run.sumss[iEvent], xTarCorrIterNum);
+
+    std::size_t iFoil = findClosestFoil(event, conf.zFoils);
+    if (iFoil == nFoils) continue;
+    if (!findClosestHole(
+      event, conf, xSievePhys, ySievePhys,
+      run.xSieveIndexes[iEvent], run.ySieveIndexes[iEvent]
+    )) continue;
+
+    run.foils[iEvent] = iFoil;
+    ++run.nAssigned;
+  }
+}
+
+
+double getOffsetObjective(
+  const std::vector<OffsetFitRun>& runs, const OffsetShifts& shifts,
+  int xTarCorrIterNum, int nThreads
+) {
+  if (nThreads < 1) nThreads = 1;
+  const std::size_t nChunks = static_cast<std::size_t>(nThreads);
+
+  double sum = 0.0;
+  std::size_t nAssigned = 0;
+
+  for (const auto& run : runs) {  // run loop
+    const config::RunConfig conf = applyShifts(run.runConf, shifts);
+    const std::size_t nFoils = conf.zFoils.size();
+    const std::size_t nEvents = run.events.size();
+    const std::vector<double> xSievePhys = conf.getSieveHolesX();
+    const std::vector<double> ySievePhys = conf.getSieveHolesY();
+
+    // Partial sums are added in fixed order to keep the result independent
+    // of thread timing.
+    std::vector<double> partials(nChunks, 0.0);
+    auto sumChunk = [&](std::size_t iChunk) {
+      Event event;
+      double partial = 0.0;
+      const std::size_t first = iChunk*nEvents/nChunks;
+      const std::size_t last = (iChunk+1)*nEvents/nChunks;
+
+      for (std::size_t iEvent=first; iEvent<last; ++iEvent) {
+        const std::size_t iFoil = run.foils[iEvent];
+        if (iFoil == nFoils) continue;
+
+        event = run.events[iEvent];
+        reconstructEvent(event, conf, run.sumss[iEvent], xTarCorrIterNum);
+
+        const double dx = (event.xSieve - xSievePhys[run.xSieveIndexes[iEvent]]) / kSieveSigma;
+        const double dy = (event.ySieve - ySievePhys[run.ySieveIndexes[iEvent]]) / kSieveSigma;
+        const double dz = (event.zVer - conf.zFoils[iFoil]) / kZVerSigma;
+        partial += dx*dx + dy*dy + dz*dz;
+      }
+      partials[iChunk] = partial;
+    };
+
+    std::vector<std::thread> threads;
+    for (std::size_t iChunk=1; iChunk<nChunks; ++iChunk) {
+      threads.push_back(std::thread(sumChunk, iChunk));
+    }
+    sumChunk(0);
+    for (auto& thread : threads) thread.join();
+
+    for (const auto& partial : partials) sum += partial;
+    nAssigned += run.nAssigned;
+  }  // run loop
+
+  if (nAssigned == 0) return 0.0;
+
+  return sum / static_cast<double>(nAssigned);
+}
+
+
+OffsetShifts fitOffsets(
+  std::vector<OffsetFitRun>& runs, const OffsetShifts& shifts,
+  int xTarCorrIterNum, int nThreads, int nAssignIter
+) {
+  const int maxIterNum = 100;
+  OffsetShifts start = shifts;
+
+  for (int iAssign=0; iAssign<nAssignIter; ++iAssign) {  // assignment loop
+    std::size_t nAssigned = 0;
+    for (auto& run : runs) {
+      assignEvents(run, start, xTarCorrIterNum);
+      nAssigned += run.nAssigned;
+    }
+    std::cout
+      << "  Assignment " << iAssign+1 << ": " << nAssigned
+      << " events in foils and holes" << std::endl;
+    if (nAssigned == 0) break;
+
+    // BFGS with backtracking line search.
+    std::vector<double> pars(kNPars, 0.0);
+    std::vector<double> hessInv(kNPars*kNPars, 0.0);
+    for (std::size_t i=0; i<kNPars; ++i) hessInv[i*kNPars+i] = 1.0;
+
+    double f = getObjective(runs, start, pars, xTarCorrIterNum, nThreads);
+    std::vector<double> gradient = getGradient(runs, start, pars, xTarCorrIterNum, nThreads);
+    std::vector<double> direction(kNPars);
+    std::vector<double> parsNew(kNPars);
+
+    for (int iIter=0; iIter<maxIterNum; ++iIter) {  // minimisation loop
+      auto iterStart = std::chrono::steady_clock::now();
+
+      for (std::size_t i=0; i<kNPars; ++i) {
+        direction[i] = 0.0;
+        for (std::size_t j=0; j<kNPars; ++j) {
+          direction[i] -= hessInv[i*kNPars+j]*gradient[j];
+        }
+      }
+      double slope = dot(gradient, direction);
+      if (slope >= 0.0) {
+        // Not a descent direction, restart from steepest descent.
+        for (std::size_t i=0; i<kNPars; ++i) {
+          for (std::size_t j=0; j<kNPars; ++j) hessInv[i*kNPars+j] = (i==j) ? 1.0 : 0.0;
+          direction[i] = -gradient[i];
+        }
+        slope = dot(gradient, direction);
+      }
+
+      double step = 1.0;
+      double fNew = f;
+      while (step > 1.0e-8) {
+        for (std::size_t i=0; i<kNPars; ++i) parsNew[i] = pars[i] + step*direction[i];
+        fNew = getObjective(runs, start, parsNew, xTarCorrIterNum, nThreads);
+        if (fNew <= f + 1.0e-4*step*slope) break;
+        step *= 0.5;
+      }
+      if (step <= 1.0e-8) break;
+
+      std::vector<double> gradientNew = getGradient(runs, start, parsNew, xTarCorrIterNum, nThreads);
+      std::vector<double> s(kNPars);
+      std::vector<double> y(kNPars);
+      for (std::size_t i=0; i<kNPars; ++i) {
+        s[i] = parsNew[i] - pars[i];
+        y[i] = gradientNew[i] - gradient[i];
+      }
+
+      // H = (I - rho s y^T) H (I - rho y s^T) + rho s s^T
+      const double sy = dot(s, y);
+      if (sy > 1.0e-12) {
+        const double rho = 1.0/sy;
+        std::vector<double> hy(kNPars, 0.0);
+        for (std::size_t i=0; i<kNPars; ++i) {
+          for (std::size_t j=0; j<kNPars; ++j) hy[i] += hessInv[i*kNPars+j]*y[j];
+        }
+        const double yhy = dot(y, hy);
+        for (std::size_t i=0; i<kNPars; ++i) {
+          for (std::size_t j=0; j<kNPars; ++j) {
+            hessInv[i*kNPars+j] +=
+              rho*rho*yhy*s[i]*s[j] + rho*s[i]*s[j] -
+              rho*(hy[i]*s[j] + s[i]*hy[j]);
+          }
+        }
+      }
+
+      const double fChange = f - fNew;
+      pars = parsNew;
+      gradient = gradientNew;
+      f = fNew;
+
+      std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - iterStart;
+      std::cout
+        << "    Iteration " << iIter+1 << ": objective " << f
+        << ", dTheta " << kParScales[0]*pars[0]
+        << ", dPhi " << kParScales[1]*pars[1]
+        << ", dXMis " << kParScales[2]*pars[2]
+        << ", dYMis " << kParScales[3]*pars[3]
+        << ", " << elapsed.count() << " s" << std::endl;
+
+      if (fChange < 1.0e-10*(1.0 + std::abs(f))) break;
+      if (std::sqrt(dot(gradient, gradient)) < 1.0e-8) break;
+    }  // minimisation loop
+
+    start = getShifts(start, pars);
+  }  // assignment loop
+
+  return start;
+}
@@ -1,6 +1,7 @@
 #include "myOther.hpp"
 
 #include <cstdio>
+#include <thread>
 
 
 // Implementation of reportProgress.
@@ -34,3 +35,25 @@ void reportProgress(long long int done, long long int length) {
 void reportProgressFinish() {
   printf("%5.1f%%\n", 100.0);
 }
+
+
+// Implementation of other functions.
+
+int getThreadNum(int requested) {
+  if (requested > 0) return requested;
+
+  int nThreads = static_cast<int>(std::thread::hardware_concurrency());
+  return (nThreads > 0) ? nThreads : 1;
+}
+
+
+void writeBinary(std::ostream& os, const std::string& str) {
+  writeBinary(os, std::vector<char>(str.begin(), str.end()));
+}
+
+
+void readBinary(std::istream& is, std::string& str) {
+  std::vector<char> chars;
+  readBinary(is, chars);
+  str.assign(chars.begin(), chars.end());
+}
@@ -0,0 +1,54 @@
+#include "myPipeline.hpp"
+
+#include <chrono>
+
+
+// EventPipeline implementation.
+
+EventPipeline::EventPipeline(
+  const config::RunConfig& runConf, EventFileCache* cache,
+  std::size_t batchSize, std::size_t queueDepth
+) :
+  readTime(0.0), queue(queueDepth), thread(), error()
+{
+  // The thread gets its own copy of the run configuration.
+  thread = std::thread([this, runConf, cache, batchSize]() {
+    auto start = std::chrono::steady_clock::now();
+    try {
+      readEventBatches(
+        runConf, batchSize,
+        [this](std::vector<Event>& batch) { queue.push(batch); }, cache
+      );
+    }
+    catch (...) {
+      error = std::current_exception();
+    }
+    std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+    readTime = elapsed.count();
+    queue.close();
+  });
+}
+
+
+EventPipeline::~EventPipeline() {
+  // A reader waiting for a free slot needs the rest of the batches taken.
+  std::vector<Event> batch;
+  while (queue.pop(batch)) {}
+  if (thread.joinable()) thread.join();
+}
+
+
+bool EventPipeline::next(std::vector<Event>& batch) {
+  if (queue.pop(batch)) return true;
+
+  if (thread.joinable()) thread.join();
+  if (error) std::rethrow_exception(error);
+
+  return false;
+}
+
+
+const QueueMetrics& EventPipeline::getMetrics() const {
+  return queue.getMetrics();
+}
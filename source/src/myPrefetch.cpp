@@ -0,0 +1,85 @@
+#include "myPrefetch.hpp"
+
+#include <chrono>
+
+
+// EventPrefetcher implementation.
+
+EventPrefetcher::EventPrefetcher(std::size_t maxBytes, EventFileCache* cache) :
+  nPrefetched(0), nSkipped(0), readTime(0.0), waitTime(0.0),
+  lastReadTime(0.0), lastWaitTime(0.0),
+  maxBytes(maxBytes), cache(cache), readRunNumber(-1), thread(), buffer(), skipped(false),
+  bufferReadTime(0.0), error()
+{}
+
+
+EventPrefetcher::~EventPrefetcher() {
+  if (thread.joinable()) thread.join();
+}
+
+
+void EventPrefetcher::start(const config::RunConfig& runConf) {
+  wait();
+
+  readRunNumber = runConf.runNumber;
+  buffer.clear();
+  skipped = false;
+  bufferReadTime = 0.0;
+  error = std::exception_ptr();
+
+  // The thread gets its own copy of the run configuration.
+  thread = std::thread([this, runConf]() {
+    auto start = std::chrono::steady_clock::now();
+    try {
+      const long long nEvents = countEvents(runConf);
+      if (static_cast<double>(nEvents)*sizeof(Event) > static_cast<double>(maxBytes)) {
+        skipped = true;
+      }
+      else {
+        buffer = readEvents(runConf, nEvents, cache);
+      }
+    }
+    catch (...) {
+      error = std::current_exception();
+    }
+    std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+    bufferReadTime = elapsed.count();
+  });
+}
+
+
+bool EventPrefetcher::isReading(int runNumber) const {
+  return readRunNumber >= 0 && readRunNumber == runNumber;
+}
+
+
+bool EventPrefetcher::take(std::vector<Event>& events) {
+  auto start = std::chrono::steady_clock::now();
+  wait();
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+  readRunNumber = -1;
+
+  if (error) std::rethrow_exception(error);
+  if (skipped) {
+    ++nSkipped;
+    return false;
+  }
+
+  ++nPrefetched;
+  lastReadTime = bufferReadTime;
+  lastWaitTime = elapsed.count();
+  readTime += lastReadTime;
+  waitTime += lastWaitTime;
+
+  events.swap(buffer);
+  std::vector<Event>().swap(buffer);
+
+  return true;
+}
+
+
+void EventPrefetcher::wait() {
+  if (thread.joinable()) thread.join();
+}
@@ -0,0 +1,18 @@
+#include "myQueue.hpp"
+
+
+// QueueMetrics implementation.
+
+QueueMetrics::QueueMetrics() :
+  capacity(0), nItems(0), maxDepth(0), depthSum(0),
+  producerStallTime(0.0), consumerStallTime(0.0)
+{}
+
+
+QueueMetrics::~QueueMetrics() {}
+
+
+double QueueMetrics::getMeanDepth() const {
+  if (nItems == 0) return 0.0;
+  return static_cast<double>(depthSum) / static_cast<double>(nItems);
+}
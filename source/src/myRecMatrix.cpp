@@ -180,3 +180,17 @@ void writeMatrixFile(const std::string& fileName, const RecMatrix& recMatrix) {
 
   ofs.close();
 }
+
+
+void splitRecMatrix(
+  const RecMatrix& recMatrix, RecMatrix& recMatrixIndep, RecMatrix& recMatrixDep
+) {
+  recMatrixIndep = RecMatrix();
+  recMatrixDep = RecMatrix();
+  recMatrixIndep.header = recMatrix.header;
+  recMatrixDep.header = recMatrix.header;
+  for (const auto& line : recMatrix.matrix) {
+    if (line.E_xTar == 0) recMatrixIndep.addLine(line);
+    else recMatrixDep.addLine(line);
+  }
+}
@@ -0,0 +1,248 @@
+#include "myReconstruct.hpp"
+
+#include <cmath>
+#include <stdexcept>
+
+#include "TMath.h"
+
+
+// TargetVariables implementation.
+
+TargetVariables::TargetVariables() :
+  xTar(0.0), yTar(0.0), xpTar(0.0), ypTar(0.0)
+{}
+
+
+TargetVariables::~TargetVariables() {}
+
+
+// MatrixSums implementation.
+
+MatrixSums::MatrixSums() : xpSums(), ySums(), ypSums(), nPowers(1) {}
+
+
+MatrixSums::MatrixSums(
+  const Event& event,
+  const RecMatrix& recMatrixIndep, const RecMatrix& recMatrixDep
+) :
+  xpSums(), ySums(), ypSums(), nPowers(1)
+{
+  for (const auto& line : recMatrixIndep.matrix) {
+    double lambda =
+      pow(event.xFp/100.0, line.E_x) *
+      pow(event.xpFp, line.E_xp) *
+      pow(event.yFp/100.0, line.E_y) *
+      pow(event.ypFp, line.E_yp);
+
+    xpSums[0] += line.C_Xp * lambda;
+    ySums[0] += line.C_Y * lambda;
+    ypSums[0] += line.C_Yp * lambda;
+  }
+
+  for (const auto& line : recMatrixDep.matrix) {
+    if (line.E_xTar > kMaxXTarPower) {
+      throw std::runtime_error("Too high power of xTar in matrix!");
+    }
+
+    double lambda =
+      pow(event.xFp/100.0, line.E_x) *
+      pow(event.xpFp, line.E_xp) *
+      pow(event.yFp/100.0, line.E_y) *
+      pow(event.ypFp, line.E_yp);
+
+    xpSums[line.E_xTar] += line.C_Xp * lambda;
+    ySums[line.E_xTar] += line.C_Y * lambda;
+    ypSums[line.E_xTar] += line.C_Yp * lambda;
+    if (line.E_xTar >= nPowers) nPowers = line.E_xTar + 1;
+  }
+}
+
+
+MatrixSums::~MatrixSums() {}
+
+
+void MatrixSums::getSums(
+  double xTar, double& xpSum, double& ySum, double& ypSum
+) const {
+  // Horner's scheme.
+  const double x = xTar/100.0;
+  xpSum = 0.0;
+  ySum = 0.0;
+  ypSum = 0.0;
+  for (int k=nPowers-1; k>=0; --k) {
+    xpSum = xpSum*x + xpSums[k];
+    ySum = ySum*x + ySums[k];
+    ypSum = ypSum*x + ypSums[k];
+  }
+}
+
+
+// Implementation of functions.
+
+void reconstructEvent(
+  Event& event, const config::RunConfig& runConf,
+  const RecMatrix& recMatrixIndep, const RecMatrix& recMatrixDep,
+  int xTarCorrIterNum
+) {
+  MatrixSums sums(event, recMatrixIndep, recMatrixDep);
+  reconstructEvent(event, runConf, sums, xTarCorrIterNum);
+}
+
+
+void reconstructEvent(
+  Event& event, const config::RunConfig& runConf,
+  const MatrixSums& sums, int xTarCorrIterNum
+) {
+  const double D1 = 138.0;
+  const double D2 = 75.0;
+  const double D3 = 40.0;
+
+  double cosTheta = cos(event.theta*TMath::DegToRad());
+  double sinTheta = sin(event.theta*TMath::DegToRad());
+
+  double xpSum = 0.0;
+  double ySum = 0.0;
+  double ypSum = 0.0;
+
+  // Now do several iterations of xTar dependent constributions, each time
+  // with a better approximation for xTar.
+  event.xTar = -event.yVer - runConf.SHMS.xMispointing;
+  double corrFactor = 25.0;
+  double uncorrYTar = 0.0;
+  double uncorrZVer = 0.0;
+  for (int iIter=0; iIter<xTarCorrIterNum+1; ++iIter) {  // iteration loop
+    sums.getSums(event.xTar, xpSum, ySum, ypSum);
+
+    event.xpTar = xpSum + runConf.SHMS.phiOffset;
+    event.yTar = ySum*100.0 + runConf.SHMS.yMispointing;
+    event.ypTar = ypSum + runConf.SHMS.thetaOffset;
+
+    //correct the ytar vs yptar dependency
+    //this is for 2017 data prior to optimization only
+    uncorrYTar = event.yTar;
+    if (sinTheta>0.4){corrFactor = 6.0;}
+
+    if (runConf.use2017Corr != 0){
+      event.yTar = event.yTar - runConf.SHMS.yMispointing - corrFactor*event.ypTar;
+      event.yTar += runConf.SHMS.yMispointing;
+    }
+
+    event.zVer =
+      (event.yTar - event.xVer*(cosTheta - event.ypTar*sinTheta)) /
+      (-sinTheta - event.ypTar*cosTheta);
+
+    uncorrZVer = (uncorrYTar - event.xVer*(cosTheta - event.ypTar*sinTheta)) /
+      (-sinTheta - event.ypTar*cosTheta);
+
+    event.xTarVer = -event.yVer;
+    event.yTarVer = -uncorrZVer*sinTheta + event.xVer*cosTheta;
+    event.zTarVer = uncorrZVer*cosTheta + event.xVer*sinTheta;
+
+    event.xTar = event.xTarVer - event.zTarVer*event.xpTar - runConf.SHMS.xMispointing;
+  }   // iteration loop
+
+  event.xTar += runConf.SHMS.xMispointing;
+  event.yTar -= runConf.SHMS.yMispointing;
+
+  event.xSieve = event.xTar + event.xpTar*runConf.sieve.z0;
+  event.ySieve = (-0.019*event.delta+0.00019*pow(event.delta,2)+(D1+D2)*event.ypTar+uncorrYTar) + D3*(-0.00052*event.delta+0.0000052*pow(event.delta,2)+event.ypTar);
+}
+
+
+TargetVariables getPhysicalTarget(
+  const Event& event, const config::RunConfig& runConf,
+  double zFoil, double xSieveHole, double ySieveHole
+) {
+  double cosTheta = cos(event.theta*TMath::DegToRad());
+  double sinTheta = sin(event.theta*TMath::DegToRad());
+
+  double xTarVerPhy = -event.yVer- runConf.SHMS.xMispointing;
+  double yTarVerPhy = -zFoil*sinTheta + event.xVer*cosTheta - runConf.SHMS.yMispointing;
+  double zTarVerPhy = zFoil*cosTheta + event.xVer*sinTheta;
+
+  TargetVariables target;
+  target.xpTar =
+    (xSieveHole - xTarVerPhy) /
+    (runConf.sieve.z0 - zTarVerPhy);
+
+  double Cdelta = -0.019*event.delta+0.00019*pow(event.delta,2) + 40.0*(-0.00052*event.delta+0.0000052*pow(event.delta,2));
+  target.ypTar =
+    (ySieveHole - Cdelta - yTarVerPhy) /
+    (runConf.sieve.z0 - zTarVerPhy);
+
+  target.xTar = xTarVerPhy - target.xpTar*zTarVerPhy;
+  target.yTar = yTarVerPhy - target.ypTar*zTarVerPhy;
+
+  return target;
+}
+
+
+void sumMatrix(
+  const Event& event, double xTar, const RecMatrix& recMatrix,
+  double& xpSum, double& ySum, double& ypSum
+) {
+  xpSum = 0.0;
+  ySum = 0.0;
+  ypSum = 0.0;
+
+  for (const auto& line : recMatrix.matrix) {
+    double lambda =
+      pow(event.xFp/100.0, line.E_x) *
+      pow(event.xpFp, line.E_xp) *
+      pow(event.yFp/100.0, line.E_y) *
+      pow(event.ypFp, line.E_yp) *
+      pow(xTar/100.0, line.E_xTar);
+
+    xpSum += line.C_Xp * lambda;
+    ySum += line.C_Y * lambda;
+    ypSum += line.C_Yp * lambda;
+  }
+}
+
+
+double sumDelta(const Event& event, double xTar, const RecMatrix& recMatrix) {
+  double deltaSum = 0.0;
+
+  for (const auto& line : recMatrix.matrix) {
+    double lambda =
+      pow(event.xFp/100.0, line.E_x) *
+      pow(event.xpFp, line.E_xp) *
+      pow(event.yFp/100.0, line.E_y) *
+      pow(event.ypFp, line.E_yp) *
+      pow(xTar/100.0, line.E_xTar);
+
+    deltaSum += line.C_D * lambda;
+  }
+
+  return deltaSum;
+}
+
+
+double reconstructDelta(
+  const Event& event, const config::RunConfig& runConf,
+  const RecMatrix& recMatrixIndep, const RecMatrix& recMatrixDep
+) {
+  const double xTar = event.xTar - runConf.SHMS.xMispointing;
+  return 100.0 * (
+    sumDelta(event, xTar, recMatrixIndep) + sumDelta(event, xTar, recMatrixDep)
+  );
+}
+
+
+void getLambdas(
+  const Event& event, double xTar, const RecMatrix& recMatrix,
+  std::vector<double>& lambdas
+) {
+  lambdas.resize(recMatrix.size());
+
+  std::size_t iLine = 0;
+  for (const auto& line : recMatrix.matrix) {
+    lambdas[iLine] =
+      pow(event.xFp/100.0, line.E_x) *
+      pow(event.xpFp, line.E_xp) *
+      pow(event.yFp/100.0, line.E_y) *
+      pow(event.ypFp, line.E_yp) *
+      pow(xTar/100.0, line.E_xTar);
+    ++iLine;
+  }
+}
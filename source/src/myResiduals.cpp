@@ -0,0 +1,236 @@
+#include "myResiduals.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+
+#include "myOther.hpp"
+
+
+// RunningStats implementation.
+
+RunningStats::RunningStats() : n(0), mean(0.0), m2(0.0) {}
+
+
+RunningStats::~RunningStats() {}
+
+
+void RunningStats::fill(double value) {
+  ++n;
+  double delta = value - mean;
+  mean += delta / static_cast<double>(n);
+  m2 += delta * (value - mean);
+}
+
+
+void RunningStats::add(const RunningStats& other) {
+  if (other.n == 0) return;
+  if (n == 0) {
+    *this = other;
+    return;
+  }
+
+  const double n1 = static_cast<double>(n);
+  const double n2 = static_cast<double>(other.n);
+  const double delta = other.mean - mean;
+  mean += delta * n2/(n1+n2);
+  m2 += other.m2 + delta*delta * n1*n2/(n1+n2);
+  n += other.n;
+}
+
+
+double RunningStats::getMean() const {
+  return mean;
+}
+
+
+double RunningStats::getRMS() const {
+  if (n < 2) return 0.0;
+
+  return std::sqrt(m2 / static_cast<double>(n-1));
+}
+
+
+void RunningStats::write(std::ostream& os) const {
+  writeBinary(os, n);
+  writeBinary(os, mean);
+  writeBinary(os, m2);
+}
+
+
+void RunningStats::read(std::istream& is) {
+  readBinary(is, n);
+  readBinary(is, mean);
+  readBinary(is, m2);
+}
+
+
+// RunningMedian implementation.
+
+RunningMedian::RunningMedian() :
+  n(0), heights(), positions(), desired()
+{}
+
+
+RunningMedian::~RunningMedian() {}
+
+
+void RunningMedian::fill(double value) {
+  // The first 5 values are kept sorted as the marker heights.
+  if (n < 5) {
+    heights[n] = value;
+    ++n;
+    std::sort(heights, heights+n);
+    if (n == 5) {
+      for (int i=0; i<5; ++i) positions[i] = i;
+      desired[0] = 0.0;
+      desired[1] = 1.0;
+      desired[2] = 2.0;
+      desired[3] = 3.0;
+      desired[4] = 4.0;
+    }
+    return;
+  }
+  ++n;
+
+  // Cell of the value, extending the extreme markers.
+  int k = 0;
+  if (value < heights[0]) {
+    heights[0] = value;
+  }
+  else if (value >= heights[4]) {
+    heights[4] = value;
+    k = 3;
+  }
+  else {
+    while (value >= heights[k+1]) ++k;
+  }
+  for (int i=k+1; i<5; ++i) positions[i] += 1.0;
+
+  // Desired positions of the minimum, quartiles, median and maximum.
+  desired[1] += 0.25;
+  desired[2] += 0.5;
+  desired[3] += 0.75;
+  desired[4] += 1.0;
+
+  // Move the middle markers towards their desired positions, with a
+  // piecewise parabolic prediction of the heights or a linear one if that
+  // would break their order.
+  for (int i=1; i<4; ++i) {
+    const double offset = desired[i] - positions[i];
+    if (
+      (offset >= 1.0 && positions[i+1]-positions[i] > 1.0) ||
+      (offset <= -1.0 && positions[i-1]-positions[i] < -1.0)
+    ) {
+      const int d = (offset > 0.0) ? 1 : -1;
+      const double height = heights[i] + d/(positions[i+1]-positions[i-1]) * (
+        (positions[i]-positions[i-1]+d) * (heights[i+1]-heights[i]) / (positions[i+1]-positions[i]) +
+        (positions[i+1]-positions[i]-d) * (heights[i]-heights[i-1]) / (positions[i]-positions[i-1])
+      );
+      if (heights[i-1] < height && height < heights[i+1]) {
+        heights[i] = height;
+      }
+      else {
+        heights[i] += d * (heights[i+d]-heights[i]) / (positions[i+d]-positions[i]);
+      }
+      positions[i] += d;
+    }
+  }
+}
+
+
+double RunningMedian::getMedian() const {
+  if (n == 0) return 0.0;
+  if (n >= 5) return heights[2];
+  if (n%2 == 1) return heights[n/2];
+
+  return 0.5*(heights[n/2-1] + heights[n/2]);
+}
+
+
+// ResidualStats implementation.
+
+ResidualStats::ResidualStats() : moments(), median() {}
+
+
+ResidualStats::~ResidualStats() {}
+
+
+void ResidualStats::fill(double value) {
+  moments.fill(value);
+  median.fill(value);
+}
+
+
+// ResidualSummary implementation.
+
+ResidualSummary::ResidualSummary() : xpTar(), yTar(), ypTar(), zVer() {}
+
+
+ResidualSummary::~ResidualSummary() {}
+
+
+void ResidualSummary::fill(
+  const Event& event, const TargetVariables& target, double zFoil
+) {
+  xpTar.fill(event.xpTar - target.xpTar);
+  yTar.fill(event.yTar - target.yTar);
+  ypTar.fill(event.ypTar - target.ypTar);
+  zVer.fill(event.zVer - zFoil);
+}
+
+
+void ResidualSummary::write(std::ostream& os) const {
+  xpTar.write(os);
+  yTar.write(os);
+  ypTar.write(os);
+  zVer.write(os);
+}
+
+
+void ResidualSummary::read(std::istream& is) {
+  xpTar.read(is);
+  yTar.read(is);
+  ypTar.read(is);
+  zVer.read(is);
+}
+
+
+// Implementation of functions.
+
+void writeResidualSummaryHeader(std::ostream& os) {
+  os
+    << "# iter    run foil   events"
+    << "     xpTar_mean      xpTar_rms"
+    << "      yTar_mean       yTar_rms"
+    << "     ypTar_mean      ypTar_rms"
+    << "      zVer_mean       zVer_rms" << std::endl;
+}
+
+
+void writeResidualSummary(
+  std::ostream& os, int iteration, int runNumber, int iFoil,
+  const ResidualSummary& summary
+) {
+  std::ios::fmtflags f(os.flags());
+  std::streamsize prevPrec = os.precision(6);
+
+  os
+    << std::setw(6) << iteration
+    << std::setw(7) << runNumber
+    << std::setw(5) << iFoil
+    << std::setw(9) << summary.xpTar.n
+    << std::scientific
+    << std::setw(15) << summary.xpTar.getMean()
+    << std::setw(15) << summary.xpTar.getRMS()
+    << std::setw(15) << summary.yTar.getMean()
+    << std::setw(15) << summary.yTar.getRMS()
+    << std::setw(15) << summary.ypTar.getMean()
+    << std::setw(15) << summary.ypTar.getRMS()
+    << std::setw(15) << summary.zVer.getMean()
+    << std::setw(15) << summary.zVer.getRMS()
+    << std::endl;
+
+  os.precision(prevPrec);
+  os.flags(f);
+}
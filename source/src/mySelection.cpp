@@ -0,0 +1,322 @@
+#include "mySelection.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+
+// RunCuts implementation.
+
+RunCuts::RunCuts() :
+  zVerPeaks(), yTarPeaks(),
+  xSievePeakss(), ySievePeakss(), xSieveIndexess(), ySieveIndexess(),
+  sieveCorrelationss()
+{}
+
+
+RunCuts::~RunCuts() {}
+
+
+namespace {
+
+  bool isInFoil(
+    const Event& event, const Peak& zVerPeak, const Peak& yTarPeak
+  ) {
+    // Cut on yTar is looser for high delta.
+    const double yTarSigmas = (event.delta<1) ? 1.0 : 1.8;
+
+    return
+      zVerPeak.mean - 1.3*zVerPeak.sigma <= event.zVer &&
+      event.zVer <= zVerPeak.mean + 1.3*zVerPeak.sigma &&
+      yTarPeak.mean - yTarSigmas*yTarPeak.sigma <= event.yTar &&
+      event.yTar <= yTarPeak.mean + yTarSigmas*yTarPeak.sigma &&
+      event.delta>-12;
+  }
+
+
+  // Box of 2.2 sigma in x and 2 sigma in y, or the ellipse inscribed in it
+  // and tilted by correlation if useCorrelation.
+  bool isInHole(
+    const Event& event, const Peak& xSieveP, const Peak& ySieveP,
+    bool useCorrelation, double correlation
+  ) {
+    if (useCorrelation) {
+      // Distance in units of the half-axes of the bounding box.
+      const double u = (event.xSieve - xSieveP.mean) / (2.2*xSieveP.sigma);
+      const double v = (event.ySieve - ySieveP.mean) / (2*ySieveP.sigma);
+      const double rho = correlation;
+      return u*u - 2*rho*u*v + v*v <= 1.0 - rho*rho;
+    }
+
+    return
+      xSieveP.mean - 2.2*xSieveP.sigma <= event.xSieve &&
+      event.xSieve <= xSieveP.mean + 2.2*xSieveP.sigma &&
+      ySieveP.mean - 2*ySieveP.sigma <= event.ySieve &&
+      event.ySieve <= ySieveP.mean + 2*ySieveP.sigma;
+  }
+
+}
+
+
+// CutIndex implementation.
+
+CutIndex::CutIndex(const RunCuts& cuts, const config::RunConfig& runConf) :
+  cuts(&cuts), zVerIndex(), holeIndexes()
+{
+  const std::size_t nFoils = cuts.zVerPeaks.size();
+  if (cuts.yTarPeaks.size() != nFoils) {
+    throw std::runtime_error("CutIndex: different number of zVer and yTar peaks!");
+  }
+
+  std::vector<double> lows, highs;
+  for (const auto& zVerPeak : cuts.zVerPeaks) {
+    lows.push_back(zVerPeak.mean - 1.3*zVerPeak.sigma);
+    highs.push_back(zVerPeak.mean + 1.3*zVerPeak.sigma);
+  }
+  zVerIndex = IntervalIndex1D(lows, highs);
+
+  if (cuts.xSievePeakss.size() != nFoils) return;
+
+  // Grid of half the hole spacing, so a hole box spans only a few cells.
+  const double cellSize =
+    0.5*std::min(runConf.sieve.xHoleSpace, runConf.sieve.yHoleSpace);
+  for (std::size_t iFoil=0; iFoil<nFoils; ++iFoil) {
+    const std::vector<Peak>& xSievePeaks = cuts.xSievePeakss.at(iFoil);
+    const std::vector<Peak>& ySievePeaks = cuts.ySievePeakss.at(iFoil);
+    std::vector<double> xLows, xHighs, yLows, yHighs;
+    for (std::size_t iHole=0; iHole<xSievePeaks.size(); ++iHole) {
+      const Peak& xSieveP = xSievePeaks.at(iHole);
+      const Peak& ySieveP = ySievePeaks.at(iHole);
+      xLows.push_back(xSieveP.mean - 2.2*xSieveP.sigma);
+      xHighs.push_back(xSieveP.mean + 2.2*xSieveP.sigma);
+      yLows.push_back(ySieveP.mean - 2*ySieveP.sigma);
+      yHighs.push_back(ySieveP.mean + 2*ySieveP.sigma);
+    }
+    holeIndexes.push_back(
+      BoxGridIndex2D(xLows, xHighs, yLows, yHighs, cellSize)
+    );
+  }
+}
+
+
+CutIndex::~CutIndex() {}
+
+
+std::size_t CutIndex::findFoil(const Event& event) const {
+  const std::size_t nFoils = cuts->zVerPeaks.size();
+
+  const std::size_t* first;
+  const std::size_t* last;
+  zVerIndex.find(event.zVer, first, last);
+  for (const std::size_t* iFoil=first; iFoil!=last; ++iFoil) {
+    if (
+      isInFoil(event, cuts->zVerPeaks[*iFoil], cuts->yTarPeaks[nFoils-1-*iFoil])
+    ) {
+      return *iFoil;
+    }
+  }
+
+  return nFoils;
+}
+
+
+std::size_t CutIndex::findHole(const Event& event, std::size_t iFoil) const {
+  if (iFoil >= holeIndexes.size()) {
+    throw std::runtime_error("CutIndex: no sieve holes indexed for the foil!");
+  }
+  const std::vector<Peak>& xSievePeaks = cuts->xSievePeakss[iFoil];
+  const std::vector<Peak>& ySievePeaks = cuts->ySievePeakss[iFoil];
+  const std::vector<double>* correlations =
+    (iFoil < cuts->sieveCorrelationss.size()) ?
+    &cuts->sieveCorrelationss[iFoil] : NULL;
+  const bool useCorrelation = correlations && !correlations->empty();
+
+  const std::size_t* first;
+  const std::size_t* last;
+  holeIndexes[iFoil].find(event.xSieve, event.ySieve, first, last);
+  for (const std::size_t* iHole=first; iHole!=last; ++iHole) {
+    if (isInHole(
+      event, xSievePeaks[*iHole], ySievePeaks[*iHole],
+      useCorrelation, useCorrelation ? (*correlations)[*iHole] : 0.0
+    )) {
+      return *iHole;
+    }
+  }
+
+  return xSievePeaks.size();
+}
+
+
+// EventAssignment implementation.
+
+EventAssignment::EventAssignment() :
+  nFoils(0), foils(), holes(), selected()
+{}
+
+
+EventAssignment::~EventAssignment() {}
+
+
+void EventAssignment::reset(std::size_t nEvents, std::size_t nFoils) {
+  if (nFoils >= std::numeric_limits<std::uint16_t>::max()) {
+    throw std::runtime_error("EventAssignment: too many foils!");
+  }
+  if (nEvents > std::numeric_limits<std::uint32_t>::max()) {
+    throw std::runtime_error("EventAssignment: too many events!");
+  }
+
+  this->nFoils = nFoils;
+  foils.assign(nEvents, static_cast<std::uint16_t>(nFoils));
+  holes.assign(nEvents, 0);
+  selected.clear();
+}
+
+
+void EventAssignment::grow(std::size_t nEvents) {
+  if (nEvents > std::numeric_limits<std::uint32_t>::max()) {
+    throw std::runtime_error("EventAssignment: too many events!");
+  }
+
+  foils.resize(nEvents, static_cast<std::uint16_t>(nFoils));
+  holes.resize(nEvents, 0);
+}
+
+
+// Implementation of functions.
+
+std::size_t findFoil(
+  const Event& event,
+  const std::vector<Peak>& zVerPeaks, const std::vector<Peak>& yTarPeaks
+) {
+  const std::size_t nFoils = zVerPeaks.size();
+
+  std::size_t iFoil = 0;
+  for (iFoil=0; iFoil<nFoils; ++iFoil) {
+    // yTar peaks are ordered opposite to zVer peaks.
+    if (isInFoil(event, zVerPeaks.at(iFoil), yTarPeaks.at(nFoils-1-iFoil))) {
+      break;
+    }
+  }
+
+  return iFoil;
+}
+
+
+std::size_t findHole(
+  const Event& event,
+  const std::vector<Peak>& xSievePeaks, const std::vector<Peak>& ySievePeaks,
+  const std::vector<double>& correlations
+) {
+  const bool useCorrelation = !correlations.empty();
+
+  std::size_t iHole = 0;
+  for (iHole=0; iHole<xSievePeaks.size(); ++iHole) {
+    if (isInHole(
+      event, xSievePeaks.at(iHole), ySievePeaks.at(iHole),
+      useCorrelation, useCorrelation ? correlations.at(iHole) : 0.0
+    )) {
+      break;
+    }
+  }
+
+  return iHole;
+}
+
+
+void assignEvent(
+  const Event& event, std::size_t iEvent,
+  const CutIndex& index, const RunCuts& cuts, EventAssignment& assignment
+) {
+  const std::size_t iFoil = index.findFoil(event);
+  if (iFoil == assignment.nFoils) return;
+  const std::size_t iHole = index.findHole(event, iFoil);
+  if (iHole == cuts.xSievePeakss.at(iFoil).size()) return;
+
+  assignment.foils[iEvent] = static_cast<std::uint16_t>(iFoil);
+  assignment.holes[iEvent] = static_cast<std::uint16_t>(iHole);
+  assignment.selected.push_back(static_cast<std::uint32_t>(iEvent));
+}
+
+
+void assignFoils(
+  const std::vector<Event>& events, const CutIndex& index,
+  const RunCuts& cuts, EventAssignment& assignment
+) {
+  assignment.reset(events.size(), cuts.zVerPeaks.size());
+  for (std::size_t iEvent=0; iEvent<events.size(); ++iEvent) {
+    const std::size_t iFoil = index.findFoil(events[iEvent]);
+    if (iFoil == assignment.nFoils) continue;
+
+    assignment.foils[iEvent] = static_cast<std::uint16_t>(iFoil);
+    assignment.selected.push_back(static_cast<std::uint32_t>(iEvent));
+  }
+}
+
+
+void assignHoles(
+  const std::vector<Event>& events, const CutIndex& index,
+  const RunCuts& cuts, EventAssignment& assignment
+) {
+  for (const auto& xSievePeaks : cuts.xSievePeakss) {
+    if (xSievePeaks.size() >= std::numeric_limits<std::uint16_t>::max()) {
+      throw std::runtime_error("assignHoles: too many sieve holes!");
+    }
+  }
+
+  // Events in a foil but in no hole are left out of the foil, the selected
+  // events are compacted in place.
+  std::size_t nSelected = 0;
+  for (const std::uint32_t iEvent : assignment.selected) {
+    const std::size_t iFoil = assignment.foils[iEvent];
+    const std::size_t iHole = index.findHole(events[iEvent], iFoil);
+    if (iHole < cuts.xSievePeakss.at(iFoil).size()) {
+      assignment.holes[iEvent] = static_cast<std::uint16_t>(iHole);
+      assignment.selected[nSelected++] = iEvent;
+    }
+    else {
+      assignment.foils[iEvent] = static_cast<std::uint16_t>(assignment.nFoils);
+    }
+  }
+  assignment.selected.resize(nSelected);
+}
+
+
+std::size_t findClosestFoil(
+  const Event& event, const std::vector<double>& zFoils
+) {
+  const std::size_t nFoils = zFoils.size();
+  if (nFoils == 0 || event.delta <= -12) return nFoils;
+
+  // Window for a single foil is the range of the zVer histogram.
+  double window = 5.0;
+  for (std::size_t iFoil=1; iFoil<nFoils; ++iFoil) {
+    window = std::min(window, 0.5*std::abs(zFoils.at(iFoil) - zFoils.at(iFoil-1)));
+  }
+
+  std::size_t iClosest = nFoils;
+  double minDistance = window;
+  for (std::size_t iFoil=0; iFoil<nFoils; ++iFoil) {
+    double distance = std::abs(event.zVer - zFoils.at(iFoil));
+    if (distance < minDistance) {
+      minDistance = distance;
+      iClosest = iFoil;
+    }
+  }
+
+  return iClosest;
+}
+
+
+bool findClosestHole(
+  const Event& event, const config::RunConfig& runConf,
+  const std::vector<double>& xSievePhys, const std::vector<double>& ySievePhys,
+  std::size_t& xSieveIndex, std::size_t& ySieveIndex
+) {
+  xSieveIndex = getClosestIndex(event.xSieve, xSievePhys);
+  ySieveIndex = getClosestIndex(event.ySieve, ySievePhys);
+
+  return
+    std::abs(event.xSieve - xSievePhys.at(xSieveIndex)) < 0.5*runConf.sieve.xHoleSpace &&
+    std::abs(event.ySieve - ySievePhys.at(ySieveIndex)) < 0.5*runConf.sieve.yHoleSpace;
+}
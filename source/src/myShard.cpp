@@ -0,0 +1,159 @@
+#include "myShard.hpp"
+
+#include <stdexcept>
+
+#include "myOther.hpp"
+
+
+namespace {
+
+  const std::string shardMagic = "shms_optics shard";
+  // Version 4 added the run number and config hash of each run.
+  const int shardVersion = 4;
+
+}
+
+
+// RunResult implementation.
+
+RunResult::RunResult(int nTerms) :
+  fitAcc(nTerms), designCache(nTerms), holeBlocks(), summaries(), treeRows(),
+  newCuts(false), runNumber(0), configHash(0)
+{}
+
+
+RunResult::~RunResult() {}
+
+
+// ShardHeader implementation.
+
+ShardHeader::ShardHeader() :
+  shardIndex(0), shardNum(1), nRuns(0), nTerms(0), matrixHash(0),
+  robustLoss("ls"), blockUnit()
+{}
+
+
+ShardHeader::~ShardHeader() {}
+
+
+// Implementation of functions.
+
+bool isShardRun(std::size_t iRun, int shardIndex, int shardNum) {
+  if (shardNum <= 1) return true;
+
+  return iRun % static_cast<std::size_t>(shardNum) == static_cast<std::size_t>(shardIndex);
+}
+
+
+std::string getShardFileName(
+  const std::string& fileName, int shardIndex, int shardNum,
+  const std::string& extension
+) {
+  std::size_t dot = fileName.rfind('.');
+  const std::size_t slash = fileName.rfind('/');
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+    dot = fileName.size();
+  }
+
+  return
+    fileName.substr(0, dot) +
+    "_shard" + std::to_string(shardIndex) + "of" + std::to_string(shardNum) +
+    (extension.empty() ? fileName.substr(dot) : extension);
+}
+
+
+void mergeRunResult(
+  const RunResult& result, std::size_t iRun,
+  FitAccumulator& fitAcc, DesignCache& designCache,
+  std::vector<FitAccumulator>& holeBlocks, std::vector<std::size_t>& blockRuns
+) {
+  fitAcc.add(result.fitAcc);
+  designCache.add(result.designCache);
+  holeBlocks.insert(
+    holeBlocks.end(), result.holeBlocks.begin(), result.holeBlocks.end()
+  );
+  blockRuns.resize(holeBlocks.size(), iRun);
+}
+
+
+void writeShardHeader(std::ostream& os, const ShardHeader& header) {
+  writeBinary(os, shardMagic);
+  writeBinary(os, shardVersion);
+  writeBinary(os, header.shardIndex);
+  writeBinary(os, header.shardNum);
+  writeBinary(os, static_cast<unsigned long long>(header.nRuns));
+  writeBinary(os, header.nTerms);
+  writeBinary(os, header.matrixHash);
+  writeBinary(os, header.robustLoss);
+  writeBinary(os, header.blockUnit);
+}
+
+
+ShardHeader readShardHeader(std::istream& is) {
+  std::string magic;
+  int version = 0;
+  try {
+    readBinary(is, magic);
+    readBinary(is, version);
+  }
+  catch (const std::runtime_error& err) {
+    throw std::runtime_error("Not a shard file!");
+  }
+  if (magic != shardMagic) {
+    throw std::runtime_error("Not a shard file!");
+  }
+  if (version != shardVersion) {
+    throw std::runtime_error(
+      "Unsupported version of shard file: " + std::to_string(version) + "!"
+    );
+  }
+
+  ShardHeader header;
+  unsigned long long nRuns = 0;
+  readBinary(is, header.shardIndex);
+  readBinary(is, header.shardNum);
+  readBinary(is, nRuns);
+  readBinary(is, header.nTerms);
+  readBinary(is, header.matrixHash);
+  readBinary(is, header.robustLoss);
+  readBinary(is, header.blockUnit);
+  header.nRuns = static_cast<std::size_t>(nRuns);
+
+  return header;
+}
+
+
+void writeShardRun(std::ostream& os, std::size_t iRun, const RunResult& result) {
+  writeBinary(os, static_cast<unsigned long long>(iRun));
+  writeBinary(os, result.runNumber);
+  writeBinary(os, result.configHash);
+  result.fitAcc.write(os);
+  result.designCache.write(os);
+  writeBinary(os, static_cast<unsigned long long>(result.holeBlocks.size()));
+  for (const auto& block : result.holeBlocks) block.write(os);
+  writeBinary(os, static_cast<unsigned long long>(result.summaries.size()));
+  for (const auto& summary : result.summaries) summary.write(os);
+}
+
+
+bool readShardRun(std::istream& is, std::size_t& iRun, RunResult& result) {
+  if (is.peek() == std::char_traits<char>::eof()) return false;
+
+  unsigned long long value = 0;
+  readBinary(is, value);
+  iRun = static_cast<std::size_t>(value);
+  readBinary(is, result.runNumber);
+  readBinary(is, result.configHash);
+  result.fitAcc.read(is);
+  result.designCache.read(is);
+  readBinary(is, value);
+  result.holeBlocks.assign(
+    static_cast<std::size_t>(value), FitAccumulator(result.fitAcc.nTerms)
+  );
+  for (auto& block : result.holeBlocks) block.read(is);
+  readBinary(is, value);
+  result.summaries.assign(static_cast<std::size_t>(value), ResidualSummary());
+  for (auto& summary : result.summaries) summary.read(is);
+
+  return true;
+}
@@ -0,0 +1,609 @@
+#include "mySieveFit.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+
+#include "Math/Factory.h"
+#include "Math/Functor.h"
+#include "Math/Minimizer.h"
+#include "TAxis.h"
+#include "TH1D.h"
+#include "TH2D.h"
+#include "TMath.h"
+#include "TString.h"
+
+#include "myIndex.hpp"
+#include "mySieveGrid.hpp"
+
+
+namespace {
+
+  //! Projection histograms, fitter and minimiser private to one thread.
+  class SieveFitWorkspace {
+    public:
+      SieveFitWorkspace(
+        const TH2D& xySieveHist, int iThread,
+        PeakMethod method, bool compare, bool unbinned
+      );
+      ~SieveFitWorkspace();
+
+      TH1D xHist;
+      TH1D yHist;
+      PeakFitter fitter;
+
+      // Used by the unbinned fit only, reused for all holes.
+      std::unique_ptr<ROOT::Math::Minimizer> minimizer;
+      std::vector<std::size_t> holeEvents;
+      std::vector<double> holeXs;
+      std::vector<double> holeYs;
+  };
+
+
+  //! Selected events of a foil with an index over their sieve positions.
+  class FoilEvents {
+    public:
+      FoilEvents();
+      ~FoilEvents();
+
+      std::vector<double> xs;
+      std::vector<double> ys;
+      GridIndex2D index;
+  };
+
+
+  //! Negative log likelihood of events in a box of area for a 2D gaussian
+  //! on a flat background. Parameters are x and y means, logarithms of x
+  //! and y sigmas, atanh of the correlation and logit of the signal
+  //! fraction.
+  class HoleLikelihood {
+    public:
+      HoleLikelihood(
+        const std::vector<double>& xs, const std::vector<double>& ys,
+        double area
+      );
+      ~HoleLikelihood();
+
+      double operator()(const double* pars) const;
+
+    private:
+      const std::vector<double>* xs;
+      const std::vector<double>* ys;
+      double area;
+  };
+
+
+  //! Sieve hole candidate of a foil, fitted before the selection.
+  class HoleCandidate {
+    public:
+      HoleCandidate();
+      ~HoleCandidate();
+
+      std::size_t iFoil;
+      // Indexes of the x and y estimates, or of the row and column of the
+      // hole if predicted by the grid.
+      std::size_t iXPeak;
+      std::size_t iYPeak;
+      // Initial hole estimates, norm zero if predicted by the grid.
+      Peak xSievePeakInit;
+      Peak ySievePeakInit;
+      double xPeakSigmaInit;
+      double yPeakSigmaInit;
+      int binXmin, binXmax, binYmin, binYmax;
+
+      // Results, fitted only with enough events in the bounding box.
+      bool fitted;
+      Peak xSievePeak;
+      Peak ySievePeak;
+      double correlation;
+      double fitIntegral;
+  };
+
+
+  SieveFitWorkspace::SieveFitWorkspace(
+    const TH2D& xySieveHist, int iThread,
+    PeakMethod method, bool compare, bool unbinned
+  ) :
+    xHist(
+      TString::Format("sieveFit_px_%d", iThread), "",
+      xySieveHist.GetNbinsX(),
+      xySieveHist.GetXaxis()->GetXmin(), xySieveHist.GetXaxis()->GetXmax()
+    ),
+    yHist(
+      TString::Format("sieveFit_py_%d", iThread), "",
+      xySieveHist.GetNbinsY(),
+      xySieveHist.GetYaxis()->GetXmin(), xySieveHist.GetYaxis()->GetXmax()
+    ),
+    fitter(method, compare),
+    minimizer(), holeEvents(), holeXs(), holeYs()
+  {
+    // Not owned by any directory, which would be shared by threads.
+    xHist.SetDirectory(NULL);
+    yHist.SetDirectory(NULL);
+
+    if (unbinned) {
+      minimizer.reset(ROOT::Math::Factory::CreateMinimizer("Minuit2", "Migrad"));
+      if (!minimizer) {
+        throw std::runtime_error("fitSieveHoles: Minuit2 is not available!");
+      }
+      minimizer->SetPrintLevel(0);
+      minimizer->SetStrategy(1);
+      minimizer->SetMaxFunctionCalls(10000);
+      minimizer->SetTolerance(0.01);
+      minimizer->SetErrorDef(0.5);
+    }
+  }
+
+
+  SieveFitWorkspace::~SieveFitWorkspace() {}
+
+
+  FoilEvents::FoilEvents() : xs(), ys(), index() {}
+
+
+  FoilEvents::~FoilEvents() {}
+
+
+  HoleLikelihood::HoleLikelihood(
+    const std::vector<double>& xs, const std::vector<double>& ys,
+    double area
+  ) :
+    xs(&xs), ys(&ys), area(area)
+  {}
+
+
+  HoleLikelihood::~HoleLikelihood() {}
+
+
+  double HoleLikelihood::operator()(const double* pars) const {
+    const double xMean = pars[0];
+    const double yMean = pars[1];
+    const double xSigma = std::exp(pars[2]);
+    const double ySigma = std::exp(pars[3]);
+    const double rho = std::tanh(pars[4]);
+    const double fraction = 1.0 / (1.0 + std::exp(-pars[5]));
+
+    const double oneMinusRho2 = 1.0 - rho*rho;
+    const double signalNorm = fraction / (
+      2*TMath::Pi() * xSigma * ySigma * std::sqrt(oneMinusRho2)
+    );
+    const double background = (1.0-fraction) / area;
+
+    double nll = 0.0;
+    for (std::size_t i=0; i<xs->size(); ++i) {
+      const double u = ((*xs)[i] - xMean) / xSigma;
+      const double v = ((*ys)[i] - yMean) / ySigma;
+      const double q = (u*u - 2*rho*u*v + v*v) / oneMinusRho2;
+      nll -= std::log(signalNorm*std::exp(-0.5*q) + background);
+    }
+
+    return nll;
+  }
+
+
+  HoleCandidate::HoleCandidate() :
+    iFoil(0), iXPeak(0), iYPeak(0),
+    xSievePeakInit(), ySievePeakInit(), xPeakSigmaInit(0.0), yPeakSigmaInit(0.0),
+    binXmin(0), binXmax(0), binYmin(0), binYmax(0),
+    fitted(false), xSievePeak(), ySievePeak(), correlation(0.0),
+    fitIntegral(0.0)
+  {}
+
+
+  HoleCandidate::~HoleCandidate() {}
+
+
+  // Project bins firstBin to lastBin of the other axis onto x (onX) or y
+  // into hist, with the same bin ranges and contents as TH2::ProjectionX or
+  // TH2::ProjectionY, but without creating a new histogram.
+  void project(
+    const TH2D& hist2, bool onX, int firstBin, int lastBin, TH1D& hist
+  ) {
+    const int nOut = onX ? hist2.GetNbinsX() : hist2.GetNbinsY();
+    const int nIn = onX ? hist2.GetNbinsY() : hist2.GetNbinsX();
+    if (firstBin < 0) firstBin = 0;
+    if (lastBin < 0 || lastBin > nIn+1) lastBin = nIn+1;
+
+    hist.Reset();
+    hist.GetXaxis()->SetRange();
+    for (int outBin=0; outBin<=nOut+1; ++outBin) {
+      double content = 0.0;
+      for (int inBin=firstBin; inBin<=lastBin; ++inBin) {
+        content += onX ?
+          hist2.GetBinContent(outBin, inBin) :
+          hist2.GetBinContent(inBin, outBin);
+      }
+      hist.SetBinContent(outBin, content);
+    }
+  }
+
+
+  // Position estimates of the holes from the projections of a foil.
+  void fitProjections(
+    const TH2D& xySieveHist, std::size_t iFoil, SieveFitWorkspace& workspace,
+    std::vector<Peak>& xSievePeaksFit, std::vector<Peak>& ySievePeaksFit
+  ) {
+    const int binsx = xySieveHist.GetNbinsX();
+    const int binsy = xySieveHist.GetNbinsY();
+
+    if (iFoil>=1) project(xySieveHist, true, binsy/4, binsy, workspace.xHist);
+    else project(xySieveHist, true, 0, -1, workspace.xHist);
+    xSievePeaksFit = fitMultiPeak(&workspace.xHist, 0.1, false);
+
+    if (iFoil>=1) project(xySieveHist, false, binsx/4, binsx, workspace.yHist);
+    else project(xySieveHist, false, 0, -1, workspace.yHist);
+    ySievePeaksFit = fitMultiPeak(&workspace.yHist, 0.1, false);
+  }
+
+
+  // Fit x and y projections of a single hole.
+  // Predicted holes without a norm start from the projection content.
+  void fitCandidateProjections(
+    const TH2D& xySieveHist,
+    const Peak& xSievePeak, const Peak& ySievePeak,
+    SieveFitWorkspace& workspace, HoleCandidate& candidate
+  ) {
+    project(xySieveHist, true, candidate.binYmin, candidate.binYmax, workspace.xHist);
+    workspace.xHist.GetXaxis()->SetRange(candidate.binXmin, candidate.binXmax);
+    const double xNormInit = (xSievePeak.norm > 0.0) ? xSievePeak.norm :
+      workspace.xHist.GetBinContent(workspace.xHist.GetXaxis()->FindBin(xSievePeak.mean));
+    candidate.xSievePeak = workspace.fitter.fit(
+      &workspace.xHist,
+      xNormInit, xSievePeak.mean, candidate.xPeakSigmaInit,
+      false
+    );
+
+    project(xySieveHist, false, candidate.binXmin, candidate.binXmax, workspace.yHist);
+    workspace.yHist.GetXaxis()->SetRange(candidate.binYmin, candidate.binYmax);
+    const double yNormInit = (ySievePeak.norm > 0.0) ? ySievePeak.norm :
+      workspace.yHist.GetBinContent(workspace.yHist.GetXaxis()->FindBin(ySievePeak.mean));
+    candidate.ySievePeak = workspace.fitter.fit(
+      &workspace.yHist,
+      yNormInit, ySievePeak.mean, candidate.yPeakSigmaInit,
+      false
+    );
+  }
+
+
+  // Fit a 2D gaussian on a flat background to the events in the bounding
+  // box of a hole. Sigmas are limited to the initial ones as in the
+  // projection fit, a hole whose mean leaves the box gets zero sigmas.
+  void fitCandidateUnbinned(
+    const TH2D& xySieveHist, const FoilEvents& foilEvents,
+    const Peak& xSievePeak, const Peak& ySievePeak,
+    SieveFitWorkspace& workspace, HoleCandidate& candidate
+  ) {
+    const TAxis* xAxis = xySieveHist.GetXaxis();
+    const TAxis* yAxis = xySieveHist.GetYaxis();
+    const double xLow = xAxis->GetBinLowEdge(candidate.binXmin);
+    const double xHigh = xAxis->GetBinUpEdge(candidate.binXmax);
+    const double yLow = yAxis->GetBinLowEdge(candidate.binYmin);
+    const double yHigh = yAxis->GetBinUpEdge(candidate.binYmax);
+
+    workspace.holeEvents.clear();
+    foilEvents.index.query(xLow, xHigh, yLow, yHigh, workspace.holeEvents);
+    workspace.holeXs.clear();
+    workspace.holeYs.clear();
+    for (std::size_t iEvent : workspace.holeEvents) {
+      workspace.holeXs.push_back(foilEvents.xs[iEvent]);
+      workspace.holeYs.push_back(foilEvents.ys[iEvent]);
+    }
+    const double nEvents = static_cast<double>(workspace.holeXs.size());
+
+    HoleLikelihood likelihood(
+      workspace.holeXs, workspace.holeYs, (xHigh-xLow)*(yHigh-yLow)
+    );
+    ROOT::Math::Functor function(likelihood, 6);
+    ROOT::Math::Minimizer& minimizer = *workspace.minimizer;
+    minimizer.Clear();
+    minimizer.SetFunction(function);
+    minimizer.SetVariable(0, "xMean", xSievePeak.mean, 0.1*candidate.xPeakSigmaInit);
+    minimizer.SetVariable(1, "yMean", ySievePeak.mean, 0.1*candidate.yPeakSigmaInit);
+    minimizer.SetVariable(2, "xLogSigma", std::log(candidate.xPeakSigmaInit), 0.1);
+    minimizer.SetVariable(3, "yLogSigma", std::log(candidate.yPeakSigmaInit), 0.1);
+    minimizer.SetLimitedVariable(4, "atanhRho", 0.0, 0.1, -3.0, 3.0);
+    minimizer.SetLimitedVariable(5, "logitFraction", std::log(9.0), 0.5, -10.0, 10.0);
+
+    if (!minimizer.Minimize()) {
+      candidate.xSievePeak = Peak(0.0, xSievePeak.mean, 0.0);
+      candidate.ySievePeak = Peak(0.0, ySievePeak.mean, 0.0);
+      return;
+    }
+    const double* pars = minimizer.X();
+    const double norm = nEvents / (1.0 + std::exp(-pars[5]));
+    const bool inside =
+      xLow < pars[0] && pars[0] < xHigh && yLow < pars[1] && pars[1] < yHigh;
+    const double xSigma = inside ?
+      std::min(std::exp(pars[2]), candidate.xPeakSigmaInit) : 0.0;
+    const double ySigma = inside ?
+      std::min(std::exp(pars[3]), candidate.yPeakSigmaInit) : 0.0;
+
+    candidate.xSievePeak = Peak(norm, pars[0], xSigma);
+    candidate.ySievePeak = Peak(norm, pars[1], ySigma);
+    candidate.correlation = std::tanh(pars[4]);
+  }
+
+
+  // Fit x and y projections of a single hole, or the hole events directly
+  // if foilEvents are given.
+  void fitCandidate(
+    const TH2D& xySieveHist, const FoilEvents* foilEvents,
+    SieveFitWorkspace& workspace, HoleCandidate& candidate
+  ) {
+    const Peak& xSievePeak = candidate.xSievePeakInit;
+    const Peak& ySievePeak = candidate.ySievePeakInit;
+
+    // Want to have at least 50 events for fitting.
+    double integral = xySieveHist.Integral(
+      candidate.binXmin, candidate.binXmax,
+      candidate.binYmin, candidate.binYmax
+    );
+    if (integral < 50) return;
+
+    if (foilEvents) {
+      fitCandidateUnbinned(
+        xySieveHist, *foilEvents, xSievePeak, ySievePeak, workspace, candidate
+      );
+    }
+    else {
+      fitCandidateProjections(
+        xySieveHist, xSievePeak, ySievePeak, workspace, candidate
+      );
+    }
+
+    const Peak& xFit = candidate.xSievePeak;
+    const Peak& yFit = candidate.ySievePeak;
+    candidate.fitIntegral = xySieveHist.Integral(
+      xySieveHist.GetXaxis()->FindBin(xFit.mean - 2.2*xFit.sigma),
+      xySieveHist.GetXaxis()->FindBin(xFit.mean + 2.2*xFit.sigma),
+      xySieveHist.GetYaxis()->FindBin(yFit.mean - 2.2*yFit.sigma),
+      xySieveHist.GetYaxis()->FindBin(yFit.mean + 2.2*yFit.sigma)
+    );
+    candidate.fitted = true;
+  }
+
+
+  // Run task(iTask, workspace) for all tasks on nThreads threads. Results
+  // must be stored by task index to keep them independent of scheduling.
+  template<typename Task>
+  void runTasks(
+    std::size_t nTasks,
+    std::vector<std::unique_ptr<SieveFitWorkspace> >& workspaces,
+    Task task
+  ) {
+    std::atomic<std::size_t> nextTask(0);
+    auto work = [&](std::size_t iThread) {
+      std::size_t iTask;
+      while ((iTask = nextTask++) < nTasks) task(iTask, *workspaces[iThread]);
+    };
+
+    std::vector<std::thread> threads;
+    for (std::size_t iThread=1; iThread<workspaces.size(); ++iThread) {
+      threads.push_back(std::thread(work, iThread));
+    }
+    work(0);
+    for (auto& thread : threads) thread.join();
+  }
+
+}
+
+
+// Implementation of functions.
+
+void fitSieveHoles(
+  const std::vector<Event>& events, const EventAssignment& assignment,
+  const std::vector<TH2D>& xySieveHists, const config::RunConfig& runConf,
+  int nThreads, PeakMethod method, bool unbinned,
+  PeakFitComparison* comparison, std::vector<SieveGridMatch>* gridMatches,
+  RunCuts& cuts
+) {
+  const std::size_t nFoils = xySieveHists.size();
+  std::vector<double> xSievePhys = runConf.getSieveHolesX();
+  std::vector<double> ySievePhys = runConf.getSieveHolesY();
+
+  cuts.xSievePeakss.assign(nFoils, std::vector<Peak>());
+  cuts.ySievePeakss.assign(nFoils, std::vector<Peak>());
+  cuts.xSieveIndexess.assign(nFoils, std::vector<std::size_t>());
+  cuts.ySieveIndexess.assign(nFoils, std::vector<std::size_t>());
+  cuts.sieveCorrelationss.assign(nFoils, std::vector<double>());
+  if (nFoils == 0) return;
+
+  // Workspaces are created here, ROOT objects should not be created in the
+  // threads.
+  if (nThreads < 1) nThreads = 1;
+  std::vector<std::unique_ptr<SieveFitWorkspace> > workspaces;
+  for (int iThread=0; iThread<nThreads; ++iThread) {
+    workspaces.push_back(std::unique_ptr<SieveFitWorkspace>(
+      new SieveFitWorkspace(
+        xySieveHists.front(), iThread, method, comparison != NULL, unbinned
+      )
+    ));
+  }
+
+  // Sieve positions of the events of each foil, indexed on a grid of half
+  // the hole spacing, so a hole box spans only a few cells.
+  std::vector<FoilEvents> foilEventss(unbinned ? nFoils : 0);
+  if (unbinned) {
+    for (const std::uint32_t iEvent : assignment.selected) {
+      FoilEvents& foilEvents = foilEventss[assignment.foils[iEvent]];
+      foilEvents.xs.push_back(events[iEvent].xSieve);
+      foilEvents.ys.push_back(events[iEvent].ySieve);
+    }
+    const double cellSize =
+      0.5*std::min(runConf.sieve.xHoleSpace, runConf.sieve.yHoleSpace);
+    for (auto& foilEvents : foilEventss) {
+      foilEvents.index = GridIndex2D(foilEvents.xs, foilEvents.ys, cellSize);
+    }
+  }
+
+  // Position estimates of all foils, from the projections or the grid.
+  std::vector<std::vector<Peak> > xSievePeaksFits(nFoils);
+  std::vector<std::vector<Peak> > ySievePeaksFits(nFoils);
+  if (gridMatches) gridMatches->assign(nFoils, SieveGridMatch());
+  runTasks(nFoils, workspaces, [&](std::size_t iFoil, SieveFitWorkspace& workspace) {
+    if (gridMatches) {
+      (*gridMatches)[iFoil] = matchSieveGrid(xySieveHists[iFoil], xSievePhys, ySievePhys);
+    }
+    else {
+      fitProjections(
+        xySieveHists[iFoil], iFoil, workspace,
+        xSievePeaksFits[iFoil], ySievePeaksFits[iFoil]
+      );
+    }
+  });
+
+  // Candidates at all predicted holes inside the histogram. Empty ones are
+  // not fitted.
+  std::vector<HoleCandidate> candidates;
+  for (std::size_t iFoil=0; iFoil<nFoils && gridMatches; ++iFoil) {
+    const TH2D& xySieveHist = xySieveHists[iFoil];
+    const TAxis* xAxis = xySieveHist.GetXaxis();
+    const TAxis* yAxis = xySieveHist.GetYaxis();
+
+    for (std::size_t iRow=0; iRow<xSievePhys.size(); ++iRow) {
+      for (std::size_t iCol=0; iCol<ySievePhys.size(); ++iCol) {
+        double x, y;
+        (*gridMatches)[iFoil].transform(xSievePhys[iRow], ySievePhys[iCol], x, y);
+        if (
+          x < xAxis->GetXmin() || x > xAxis->GetXmax() ||
+          y < yAxis->GetXmin() || y > yAxis->GetXmax()
+        ) {
+          continue;
+        }
+
+        HoleCandidate candidate;
+        candidate.iFoil = iFoil;
+        candidate.iXPeak = iRow;
+        candidate.iYPeak = iCol;
+        candidate.xSievePeakInit = Peak(0.0, x, 0.36);
+        candidate.ySievePeakInit = Peak(0.0, y, 0.35);
+        candidate.xPeakSigmaInit = 0.36;
+        candidate.yPeakSigmaInit = 0.35;
+        candidate.binXmin = xAxis->FindFixBin(x - 3*candidate.xPeakSigmaInit);
+        candidate.binXmax = xAxis->FindFixBin(x + 3*candidate.xPeakSigmaInit);
+        candidate.binYmin = yAxis->FindFixBin(y - 3*candidate.yPeakSigmaInit);
+        candidate.binYmax = yAxis->FindFixBin(y + 3*candidate.yPeakSigmaInit);
+        candidates.push_back(candidate);
+      }
+    }
+  }
+
+  // Candidates for all combinations of x and y estimates. The x estimates
+  // too close to the previous one are skipped as in the sequential fit.
+  for (std::size_t iFoil=0; iFoil<nFoils && !gridMatches; ++iFoil) {
+    const TH2D& xySieveHist = xySieveHists[iFoil];
+
+    double xComparison = -30.0;
+    for (std::size_t iX=0; iX<xSievePeaksFits[iFoil].size(); ++iX) {
+      const Peak& xSievePeak = xSievePeaksFits[iFoil][iX];
+      double xPeakSigmaInit = 0.36;
+      int binXmin = xySieveHist.GetXaxis()->FindBin(xSievePeak.mean - 3*xPeakSigmaInit);
+      int binXmax = xySieveHist.GetXaxis()->FindBin(xSievePeak.mean + 3*xPeakSigmaInit);
+      if (std::abs(xSievePeak.mean - xComparison)<1.5) continue;
+      if (std::abs(xSievePeak.mean - xComparison)<2.0) xPeakSigmaInit = 0.35;
+      xComparison = xSievePeak.mean;
+
+      for (std::size_t iY=0; iY<ySievePeaksFits[iFoil].size(); ++iY) {
+        const Peak& ySievePeak = ySievePeaksFits[iFoil][iY];
+        double yPeakSigmaInit = ySievePeak.sigma;
+        if (yPeakSigmaInit>0.35) yPeakSigmaInit = 0.35;
+
+        HoleCandidate candidate;
+        candidate.iFoil = iFoil;
+        candidate.iXPeak = iX;
+        candidate.iYPeak = iY;
+        candidate.xSievePeakInit = xSievePeak;
+        candidate.ySievePeakInit = ySievePeak;
+        candidate.xPeakSigmaInit = xPeakSigmaInit;
+        candidate.yPeakSigmaInit = yPeakSigmaInit;
+        candidate.binXmin = binXmin;
+        candidate.binXmax = binXmax;
+        candidate.binYmin = xySieveHist.GetYaxis()->FindBin(ySievePeak.mean - 3*yPeakSigmaInit);
+        candidate.binYmax = xySieveHist.GetYaxis()->FindBin(ySievePeak.mean + 3*yPeakSigmaInit);
+        candidates.push_back(candidate);
+      }
+    }
+  }
+
+  // Fit all candidates of all foils.
+  runTasks(candidates.size(), workspaces, [&](std::size_t iCandidate, SieveFitWorkspace& workspace) {
+    HoleCandidate& candidate = candidates[iCandidate];
+    fitCandidate(
+      xySieveHists[candidate.iFoil],
+      unbinned ? &foilEventss[candidate.iFoil] : NULL,
+      workspace, candidate
+    );
+  });
+  if (comparison) {
+    for (const auto& workspace : workspaces) {
+      comparison->add(workspace->fitter.comparison);
+    }
+  }
+
+  // Predicted holes are known, keep the fits that stay within half the hole
+  // spacing of the prediction.
+  if (gridMatches) {
+    for (const auto& candidate : candidates) {
+      if (!candidate.fitted || candidate.fitIntegral<50) continue;
+
+      const Peak& xFit = candidate.xSievePeak;
+      const Peak& yFit = candidate.ySievePeak;
+      if (
+        xFit.sigma==0.0 || yFit.sigma==0.0 ||
+        std::abs(xFit.mean-candidate.xSievePeakInit.mean) > 0.5*runConf.sieve.xHoleSpace ||
+        std::abs(yFit.mean-candidate.ySievePeakInit.mean) > 0.5*runConf.sieve.yHoleSpace
+      ) {
+        continue;
+      }
+      cuts.xSievePeakss.at(candidate.iFoil).push_back(xFit);
+      cuts.ySievePeakss.at(candidate.iFoil).push_back(yFit);
+      cuts.xSieveIndexess.at(candidate.iFoil).push_back(candidate.iXPeak);
+      cuts.ySieveIndexess.at(candidate.iFoil).push_back(candidate.iYPeak);
+      if (unbinned) {
+        cuts.sieveCorrelationss.at(candidate.iFoil).push_back(candidate.correlation);
+      }
+    }
+
+    return;
+  }
+
+  // Select holes in the order of the sequential fit, each accepted hole
+  // vetoes the following y estimates close to it.
+  double yComparison = -10.0;
+  for (std::size_t iCandidate=0; iCandidate<candidates.size(); ++iCandidate) {
+    const HoleCandidate& candidate = candidates[iCandidate];
+    if (
+      iCandidate == 0 ||
+      candidate.iFoil != candidates[iCandidate-1].iFoil ||
+      candidate.iXPeak != candidates[iCandidate-1].iXPeak
+    ) {
+      yComparison = -10.0;
+    }
+
+    const Peak& ySievePeak = ySievePeaksFits[candidate.iFoil][candidate.iYPeak];
+    if (std::abs(ySievePeak.mean - yComparison)<0.95) continue;
+    if (!candidate.fitted || candidate.fitIntegral<50) continue;
+
+    const Peak& xFit = candidate.xSievePeak;
+    const Peak& yFit = candidate.ySievePeak;
+    if (
+      xFit.sigma!=0.0 && yFit.sigma!=0.0 &&
+      std::abs(xFit.mean)<15.0 && std::abs(yFit.mean)<10.0 &&
+      std::abs(yFit.mean-yComparison)>0.95
+    ) {
+      cuts.xSievePeakss.at(candidate.iFoil).push_back(xFit);
+      cuts.ySievePeakss.at(candidate.iFoil).push_back(yFit);
+      cuts.xSieveIndexess.at(candidate.iFoil).push_back(getClosestIndex(xFit.mean, xSievePhys));
+      cuts.ySieveIndexess.at(candidate.iFoil).push_back(getClosestIndex(yFit.mean, ySievePhys));
+      if (unbinned) {
+        cuts.sieveCorrelationss.at(candidate.iFoil).push_back(candidate.correlation);
+      }
+      yComparison = yFit.mean;
+    }
+  }
+}
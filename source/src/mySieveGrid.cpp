@@ -0,0 +1,272 @@
+#include "mySieveGrid.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <stdexcept>
+#include <utility>
+
+#include "TAxis.h"
+#include "TH2D.h"
+#include "TMath.h"
+
+
+namespace {
+
+  typedef std::complex<double> Complex;
+
+  // Image bins are merged by this factor in each direction for the match.
+  const int rebinFactor = 2;
+  // Width of the holes in the grid template.
+  const double templateSigma = 0.3;  // cm
+  // Scales and rotations tried.
+  const double scaleStep = 0.02;
+  const int nScaleSteps = 3;  // on each side of 1
+  const double rotationStep = 1.0;  // degree
+  const int nRotationSteps = 2;  // on each side of 0
+
+
+  std::size_t getPow2(std::size_t n) {
+    std::size_t pow2 = 1;
+    while (pow2 < n) pow2 *= 2;
+
+    return pow2;
+  }
+
+
+  // In-place radix-2 FFT of n = 2^k values, inverse without the 1/n.
+  void fft(std::vector<Complex>& values, bool inverse) {
+    const std::size_t n = values.size();
+
+    // Bit reversal permutation.
+    for (std::size_t i=1, j=0; i<n; ++i) {
+      std::size_t bit = n >> 1;
+      for (; j & bit; bit >>= 1) j ^= bit;
+      j ^= bit;
+      if (i < j) std::swap(values[i], values[j]);
+    }
+
+    for (std::size_t length=2; length<=n; length*=2) {
+      const double angle =
+        (inverse ? 2 : -2) * TMath::Pi() / static_cast<double>(length);
+      const Complex step(std::cos(angle), std::sin(angle));
+      for (std::size_t first=0; first<n; first+=length) {
+        Complex w(1.0, 0.0);
+        for (std::size_t k=0; k<length/2; ++k) {
+          const Complex u = values[first+k];
+          const Complex v = values[first+k+length/2] * w;
+          values[first+k] = u + v;
+          values[first+k+length/2] = u - v;
+          w *= step;
+        }
+      }
+    }
+  }
+
+
+  // 2D FFT of an nx by ny image stored row by row.
+  void fft2(
+    std::vector<Complex>& image, std::size_t nx, std::size_t ny, bool inverse
+  ) {
+    std::vector<Complex> line(nx);
+    for (std::size_t iy=0; iy<ny; ++iy) {
+      for (std::size_t ix=0; ix<nx; ++ix) line[ix] = image[iy*nx+ix];
+      fft(line, inverse);
+      for (std::size_t ix=0; ix<nx; ++ix) image[iy*nx+ix] = line[ix];
+    }
+
+    line.resize(ny);
+    for (std::size_t ix=0; ix<nx; ++ix) {
+      for (std::size_t iy=0; iy<ny; ++iy) line[iy] = image[iy*nx+ix];
+      fft(line, inverse);
+      for (std::size_t iy=0; iy<ny; ++iy) image[iy*nx+ix] = line[iy];
+    }
+  }
+
+
+  // Offset of the maximum from a parabola through three values.
+  double getParabolaPeak(double low, double centre, double high) {
+    const double denominator = low - 2*centre + high;
+    if (denominator >= 0.0) return 0.0;
+
+    return 0.5*(low - high)/denominator;
+  }
+
+}
+
+
+// SieveGridMatch implementation.
+
+SieveGridMatch::SieveGridMatch() :
+  xCenter(0.0), yCenter(0.0), xShift(0.0), yShift(0.0),
+  scale(1.0), rotation(0.0), score(0.0)
+{}
+
+
+SieveGridMatch::~SieveGridMatch() {}
+
+
+void SieveGridMatch::transform(
+  double xPhys, double yPhys, double& x, double& y
+) const {
+  const double c = std::cos(rotation);
+  const double s = std::sin(rotation);
+  const double dx = xPhys - xCenter;
+  const double dy = yPhys - yCenter;
+
+  x = xCenter + scale*(c*dx - s*dy) + xShift;
+  y = yCenter + scale*(s*dx + c*dy) + yShift;
+}
+
+
+// Implementation of functions.
+
+SieveGridMatch matchSieveGrid(
+  const TH2D& xySieveHist,
+  const std::vector<double>& xSievePhys, const std::vector<double>& ySievePhys
+) {
+  if (xSievePhys.empty() || ySievePhys.empty()) {
+    throw std::runtime_error("matchSieveGrid: no sieve holes!");
+  }
+
+  // Coarse image, square root of counts to keep the brightest holes from
+  // dominating, with zero mean so that empty parts count against a match.
+  const TAxis* xAxis = xySieveHist.GetXaxis();
+  const TAxis* yAxis = xySieveHist.GetYaxis();
+  const std::size_t nx = static_cast<std::size_t>(
+    (xySieveHist.GetNbinsX() + rebinFactor-1) / rebinFactor
+  );
+  const std::size_t ny = static_cast<std::size_t>(
+    (xySieveHist.GetNbinsY() + rebinFactor-1) / rebinFactor
+  );
+  const double xMin = xAxis->GetXmin();
+  const double yMin = yAxis->GetXmin();
+  const double xWidth = rebinFactor * (xAxis->GetXmax()-xMin) / xySieveHist.GetNbinsX();
+  const double yWidth = rebinFactor * (yAxis->GetXmax()-yMin) / xySieveHist.GetNbinsY();
+
+  std::vector<double> coarse(nx*ny, 0.0);
+  for (int binY=1; binY<=xySieveHist.GetNbinsY(); ++binY) {
+    for (int binX=1; binX<=xySieveHist.GetNbinsX(); ++binX) {
+      const std::size_t ix = static_cast<std::size_t>((binX-1)/rebinFactor);
+      const std::size_t iy = static_cast<std::size_t>((binY-1)/rebinFactor);
+      coarse[iy*nx + ix] += xySieveHist.GetBinContent(binX, binY);
+    }
+  }
+  double mean = 0.0;
+  for (auto& value : coarse) {
+    value = std::sqrt(value);
+    mean += value;
+  }
+  mean /= static_cast<double>(coarse.size());
+  double imageNorm2 = 0.0;
+  for (auto& value : coarse) {
+    value -= mean;
+    imageNorm2 += value*value;
+  }
+
+  // Padded to at least twice the size, so shifts do not wrap around.
+  const std::size_t px = getPow2(2*nx);
+  const std::size_t py = getPow2(2*ny);
+  std::vector<Complex> imageFft(px*py, Complex(0.0, 0.0));
+  for (std::size_t iy=0; iy<ny; ++iy) {
+    for (std::size_t ix=0; ix<nx; ++ix) imageFft[iy*px+ix] = coarse[iy*nx+ix];
+  }
+  fft2(imageFft, px, py, false);
+
+  SieveGridMatch best;
+  best.xCenter = 0.5*(xSievePhys.front() + xSievePhys.back());
+  best.yCenter = 0.5*(ySievePhys.front() + ySievePhys.back());
+  best.score = -1.0;
+  if (imageNorm2 <= 0.0) return best;
+
+  // Template bins from half the padding before to half the padding after
+  // the image, so that holes outside the image can be shifted into it.
+  const int ipx = static_cast<int>(px);
+  const int ipy = static_cast<int>(py);
+  const int ixBegin = -static_cast<int>((px-nx)/2);
+  const int iyBegin = -static_cast<int>((py-ny)/2);
+
+  std::vector<Complex> correlation(px*py);
+  for (int iScale=-nScaleSteps; iScale<=nScaleSteps; ++iScale) {
+    for (int iRotation=-nRotationSteps; iRotation<=nRotationSteps; ++iRotation) {
+      SieveGridMatch match;
+      match.xCenter = best.xCenter;
+      match.yCenter = best.yCenter;
+      match.scale = 1.0 + iScale*scaleStep;
+      match.rotation = iRotation*rotationStep*TMath::DegToRad();
+
+      // Template of gaussian holes at the unshifted positions, negative bins
+      // wrapped around the padded array.
+      std::fill(correlation.begin(), correlation.end(), Complex(0.0, 0.0));
+      for (const double xPhys : xSievePhys) {
+        for (const double yPhys : ySievePhys) {
+          double x, y;
+          match.transform(xPhys, yPhys, x, y);
+          const double cx = (x-xMin)/xWidth - 0.5;
+          const double cy = (y-yMin)/yWidth - 0.5;
+          const int rx = static_cast<int>(std::ceil(3*templateSigma/xWidth));
+          const int ry = static_cast<int>(std::ceil(3*templateSigma/yWidth));
+          const int ixCenter = static_cast<int>(std::floor(cx));
+          const int iyCenter = static_cast<int>(std::floor(cy));
+          for (int iy=iyCenter-ry; iy<=iyCenter+ry+1; ++iy) {
+            if (iy < iyBegin || iy >= iyBegin+ipy) continue;
+            const std::size_t jy = static_cast<std::size_t>((iy+ipy) % ipy);
+            for (int ix=ixCenter-rx; ix<=ixCenter+rx+1; ++ix) {
+              if (ix < ixBegin || ix >= ixBegin+ipx) continue;
+              const std::size_t jx = static_cast<std::size_t>((ix+ipx) % ipx);
+              const double u = (ix-cx)*xWidth/templateSigma;
+              const double v = (iy-cy)*yWidth/templateSigma;
+              correlation[jy*px+jx] += std::exp(-0.5*(u*u + v*v));
+            }
+          }
+        }
+      }
+      double templateNorm2 = 0.0;
+      for (const auto& value : correlation) templateNorm2 += std::norm(value);
+      if (templateNorm2 <= 0.0) continue;
+
+      // Cross-correlation, element (ix, iy) is the overlap of the image
+      // with the template shifted by ix and iy coarse bins.
+      fft2(correlation, px, py, false);
+      for (std::size_t i=0; i<correlation.size(); ++i) {
+        correlation[i] = imageFft[i] * std::conj(correlation[i]);
+      }
+      fft2(correlation, px, py, true);
+
+      std::size_t iMax = 0;
+      for (std::size_t i=1; i<correlation.size(); ++i) {
+        if (correlation[i].real() > correlation[iMax].real()) iMax = i;
+      }
+      const double norm = static_cast<double>(px*py) * std::sqrt(imageNorm2*templateNorm2);
+      match.score = correlation[iMax].real() / norm;
+      if (match.score <= best.score) continue;
+
+      // Shift with sub-bin precision.
+      const std::size_t ixMax = iMax % px;
+      const std::size_t iyMax = iMax / px;
+      const double xShift = getParabolaPeak(
+        correlation[iyMax*px + (ixMax+px-1)%px].real(),
+        correlation[iMax].real(),
+        correlation[iyMax*px + (ixMax+1)%px].real()
+      );
+      const double yShift = getParabolaPeak(
+        correlation[((iyMax+py-1)%py)*px + ixMax].real(),
+        correlation[iMax].real(),
+        correlation[((iyMax+1)%py)*px + ixMax].real()
+      );
+      const double ix = (ixMax < px/2) ?
+        static_cast<double>(ixMax) :
+        static_cast<double>(ixMax) - static_cast<double>(px);
+      const double iy = (iyMax < py/2) ?
+        static_cast<double>(iyMax) :
+        static_cast<double>(iyMax) - static_cast<double>(py);
+      match.xShift = (ix + xShift)*xWidth;
+      match.yShift = (iy + yShift)*yWidth;
+
+      best = match;
+    }
+  }
+
+  return best;
+}
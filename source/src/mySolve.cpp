@@ -0,0 +1,241 @@
+#include "mySolve.hpp"
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+  using std::cout;
+  using std::endl;
+
+#include "TDecompSVD.h"
+
+#include "myBootstrap.hpp"
+
+
+// Implementation of functions.
+
+void readMatrices(
+  const std::string& fileName, RecMatrix& recMatrixIndep, RecMatrix& recMatrixDep
+) {
+  std::string recMatrixDepFileName = fileName;
+  recMatrixDepFileName.insert(fileName.size()-4, "__dep");
+  std::string recMatrixIndepFileName = fileName;
+  recMatrixIndepFileName.insert(fileName.size()-4, "__indep");
+
+  cout
+    << "Reading xTar dependent matrix file:" << endl
+    << "  `" << recMatrixDepFileName << "`" << endl;
+  recMatrixDep = readMatrixFile(recMatrixDepFileName);
+  cout
+    << "Reading xTar independent matrix file:" << endl
+    << "  `" << recMatrixIndepFileName << "`" << endl;
+  recMatrixIndep = readMatrixFile(recMatrixIndepFileName);
+}
+
+
+RecMatrix getNewRecMatrix(RecMatrix recMatrixIndep, int fitOrder) {
+  cout << "Initializing new xTar independent matrix." << endl;
+  // Copy header and delta elements from old matrix.
+  // Initialize other elements to 0.
+  RecMatrix recMatrixNew;
+  recMatrixNew.header = recMatrixIndep.header;
+  double C_D;
+  std::vector<RecMatrixLine>::iterator lineIt;
+  // Construct order by order.
+  // Only include xTar independent terms.
+  for (int order=0; order<=fitOrder; ++order) {
+    for (int l=0; l<=order; ++l) {
+      for (int k=0; k<=order-l; ++k) {
+        for (int j=0; j<=order-l-k; ++j) {
+          for (int i=0; i<=order-l-k-j; ++i) {
+            if (i+j+k+l != order) continue;
+
+            lineIt = recMatrixIndep.findLine(i, j, k, l, 0);
+            if (lineIt != recMatrixIndep.end()) C_D = lineIt->C_D;
+            else C_D = 0.0;
+
+            recMatrixNew.addLine(
+              0.0, 0.0, 0.0, C_D,
+              i, j, k, l, 0
+            );
+          }
+        }
+      }
+    }
+  }
+  cout << "  " << recMatrixNew.size() << " xTar independent terms" << endl;
+
+  return recMatrixNew;
+}
+
+
+bool solveFit(
+  const FitAccumulator& fitAcc, const DesignCache& designCache,
+  const std::string& robustLossName, int robustIterNum,
+  RecMatrix& recMatrixNew
+) {
+  const Int_t recMatrixNewLen = static_cast<Int_t>(recMatrixNew.size());
+
+  TMatrixD xpTarFitMat = fitAcc.getFitMatrix();
+  TVectorD xpTarFitVec = fitAcc.getXpTarFitVector();
+  TVectorD yTarFitVec = fitAcc.getYTarFitVector();
+  TVectorD ypTarFitVec = fitAcc.getYpTarFitVector();
+  cout
+    << "Fitting " << fitAcc.nEvents << " events with total weight "
+    << fitAcc.sumWeights << "." << endl;
+
+  std::ofstream ofs("xpVec.txt");
+  std::ios::fmtflags f1(ofs.flags());
+  std::streamsize prevPrec1 = ofs.precision(9);
+  for (Int_t iTerm=0; iTerm<recMatrixNewLen; ++iTerm) {
+    ofs << std::scientific << std::setw(17) << xpTarFitVec(iTerm) << endl;
+  }
+  ofs.precision(prevPrec1);
+  ofs.flags(f1);
+  ofs.close();
+
+  ofs.open("xpMat.txt");
+  std::ios::fmtflags f2(ofs.flags());
+  std::streamsize prevPrec2 = ofs.precision(9);
+  for (Int_t iTerm=0; iTerm<recMatrixNewLen; ++iTerm) {
+    for (Int_t jTerm=0; jTerm<recMatrixNewLen; ++jTerm) {
+      ofs
+        << std::scientific << std::setw(17)
+        << xpTarFitMat(iTerm, jTerm);
+    }
+    ofs << endl;
+  }
+  ofs.precision(prevPrec2);
+  ofs.flags(f2);
+  ofs.close();
+
+
+  cout << "Solving SVD problems:" << endl;
+  // Matrix is the same for all three problems, decompose it only once.
+  TDecompSVD fitSVD(xpTarFitMat);
+
+  bool xpTarSuccess = fitSVD.Solve(xpTarFitVec);
+  cout << "  xpTar: " << (xpTarSuccess ? "success" : "failure") << endl;
+  bool yTarSuccess = fitSVD.Solve(yTarFitVec);
+  cout << "  yTar: " << (yTarSuccess ? "success" : "failure") << endl;
+  bool ypTarSuccess = fitSVD.Solve(ypTarFitVec);
+  cout << "  ypTar: " << (ypTarSuccess ? "success" : "failure") << endl;
+
+  bool robustSuccess = true;
+  RobustLoss robustLoss = parseRobustLoss(robustLossName);
+  if (robustLoss != kLeastSquares) {
+    cout
+      << "Robust refit of " << designCache.size() << " cached events ("
+      << robustLossName << "):" << endl;
+    robustSuccess = robustRefit(
+      designCache, robustLoss, robustIterNum,
+      xpTarFitVec, yTarFitVec, ypTarFitVec
+    );
+    cout << "  " << (robustSuccess ? "success" : "failure") << endl;
+  }
+
+
+  cout << "Constructing new xTar independent optics matrix." << endl;
+  Int_t iTerm = 0;
+  for(auto& line : recMatrixNew.matrix) {
+    line.C_Xp = xpTarFitVec(iTerm);
+    line.C_Y = yTarFitVec(iTerm);
+    line.C_Yp = ypTarFitVec(iTerm);
+
+    ++iTerm;
+  }
+
+  return xpTarSuccess && yTarSuccess && ypTarSuccess && robustSuccess;
+}
+
+
+void writeMatrices(
+  const std::string& fileName, const std::string& suffix,
+  const RecMatrix& recMatrixIndep, const RecMatrix& recMatrixDep
+) {
+  std::string recMatrixDepFileName = fileName;
+  recMatrixDepFileName.insert(fileName.size()-4, suffix + "__dep");
+  std::string recMatrixIndepFileName = fileName;
+  recMatrixIndepFileName.insert(fileName.size()-4, suffix + "__indep");
+
+  cout
+    << "Saving xTar independent matrix to:" << endl
+    << "  `" << recMatrixIndepFileName << "`" << endl;
+  writeMatrixFile(recMatrixIndepFileName, recMatrixIndep);
+  cout
+    << "Saving xTar dependent matrix to:" << endl
+    << "  `" << recMatrixDepFileName << "`" << endl;
+  writeMatrixFile(recMatrixDepFileName, recMatrixDep);
+}
+
+
+void bootstrap(
+  const std::vector<FitAccumulator>& holeBlocks,
+  const std::vector<std::size_t>& blockRuns, std::size_t nRuns,
+  int bootstrapNum, const std::string& bootstrapUnit, int nThreads,
+  const std::string& fileName, const RecMatrix& recMatrixNew
+) {
+  cout
+    << "Bootstrap with " << bootstrapNum << " replicas resampling "
+    << bootstrapUnit << "s on " << nThreads << " threads:" << endl;
+
+  // Resampling runs means resampling blocks of whole runs. Runs without
+  // blocks, for example without events in sieve holes, are left out.
+  std::vector<FitAccumulator> runBlocks;
+  if (bootstrapUnit == "run") {
+    std::vector<std::size_t> runBlockIndexes(nRuns, nRuns);
+    for (std::size_t iBlock=0; iBlock<holeBlocks.size(); ++iBlock) {
+      std::size_t& iRunBlock = runBlockIndexes.at(blockRuns.at(iBlock));
+      if (iRunBlock == nRuns) {
+        iRunBlock = runBlocks.size();
+        runBlocks.emplace_back(static_cast<int>(recMatrixNew.size()));
+      }
+      runBlocks.at(iRunBlock).add(holeBlocks.at(iBlock));
+    }
+  }
+  const std::vector<FitAccumulator>& blocks =
+    (bootstrapUnit == "run") ? runBlocks : holeBlocks;
+
+  auto start = std::chrono::steady_clock::now();
+  BootstrapResult result;
+  try {
+    result = bootstrapFit(blocks, bootstrapNum, nThreads, 12345);
+  }
+  catch (const std::runtime_error& err) {
+    cout
+      << "  Warning: bootstrap failed, no uncertainties saved: "
+      << err.what() << endl;
+    return;
+  }
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+
+  cout
+    << "  " << blocks.size() << " " << bootstrapUnit << "s with events, "
+    << result.nFailed
+    << " failed replicas, " << elapsed.count() << " s" << endl
+    << "  propagated resolution:" << endl
+    << "    xpTar: " << result.xpTarResolution << endl
+    << "    yTar: " << result.yTarResolution << " cm" << endl
+    << "    ypTar: " << result.ypTarResolution << endl;
+
+  // Write standard deviations in the matrix format.
+  RecMatrix sigmaMatrix;
+  sigmaMatrix.header = recMatrixNew.header;
+  std::size_t iTerm = 0;
+  for (const auto& line : recMatrixNew.matrix) {
+    sigmaMatrix.addLine(
+      result.xpTarSigmas.at(iTerm), result.yTarSigmas.at(iTerm),
+      result.ypTarSigmas.at(iTerm), 0.0,
+      line.E_x, line.E_xp, line.E_y, line.E_yp, line.E_xTar
+    );
+    ++iTerm;
+  }
+
+  std::string sigmaFileName = fileName;
+  sigmaFileName.insert(fileName.size()-4, "_sigma__indep");
+  cout
+    << "Saving coefficient standard deviations to:" << endl
+    << "  `" << sigmaFileName << "`" << endl;
+  writeMatrixFile(sigmaFileName, sigmaMatrix);
+}
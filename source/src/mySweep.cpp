@@ -0,0 +1,253 @@
+#include "mySweep.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+#include <thread>
+
+#include "mySelection.hpp"
+
+
+// OffsetShifts implementation.
+
+OffsetShifts::OffsetShifts() :
+  thetaOffset(0.0), phiOffset(0.0), zFoilOffset(0.0),
+  xMispointing(0.0), yMispointing(0.0)
+{}
+
+
+OffsetShifts::~OffsetShifts() {}
+
+
+// SweepMetrics implementation.
+
+SweepMetrics::SweepMetrics() :
+  nEvents(0),
+  zVer(), xSieve(), ySieve(), xpTar(), yTar(), ypTar()
+{}
+
+
+SweepMetrics::~SweepMetrics() {}
+
+
+// Implementation of functions.
+
+config::RunConfig applyShifts(
+  const config::RunConfig& runConf, const OffsetShifts& shifts
+) {
+  config::RunConfig shifted = runConf;
+
+  shifted.SHMS.thetaOffset += shifts.thetaOffset;
+  shifted.SHMS.phiOffset += shifts.phiOffset;
+  shifted.SHMS.xMispointing += shifts.xMispointing;
+  shifted.SHMS.yMispointing += shifts.yMispointing;
+  for (auto& zFoil : shifted.zFoils) zFoil += shifts.zFoilOffset;
+
+  return shifted;
+}
+
+
+std::vector<OffsetShifts> loadSweepFile(const std::string& fname) {
+  std::ifstream ifs(fname);
+  std::string line;
+  std::vector<std::string> tokens;
+
+  if (!ifs.is_open()) {
+    throw std::runtime_error("Could not open file: `"+fname+"`!");
+  }
+
+  // Values of each parameter, in the order of OffsetShifts members.
+  const std::vector<std::string> keywords = {
+    "htheta_offset", "hphi_offset", "zoffset_foil",
+    "xmispointing", "ymispointing"
+  };
+  std::vector<std::vector<double> > valuess(keywords.size(), {0.0});
+  bool isGrid = false;
+  std::vector<OffsetShifts> points;
+
+  while (getline(ifs, line)) {
+    if (line.empty()) continue;
+
+    tokens = config::tokenize(line);
+    if (tokens.empty() || tokens[0][0] == '#') continue;
+
+    if (tokens[0] == "point") {
+      if (tokens.size() != 6) {
+        throw std::runtime_error("Sweep point needs 5 values: `"+line+"`!");
+      }
+      OffsetShifts point;
+      point.thetaOffset = stod(tokens[1]);
+      point.phiOffset = stod(tokens[2]);
+      point.zFoilOffset = stod(tokens[3]);
+      point.xMispointing = stod(tokens[4]);
+      point.yMispointing = stod(tokens[5]);
+      points.push_back(point);
+      continue;
+    }
+
+    std::size_t iPar = 0;
+    while (iPar < keywords.size() && keywords[iPar] != tokens[0]) ++iPar;
+    if (iPar == keywords.size()) {
+      throw std::runtime_error("Unknown sweep keyword `"+tokens[0]+"`!");
+    }
+
+    std::vector<double>& values = valuess.at(iPar);
+    values.clear();
+    if (tokens.size() == 5 && tokens[1] == "range") {
+      double min = stod(tokens[2]);
+      double max = stod(tokens[3]);
+      int n = stoi(tokens[4]);
+      for (int i=0; i<n; ++i) {
+        values.push_back((n == 1) ? min : min + (max-min)*i/(n-1));
+      }
+    }
+    else {
+      for (std::size_t i=1; i<tokens.size(); ++i) values.push_back(stod(tokens[i]));
+    }
+    if (values.empty()) {
+      throw std::runtime_error("No values for `"+tokens[0]+"`!");
+    }
+    isGrid = true;
+  }
+
+  // All combinations of the grid values.
+  if (isGrid || points.empty()) {
+    for (const auto& theta : valuess[0]) {
+      for (const auto& phi : valuess[1]) {
+        for (const auto& z : valuess[2]) {
+          for (const auto& x : valuess[3]) {
+            for (const auto& y : valuess[4]) {
+              OffsetShifts point;
+              point.thetaOffset = theta;
+              point.phiOffset = phi;
+              point.zFoilOffset = z;
+              point.xMispointing = x;
+              point.yMispointing = y;
+              points.push_back(point);
+            }
+          }
+        }
+      }
+    }
+  }
+
+  return points;
+}
+
+
+void sweepRun(
+  const std::vector<Event>& events, const std::vector<MatrixSums>& sumss,
+  const config::RunConfig& runConf, int xTarCorrIterNum,
+  const std::vector<OffsetShifts>& points, int nThreads,
+  std::vector<SweepMetrics>& metricss
+) {
+  const std::size_t nPoints = points.size();
+  const std::size_t nEvents = events.size();
+  if (metricss.size() != nPoints) metricss.resize(nPoints);
+  if (nThreads < 1) nThreads = 1;
+
+  std::vector<config::RunConfig> shiftedConfs;
+  for (const auto& point : points) {
+    shiftedConfs.push_back(applyShifts(runConf, point));
+  }
+
+  // Shared by all threads.
+  const std::vector<double> xSievePhys = runConf.getSieveHolesX();
+  const std::vector<double> ySievePhys = runConf.getSieveHolesY();
+
+  // Every thread goes once through all events for its own block of points,
+  // so each point is only touched by one thread.
+  auto sweepPoints = [&](std::size_t first, std::size_t last) {
+    std::size_t xSieveIndex, ySieveIndex;
+    Event event;
+
+    for (std::size_t iEvent=0; iEvent<nEvents; ++iEvent) {  // event loop
+      const MatrixSums& sums = sumss[iEvent];
+
+      for (std::size_t iPoint=first; iPoint<last; ++iPoint) {  // point loop
+        const config::RunConfig& conf = shiftedConfs[iPoint];
+        SweepMetrics& metrics = metricss[iPoint];
+        ++metrics.nEvents;
+
+        event = events[iEvent];
+        reconstructEvent(event, conf, sums, xTarCorrIterNum);
+
+        std::size_t iFoil = findClosestFoil(event, conf.zFoils);
+        if (iFoil == conf.zFoils.size()) continue;
+        if (!findClosestHole(
+          event, conf, xSievePhys, ySievePhys, xSieveIndex, ySieveIndex
+        )) continue;
+
+        const double zFoil = conf.zFoils[iFoil];
+        TargetVariables target = getPhysicalTarget(
+          event, conf, zFoil,
+          xSievePhys[xSieveIndex], ySievePhys[ySieveIndex]
+        );
+
+        metrics.zVer.fill(event.zVer - zFoil);
+        metrics.xSieve.fill(event.xSieve - xSievePhys[xSieveIndex]);
+        metrics.ySieve.fill(event.ySieve - ySievePhys[ySieveIndex]);
+        metrics.xpTar.fill(event.xpTar - target.xpTar);
+        metrics.yTar.fill(event.yTar - target.yTar);
+        metrics.ypTar.fill(event.ypTar - target.ypTar);
+      }  // point loop
+    }  // event loop
+  };
+
+  const std::size_t nBlocks = std::min(nPoints, static_cast<std::size_t>(nThreads));
+  std::vector<std::thread> threads;
+  for (std::size_t iBlock=1; iBlock<nBlocks; ++iBlock) {
+    threads.push_back(std::thread(
+      sweepPoints, iBlock*nPoints/nBlocks, (iBlock+1)*nPoints/nBlocks
+    ));
+  }
+  if (nBlocks > 0) sweepPoints(0, nPoints/nBlocks);
+  for (auto& thread : threads) thread.join();
+}
+
+
+void writeSweepTable(
+  std::ostream& os,
+  const std::vector<OffsetShifts>& points,
+  const std::vector<SweepMetrics>& metricss
+) {
+  std::ios::fmtflags f(os.flags());
+  std::streamsize prevPrec = os.precision(5);
+
+  os
+    << "# point"
+    << "    dThetaOff      dPhiOff       dZFoil        dXMis        dYMis"
+    << "   selected      tried"
+    << "   zVer_mean    zVer_rms xSieve_mean  xSieve_rms ySieve_mean  ySieve_rms"
+    << "  xpTar_mean   xpTar_rms   yTar_mean    yTar_rms  ypTar_mean   ypTar_rms"
+    << std::endl;
+
+  for (std::size_t iPoint=0; iPoint<points.size(); ++iPoint) {
+    const OffsetShifts& point = points.at(iPoint);
+    const SweepMetrics& metrics = metricss.at(iPoint);
+
+    os
+      << std::setw(7) << iPoint
+      << std::scientific
+      << std::setw(13) << point.thetaOffset
+      << std::setw(13) << point.phiOffset
+      << std::setw(13) << point.zFoilOffset
+      << std::setw(13) << point.xMispointing
+      << std::setw(13) << point.yMispointing
+      << std::setw(11) << metrics.zVer.n
+      << std::setw(11) << metrics.nEvents;
+    os.precision(4);
+    for (const auto* stats : {
+      &metrics.zVer, &metrics.xSieve, &metrics.ySieve,
+      &metrics.xpTar, &metrics.yTar, &metrics.ypTar
+    }) {
+      os << std::setw(12) << stats->getMean() << std::setw(12) << stats->getRMS();
+    }
+    os.precision(5);
+    os << std::endl;
+  }
+
+  os.precision(prevPrec);
+  os.flags(f);
+}
@@ -0,0 +1,193 @@
+#include "shmsoptics.h"
+
+#include <exception>
+#include <stdexcept>
+#include <string>
+
+#include "myConfig.hpp"
+#include "myEvent.hpp"
+#include "myRecMatrix.hpp"
+#include "myReconstruct.hpp"
+
+
+// Matrix behind the opaque handle of the C interface.
+struct shmsoptics_matrix {
+  shmsoptics_matrix();
+  ~shmsoptics_matrix();
+
+  RecMatrix indep;
+  RecMatrix dep;
+};
+
+
+namespace {
+
+  thread_local std::string lastError;
+
+
+  // Run function, turning an exception into a return value and the last
+  // error, as exceptions must not cross the C interface.
+  template<typename Function>
+  int guard(Function function) {
+    try {
+      function();
+    }
+    catch (const std::exception& err) {
+      lastError = err.what();
+      return 1;
+    }
+    catch (...) {
+      lastError = "Unknown error!";
+      return 1;
+    }
+    lastError.clear();
+    return 0;
+  }
+
+
+  config::RunConfig getRunConfig(const shmsoptics_setup& setup) {
+    config::RunConfig runConf;
+    runConf.SHMS.thetaCentral = setup.theta;
+    runConf.SHMS.thetaOffset = setup.thetaOffset;
+    runConf.SHMS.phiOffset = setup.phiOffset;
+    runConf.SHMS.xMispointing = setup.xMispointing;
+    runConf.SHMS.yMispointing = setup.yMispointing;
+    runConf.sieve.z0 = setup.zSieve;
+    runConf.use2017Corr = setup.use2017Corr;
+
+    return runConf;
+  }
+
+}
+
+
+// shmsoptics_matrix implementation.
+
+shmsoptics_matrix::shmsoptics_matrix() : indep(), dep() {}
+
+
+shmsoptics_matrix::~shmsoptics_matrix() {}
+
+
+// Implementation of functions.
+
+int shmsoptics_api_version(void) {
+  return SHMSOPTICS_API_VERSION;
+}
+
+
+const char* shmsoptics_last_error(void) {
+  return lastError.c_str();
+}
+
+
+void shmsoptics_setup_init(shmsoptics_setup* setup) {
+  const config::RunConfig runConf;
+  setup->theta = runConf.SHMS.thetaCentral;
+  setup->thetaOffset = runConf.SHMS.thetaOffset;
+  setup->phiOffset = runConf.SHMS.phiOffset;
+  setup->xMispointing = runConf.SHMS.xMispointing;
+  setup->yMispointing = runConf.SHMS.yMispointing;
+  setup->zSieve = runConf.sieve.z0;
+  setup->use2017Corr = runConf.use2017Corr;
+  setup->xTarCorrIterNum = config::Config().xTarCorrIterNum;
+}
+
+
+int shmsoptics_matrix_load(const char* fileName, shmsoptics_matrix** matrix) {
+  *matrix = NULL;
+  return guard([&]() {
+    shmsoptics_matrix* newMatrix = new shmsoptics_matrix();
+    try {
+      splitRecMatrix(readMatrixFile(fileName), newMatrix->indep, newMatrix->dep);
+    }
+    catch (...) {
+      delete newMatrix;
+      throw;
+    }
+    *matrix = newMatrix;
+  });
+}
+
+
+int shmsoptics_matrix_load_split(const char* fileName, shmsoptics_matrix** matrix) {
+  *matrix = NULL;
+  return guard([&]() {
+    // Same names as in readMatrices, but without messages.
+    const std::string name(fileName);
+    if (name.size() < 4) {
+      throw std::runtime_error("Matrix file name `"+name+"` has no extension!");
+    }
+    std::string depFileName = name;
+    depFileName.insert(name.size()-4, "__dep");
+    std::string indepFileName = name;
+    indepFileName.insert(name.size()-4, "__indep");
+
+    shmsoptics_matrix* newMatrix = new shmsoptics_matrix();
+    try {
+      newMatrix->indep = readMatrixFile(indepFileName);
+      newMatrix->dep = readMatrixFile(depFileName);
+    }
+    catch (...) {
+      delete newMatrix;
+      throw;
+    }
+    *matrix = newMatrix;
+  });
+}
+
+
+void shmsoptics_matrix_free(shmsoptics_matrix* matrix) {
+  delete matrix;
+}
+
+
+size_t shmsoptics_matrix_size(const shmsoptics_matrix* matrix) {
+  return matrix->indep.size() + matrix->dep.size();
+}
+
+
+int shmsoptics_reconstruct(
+  const shmsoptics_matrix* matrix, const shmsoptics_setup* setup,
+  size_t nEvents, const shmsoptics_focal_plane* focalPlane,
+  shmsoptics_target* target
+) {
+  return guard([&]() {
+    if (
+      !focalPlane->xFp || !focalPlane->yFp ||
+      !focalPlane->xpFp || !focalPlane->ypFp ||
+      !focalPlane->xVer || !focalPlane->yVer
+    ) {
+      throw std::runtime_error("Missing focal plane or beam position array!");
+    }
+    const config::RunConfig runConf = getRunConfig(*setup);
+
+    Event event;
+    for (size_t iEvent=0; iEvent<nEvents; ++iEvent) {  // event loop
+      event.reset();
+      event.theta = setup->theta;
+      event.xFp = focalPlane->xFp[iEvent];
+      event.yFp = focalPlane->yFp[iEvent];
+      event.xpFp = focalPlane->xpFp[iEvent];
+      event.ypFp = focalPlane->ypFp[iEvent];
+      event.xVer = focalPlane->xVer[iEvent];
+      event.yVer = focalPlane->yVer[iEvent];
+      event.delta = focalPlane->delta ? focalPlane->delta[iEvent] : 0.0;
+
+      const MatrixSums sums(event, matrix->indep, matrix->dep);
+      reconstructEvent(event, runConf, sums, setup->xTarCorrIterNum);
+
+      if (target->xTar) target->xTar[iEvent] = event.xTar;
+      if (target->yTar) target->yTar[iEvent] = event.yTar;
+      if (target->xpTar) target->xpTar[iEvent] = event.xpTar;
+      if (target->ypTar) target->ypTar[iEvent] = event.ypTar;
+      if (target->zVer) target->zVer[iEvent] = event.zVer;
+      if (target->xSieve) target->xSieve[iEvent] = event.xSieve;
+      if (target->ySieve) target->ySieve[iEvent] = event.ySieve;
+      if (target->delta) {
+        target->delta[iEvent] =
+          reconstructDelta(event, runConf, matrix->indep, matrix->dep);
+      }
+    }  // event loop
+  });
+}